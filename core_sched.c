@@ -0,0 +1,466 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "core_sched.h"
+
+#define __MODULE__ "core_sched"
+#include "log.h"
+#include "cpuinfo.h"
+#include "virtio_worker.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <rte_cycles.h>
+
+/* How often the scheduler thread checks for the end of an interval. */
+#define CORE_SCHED_POLL_US 10000
+/* Load, in percent of a CPU, charged to a relay direction for leaving its
+ * current worker. Keeps rounds from shuffling directions for marginal gains. */
+#define CORE_SCHED_MIGRATION_COST 5
+/* Load, in percent of a CPU, assumed for a newly placed direction until the
+ * next sample, so that directions attached together are spread. */
+#define CORE_SCHED_NEW_DIR_LOAD 10
+/* Intervals a direction stays on a worker before it may be moved again. */
+#define CORE_SCHED_RESIDENCY 3
+
+/* A relay direction, as seen by a rebalancing round. */
+struct sched_dir {
+	unsigned relay;
+	enum relay_dir dir;
+	int cpu;
+	int node; /* Node it should be served on. */
+	int target; /* Worker picked by the round. */
+	double load; /* Percent of a CPU. */
+	bool movable;
+};
+
+static struct {
+	pthread_t thread;
+	volatile bool running;
+	pthread_mutex_t lock; /* Protects the fields below. */
+	struct core_sched_conf conf;
+	struct core_sched_stats stats;
+	/* Percent of a CPU used at the last sample, plus new placements. */
+	double worker_load[MAX_CPUS];
+	uint64_t prev_cycles[MAX_RELAYS][RELAY_NB_DIRS];
+	uint64_t prev_tsc;
+} sched = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Workers on NUMA node @a node. */
+static uint64_t node_workers(int node)
+{
+	cpuinfo_t *c = get_cpuinfo();
+	uint64_t workers = get_eal_core_map(), ans = 0;
+
+	while (workers) {
+		int cpu = __builtin_ffsll(workers) - 1;
+
+		workers &= ~(1ULL << cpu);
+		if ((int)c->cpus[cpu].numanode == node)
+			ans |= 1ULL << cpu;
+	}
+
+	return ans;
+}
+
+static int cmp_dir_load(const void *a, const void *b)
+{
+	const struct sched_dir *da = *(const struct sched_dir * const *)a;
+	const struct sched_dir *db = *(const struct sched_dir * const *)b;
+
+	return (da->load < db->load) - (da->load > db->load);
+}
+
+/*
+ * Rebalance the relay directions of NUMA node @a node over its @a workers.
+ * Directions that cannot move are accounted on their current worker, then the
+ * others are packed heaviest first, each onto the worker where the load ends
+ * up lowest, counting the migration cost against leaving the current worker.
+ * The result is applied if it relieves the busiest worker of the node by at
+ * least the sensitivity, or if it brings directions to their memory's node.
+ * Returns the number of directions moved.
+ */
+static unsigned
+rebalance_node(int node, uint64_t workers, struct sched_dir *dirs, unsigned n)
+{
+	cpuinfo_t *c = get_cpuinfo();
+	struct sched_dir *packed[n ? n : 1];
+	double load[MAX_CPUS] = {0}, cur_max = 0, new_max = 0;
+	unsigned nb_packed = 0, moved = 0;
+	bool numa_fix = false;
+	uint64_t w;
+	int cpu;
+
+	for (w = workers; w; w &= ~(1ULL << cpu)) {
+		cpu = __builtin_ffsll(w) - 1;
+		if (sched.worker_load[cpu] > cur_max)
+			cur_max = sched.worker_load[cpu];
+	}
+
+	for (unsigned i=0; i<n; ++i) {
+		struct sched_dir *d = &dirs[i];
+
+		if (!d->movable) {
+			if ((1ULL << d->cpu) & workers)
+				load[d->cpu] += d->load;
+		} else if (d->node == node) {
+			packed[nb_packed++] = d;
+			if ((int)c->cpus[d->cpu].numanode != node)
+				numa_fix = true;
+		}
+	}
+	qsort(packed, nb_packed, sizeof(*packed), cmp_dir_load);
+
+	for (unsigned i=0; i<nb_packed; ++i) {
+		struct sched_dir *d = packed[i];
+		double best = 0;
+
+		d->target = -1;
+		for (w = workers; w; w &= ~(1ULL << cpu)) {
+			double cost;
+
+			cpu = __builtin_ffsll(w) - 1;
+			cost = load[cpu] + d->load +
+				(cpu != d->cpu ? CORE_SCHED_MIGRATION_COST : 0);
+			if (d->target == -1 || cost < best) {
+				d->target = cpu;
+				best = cost;
+			}
+		}
+		load[d->target] += d->load;
+	}
+
+	for (w = workers; w; w &= ~(1ULL << cpu)) {
+		cpu = __builtin_ffsll(w) - 1;
+		if (load[cpu] > new_max)
+			new_max = load[cpu];
+	}
+	if (!numa_fix && cur_max - new_max < sched.conf.sensitivity)
+		return 0;
+
+	for (unsigned i=0; i<nb_packed; ++i) {
+		struct sched_dir *d = packed[i];
+
+		if (d->target != d->cpu &&
+				migrate_relay_dir(d->relay, d->dir, d->target) == 1)
+			++moved;
+	}
+	if (moved)
+		log_info("Moved %u relay directions on node %d, busiest worker at %.0f%% instead of %.0f%%",
+			moved, node, new_max, cur_max);
+
+	return moved;
+}
+
+/*
+ * Sample the cycles spent forwarding on every relay direction since the last
+ * round, and rebalance each NUMA node if enabled. Only polls that moved
+ * packets count, so a ready but idle direction has no load. Called with
+ * sched.lock held.
+ */
+static void core_sched_round(uint64_t now)
+{
+	struct sched_dir dirs[MAX_RELAYS * RELAY_NB_DIRS];
+	uint64_t workers = get_eal_core_map();
+	uint64_t residency = rte_get_tsc_hz() / 1000 * sched.conf.interval_ms *
+				CORE_SCHED_RESIDENCY;
+	double elapsed = now - sched.prev_tsc;
+	cpuinfo_t *c = get_cpuinfo();
+	uint64_t nodes_done = 0;
+	unsigned n = 0;
+
+	memset(sched.worker_load, 0, sizeof(sched.worker_load));
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		struct virtio_relay_load rl[RELAY_NB_DIRS];
+
+		virtio_forwarder_get_relay_load(id, rl);
+		for (int dir=0; dir<RELAY_NB_DIRS; ++dir) {
+			uint64_t cycles = rl[dir].cycles - sched.prev_cycles[id][dir];
+			struct sched_dir *d;
+
+			sched.prev_cycles[id][dir] = rl[dir].cycles;
+			if (!rl[dir].active || rl[dir].cpu < 0 ||
+					!((1ULL << rl[dir].cpu) & workers))
+				continue;
+
+			d = &dirs[n++];
+			d->relay = id;
+			d->dir = dir;
+			d->cpu = rl[dir].cpu;
+			d->load = sched.prev_tsc ? 100.0 * cycles / elapsed : 0;
+			d->movable = !rl[dir].pinned &&
+				now - rl[dir].owned_tsc >= residency;
+			/* Serve directions on the node of their memory. */
+			if (rl[dir].socket_id >= 0 &&
+					node_workers(rl[dir].socket_id))
+				d->node = rl[dir].socket_id;
+			else
+				d->node = c->cpus[d->cpu].numanode;
+			sched.worker_load[d->cpu] += d->load;
+		}
+	}
+
+	if (sched.conf.enabled && sched.prev_tsc) {
+		++sched.stats.rounds;
+		while (workers & ~nodes_done) {
+			int cpu = __builtin_ffsll(workers & ~nodes_done) - 1;
+			int node = c->cpus[cpu].numanode;
+			uint64_t on_node = node_workers(node);
+
+			nodes_done |= on_node;
+			sched.stats.migrations +=
+				rebalance_node(node, on_node, dirs, n);
+		}
+	}
+	sched.prev_tsc = now;
+}
+
+static void *core_sched_thread(void *arg __attribute__((unused)))
+{
+	uint64_t next = 0;
+
+	log_debug("Core scheduler thread started");
+	while (sched.running) {
+		uint64_t now;
+
+		usleep(CORE_SCHED_POLL_US);
+		now = rte_rdtsc();
+		pthread_mutex_lock(&sched.lock);
+		if (now >= next) {
+			core_sched_round(now);
+			next = now + rte_get_tsc_hz() / 1000 *
+				sched.conf.interval_ms;
+		}
+		pthread_mutex_unlock(&sched.lock);
+	}
+	log_debug("Core scheduler thread ended");
+
+	return NULL;
+}
+
+static bool core_sched_conf_valid(const struct core_sched_conf *conf)
+{
+	if (conf->interval_ms < 10 || conf->interval_ms > 60000) {
+		log_error("Core scheduler interval must be between 10 and 60000 ms!");
+		return false;
+	}
+	if (conf->sensitivity > 100) {
+		log_error("Core scheduler sensitivity must be between 0 and 100!");
+		return false;
+	}
+	if (conf->enabled &&
+			(g_vio_worker_conf.graph || g_vio_worker_conf.eventdev)) {
+		/* Relay directions are not owned by workers in these modes. */
+		log_error("The core scheduler cannot be used in event or graph mode!");
+		return false;
+	}
+	if (conf->enabled && g_vio_worker_conf.work_stealing) {
+		/* The workers would undo each other's placements. */
+		log_error("The core scheduler cannot be combined with work stealing!");
+		return false;
+	}
+
+	return true;
+}
+
+int core_sched_start(const struct core_sched_conf *conf)
+{
+	if (!core_sched_conf_valid(conf))
+		return -1;
+
+	sched.conf = *conf;
+	sched.running = true;
+	if (pthread_create(&sched.thread, NULL, core_sched_thread, NULL)) {
+		log_error("Could not create core scheduler thread!");
+		sched.running = false;
+		return -1;
+	}
+	if (conf->enabled)
+		log_info("Core scheduler: rebalancing every %u ms, sensitivity %u%%",
+			conf->interval_ms, conf->sensitivity);
+
+	return 0;
+}
+
+void core_sched_stop(void)
+{
+	if (!sched.running)
+		return;
+
+	sched.running = false;
+	pthread_join(sched.thread, NULL);
+}
+
+int core_sched_set_conf(const struct core_sched_conf *conf)
+{
+	if (!core_sched_conf_valid(conf))
+		return -1;
+
+	pthread_mutex_lock(&sched.lock);
+	sched.conf = *conf;
+	pthread_mutex_unlock(&sched.lock);
+	log_info("Core scheduler %s: interval %u ms, sensitivity %u%%",
+		conf->enabled ? "enabled" : "disabled", conf->interval_ms,
+		conf->sensitivity);
+
+	return 0;
+}
+
+void core_sched_get(struct core_sched_conf *conf, struct core_sched_stats *stats)
+{
+	pthread_mutex_lock(&sched.lock);
+	if (conf)
+		*conf = sched.conf;
+	if (stats)
+		*stats = sched.stats;
+	pthread_mutex_unlock(&sched.lock);
+}
+
+int core_sched_place(int node)
+{
+	uint64_t workers;
+	int ans = -1;
+
+	pthread_mutex_lock(&sched.lock);
+	if (!sched.conf.enabled)
+		goto out;
+
+	workers = node >= 0 ? node_workers(node) : 0;
+	if (!workers)
+		workers = get_eal_core_map();
+	while (workers) {
+		int cpu = __builtin_ffsll(workers) - 1;
+
+		workers &= ~(1ULL << cpu);
+		if (ans == -1 || sched.worker_load[cpu] < sched.worker_load[ans])
+			ans = cpu;
+	}
+	if (ans >= 0)
+		sched.worker_load[ans] += CORE_SCHED_NEW_DIR_LOAD;
+
+out:
+	pthread_mutex_unlock(&sched.lock);
+	return ans;
+}
+
+/*
+ * gcc -O2 -DCORE_SCHED_UNITTEST core_sched.c log.c \
+ *	$(pkg-config --cflags --libs libdpdk) -o core_sched
+ */
+#ifdef CORE_SCHED_UNITTEST
+#include <stdio.h>
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+/* Workers on CPUs 1 and 2, both on node 0. */
+#define TEST_WORKERS 0x6ULL
+#define TEST_INTERVAL 1000000000ULL
+
+struct virtio_vhostuser_conf g_vio_worker_conf;
+static cpuinfo_t test_cpuinfo;
+static struct virtio_relay_load test_load[MAX_RELAYS][RELAY_NB_DIRS];
+static unsigned test_moves[MAX_RELAYS];
+
+cpuinfo_t *get_cpuinfo(void)
+{
+	return &test_cpuinfo;
+}
+
+uint64_t get_eal_core_map(void)
+{
+	return TEST_WORKERS;
+}
+
+void
+virtio_forwarder_get_relay_load(unsigned id,
+				struct virtio_relay_load load[RELAY_NB_DIRS])
+{
+	memcpy(load, test_load[id], sizeof(test_load[id]));
+}
+
+int migrate_relay_dir(unsigned relay_number, enum relay_dir dir, int cpu)
+{
+	test_load[relay_number][dir].cpu = cpu;
+	++test_moves[relay_number];
+	return 1;
+}
+
+int main(void)
+{
+	uint64_t now = 1000 * TEST_INTERVAL;
+
+	/* Relay 0 is connected but idle, relay 1 keeps 60% of a CPU busy in
+	 * each direction. All four directions start on CPU 1. */
+	for (unsigned id=0; id<2; ++id) {
+		for (int dir=0; dir<RELAY_NB_DIRS; ++dir) {
+			test_load[id][dir].active = true;
+			test_load[id][dir].cpu = 1;
+			test_load[id][dir].socket_id = 0;
+		}
+	}
+	sched.conf.enabled = true;
+	sched.conf.interval_ms = 1000;
+	sched.conf.sensitivity = CORE_SCHED_DEFAULT_SENSITIVITY;
+
+	/* The first round only takes the reference sample. */
+	core_sched_round(now);
+	_ASSERT(sched.stats.rounds == 0 && sched.stats.migrations == 0);
+
+	now += TEST_INTERVAL;
+	for (int dir=0; dir<RELAY_NB_DIRS; ++dir)
+		test_load[1][dir].cycles += TEST_INTERVAL * 6 / 10;
+	core_sched_round(now);
+	_ASSERT(sched.stats.rounds == 1);
+	/* Only the forwarding relay weighs on its worker. */
+	_ASSERT(sched.worker_load[1] > 119.9 && sched.worker_load[1] < 120.1);
+	_ASSERT(sched.worker_load[2] == 0);
+	/* One loaded direction moves to the idle worker, the idle relay,
+	 * which would not relieve anything, stays. */
+	_ASSERT(test_moves[1] == 1 && test_moves[0] == 0);
+	_ASSERT(test_load[1][RELAY_VM2VF].cpu != test_load[1][RELAY_VF2VM].cpu);
+	_ASSERT(sched.stats.migrations == 1);
+
+	/* Balanced now: nothing moves. */
+	now += TEST_INTERVAL;
+	for (int dir=0; dir<RELAY_NB_DIRS; ++dir)
+		test_load[1][dir].cycles += TEST_INTERVAL * 6 / 10;
+	core_sched_round(now);
+	_ASSERT(sched.stats.migrations == 1 && test_moves[0] == 0);
+
+	printf("core_sched: all tests passed\n");
+	return 0;
+}
+#endif /* CORE_SCHED_UNITTEST */
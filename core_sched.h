@@ -0,0 +1,95 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CORE_SCHED_H
+#define _CORE_SCHED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defaults of the in-daemon core scheduler. */
+#define CORE_SCHED_DEFAULT_INTERVAL_MS 1000
+#define CORE_SCHED_DEFAULT_SENSITIVITY 10
+
+/** Settings of the in-daemon core scheduler. */
+struct core_sched_conf {
+	bool enabled;
+	/* Time between two load samples and rebalancing rounds. */
+	unsigned interval_ms;
+	/* Minimum reduction, in percent of a CPU, of the load of the busiest
+	 * worker on a NUMA node for a rebalancing round to move anything. */
+	unsigned sensitivity;
+};
+
+/** Counters of the in-daemon core scheduler. */
+struct core_sched_stats {
+	uint64_t rounds; /* Rebalancing rounds run. */
+	uint64_t migrations; /* Relay directions moved by rebalancing. */
+};
+
+/**
+ * @brief Start the core scheduler thread.
+ *
+ * The thread samples the cycles the workers spend on each relay direction.
+ * While enabled, it rebalances the relay directions over the workers of each
+ * NUMA node at every interval.
+ *
+ * @param conf Initial settings.
+ * @return 0 on success, -1 on error.
+ */
+int core_sched_start(const struct core_sched_conf *conf);
+
+/** @brief Stop the core scheduler thread. */
+void core_sched_stop(void);
+
+/**
+ * @brief Change the settings of the core scheduler.
+ * @return 0 on success, -1 if a setting is out of range, or if enabling the
+ * scheduler conflicts with the mode of the workers or with work stealing.
+ */
+int core_sched_set_conf(const struct core_sched_conf *conf);
+
+/** @brief Get the current settings and counters of the core scheduler. */
+void core_sched_get(struct core_sched_conf *conf, struct core_sched_stats *stats);
+
+/**
+ * @brief Pick the worker for a relay direction being attached.
+ *
+ * Chooses the worker with the lowest measured load on NUMA node @a node, or on
+ * any node if @a node has no workers.
+ *
+ * @return A worker CPU, or -1 if the scheduler is disabled.
+ */
+int core_sched_place(int node);
+
+#endif /* _CORE_SCHED_H */
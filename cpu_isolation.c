@@ -0,0 +1,208 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "cpu_isolation.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+#define PROC_IRQ "/proc/irq"
+
+static const char *const names[CPU_ISOL_NB] = {
+	[CPU_ISOL_SCHED] = "sched",
+	[CPU_ISOL_TICK] = "tick",
+	[CPU_ISOL_IRQ] = "irq",
+};
+
+const char *cpu_isolation_name(enum cpu_isolation c)
+{
+	return c < CPU_ISOL_NB ? names[c] : "unknown";
+}
+
+/*
+ * Parse a kernel CPU list such as "0-3,8" into a bitmap, ignoring CPUs from
+ * MAX_CPUS on. Anything else, e.g. the "(null)" of an unset nohz_full=, is
+ * an empty list.
+ */
+static uint64_t parse_cpu_list(const char *s)
+{
+	uint64_t ans = 0;
+
+	while (*s >= '0' && *s <= '9') {
+		char *end;
+		unsigned long first = strtoul(s, &end, 10);
+		unsigned long last = first;
+
+		s = end;
+		if (*s == '-') {
+			if (s[1] < '0' || s[1] > '9')
+				break;
+			last = strtoul(s + 1, &end, 10);
+			s = end;
+		}
+		for (; first <= last && first < MAX_CPUS; ++first)
+			ans |= 1ULL << first;
+		if (*s != ',')
+			break;
+		++s;
+	}
+
+	return ans;
+}
+
+static int read_cpu_list(const char *path, uint64_t *cpus)
+{
+	char buf[1024];
+	FILE *f = fopen(path, "r");
+
+	*cpus = 0;
+	if (!f)
+		return -1;
+	if (fgets(buf, sizeof(buf), f))
+		*cpus = parse_cpu_list(buf);
+	fclose(f);
+
+	return 0;
+}
+
+/* An interrupt has a subdirectory per handler, named after the device. */
+static bool irq_has_handler(const char *path)
+{
+	DIR *d = opendir(path);
+	struct dirent *e;
+	bool ans = false;
+
+	if (!d)
+		return false;
+	while (!ans && (e = readdir(d)))
+		ans = e->d_type == DT_DIR && e->d_name[0] != '.';
+	closedir(d);
+
+	return ans;
+}
+
+int cpu_isolation_check(uint64_t cpus, struct cpu_isolation_report *r)
+{
+	uint64_t isolated, nohz_full;
+	struct dirent *e;
+	DIR *d;
+
+	memset(r, 0, sizeof(*r));
+	/* Files absent from older kernels mean no CPU is isolated. */
+	read_cpu_list(SYSFS_CPU "/isolated", &isolated);
+	read_cpu_list(SYSFS_CPU "/nohz_full", &nohz_full);
+	r->failed[CPU_ISOL_SCHED] = cpus & ~isolated;
+	r->failed[CPU_ISOL_TICK] = cpus & ~nohz_full;
+
+	d = opendir(PROC_IRQ);
+	if (!d)
+		return -1;
+	while ((e = readdir(d))) {
+		char path[PATH_MAX];
+		uint64_t affinity;
+
+		if (e->d_name[0] < '0' || e->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), PROC_IRQ "/%s", e->d_name);
+		if (!irq_has_handler(path))
+			continue;
+		snprintf(path, sizeof(path), PROC_IRQ "/%s/effective_affinity_list",
+			e->d_name);
+		if (read_cpu_list(path, &affinity)) {
+			snprintf(path, sizeof(path), PROC_IRQ "/%s/smp_affinity_list",
+				e->d_name);
+			if (read_cpu_list(path, &affinity))
+				continue;
+		}
+		affinity &= cpus;
+		r->failed[CPU_ISOL_IRQ] |= affinity;
+		while (affinity) {
+			int cpu = __builtin_ffsll(affinity) - 1;
+
+			++r->irqs[cpu];
+			affinity &= ~(1ULL << cpu);
+		}
+	}
+	closedir(d);
+
+	return 0;
+}
+
+/*
+ * Unit test, can be compiled as follows:
+ * gcc -O2 cpu_isolation.c -DCPU_ISOLATION_UNITTEST -o cpu_isolation
+ * It also prints the isolation of the CPUs of the running system.
+ */
+#ifdef CPU_ISOLATION_UNITTEST
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+int main(void)
+{
+	struct cpu_isolation_report r;
+	unsigned cpu, c;
+
+	_ASSERT(parse_cpu_list("") == 0);
+	_ASSERT(parse_cpu_list("(null)\n") == 0);
+	_ASSERT(parse_cpu_list("\n") == 0);
+	_ASSERT(parse_cpu_list("3\n") == 0x8);
+	_ASSERT(parse_cpu_list("0-3,8\n") == 0x10f);
+	_ASSERT(parse_cpu_list("1,4-5,63-70") == (0x32 | 1ULL << 63));
+	_ASSERT(parse_cpu_list("2-") == 0);
+	_ASSERT(parse_cpu_list("5-2") == 0);
+
+	/* No CPUs, no failures. */
+	cpu_isolation_check(0, &r);
+	for (c=0; c<CPU_ISOL_NB; ++c)
+		_ASSERT(r.failed[c] == 0);
+
+	cpu_isolation_check(~0ULL, &r);
+	for (cpu=0; cpu<MAX_CPUS; ++cpu) {
+		if (!(r.failed[CPU_ISOL_SCHED] & (1ULL << cpu)))
+			printf("cpu_isolation: CPU %u isolated\n", cpu);
+		if (r.irqs[cpu])
+			_ASSERT(r.failed[CPU_ISOL_IRQ] & (1ULL << cpu));
+	}
+	for (c=0; c<CPU_ISOL_NB; ++c)
+		printf("cpu_isolation: %s 0x%016llx\n", cpu_isolation_name(c),
+			(unsigned long long)r.failed[c]);
+	printf("cpu_isolation: all tests passed\n");
+
+	return 0;
+}
+#endif /* CPU_ISOLATION_UNITTEST */
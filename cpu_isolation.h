@@ -0,0 +1,76 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _CPU_ISOLATION_H
+#define _CPU_ISOLATION_H
+
+#include <stdint.h>
+#include "cpuinfo.h"
+
+/*
+ * Isolation of the worker CPUs from the kernel. A polling worker that gets
+ * preempted stops forwarding for as long, so each worker CPU should be kept
+ * out of the scheduler's load balancing, off the scheduler tick, and out of
+ * the affinity of device interrupts.
+ */
+enum cpu_isolation {
+	CPU_ISOL_SCHED, /* Not in isolcpus=, other tasks may run on it. */
+	CPU_ISOL_TICK, /* Not in nohz_full=, it takes the scheduler tick. */
+	CPU_ISOL_IRQ, /* Device interrupts may be delivered to it. */
+	CPU_ISOL_NB
+};
+
+struct cpu_isolation_report {
+	/* CPUs failing each check, as bitmaps. */
+	uint64_t failed[CPU_ISOL_NB];
+	/* Device interrupts whose affinity includes each CPU. */
+	unsigned irqs[MAX_CPUS];
+};
+
+/** Name of check @a c, for logs and the stats service. */
+const char *cpu_isolation_name(enum cpu_isolation c);
+
+/**
+ * @brief Check the isolation of the CPUs in bitmap @a cpus.
+ *
+ * Only the kernel command line isolation is seen, not cpuset partitions.
+ * Interrupts are those of /proc/irq with a handler, by their effective
+ * affinity where the kernel reports it.
+ *
+ * @return 0 on success, -1 if the interrupts could not be listed, in which
+ * case the other checks are still filled in.
+ */
+int cpu_isolation_check(uint64_t cpus, struct cpu_isolation_report *r);
+
+#endif /* _CPU_ISOLATION_H */
@@ -42,6 +42,9 @@
 #include <getopt.h>
 #include <rte_eal.h>
 #include <rte_version.h>
+#if RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+#include <rte_trace.h>
+#endif
 
 int dpdk_eal_initialize(const struct dpdk_conf *conf)
 {
@@ -100,6 +103,12 @@ if (conf->enable_vfio_vf_token) {
 	add_arg(&argv, &argc, "--vfio-vf-token");
 	add_arg(&argv, &argc, conf->vfio_vf_token);
 }
+#endif
+#if RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+	if (conf->trace[0] != '\0') {
+		add_arg(&argv, &argc, "--trace");
+		add_arg(&argv, &argc, conf->trace);
+	}
 #endif
 
 	/* Unlink the hugepages after mapping to ensure they're gone when app exits. */
@@ -166,4 +175,10 @@ if (conf->enable_vfio_vf_token) {
 }
 
 void dpdk_eal_finalize(void)
-{}
+{
+#if RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+	/* The EAL only writes the trace out from rte_eal_cleanup(). */
+	if (rte_trace_is_enabled() && rte_trace_save() < 0)
+		log_warning("Could not save the trace");
+#endif
+}
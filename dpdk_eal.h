@@ -38,6 +38,7 @@
 #include <stdbool.h>
 
 #define VFIO_VF_TOKEN_LEN 37
+#define TRACE_PATTERN_LEN 64
 
 struct dpdk_conf {
 	unsigned log_level;
@@ -49,6 +50,8 @@ struct dpdk_conf {
 	unsigned enable_tso:1;
 	unsigned enable_same_numa:1;
 	bool enable_vfio_vf_token;
+	/* Tracepoints to enable, see the EAL's --trace option. */
+	char trace[TRACE_PATTERN_LEN];
 };
 
 int dpdk_eal_initialize(const struct dpdk_conf *conf);
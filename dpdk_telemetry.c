@@ -0,0 +1,283 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dpdk_telemetry.h"
+
+#define __MODULE__ "dpdk_telemetry"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <rte_version.h>
+
+#if RTE_VERSION_NUM(20, 5, 0, 0) <= RTE_VERSION
+#include "virtio_worker.h"
+#include <rte_mempool.h>
+#include <rte_telemetry.h>
+
+#if RTE_VERSION_NUM(23, 3, 0, 0) <= RTE_VERSION
+#define tel_add_u64 rte_tel_data_add_dict_uint
+#else
+#define tel_add_u64 rte_tel_data_add_dict_u64
+#endif
+
+/* Start a dict nested in @a d under @a name, NULL on allocation failure. */
+static struct rte_tel_data *
+tel_add_dict(struct rte_tel_data *d, const char *name)
+{
+	struct rte_tel_data *sub = rte_tel_data_alloc();
+
+	if (!sub)
+		return NULL;
+	rte_tel_data_start_dict(sub);
+	if (rte_tel_data_add_dict_container(d, name, sub, 0)) {
+		rte_tel_data_free(sub);
+		return NULL;
+	}
+
+	return sub;
+}
+
+static int
+tel_relays(const char *cmd __attribute__((unused)),
+	const char *params __attribute__((unused)),
+	struct rte_tel_data *d)
+{
+	struct virtio_worker_stats s;
+
+	rte_tel_data_start_array(d, RTE_TEL_INT_VAL);
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		virtio_forwarder_get_stats(id, &s);
+		if (s.virtio2vf_active || s.vf2virtio_active)
+			rte_tel_data_add_array_int(d, id);
+	}
+
+	return 0;
+}
+
+static void
+tel_vm_to_vf(struct rte_tel_data *d, const struct virtio_worker_stats *s)
+{
+	rte_tel_data_add_dict_string(d, "internal_state",
+		s->virtio_internal_state);
+	if (!s->virtio2vf_active)
+		return;
+	rte_tel_data_add_dict_int(d, "cpu", s->virtio2vf_cpu);
+	tel_add_u64(d, "pkts_rx_from_vm", s->virtio_rx);
+	tel_add_u64(d, "bytes_rx_from_vm", s->virtio_rx_bytes);
+	tel_add_u64(d, "pkts_tx_to_vf", s->dpdk_tx);
+	tel_add_u64(d, "bytes_tx_to_vf", s->dpdk_tx_bytes);
+	tel_add_u64(d, "pkts_dropped_vf_queue_full", s->dpdk_drop_full);
+	tel_add_u64(d, "pkts_dropped_vf_not_connected", s->dpdk_drop_unavail);
+	tel_add_u64(d, "pkts_dropped_flushed", s->dpdk_drop_flush);
+	tel_add_u64(d, "guest_tx_nombuf", s->virtio_rx_nombuf);
+	tel_add_u64(d, "pkts_vf_tx_errors", s->vf_oerrors);
+	tel_add_u64(d, "pkts_csum_sw", s->csum_sw);
+	tel_add_u64(d, "pkts_csum_offload", s->csum_offload);
+	tel_add_u64(d, "pkts_csum_trunc", s->csum_trunc);
+	tel_add_u64(d, "cpu_migrations", s->virtio2vf_migrations);
+	tel_add_u64(d, "cpu_steals", s->virtio2vf_steals);
+	tel_add_u64(d, "cycles", s->virtio2vf_cycles);
+	/* Telemetry has no floating point values. */
+	tel_add_u64(d, "pkt_rate_rx_from_vm", s->virtio_rx_rate);
+	tel_add_u64(d, "byte_rate_rx_from_vm", s->virtio_rx_byte_rate);
+	tel_add_u64(d, "pkt_rate_tx_to_vf", s->dpdk_tx_rate);
+	tel_add_u64(d, "byte_rate_tx_to_vf", s->dpdk_tx_byte_rate);
+}
+
+static void
+tel_vf_to_vm(struct rte_tel_data *d, const struct virtio_worker_stats *s)
+{
+	rte_tel_data_add_dict_string(d, "internal_state",
+		s->dpdk_internal_state);
+	if (!s->vf2virtio_active)
+		return;
+	rte_tel_data_add_dict_int(d, "cpu", s->vf2virtio_cpu);
+	tel_add_u64(d, "pkts_rx_from_vf", s->dpdk_rx);
+	tel_add_u64(d, "bytes_rx_from_vf", s->dpdk_rx_bytes);
+	tel_add_u64(d, "pkts_tx_to_vm", s->virtio_tx);
+	tel_add_u64(d, "bytes_tx_to_vm", s->virtio_tx_bytes);
+	tel_add_u64(d, "pkts_dropped_vm_queue_full", s->virtio_drop_full);
+	tel_add_u64(d, "pkts_dropped_vm_not_connected",
+		s->virtio_drop_unavail);
+	tel_add_u64(d, "pkts_dropped_flushed", s->virtio_drop_flush);
+	tel_add_u64(d, "pkts_queue_fallback", s->virtio_queue_fallback);
+	tel_add_u64(d, "guest_rx_ring_empty", s->virtio_ring_empty);
+	tel_add_u64(d, "pkts_vf_missed", s->vf_imissed);
+	tel_add_u64(d, "pkts_vf_rx_nombuf", s->vf_rx_nombuf);
+	tel_add_u64(d, "pkts_vf_rx_errors", s->vf_ierrors);
+	tel_add_u64(d, "pkts_csum_good", s->rx_csum_good);
+	tel_add_u64(d, "pkts_csum_bad", s->rx_csum_bad);
+	tel_add_u64(d, "cpu_migrations", s->vf2virtio_migrations);
+	tel_add_u64(d, "cpu_steals", s->vf2virtio_steals);
+	tel_add_u64(d, "cycles", s->vf2virtio_cycles);
+	tel_add_u64(d, "guest_rx_free", s->guest_rx_free.last);
+	tel_add_u64(d, "vf_rx_queue_depth", s->vf_rx_depth.last);
+	tel_add_u64(d, "pkt_rate_rx_from_vf", s->dpdk_rx_rate);
+	tel_add_u64(d, "byte_rate_rx_from_vf", s->dpdk_rx_byte_rate);
+	tel_add_u64(d, "pkt_rate_tx_to_vm", s->virtio_tx_rate);
+	tel_add_u64(d, "byte_rate_tx_to_vm", s->virtio_tx_byte_rate);
+}
+
+static int
+tel_relay(const char *cmd __attribute__((unused)), const char *params,
+	struct rte_tel_data *d)
+{
+	struct virtio_worker_stats s;
+	struct rte_tel_data *dir;
+	unsigned long id;
+	char *end;
+
+	if (!params || *params == '\0')
+		return -EINVAL;
+	id = strtoul(params, &end, 10);
+	if (*end != '\0' || id >= MAX_RELAYS)
+		return -EINVAL;
+
+	/* The same counters as the stats service, rates are not reset. */
+	virtio_forwarder_get_stats(id, &s);
+
+	rte_tel_data_start_dict(d);
+	rte_tel_data_add_dict_int(d, "id", id);
+	rte_tel_data_add_dict_int(d, "active", s.active);
+	rte_tel_data_add_dict_int(d, "socket_id", s.socket_id);
+	rte_tel_data_add_dict_string(d, "vhost_socket_name",
+		s.vhost_socket_name);
+	if (s.vf2virtio_active)
+		rte_tel_data_add_dict_string(d, "pci_addr_str", s.pci_dbdf);
+	dir = tel_add_dict(d, "vm_to_vf");
+	if (dir)
+		tel_vm_to_vf(dir, &s);
+	dir = tel_add_dict(d, "vf_to_vm");
+	if (dir)
+		tel_vf_to_vm(dir, &s);
+
+	return 0;
+}
+
+static int
+tel_workers(const char *cmd __attribute__((unused)),
+	const char *params __attribute__((unused)),
+	struct rte_tel_data *d)
+{
+	struct virtio_worker_state states[MAX_CPUS];
+	unsigned n = virtio_forwarder_get_worker_states(states, MAX_CPUS);
+
+	rte_tel_data_start_dict(d);
+	for (unsigned i=0; i<n; ++i) {
+		const struct virtio_worker_state *s = &states[i];
+		struct rte_tel_data *w;
+		char name[16];
+
+		snprintf(name, sizeof(name), "%d", s->cpu);
+		w = tel_add_dict(d, name);
+		if (!w)
+			return -ENOMEM;
+		tel_add_u64(w, "relays", s->nb_relays);
+		tel_add_u64(w, "tsc_hz", s->tsc_hz);
+		tel_add_u64(w, "iterations", s->iterations);
+		tel_add_u64(w, "busy_cycles", s->busy_cycles);
+		tel_add_u64(w, "idle_cycles", s->idle_cycles);
+		tel_add_u64(w, "sleep_cycles", s->sleep_cycles);
+		tel_add_u64(w, "overhead_cycles", s->overhead_cycles);
+	}
+
+	return 0;
+}
+
+static void
+tel_mempool(struct rte_mempool *mp, void *arg)
+{
+	struct rte_tel_data *m = tel_add_dict(arg, mp->name);
+
+	if (!m)
+		return;
+	rte_tel_data_add_dict_int(m, "socket_id", mp->socket_id);
+	tel_add_u64(m, "size", mp->size);
+	tel_add_u64(m, "cache_size", mp->cache_size);
+	tel_add_u64(m, "elt_size", mp->elt_size);
+	tel_add_u64(m, "avail", rte_mempool_avail_count(mp));
+	tel_add_u64(m, "in_use", rte_mempool_in_use_count(mp));
+}
+
+static int
+tel_mempools(const char *cmd __attribute__((unused)),
+	const char *params __attribute__((unused)),
+	struct rte_tel_data *d)
+{
+	rte_tel_data_start_dict(d);
+	/* Relay mempools come and go; the walk holds the mempool list lock. */
+	rte_mempool_walk(tel_mempool, d);
+
+	return 0;
+}
+
+int dpdk_telemetry_register(void)
+{
+	static const struct {
+		const char *cmd;
+		telemetry_cb fn;
+		const char *help;
+	} cmds[] = {
+		{ "/virtio_forwarder/relays", tel_relays,
+			"Returns the IDs of the relays with an active direction. Takes no parameters" },
+		{ "/virtio_forwarder/relay", tel_relay,
+			"Returns the counters of a relay. Parameters: int relay_id" },
+		{ "/virtio_forwarder/workers", tel_workers,
+			"Returns the cycle accounting of the worker CPUs. Takes no parameters" },
+		{ "/virtio_forwarder/mempools", tel_mempools,
+			"Returns the fill level of the mbuf pools. Takes no parameters" },
+	};
+
+	for (unsigned i=0; i<sizeof(cmds)/sizeof(cmds[0]); ++i) {
+		if (rte_telemetry_register_cmd(cmds[i].cmd, cmds[i].fn,
+				cmds[i].help)) {
+			log_error("Could not register telemetry command %s",
+				cmds[i].cmd);
+			return -1;
+		}
+	}
+	log_debug("Registered telemetry commands");
+
+	return 0;
+}
+
+#else
+
+int dpdk_telemetry_register(void)
+{
+	return 0;
+}
+
+#endif
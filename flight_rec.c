@@ -0,0 +1,156 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "flight_rec.h"
+
+void
+flight_record(struct flight_ring *r, uint64_t tsc, uint16_t event,
+		uint16_t relay, uint32_t a, uint64_t b)
+{
+	uint64_t pos = __atomic_fetch_add(&r->head, 1, __ATOMIC_RELAXED);
+	struct flight_entry *e = &r->entry[pos & (FLIGHT_REC_SIZE - 1)];
+
+	__atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	e->tsc = tsc;
+	e->event = event;
+	e->relay = relay;
+	e->a = a;
+	e->b = b;
+	__atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+unsigned
+flight_read(const struct flight_ring *r, struct flight_entry *out,
+		unsigned max)
+{
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	uint64_t pos = 0;
+	unsigned n = 0;
+
+	if (max > FLIGHT_REC_SIZE)
+		max = FLIGHT_REC_SIZE;
+	if (head > max)
+		pos = head - max;
+	for (; pos<head; ++pos) {
+		const struct flight_entry *e =
+			&r->entry[pos & (FLIGHT_REC_SIZE - 1)];
+		uint64_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+
+		/* Not written yet, or already overwritten. */
+		if (seq != pos + 1)
+			continue;
+		out[n] = *e;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		out[n++].seq = seq;
+	}
+
+	return n;
+}
+
+/*
+ * gcc -O2 -pthread flight_rec.c -DFLIGHT_REC_UNITTEST -o flight_rec
+ */
+#ifdef FLIGHT_REC_UNITTEST
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+#define TEST_WRITERS 4
+#define TEST_EVENTS 1000000
+
+static struct flight_ring ring;
+
+/* Writer @a arg records events whose fields all derive from a count. */
+static void *test_writer(void *arg)
+{
+	uint16_t w = (uint16_t)(uintptr_t)arg;
+
+	for (uint32_t i=0; i<TEST_EVENTS; ++i)
+		flight_record(&ring, i, w, w, i, (uint64_t)i << 32 | w);
+
+	return NULL;
+}
+
+int main(void)
+{
+	static struct flight_entry e[FLIGHT_REC_SIZE];
+	pthread_t t[TEST_WRITERS];
+	unsigned n, i, reads = 0;
+
+	_ASSERT(flight_read(&ring, e, FLIGHT_REC_SIZE) == 0);
+
+	/* Partial fill, then wrap around. */
+	for (i=0; i<10; ++i)
+		flight_record(&ring, i, 1, 2, i, i);
+	n = flight_read(&ring, e, FLIGHT_REC_SIZE);
+	_ASSERT(n == 10 && e[0].tsc == 0 && e[9].tsc == 9);
+	n = flight_read(&ring, e, 4);
+	_ASSERT(n == 4 && e[0].tsc == 6 && e[3].seq == 10);
+	for (; i<3*FLIGHT_REC_SIZE+5; ++i)
+		flight_record(&ring, i, 1, 2, i, i);
+	n = flight_read(&ring, e, FLIGHT_REC_SIZE);
+	_ASSERT(n == FLIGHT_REC_SIZE);
+	for (i=0; i<n; ++i)
+		_ASSERT(e[i].tsc == 2*FLIGHT_REC_SIZE+5+i && e[i].a == e[i].tsc);
+
+	/* Concurrent writers: no torn entry is ever returned. */
+	for (i=0; i<TEST_WRITERS; ++i)
+		pthread_create(&t[i], NULL, test_writer, (void *)(uintptr_t)i);
+	for (reads=0; reads<10000; ++reads) {
+		n = flight_read(&ring, e, FLIGHT_REC_SIZE);
+		for (i=0; i<n; ++i) {
+			if (e[i].event == 1)
+				continue;
+			_ASSERT(e[i].relay == e[i].event);
+			_ASSERT(e[i].a == e[i].tsc);
+			_ASSERT(e[i].b == ((uint64_t)e[i].a << 32 | e[i].event));
+			if (i)
+				_ASSERT(e[i].seq > e[i-1].seq);
+		}
+	}
+	for (i=0; i<TEST_WRITERS; ++i)
+		pthread_join(t[i], NULL);
+	n = flight_read(&ring, e, FLIGHT_REC_SIZE);
+	_ASSERT(n == FLIGHT_REC_SIZE);
+	_ASSERT(e[n-1].seq == 3*FLIGHT_REC_SIZE+5 +
+		(uint64_t)TEST_WRITERS*TEST_EVENTS);
+
+	printf("OK\n");
+	return 0;
+}
+#endif /* FLIGHT_REC_UNITTEST */
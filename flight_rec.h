@@ -0,0 +1,81 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FLIGHT_REC_H
+#define _FLIGHT_REC_H
+
+#include <stdint.h>
+
+/*
+ * Flight recorder: a ring of the last FLIGHT_REC_SIZE events of a thread,
+ * always on, for post-mortem inspection. Recording is lock-free and may be
+ * done from several threads at once. Each entry carries its own sequence
+ * number, so that readers skip the entries being overwritten instead of
+ * stopping the writers. An entry may only come out torn if its writer is
+ * overtaken by a whole lap of the ring while writing it.
+ */
+#define FLIGHT_REC_SIZE 256 /* Power of 2. */
+
+/** A recorded event. The meaning of @a a and @a b depends on @a event. */
+struct flight_entry {
+	uint64_t seq; /* Position in the ring + 1, 0 while being written. */
+	uint64_t tsc;
+	uint16_t event;
+	uint16_t relay;
+	uint32_t a;
+	uint64_t b;
+};
+
+struct flight_ring {
+	uint64_t head; /* Position of the next entry. */
+	struct flight_entry entry[FLIGHT_REC_SIZE];
+} __attribute__ ((aligned (64)));
+
+/**
+ * @brief Append an event to @a r, overwriting the oldest once full.
+ */
+void flight_record(struct flight_ring *r, uint64_t tsc, uint16_t event,
+		uint16_t relay, uint32_t a, uint64_t b);
+
+/**
+ * @brief Copy the events of @a r, oldest first.
+ *
+ * May run concurrently with flight_record(). Entries overwritten during the
+ * copy are left out.
+ * @param out Array receiving up to @a max entries, the most recent ones.
+ * @return Number of entries filled in.
+ */
+unsigned flight_read(const struct flight_ring *r, struct flight_entry *out,
+		unsigned max);
+
+#endif /* _FLIGHT_REC_H */
@@ -0,0 +1,757 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "flow_hash.h"
+
+#include <string.h>
+#include <netinet/in.h>
+
+#define ETH_ADDRS_LEN 12
+#define ETH_HDR_LEN 14
+#define VLAN_TAG_LEN 4
+#define MAX_VLAN_TAGS 2
+#define IPV4_HDR_MIN_LEN 20
+#define IPV6_HDR_LEN 40
+#define IPV6_MAX_EXT_HDRS 8
+#define UDP_HDR_LEN 8
+#define VXLAN_HDR_LEN 8
+#define GENEVE_HDR_LEN 8
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86DD
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88A8
+#define ETHERTYPE_QINQ_LEGACY 0x9100
+#define ETHERTYPE_TEB 0x6558 /* Transparent Ethernet Bridging. */
+
+static inline uint16_t load_be16(const uint8_t *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* Loads a word in whatever order it is stored; only used as hash input. */
+static inline uint32_t load_u32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline bool is_vlan_type(uint16_t type)
+{
+	return type == ETHERTYPE_VLAN || type == ETHERTYPE_QINQ ||
+		type == ETHERTYPE_QINQ_LEGACY;
+}
+
+/*
+ * Return the offset of the inner Ethernet frame of a VXLAN or GENEVE packet,
+ * relative to the start of its UDP header, or 0 if the packet does not carry
+ * a recognized tunnel.
+ */
+static unsigned tunnel_payload_offset(const uint8_t *udp, unsigned len)
+{
+	const uint8_t *tun = udp + UDP_HDR_LEN;
+	uint16_t dport;
+
+	if (len < UDP_HDR_LEN + VXLAN_HDR_LEN)
+		return 0;
+
+	dport = load_be16(udp + 2);
+	if (dport == FLOW_HASH_VXLAN_PORT) {
+		/* The I flag must be set for the VNI to be valid. */
+		if (!(tun[0] & 0x08))
+			return 0;
+		return UDP_HDR_LEN + VXLAN_HDR_LEN;
+	} else if (dport == FLOW_HASH_GENEVE_PORT) {
+		/* Version 0 only, carrying Ethernet. */
+		if ((tun[0] >> 6) != 0 || load_be16(tun + 2) != ETHERTYPE_TEB)
+			return 0;
+		return UDP_HDR_LEN + GENEVE_HDR_LEN + (tun[0] & 0x3f) * 4;
+	}
+
+	return 0;
+}
+
+/* Location of the network and transport headers of a frame. */
+struct l3_info {
+	uint16_t type;	/* Ethertype after any VLAN tags. */
+	unsigned l3;	/* Offset of the IP header. */
+	unsigned l4;	/* Offset of the transport header. */
+	uint8_t proto;	/* Transport protocol. */
+	bool frag;	/* True if the transport header may be absent. */
+};
+
+/*
+ * Skip VLAN tags and IPv6 extension headers. Returns false for non-IP or
+ * malformed frames, in which case only @a info->type is valid.
+ */
+static bool parse_l3(const uint8_t *frame, unsigned len, struct l3_info *info)
+{
+	unsigned off = ETH_ADDRS_LEN;
+	unsigned i;
+
+	info->type = load_be16(frame + off);
+	off += 2;
+	for (i=0; i<MAX_VLAN_TAGS && is_vlan_type(info->type) &&
+			len >= off + VLAN_TAG_LEN; ++i) {
+		info->type = load_be16(frame + off + 2);
+		off += VLAN_TAG_LEN;
+	}
+	info->l3 = off;
+	info->frag = false;
+
+	if (info->type == ETHERTYPE_IPV4 && len >= off + IPV4_HDR_MIN_LEN) {
+		const uint8_t *ip = frame + off;
+		unsigned ihl = (ip[0] & 0xf) * 4;
+
+		if (ihl < IPV4_HDR_MIN_LEN)
+			return false;
+
+		info->proto = ip[9];
+		/* Only the first fragment carries the L4 header. Treat all
+		 * fragments (MF set or non-zero offset) alike. */
+		info->frag = (load_be16(ip + 6) & 0x3fff) != 0;
+		info->l4 = off + ihl;
+		return true;
+	} else if (info->type == ETHERTYPE_IPV6 &&
+			len >= off + IPV6_HDR_LEN) {
+		unsigned l4 = off + IPV6_HDR_LEN;
+		uint8_t proto = frame[off + 6];
+
+		for (i=0; i<IPV6_MAX_EXT_HDRS && len >= l4 + 2; ++i) {
+			if (proto == IPPROTO_HOPOPTS ||
+					proto == IPPROTO_ROUTING ||
+					proto == IPPROTO_DSTOPTS) {
+				proto = frame[l4];
+				l4 += (frame[l4 + 1] + 1) * 8;
+			} else if (proto == IPPROTO_AH) {
+				proto = frame[l4];
+				l4 += (frame[l4 + 1] + 2) * 4;
+			} else if (proto == IPPROTO_FRAGMENT) {
+				/* Report the upper layer protocol. */
+				proto = frame[l4];
+				info->frag = true;
+				break;
+			} else {
+				break;
+			}
+		}
+		info->proto = proto;
+		info->l4 = l4;
+		return true;
+	}
+
+	return false;
+}
+
+static inline bool has_ports(uint8_t proto)
+{
+	/* The first 32 bits of TCP, UDP and SCTP are the ports. */
+	return proto == IPPROTO_TCP || proto == IPPROTO_UDP ||
+		proto == IPPROTO_SCTP;
+}
+
+unsigned
+flow_hash_key(const uint8_t *frame, unsigned len, bool tunnels,
+		uint32_t key[FLOW_HASH_KEY_WORDS])
+{
+	struct l3_info info;
+	unsigned words = 0;
+	unsigned l4, i;
+
+	if (len < ETH_HDR_LEN)
+		return 0;
+
+	if (!parse_l3(frame, len, &info)) {
+		/* Non-IP: MAC addresses and ethertype. */
+		key[0] = load_u32(frame);
+		key[1] = load_u32(frame + 4);
+		key[2] = load_u32(frame + 8);
+		key[3] = info.type;
+		return 4;
+	}
+
+	if (info.type == ETHERTYPE_IPV4) {
+		key[words++] = load_u32(frame + info.l3 + 12); /* source address */
+		key[words++] = load_u32(frame + info.l3 + 16); /* destination address */
+	} else {
+		/* Source and destination addresses. */
+		for (i=0; i<8; ++i)
+			key[words++] = load_u32(frame + info.l3 + 8 + 4*i);
+	}
+	key[words++] = info.proto;
+
+	/* Fragments are keyed on the 3-tuple. */
+	l4 = info.l4;
+	if (info.frag || !has_ports(info.proto) || len < l4 + 4)
+		return words;
+
+	key[words++] = load_u32(frame + l4);
+	if (tunnels && info.proto == IPPROTO_UDP) {
+		unsigned inner = tunnel_payload_offset(frame + l4, len - l4);
+		if (inner && len >= l4 + inner + ETH_HDR_LEN)
+			return flow_hash_key(frame + l4 + inner,
+					len - l4 - inner, false, key);
+	}
+
+	return words;
+}
+
+bool
+flow_hash_tuple(const uint8_t *frame, unsigned len, struct flow_tuple *t)
+{
+	struct l3_info info;
+	const uint8_t *ip;
+	unsigned i;
+
+	if (len < ETH_HDR_LEN || !parse_l3(frame, len, &info))
+		return false;
+
+	ip = frame + info.l3;
+	if (info.type == ETHERTYPE_IPV4) {
+		t->ip_version = 4;
+		t->src[0] = ntohl(load_u32(ip + 12));
+		t->dst[0] = ntohl(load_u32(ip + 16));
+	} else {
+		t->ip_version = 6;
+		for (i=0; i<4; ++i) {
+			t->src[i] = ntohl(load_u32(ip + 8 + 4*i));
+			t->dst[i] = ntohl(load_u32(ip + 24 + 4*i));
+		}
+	}
+	t->proto = info.proto;
+	t->has_ports = !info.frag && has_ports(info.proto) &&
+		len >= info.l4 + 4;
+	if (t->has_ports) {
+		t->sport = load_be16(frame + info.l4);
+		t->dport = load_be16(frame + info.l4 + 2);
+	}
+
+	return true;
+}
+
+/*
+ * Unit test and steering benchmark, can be compiled as follows:
+ * gcc -O2 flow_hash.c -DFLOW_HASH_UNITTEST -lm -o flow_hash
+ */
+#ifdef FLOW_HASH_UNITTEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+#define TEST_FLOWS 4096
+#define TEST_QUEUES 8
+#define TEST_PKT_LEN 256
+
+enum {
+	PKT_VLAN = 1 << 0,
+	PKT_QINQ = 1 << 1,
+	PKT_IPV6 = 1 << 2,
+	PKT_EXTHDR = 1 << 3,
+	PKT_FRAG_FIRST = 1 << 4,
+	PKT_FRAG_LATER = 1 << 5,
+	PKT_VXLAN = 1 << 6,
+	PKT_GENEVE = 1 << 7,
+};
+
+struct test_flow {
+	uint32_t src, dst;
+	uint16_t sport, dport;
+	uint8_t proto;
+};
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v >> 16);
+	put16(p + 2, v & 0xffff);
+}
+
+/* Builds a frame for @a f into zeroed memory at @a b, returning its length. */
+static unsigned build_frame(uint8_t *b, const struct test_flow *f, unsigned flags)
+{
+	unsigned off = 0, l4;
+
+	b[0] = 0x02; b[5] = 0x01; /* dst MAC */
+	b[6] = 0x02; b[11] = 0x02; /* src MAC */
+	off = ETH_ADDRS_LEN;
+	if (flags & PKT_QINQ) {
+		put16(b + off, ETHERTYPE_QINQ);
+		put16(b + off + 2, 100);
+		off += VLAN_TAG_LEN;
+	}
+	if (flags & (PKT_VLAN | PKT_QINQ)) {
+		put16(b + off, ETHERTYPE_VLAN);
+		put16(b + off + 2, 200);
+		off += VLAN_TAG_LEN;
+	}
+
+	if (flags & (PKT_VXLAN | PKT_GENEVE)) {
+		/* Fixed outer 5-tuple between two tunnel endpoints. */
+		unsigned inner;
+		put16(b + off, ETHERTYPE_IPV4);
+		off += 2;
+		b[off] = 0x45;
+		b[off + 9] = IPPROTO_UDP;
+		put32(b + off + 12, 0x0a000001);
+		put32(b + off + 16, 0x0a000002);
+		off += IPV4_HDR_MIN_LEN;
+		put16(b + off, 49152);
+		if (flags & PKT_VXLAN) {
+			put16(b + off + 2, FLOW_HASH_VXLAN_PORT);
+			off += UDP_HDR_LEN;
+			b[off] = 0x08;
+			off += VXLAN_HDR_LEN;
+		} else {
+			put16(b + off + 2, FLOW_HASH_GENEVE_PORT);
+			off += UDP_HDR_LEN;
+			b[off] = 2; /* 8 bytes of options */
+			put16(b + off + 2, ETHERTYPE_TEB);
+			off += GENEVE_HDR_LEN + 8;
+		}
+		inner = build_frame(b + off, f, flags & ~(PKT_VXLAN | PKT_GENEVE |
+							PKT_VLAN | PKT_QINQ));
+		return off + inner;
+	}
+
+	if (flags & PKT_IPV6) {
+		uint8_t *nh;
+		put16(b + off, ETHERTYPE_IPV6);
+		off += 2;
+		b[off] = 0x60;
+		nh = &b[off + 6];
+		put32(b + off + 20, f->src);
+		put32(b + off + 36, f->dst);
+		off += IPV6_HDR_LEN;
+		if (flags & PKT_EXTHDR) {
+			*nh = IPPROTO_HOPOPTS;
+			nh = &b[off];
+			off += 8;
+			*nh = IPPROTO_DSTOPTS;
+			nh = &b[off];
+			b[off + 1] = 1;
+			off += 16;
+		}
+		if (flags & (PKT_FRAG_FIRST | PKT_FRAG_LATER)) {
+			*nh = IPPROTO_FRAGMENT;
+			nh = &b[off];
+			put16(b + off + 2, (flags & PKT_FRAG_LATER) ? 0x0100 : 0x0001);
+			put32(b + off + 4, f->sport);
+			off += 8;
+		}
+		*nh = f->proto;
+	} else {
+		uint16_t frag = 0;
+		if (flags & PKT_FRAG_FIRST)
+			frag = 0x2000; /* MF */
+		else if (flags & PKT_FRAG_LATER)
+			frag = 0x0100; /* offset */
+		put16(b + off, ETHERTYPE_IPV4);
+		off += 2;
+		b[off] = 0x45;
+		put16(b + off + 6, frag);
+		b[off + 9] = f->proto;
+		put32(b + off + 12, f->src);
+		put32(b + off + 16, f->dst);
+		off += IPV4_HDR_MIN_LEN;
+	}
+
+	l4 = off;
+	if (flags & PKT_FRAG_LATER) {
+		/* Payload only; anything could be here. */
+		for (unsigned i=l4; i<l4+32; ++i)
+			b[i] = (uint8_t)(f->sport * 31 + f->dport * 7 + i);
+	} else {
+		put16(b + l4, f->sport);
+		put16(b + l4 + 2, f->dport);
+	}
+	return l4 + 32;
+}
+
+static unsigned build_pkt(uint8_t *b, const struct test_flow *f, unsigned flags)
+{
+	memset(b, 0, TEST_PKT_LEN);
+	return build_frame(b, f, flags);
+}
+
+/* The steering key as computed before VLAN/extension/tunnel awareness. */
+static unsigned legacy_key(const uint8_t *b, uint32_t *key)
+{
+	unsigned words = 0;
+	uint16_t type = load_be16(b + ETH_ADDRS_LEN);
+	const uint8_t *ip = b + ETH_HDR_LEN;
+
+	if (type == ETHERTYPE_IPV4) {
+		key[words++] = load_u32(ip + 12);
+		key[words++] = load_u32(ip + 16);
+		key[words++] = ip[9];
+		if (ip[9] == IPPROTO_TCP || ip[9] == IPPROTO_UDP ||
+				ip[9] == IPPROTO_SCTP)
+			key[words++] = load_u32(ip + (ip[0] & 0xf) * 4);
+	} else if (type == ETHERTYPE_IPV6) {
+		for (unsigned i=0; i<8; ++i)
+			key[words++] = load_u32(ip + 8 + 4*i);
+		key[words++] = ip[6];
+		if (ip[6] == IPPROTO_TCP || ip[6] == IPPROTO_UDP ||
+				ip[6] == IPPROTO_SCTP)
+			key[words++] = load_u32(ip + IPV6_HDR_LEN);
+	} else {
+		key[0] = load_u32(b);
+		key[1] = load_u32(b + 4);
+		key[2] = load_u32(b + 8);
+		key[3] = type;
+		words = 4;
+	}
+	return words;
+}
+
+/* Stand-in for rte_jhash_32b(), which the daemon uses. */
+static uint32_t test_hash(const uint32_t *key, unsigned words)
+{
+	uint32_t h = 0xdeadbee5;
+
+	for (unsigned i=0; i<words; ++i) {
+		h ^= key[i];
+		h *= 0xcc9e2d51;
+		h = (h << 15) | (h >> 17);
+		h *= 0x1b873593;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/* Reference Toeplitz hash, as rte_softrss() computes it. */
+static uint32_t test_toeplitz(const uint32_t *input, unsigned words,
+				const uint8_t *key)
+{
+	uint32_t ret = 0;
+
+	for (unsigned j=0; j<words; ++j) {
+		uint64_t win = ((uint64_t)ntohl(load_u32(key + 4*j)) << 32) |
+			ntohl(load_u32(key + 4*j + 4));
+		for (unsigned i=0; i<32; ++i)
+			if (input[j] & (1u << (31 - i)))
+				ret ^= (uint32_t)(win >> (32 - i));
+	}
+	return ret;
+}
+
+/* Packs a tuple as rte_ipv4_tuple/rte_ipv6_tuple, returning its length. */
+static unsigned tuple_words(const struct flow_tuple *t, bool l4, uint32_t *in)
+{
+	unsigned n = 0, naddr = t->ip_version == 4 ? 1 : 4;
+
+	for (unsigned i=0; i<naddr; ++i)
+		in[n++] = t->src[i];
+	for (unsigned i=0; i<naddr; ++i)
+		in[n++] = t->dst[i];
+	if (l4)
+		in[n++] = ((uint32_t)t->sport << 16) | t->dport;
+	return n;
+}
+
+static bool key_equal(const uint32_t *a, unsigned na, const uint32_t *b,
+			unsigned nb)
+{
+	return na == nb && memcmp(a, b, na * sizeof(*a)) == 0;
+}
+
+static void random_flow(struct test_flow *f, uint32_t *seed, uint8_t proto)
+{
+	*seed = *seed * 1103515245 + 12345;
+	/* Many connections between the same pair of hosts. */
+	f->src = 0xc0a80001;
+	f->dst = 0xc0a80002;
+	f->sport = (*seed >> 16) | 1024;
+	*seed = *seed * 1103515245 + 12345;
+	f->dport = (*seed >> 16) % 1024;
+	f->proto = proto;
+}
+
+static double entropy(const unsigned *count, unsigned n, unsigned total)
+{
+	double h = 0;
+
+	for (unsigned i=0; i<n; ++i) {
+		if (count[i]) {
+			double p = (double)count[i] / total;
+			h -= p * log2(p);
+		}
+	}
+	return h;
+}
+
+static void bench_scenario(const char *name, unsigned flags, uint8_t proto)
+{
+	unsigned legacy[TEST_QUEUES] = {0}, updated[TEST_QUEUES] = {0};
+	uint8_t pkt[TEST_PKT_LEN];
+	uint32_t key[FLOW_HASH_KEY_WORDS];
+	uint32_t seed = 1;
+	struct test_flow f;
+
+	for (unsigned i=0; i<TEST_FLOWS; ++i) {
+		unsigned len, n;
+		random_flow(&f, &seed, proto);
+		len = build_pkt(pkt, &f, flags);
+		n = legacy_key(pkt, key);
+		++legacy[test_hash(key, n) % TEST_QUEUES];
+		n = flow_hash_key(pkt, len, true, key);
+		++updated[test_hash(key, n) % TEST_QUEUES];
+	}
+	printf("%-24s %8.3f %8.3f\n", name,
+		entropy(legacy, TEST_QUEUES, TEST_FLOWS),
+		entropy(updated, TEST_QUEUES, TEST_FLOWS));
+}
+
+static void bench_fragments(const char *name, unsigned flags)
+{
+	unsigned legacy_split = 0, updated_split = 0;
+	uint8_t first[TEST_PKT_LEN], later[TEST_PKT_LEN];
+	uint32_t k1[FLOW_HASH_KEY_WORDS], k2[FLOW_HASH_KEY_WORDS];
+	uint32_t seed = 1;
+	struct test_flow f;
+
+	for (unsigned i=0; i<TEST_FLOWS; ++i) {
+		unsigned l1, l2, n1, n2;
+		random_flow(&f, &seed, IPPROTO_UDP);
+		l1 = build_pkt(first, &f, flags | PKT_FRAG_FIRST);
+		l2 = build_pkt(later, &f, flags | PKT_FRAG_LATER);
+		n1 = legacy_key(first, k1);
+		n2 = legacy_key(later, k2);
+		legacy_split += (test_hash(k1, n1) % TEST_QUEUES !=
+				test_hash(k2, n2) % TEST_QUEUES);
+		n1 = flow_hash_key(first, l1, true, k1);
+		n2 = flow_hash_key(later, l2, true, k2);
+		updated_split += (test_hash(k1, n1) % TEST_QUEUES !=
+				test_hash(k2, n2) % TEST_QUEUES);
+	}
+	printf("%-24s %8u %8u\n", name, legacy_split, updated_split);
+	_ASSERT(updated_split == 0);
+}
+
+static void bench_throughput(void)
+{
+	static uint8_t pkts[8][TEST_PKT_LEN];
+	static const unsigned flags[8] = {
+		0, PKT_VLAN, PKT_QINQ, PKT_IPV6, PKT_IPV6 | PKT_EXTHDR,
+		PKT_FRAG_FIRST, PKT_VXLAN, PKT_GENEVE
+	};
+	unsigned lens[8];
+	uint32_t key[FLOW_HASH_KEY_WORDS];
+	uint32_t seed = 1, sink = 0;
+	struct test_flow f;
+	struct timespec t0, t1;
+	const unsigned iterations = 10000000;
+
+	for (unsigned i=0; i<8; ++i) {
+		random_flow(&f, &seed, IPPROTO_TCP);
+		lens[i] = build_pkt(pkts[i], &f, flags[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (unsigned i=0; i<iterations; ++i) {
+		unsigned j = i & 7;
+		unsigned n = flow_hash_key(pkts[j], lens[j], true, key);
+		sink += key[n - 1];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("flow_hash_key: %.1f ns/pkt (mixed corpus, sink %u)\n",
+		((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+		iterations, sink & 1);
+}
+
+int main(void)
+{
+	uint8_t pkt[TEST_PKT_LEN], ref[TEST_PKT_LEN];
+	uint32_t key[FLOW_HASH_KEY_WORDS], ref_key[FLOW_HASH_KEY_WORDS];
+	unsigned len, ref_len, n, ref_n;
+	struct test_flow f = {
+		.src = 0x0a010203, .dst = 0x0a040506,
+		.sport = 1234, .dport = 80, .proto = IPPROTO_TCP
+	};
+
+	/* Plain IPv4 TCP: 5-tuple. */
+	ref_len = build_pkt(ref, &f, 0);
+	ref_n = flow_hash_key(ref, ref_len, false, ref_key);
+	_ASSERT(ref_n == 4);
+
+	/* VLAN and QinQ tags are transparent. */
+	len = build_pkt(pkt, &f, PKT_VLAN);
+	n = flow_hash_key(pkt, len, false, key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+	len = build_pkt(pkt, &f, PKT_QINQ);
+	n = flow_hash_key(pkt, len, false, key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+
+	/* IPv4 fragments share the 3-tuple. */
+	len = build_pkt(pkt, &f, PKT_FRAG_FIRST);
+	n = flow_hash_key(pkt, len, false, key);
+	_ASSERT(n == 3);
+	len = build_pkt(ref, &f, PKT_FRAG_LATER);
+	ref_n = flow_hash_key(ref, len, false, ref_key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+
+	/* IPv6 extension headers are skipped to reach the ports. */
+	ref_len = build_pkt(ref, &f, PKT_IPV6);
+	ref_n = flow_hash_key(ref, ref_len, false, ref_key);
+	_ASSERT(ref_n == 10);
+	len = build_pkt(pkt, &f, PKT_IPV6 | PKT_EXTHDR);
+	n = flow_hash_key(pkt, len, false, key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+
+	/* IPv6 fragments share the 3-tuple, with the upper layer protocol. */
+	len = build_pkt(pkt, &f, PKT_IPV6 | PKT_EXTHDR | PKT_FRAG_FIRST);
+	n = flow_hash_key(pkt, len, false, key);
+	_ASSERT(n == 9 && key[8] == IPPROTO_TCP);
+	len = build_pkt(ref, &f, PKT_IPV6 | PKT_FRAG_LATER);
+	ref_n = flow_hash_key(ref, len, false, ref_key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+
+	/* Tunnels are keyed on the inner frame only when enabled. */
+	ref_len = build_pkt(ref, &f, 0);
+	ref_n = flow_hash_key(ref, ref_len, false, ref_key);
+	len = build_pkt(pkt, &f, PKT_VXLAN);
+	n = flow_hash_key(pkt, len, true, key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+	n = flow_hash_key(pkt, len, false, key);
+	_ASSERT(n == 4 && !key_equal(key, n, ref_key, ref_n));
+	len = build_pkt(pkt, &f, PKT_GENEVE);
+	n = flow_hash_key(pkt, len, true, key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+	ref_len = build_pkt(ref, &f, PKT_IPV6 | PKT_EXTHDR);
+	ref_n = flow_hash_key(ref, ref_len, false, ref_key);
+	len = build_pkt(pkt, &f, PKT_VXLAN | PKT_IPV6 | PKT_EXTHDR);
+	n = flow_hash_key(pkt, len, true, key);
+	_ASSERT(key_equal(key, n, ref_key, ref_n));
+
+	/* Non-IP frames use MACs and ethertype. */
+	len = build_pkt(pkt, &f, 0);
+	put16(pkt + ETH_ADDRS_LEN, 0x0806);
+	n = flow_hash_key(pkt, len, true, key);
+	_ASSERT(n == 4 && key[3] == 0x0806);
+
+	/* Tuples reproduce the Microsoft RSS verification suite hashes. */
+	{
+		static const uint8_t rss_key[40] = {
+			0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+			0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+			0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+			0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+			0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+		};
+		static const uint8_t v6_src[16] = {
+			0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff,
+			0, 0, 0, 0, 0, 0, 0, 0x07
+		};
+		static const uint8_t v6_dst[16] = {
+			0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03,
+			0, 0, 0, 0, 0, 0, 0, 0x01
+		};
+		struct test_flow v4 = {
+			.src = 0x420995bb, .dst = 0xa18e6450,
+			.sport = 2794, .dport = 1766, .proto = IPPROTO_TCP
+		};
+		struct flow_tuple t;
+		uint32_t in[9];
+
+		len = build_pkt(pkt, &v4, PKT_VLAN);
+		_ASSERT(flow_hash_tuple(pkt, len, &t));
+		_ASSERT(t.ip_version == 4 && t.has_ports);
+		n = tuple_words(&t, true, in);
+		_ASSERT(test_toeplitz(in, n, rss_key) == 0x51ccc178);
+		n = tuple_words(&t, false, in);
+		_ASSERT(test_toeplitz(in, n, rss_key) == 0x323e8fc2);
+
+		len = build_pkt(pkt, &v4, PKT_IPV6 | PKT_EXTHDR);
+		memcpy(pkt + ETH_HDR_LEN + 8, v6_src, 16);
+		memcpy(pkt + ETH_HDR_LEN + 24, v6_dst, 16);
+		_ASSERT(flow_hash_tuple(pkt, len, &t));
+		_ASSERT(t.ip_version == 6 && t.has_ports);
+		n = tuple_words(&t, true, in);
+		_ASSERT(test_toeplitz(in, n, rss_key) == 0x40207d3d);
+		n = tuple_words(&t, false, in);
+		_ASSERT(test_toeplitz(in, n, rss_key) == 0x2cc18cd5);
+
+		len = build_pkt(pkt, &v4, PKT_FRAG_LATER);
+		_ASSERT(flow_hash_tuple(pkt, len, &t) && !t.has_ports);
+		put16(pkt + ETH_ADDRS_LEN, 0x0806);
+		_ASSERT(!flow_hash_tuple(pkt, len, &t));
+	}
+
+	/* Truncated frames never read past the given length (run under ASan
+	 * or valgrind to check). */
+	for (unsigned flags=0; flags<(PKT_GENEVE << 1); ++flags) {
+		len = build_pkt(ref, &f, flags);
+		for (unsigned l=0; l<=len; ++l) {
+			uint8_t *copy = malloc(l ? l : 1);
+			memcpy(copy, ref, l);
+			n = flow_hash_key(copy, l, true, key);
+			_ASSERT(n <= FLOW_HASH_KEY_WORDS);
+			struct flow_tuple t;
+			flow_hash_tuple(copy, l, &t);
+			free(copy);
+		}
+	}
+
+	printf("Queue distribution entropy over %u flows, %u queues (max %.3f bits)\n",
+		TEST_FLOWS, TEST_QUEUES, log2(TEST_QUEUES));
+	printf("%-24s %8s %8s\n", "scenario", "legacy", "new");
+	bench_scenario("ipv4 tcp", 0, IPPROTO_TCP);
+	bench_scenario("vlan ipv4 tcp", PKT_VLAN, IPPROTO_TCP);
+	bench_scenario("qinq ipv4 udp", PKT_QINQ, IPPROTO_UDP);
+	bench_scenario("ipv6 exthdr tcp", PKT_IPV6 | PKT_EXTHDR, IPPROTO_TCP);
+	bench_scenario("vxlan ipv4 tcp", PKT_VXLAN, IPPROTO_TCP);
+	bench_scenario("geneve ipv6 udp", PKT_GENEVE | PKT_IPV6, IPPROTO_UDP);
+	printf("\nDatagrams with fragments steered to different queues\n");
+	printf("%-24s %8s %8s\n", "scenario", "legacy", "new");
+	bench_fragments("ipv4 udp fragments", 0);
+	bench_fragments("ipv6 udp fragments", PKT_IPV6);
+	printf("\n");
+	bench_throughput();
+
+	return (EXIT_SUCCESS);
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FLOW_HASH_H
+#define _FLOW_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Maximum number of 32-bit words flow_hash_key() writes. */
+#define FLOW_HASH_KEY_WORDS 16
+
+/** Well-known UDP destination ports of supported tunnels. */
+#define FLOW_HASH_VXLAN_PORT 4789
+#define FLOW_HASH_GENEVE_PORT 6081
+
+/**
+ * @brief Extract the fields identifying the flow of an Ethernet frame.
+ *
+ * Up to two VLAN tags (802.1Q, 802.1ad/QinQ) are skipped and IPv6 extension
+ * headers are walked to find the transport protocol. L4 ports are only used
+ * for unfragmented packets, so that all fragments of a datagram produce the
+ * same key. Non-IP frames are keyed on their MAC addresses and ethertype.
+ *
+ * @param frame Start of the Ethernet header.
+ * @param len Number of contiguous bytes available at @a frame.
+ * @param tunnels True to key VXLAN and GENEVE packets on their inner frame.
+ * @param key Receives the flow key.
+ * @return Number of 32-bit words written to @a key.
+ */
+unsigned
+flow_hash_key(const uint8_t *frame, unsigned len, bool tunnels,
+		uint32_t key[FLOW_HASH_KEY_WORDS]);
+
+/** Addresses and ports of an IP packet, in host byte order. */
+struct flow_tuple {
+	uint8_t ip_version;	/* 4 or 6. */
+	uint8_t proto;		/* Transport protocol. */
+	bool has_ports;		/* False for fragments and port-less protocols. */
+	uint16_t sport, dport;
+	uint32_t src[4], dst[4]; /* Only word 0 is used for IPv4. */
+};
+
+/**
+ * @brief Extract the addresses and ports of the outer IP header of a frame.
+ *
+ * Parses VLAN tags and IPv6 extension headers like flow_hash_key(). The
+ * result is laid out for use as Toeplitz hash input.
+ *
+ * @param frame Start of the Ethernet header.
+ * @param len Number of contiguous bytes available at @a frame.
+ * @param t Receives the tuple.
+ * @return False if the frame is not IPv4 or IPv6.
+ */
+bool
+flow_hash_tuple(const uint8_t *frame, unsigned len, struct flow_tuple *t);
+
+#endif /* _FLOW_HASH_H */
@@ -0,0 +1,295 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "flow_sketch.h"
+
+#include <string.h>
+
+/* Odd multipliers of the multiply-shift hashes picking a counter per row. */
+static const uint32_t row_mult[FLOW_SKETCH_ROWS] = {
+	0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f,
+};
+
+static inline void entry_swap(struct flow_sketch_entry *a,
+			struct flow_sketch_entry *b)
+{
+	struct flow_sketch_entry t = *a;
+
+	*a = *b;
+	*b = t;
+}
+
+/* Restore the heap after the packets of entry @a i grew. */
+static void heap_down(struct flow_sketch *s, unsigned i)
+{
+	for (;;) {
+		unsigned min = i, l = 2 * i + 1, r = l + 1;
+
+		if (l < s->nb_top && s->top[l].pkts < s->top[min].pkts)
+			min = l;
+		if (r < s->nb_top && s->top[r].pkts < s->top[min].pkts)
+			min = r;
+		if (min == i)
+			return;
+		entry_swap(&s->top[i], &s->top[min]);
+		i = min;
+	}
+}
+
+/* Restore the heap after appending entry @a i. */
+static void heap_up(struct flow_sketch *s, unsigned i)
+{
+	while (i > 0) {
+		unsigned parent = (i - 1) / 2;
+
+		if (s->top[parent].pkts <= s->top[i].pkts)
+			return;
+		entry_swap(&s->top[i], &s->top[parent]);
+		i = parent;
+	}
+}
+
+/* Publish the top flows of the epoch ending at @a now, and start anew. */
+static void flow_sketch_roll(struct flow_sketch *s, uint64_t now)
+{
+	unsigned i, j;
+
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	/* Insertion sort, by decreasing packets. */
+	for (i=0; i<s->nb_top; ++i) {
+		for (j=i; j>0 && s->published[j-1].pkts < s->top[i].pkts; --j)
+			s->published[j] = s->published[j-1];
+		s->published[j] = s->top[i];
+	}
+	s->nb_published = s->nb_top;
+	s->published_start = s->epoch_start;
+	s->published_end = now;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+
+	memset(s->counters, 0, sizeof(s->counters));
+	s->nb_top = 0;
+	s->epoch_start = now;
+}
+
+void flow_sketch_init(struct flow_sketch *s, uint64_t epoch_len)
+{
+	memset(s, 0, sizeof(*s));
+	s->epoch_len = epoch_len;
+}
+
+void flow_sketch_add(struct flow_sketch *s, uint32_t hash, uint32_t bytes,
+		const uint8_t *frame, unsigned len, uint64_t now)
+{
+	uint32_t *c[FLOW_SKETCH_ROWS];
+	uint32_t est = UINT32_MAX;
+	struct flow_sketch_entry *e;
+	unsigned r, i;
+
+	if (!s->epoch_start)
+		s->epoch_start = now;
+	else if (now - s->epoch_start >= s->epoch_len)
+		flow_sketch_roll(s, now);
+
+	/* Conservative update: only raise the counters that hold the
+	 * estimate, which keeps the other flows sharing them accurate. */
+	for (r=0; r<FLOW_SKETCH_ROWS; ++r) {
+		c[r] = &s->counters[r][(hash * row_mult[r]) >>
+					(32 - FLOW_SKETCH_COLS_BITS)];
+		if (*c[r] < est)
+			est = *c[r];
+	}
+	++est;
+	for (r=0; r<FLOW_SKETCH_ROWS; ++r)
+		if (*c[r] < est)
+			*c[r] = est;
+
+	for (i=0; i<s->nb_top; ++i) {
+		if (s->top[i].hash == hash) {
+			s->top[i].pkts = est;
+			s->top[i].bytes += bytes;
+			heap_down(s, i);
+			return;
+		}
+	}
+
+	if (s->nb_top < FLOW_SKETCH_TOP_K) {
+		i = s->nb_top++;
+	} else if (est > s->top[0].pkts) {
+		i = 0;
+	} else {
+		return;
+	}
+	/* The bytes the flow had before it entered the top are unknown:
+	 * assume its packets were all of this size. */
+	e = &s->top[i];
+	e->hash = hash;
+	e->pkts = est;
+	e->bytes = (uint64_t)est * bytes;
+	if (!flow_hash_tuple(frame, len, &e->tuple))
+		memset(&e->tuple, 0, sizeof(e->tuple));
+	if (i)
+		heap_up(s, i);
+	else
+		heap_down(s, i);
+}
+
+unsigned flow_sketch_read(const struct flow_sketch *s,
+		struct flow_sketch_entry top[FLOW_SKETCH_TOP_K],
+		uint64_t *start, uint64_t *end)
+{
+	uint32_t seq;
+	unsigned n;
+
+	do {
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		n = s->nb_published;
+		if (n > FLOW_SKETCH_TOP_K)
+			continue;
+		memcpy(top, s->published, n * sizeof(*top));
+		*start = s->published_start;
+		*end = s->published_end;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || n > FLOW_SKETCH_TOP_K ||
+			seq != __atomic_load_n(&s->seq, __ATOMIC_RELAXED));
+
+	return n;
+}
+
+/*
+ * Unit test, can be compiled as follows:
+ * gcc -O2 flow_sketch.c flow_hash.c -DFLOW_SKETCH_UNITTEST -o flow_sketch
+ */
+#ifdef FLOW_SKETCH_UNITTEST
+#include <stdio.h>
+#include <stdlib.h>
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+#define TEST_FLOWS 20000
+#define TEST_HEAVY 10
+
+/* An IPv4/UDP frame from 10.0.0.1 to 10.0.0.2, with flow number @a f in the
+ * source port. */
+static unsigned test_frame(uint8_t *p, unsigned f)
+{
+	memset(p, 0, 64);
+	p[12] = 0x08;
+	p[14] = 0x45;
+	p[23] = 17;
+	p[26] = 10; p[29] = 1;
+	p[30] = 10; p[33] = 2;
+	p[34] = f >> 8; p[35] = f & 0xff;
+	p[37] = 53;
+
+	return 64;
+}
+
+static uint32_t test_hash(uint32_t f)
+{
+	f ^= f >> 16;
+	f *= 0x7feb352d;
+	f ^= f >> 15;
+	f *= 0x846ca68b;
+	f ^= f >> 16;
+
+	return f;
+}
+
+int main(void)
+{
+	static struct flow_sketch s;
+	struct flow_sketch_entry top[FLOW_SKETCH_TOP_K];
+	uint64_t start, end, now = 1;
+	uint8_t frame[64];
+	unsigned n, f, i;
+
+	flow_sketch_init(&s, 1000000);
+	_ASSERT(flow_sketch_read(&s, top, &start, &end) == 0);
+
+	/* TEST_HEAVY flows of 1000 packets among TEST_FLOWS flows of 2 to 6,
+	 * interleaved. */
+	for (i=0; i<1000; ++i) {
+		for (f=0; f<TEST_FLOWS; ++f) {
+			unsigned len = test_frame(frame, f);
+
+			if (f < TEST_HEAVY) {
+				flow_sketch_add(&s, test_hash(f), 1000, frame,
+						len, now++);
+			} else if (i < 2 + f % 5) {
+				flow_sketch_add(&s, test_hash(f), 100, frame,
+						len, now++);
+			}
+		}
+	}
+	/* Nothing is published before the epoch ends. */
+	_ASSERT(flow_sketch_read(&s, top, &start, &end) == 0);
+	flow_sketch_add(&s, test_hash(TEST_FLOWS), 100, frame, 64,
+			now + 1000000);
+
+	n = flow_sketch_read(&s, top, &start, &end);
+	_ASSERT(n == FLOW_SKETCH_TOP_K);
+	_ASSERT(start == 1 && end == now + 1000000);
+	for (i=0; i<n; ++i) {
+		if (i)
+			_ASSERT(top[i].pkts <= top[i-1].pkts);
+		if (i >= TEST_HEAVY)
+			continue;
+		/* The heavy flows lead, never underestimated. */
+		f = top[i].tuple.sport;
+		_ASSERT(f < TEST_HEAVY && top[i].hash == test_hash(f));
+		_ASSERT(top[i].tuple.ip_version == 4 &&
+			top[i].tuple.proto == 17 && top[i].tuple.dport == 53);
+		_ASSERT(top[i].pkts >= 1000 && top[i].pkts < 1100);
+		_ASSERT(top[i].bytes >= 1000 * 1000 &&
+			top[i].bytes < 1100 * 1000);
+	}
+
+	/* The next epoch starts from scratch, with the packet that ended the
+	 * previous one. */
+	test_frame(frame, 7);
+	flow_sketch_add(&s, test_hash(7), 100, frame, 64, now + 1500000);
+	flow_sketch_add(&s, test_hash(7), 100, frame, 64, now + 1600000);
+	flow_sketch_add(&s, test_hash(7), 100, frame, 64, now + 3000000);
+	n = flow_sketch_read(&s, top, &start, &end);
+	_ASSERT(n == 2 && top[0].pkts == 2 && top[1].pkts == 1);
+	_ASSERT(top[0].tuple.sport == 7 && top[0].bytes == 200);
+
+	printf("flow_sketch: %zu bytes, all tests passed\n", sizeof(s));
+
+	return 0;
+}
+#endif /* FLOW_SKETCH_UNITTEST */
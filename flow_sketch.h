@@ -0,0 +1,113 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _FLOW_SKETCH_H
+#define _FLOW_SKETCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "flow_hash.h"
+
+/*
+ * Heavy hitter flow tracking: a count-min sketch of FLOW_SKETCH_ROWS rows of
+ * FLOW_SKETCH_COLS counters estimates the packets of every flow, keyed on a
+ * 32-bit flow hash, and a min-heap keeps the FLOW_SKETCH_TOP_K flows with the
+ * highest estimates. Counting restarts every epoch, after the top flows of the
+ * epoch are published for readers. The size is fixed, whatever the number of
+ * flows.
+ */
+#define FLOW_SKETCH_ROWS 4
+#define FLOW_SKETCH_COLS_BITS 10
+#define FLOW_SKETCH_COLS (1U << FLOW_SKETCH_COLS_BITS)
+#define FLOW_SKETCH_TOP_K 16
+
+/** A top flow. Counts are of the packets added, i.e. of sampled packets. */
+struct flow_sketch_entry {
+	uint32_t hash;
+	uint32_t pkts; /* Count-min estimate, never below the true count. */
+	uint64_t bytes; /* Bytes counted since the flow entered the top. */
+	struct flow_tuple tuple; /* ip_version is 0 for non-IP flows. */
+};
+
+struct flow_sketch {
+	/* Written by a single thread, see flow_sketch_add(). */
+	uint64_t epoch_len;
+	uint64_t epoch_start;
+	uint32_t counters[FLOW_SKETCH_ROWS][FLOW_SKETCH_COLS];
+	unsigned nb_top;
+	struct flow_sketch_entry top[FLOW_SKETCH_TOP_K]; /* Min-heap on pkts. */
+
+	/* Top flows of the last complete epoch, by decreasing packets, under
+	 * a sequence lock: odd while being written. */
+	volatile uint32_t seq;
+	unsigned nb_published;
+	uint64_t published_start;
+	uint64_t published_end;
+	struct flow_sketch_entry published[FLOW_SKETCH_TOP_K];
+};
+
+/**
+ * @brief Reset @a s, with epochs of @a epoch_len time units (in the unit of
+ * the @a now argument of flow_sketch_add()).
+ */
+void flow_sketch_init(struct flow_sketch *s, uint64_t epoch_len);
+
+/**
+ * @brief Count a packet of the flow with hash @a hash.
+ *
+ * Must not be called concurrently for the same sketch. The flow addresses
+ * are only parsed from @a frame when the flow enters the top.
+ *
+ * @param bytes Length of the packet.
+ * @param frame Start of the Ethernet header, @a len contiguous bytes.
+ * @param now Current time, which ends the epoch once epoch_len has passed.
+ */
+void flow_sketch_add(struct flow_sketch *s, uint32_t hash, uint32_t bytes,
+		const uint8_t *frame, unsigned len, uint64_t now);
+
+/**
+ * @brief Get the top flows of the last complete epoch.
+ *
+ * May be called while the sketch is being written.
+ *
+ * @param top Receives up to FLOW_SKETCH_TOP_K flows, by decreasing packets.
+ * @param start Receives the start of the epoch.
+ * @param end Receives the end of the epoch, 0 if none has completed yet.
+ * @return Number of flows filled in.
+ */
+unsigned flow_sketch_read(const struct flow_sketch *s,
+		struct flow_sketch_entry top[FLOW_SKETCH_TOP_K],
+		uint64_t *start, uint64_t *end);
+
+#endif /* _FLOW_SKETCH_H */
@@ -0,0 +1,132 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "lat_hist.h"
+
+uint64_t lat_hist_bucket_low(unsigned i)
+{
+	unsigned shift;
+
+	if (i < LAT_HIST_SUB_BUCKETS)
+		return i;
+	shift = (i >> LAT_HIST_SUB_BITS) - 1;
+
+	return (uint64_t)(LAT_HIST_SUB_BUCKETS |
+			(i & (LAT_HIST_SUB_BUCKETS - 1))) << shift;
+}
+
+uint64_t lat_hist_percentile(const struct lat_hist *h, double pct)
+{
+	uint64_t count = 0, rank, seen = 0;
+	unsigned i;
+
+	/* Histograms are read while being written: go by the buckets, which
+	 * may be ahead of or behind h->count. */
+	for (i=0; i<LAT_HIST_BUCKETS; ++i)
+		count += h->buckets[i];
+	if (!count)
+		return 0;
+
+	rank = (uint64_t)(pct / 100.0 * count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > count)
+		rank = count;
+	for (i=0; i<LAT_HIST_BUCKETS - 1; ++i) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	if (i == LAT_HIST_BUCKETS - 1 ||
+			lat_hist_bucket_low(i + 1) - 1 > h->max)
+		return h->max;
+
+	return lat_hist_bucket_low(i + 1) - 1;
+}
+
+/*
+ * Unit test, can be compiled as follows:
+ * gcc -O2 lat_hist.c -DLAT_HIST_UNITTEST -o lat_hist
+ */
+#ifdef LAT_HIST_UNITTEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+int main(void)
+{
+	static struct lat_hist h;
+	uint64_t v, p;
+
+	/* Buckets are contiguous and no wider than their precision. */
+	for (unsigned i=0; i<LAT_HIST_BUCKETS; ++i) {
+		uint64_t low = lat_hist_bucket_low(i);
+		_ASSERT(lat_hist_index(low) == i);
+		if (i > 0)
+			_ASSERT(lat_hist_index(low - 1) == i - 1);
+		if (i + 1 < LAT_HIST_BUCKETS) {
+			uint64_t width = lat_hist_bucket_low(i + 1) - low;
+			_ASSERT(width * LAT_HIST_SUB_BUCKETS <= low ||
+				width == 1);
+		}
+	}
+	_ASSERT(lat_hist_index(~0ULL) == LAT_HIST_BUCKETS - 1);
+	_ASSERT(lat_hist_index(1ULL << LAT_HIST_MAX_BITS) ==
+		LAT_HIST_BUCKETS - 1);
+
+	/* Percentiles of 1..100000 are within the bucket precision. */
+	memset(&h, 0, sizeof(h));
+	_ASSERT(lat_hist_percentile(&h, 50) == 0);
+	for (v=1; v<=100000; ++v)
+		lat_hist_record(&h, v);
+	_ASSERT(h.count == 100000 && h.max == 100000);
+	for (unsigned pct=1; pct<=100; ++pct) {
+		uint64_t exact = pct * 1000;
+		p = lat_hist_percentile(&h, pct);
+		_ASSERT(p >= exact);
+		_ASSERT(p - exact <= exact / LAT_HIST_SUB_BUCKETS);
+	}
+	_ASSERT(lat_hist_percentile(&h, 100) == 100000);
+
+	/* The multi-writer variant keeps the same books. */
+	lat_hist_record_mt(&h, 200000);
+	_ASSERT(h.count == 100001 && h.max == 200000);
+	_ASSERT(lat_hist_percentile(&h, 100) == 200000);
+
+	printf("lat_hist: %u buckets, all tests passed\n", LAT_HIST_BUCKETS);
+
+	return 0;
+}
+#endif /* LAT_HIST_UNITTEST */
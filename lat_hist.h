@@ -0,0 +1,108 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LAT_HIST_H
+#define _LAT_HIST_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram, in the manner of HdrHistogram: values below
+ * 2^LAT_HIST_SUB_BITS get a bucket each, and every further power of two is
+ * split into 2^LAT_HIST_SUB_BITS buckets, so that a bucket is never wider
+ * than 1/2^LAT_HIST_SUB_BITS of the values it holds.
+ */
+#define LAT_HIST_SUB_BITS 3
+#define LAT_HIST_SUB_BUCKETS (1U << LAT_HIST_SUB_BITS)
+/** Values of 2^LAT_HIST_MAX_BITS and above share the last bucket. */
+#define LAT_HIST_MAX_BITS 32
+#define LAT_HIST_BUCKETS \
+	((LAT_HIST_MAX_BITS - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS)
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[LAT_HIST_BUCKETS];
+};
+
+/** Bucket of value @a v. */
+static inline unsigned lat_hist_index(uint64_t v)
+{
+	unsigned msb, shift;
+
+	if (v < LAT_HIST_SUB_BUCKETS)
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	if (msb >= LAT_HIST_MAX_BITS)
+		return LAT_HIST_BUCKETS - 1;
+	shift = msb - LAT_HIST_SUB_BITS;
+
+	return ((shift + 1) << LAT_HIST_SUB_BITS) +
+		((v >> shift) & (LAT_HIST_SUB_BUCKETS - 1));
+}
+
+/** Add value @a v to @a h, which must have a single writer. */
+static inline void lat_hist_record(struct lat_hist *h, uint64_t v)
+{
+	++h->buckets[lat_hist_index(v)];
+	++h->count;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+/** Add value @a v to @a h, which may be written by several threads. */
+static inline void lat_hist_record_mt(struct lat_hist *h, uint64_t v)
+{
+	uint64_t max = h->max;
+
+	__sync_fetch_and_add(&h->buckets[lat_hist_index(v)], 1);
+	__sync_fetch_and_add(&h->count, 1);
+	__sync_fetch_and_add(&h->sum, v);
+	while (v > max && !__sync_bool_compare_and_swap(&h->max, max, v))
+		max = h->max;
+}
+
+/** Smallest value of bucket @a i. */
+uint64_t lat_hist_bucket_low(unsigned i);
+
+/**
+ * @brief Estimate a percentile of the values in @a h.
+ * @param pct Percentile, between 0 and 100.
+ * @return Highest value of the bucket holding the percentile, capped at the
+ *	   largest value recorded, or 0 if @a h is empty.
+ */
+uint64_t lat_hist_percentile(const struct lat_hist *h, double pct);
+
+#endif /* _LAT_HIST_H */
@@ -0,0 +1,223 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+static const struct {
+	const char *name;
+	uint64_t config; /* Of type PERF_TYPE_HARDWARE. */
+} counters[PERF_NB_COUNTERS] = {
+	[PERF_CNT_INSTRUCTIONS] = {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+	[PERF_CNT_CYCLES] = {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+	/* The generic cache miss event counts last level cache misses on the
+	 * usual PMUs, and is more widely available than the cache events. */
+	[PERF_CNT_LLC_MISSES] = {"llc_misses", PERF_COUNT_HW_CACHE_MISSES},
+	[PERF_CNT_BRANCH_MISSES] = {"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/* Opening order, the group leader first. */
+static const enum perf_counter open_order[PERF_NB_COUNTERS] = {
+	PERF_CNT_CYCLES, PERF_CNT_INSTRUCTIONS, PERF_CNT_LLC_MISSES,
+	PERF_CNT_BRANCH_MISSES,
+};
+
+const char *perf_counter_name(enum perf_counter c)
+{
+	return c < PERF_NB_COUNTERS ? counters[c].name : "unknown";
+}
+
+/* Open counter @a c of the calling thread in group @a group_fd, or as a
+ * disabled group leader if -1. */
+static int perf_open(enum perf_counter c, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = counters[c].config;
+	attr.disabled = group_fd == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+		PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd,
+		PERF_FLAG_FD_CLOEXEC);
+}
+
+int perf_group_open(struct perf_group *g)
+{
+	unsigned i;
+
+	memset(g, 0, sizeof(*g));
+	for (i=0; i<PERF_NB_COUNTERS; ++i) {
+		enum perf_counter c = open_order[i];
+		int fd = perf_open(c, g->nb ? g->fd[0] : -1);
+
+		if (fd < 0) {
+			if (!g->nb)
+				return -errno;
+			/* Not provided by this PMU. */
+			continue;
+		}
+		g->fd[g->nb] = fd;
+		g->counter[g->nb] = c;
+		g->mask |= 1U << c;
+		++g->nb;
+	}
+
+	if (ioctl(g->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP)) {
+		int err = -errno;
+
+		perf_group_close(g);
+		return err;
+	}
+
+	return g->nb;
+}
+
+int perf_group_read(const struct perf_group *g,
+		uint64_t v[PERF_NB_COUNTERS], bool scale)
+{
+	/* PERF_FORMAT_GROUP layout with both times. */
+	struct {
+		uint64_t nr;
+		uint64_t time_enabled;
+		uint64_t time_running;
+		uint64_t values[PERF_NB_COUNTERS];
+	} buf;
+	ssize_t len;
+	unsigned i;
+
+	memset(v, 0, sizeof(uint64_t) * PERF_NB_COUNTERS);
+	if (!g->nb)
+		return -EBADF;
+	len = read(g->fd[0], &buf, sizeof(buf));
+	if (len < 0)
+		return -errno;
+	if (len < (ssize_t)(3 + g->nb) * 8 || buf.nr != g->nb)
+		return -EIO;
+
+	for (i=0; i<g->nb; ++i) {
+		uint64_t value = buf.values[i];
+
+		if (scale && buf.time_running &&
+				buf.time_running < buf.time_enabled)
+			value = (double)value * buf.time_enabled /
+				buf.time_running;
+		v[g->counter[i]] = value;
+	}
+
+	return 0;
+}
+
+void perf_group_close(struct perf_group *g)
+{
+	unsigned i;
+
+	/* Members first, the leader last. */
+	for (i=g->nb; i>0; --i)
+		close(g->fd[i-1]);
+	g->nb = 0;
+	g->mask = 0;
+}
+
+/*
+ * Unit test, can be compiled as follows:
+ * gcc -O2 perf_counters.c -DPERF_COUNTERS_UNITTEST -o perf_counters
+ * It passes without counting when the PMU is not accessible.
+ */
+#ifdef PERF_COUNTERS_UNITTEST
+#include <stdio.h>
+#include <stdlib.h>
+
+#define _ASSERT(x) if (!!(x)==0) { fprintf(stderr, "Assertion '"#x"' on line %u failed!\n", __LINE__); abort(); }
+
+#define TEST_LOOPS 10000000
+
+int main(void)
+{
+	struct perf_group g;
+	uint64_t before[PERF_NB_COUNTERS], after[PERF_NB_COUNTERS];
+	volatile uint32_t x = 1;
+	unsigned i;
+	int n;
+
+	n = perf_group_open(&g);
+	if (n < 0) {
+		printf("perf_counters: no counters (%s), nothing tested\n",
+			strerror(-n));
+		_ASSERT(perf_group_read(&g, before, false) == -EBADF);
+		return 0;
+	}
+	_ASSERT(n > 0 && (g.mask & (1U << PERF_CNT_CYCLES)));
+
+	_ASSERT(perf_group_read(&g, before, false) == 0);
+	for (i=0; i<TEST_LOOPS; ++i) {
+		/* Data dependent branches, for some mispredictions. */
+		x = x * 1103515245 + 12345;
+		if (x & 0x10000)
+			x ^= i;
+	}
+	_ASSERT(perf_group_read(&g, after, false) == 0);
+
+	for (i=0; i<PERF_NB_COUNTERS; ++i) {
+		if (!(g.mask & (1U << i))) {
+			printf("perf_counters: %s not available\n",
+				perf_counter_name(i));
+			_ASSERT(before[i] == 0 && after[i] == 0);
+			continue;
+		}
+		_ASSERT(after[i] >= before[i]);
+		printf("perf_counters: %s %llu\n", perf_counter_name(i),
+			(unsigned long long)(after[i] - before[i]));
+	}
+	if (g.mask & (1U << PERF_CNT_INSTRUCTIONS))
+		_ASSERT(after[PERF_CNT_INSTRUCTIONS] -
+			before[PERF_CNT_INSTRUCTIONS] >= TEST_LOOPS);
+
+	perf_group_close(&g);
+	_ASSERT(g.nb == 0 && g.mask == 0);
+	printf("perf_counters: %d counters, all tests passed\n", n);
+
+	return 0;
+}
+#endif /* PERF_COUNTERS_UNITTEST */
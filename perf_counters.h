@@ -0,0 +1,92 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _PERF_COUNTERS_H
+#define _PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Hardware performance counters of a thread, through perf_event_open(2). The
+ * counters are opened as a single group, so that the PMU schedules them
+ * together and their ratios stay meaningful when it has to multiplex. Only
+ * user mode is counted, which perf_event_paranoid allows up to level 2.
+ */
+enum perf_counter {
+	PERF_CNT_INSTRUCTIONS,
+	PERF_CNT_CYCLES,
+	PERF_CNT_LLC_MISSES,
+	PERF_CNT_BRANCH_MISSES,
+	PERF_NB_COUNTERS
+};
+
+struct perf_group {
+	unsigned nb; /* Counters open, 0 if none. */
+	int fd[PERF_NB_COUNTERS]; /* In group order, the leader first. */
+	uint8_t counter[PERF_NB_COUNTERS]; /* enum perf_counter of each fd. */
+	unsigned mask; /* 1 << enum perf_counter of the counters open. */
+};
+
+/** Name of counter @a c, for logs. */
+const char *perf_counter_name(enum perf_counter c);
+
+/**
+ * @brief Open and enable the counters of the calling thread.
+ *
+ * Counters the PMU does not provide are left out. Cycles lead the group: the
+ * group cannot be opened without them.
+ *
+ * @return Number of counters open, or negative errno if none could be, e.g.
+ * -EACCES if perf_event_paranoid forbids it or -ENOENT without a PMU.
+ */
+int perf_group_open(struct perf_group *g);
+
+/**
+ * @brief Read the counters of @a g.
+ *
+ * Any thread may read the group, not only the one counting.
+ *
+ * @param v Receives the count of each counter, 0 for those not open.
+ * @param scale Extrapolate the counts to the time the group was enabled,
+ * if it was multiplexed with other groups. Leave unset to compare reads.
+ * @return 0 on success, negative errno otherwise.
+ */
+int perf_group_read(const struct perf_group *g,
+		uint64_t v[PERF_NB_COUNTERS], bool scale);
+
+/** @brief Close the counters of @a g. */
+void perf_group_close(struct perf_group *g);
+
+#endif /* _PERF_COUNTERS_H */
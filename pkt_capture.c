@@ -0,0 +1,465 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pkt_capture.h"
+
+#define __MODULE__ "pkt_capture"
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <bsd/string.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_pause.h>
+#include <rte_ring.h>
+#include <rte_version.h>
+
+/* rte_pcapng, and rte_pktmbuf_free_bulk(), appeared in DPDK 21.11. */
+#if RTE_VERSION_NUM(21, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+#define PKT_CAPTURE_SUPPORTED
+#include <rte_pcapng.h>
+/* Filters are compiled by libpcap, and converted to eBPF by rte_bpf, which
+ * only offers the conversion when DPDK itself was built with libpcap. */
+#if defined(HAVE_LIBPCAP) && defined(RTE_PORT_PCAP)
+#define PKT_CAPTURE_FILTER
+#include <pcap/pcap.h>
+#include <rte_bpf.h>
+#endif
+#endif
+
+/* Capture mbufs waiting for the writer, and in the workers' caches. */
+#define CAPTURE_RING_SIZE 4096
+#define CAPTURE_POOL_SIZE (2 * CAPTURE_RING_SIZE - 1)
+#define CAPTURE_POOL_CACHE 64
+/* Data room of capture mbufs: longer packets take chained mbufs. */
+#define CAPTURE_MBUF_DATA 2048
+#define CAPTURE_WRITE_BURST 64
+#define CAPTURE_IDLE_US 1000
+
+static struct {
+	pthread_t thread;
+	volatile bool running; /* The writer thread runs. */
+	pthread_mutex_t lock; /* Serializes start and stop. */
+	/* Set while the workers may capture. A worker announces itself in
+	 * users before looking at it, so that stop can wait for the workers
+	 * to let go of the session. */
+	volatile bool active;
+	volatile unsigned users;
+	unsigned relay_id;
+	dpdk_port_t port; /* pcapng interface: the VF of the relay. */
+	int queue;
+	uint32_t snaplen;
+	uint64_t captured;
+	uint64_t dropped;
+	int fd;
+	char dir[128]; /* Capture files are created in here, blank to refuse. */
+#ifdef PKT_CAPTURE_SUPPORTED
+	rte_pcapng_t *pcapng;
+	struct rte_mempool *pool;
+	struct rte_ring *ring;
+#endif
+#ifdef PKT_CAPTURE_FILTER
+	struct rte_bpf *filter;
+#endif
+} cap = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.fd = -1,
+};
+
+#ifdef PKT_CAPTURE_SUPPORTED
+
+void pkt_capture_burst(enum relay_dir dir, unsigned queue,
+		struct rte_mbuf **pkts, unsigned n)
+{
+	struct rte_mbuf *copies[BURST_LEN];
+	unsigned i, nb = 0, queued, lost = 0;
+#ifdef PKT_CAPTURE_FILTER
+	uint64_t match[BURST_LEN];
+#endif
+
+	__atomic_fetch_add(&cap.users, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&cap.active, __ATOMIC_SEQ_CST))
+		goto out;
+	if (dir == RELAY_VM2VF && cap.queue >= 0 &&
+			queue != (unsigned)cap.queue)
+		goto out;
+
+	if (n > BURST_LEN)
+		n = BURST_LEN;
+#ifdef PKT_CAPTURE_FILTER
+	if (cap.filter)
+		rte_bpf_exec_burst(cap.filter, (void **)pkts, match, n);
+#endif
+	for (i=0; i<n; ++i) {
+#ifdef PKT_CAPTURE_FILTER
+		if (cap.filter && !match[i])
+			continue;
+#endif
+		copies[nb] = rte_pcapng_copy(cap.port, queue, pkts[i],
+				cap.pool, cap.snaplen,
+#if RTE_VERSION_NUM(23, 11, 0, 0) > RTE_VERSION
+				rte_get_tsc_cycles(),
+#endif
+				dir == RELAY_VM2VF ?
+					RTE_PCAPNG_DIRECTION_OUT :
+					RTE_PCAPNG_DIRECTION_IN
+#if RTE_VERSION_NUM(23, 11, 0, 0) <= RTE_VERSION
+				, NULL
+#endif
+				);
+		if (copies[nb])
+			++nb;
+		else
+			++lost;
+	}
+
+	queued = rte_ring_mp_enqueue_burst(cap.ring, (void **)copies, nb,
+					NULL);
+	if (queued < nb) {
+		rte_pktmbuf_free_bulk(copies + queued, nb - queued);
+		lost += nb - queued;
+	}
+	if (lost)
+		__atomic_fetch_add(&cap.dropped, lost, __ATOMIC_RELAXED);
+out:
+	__atomic_fetch_sub(&cap.users, 1, __ATOMIC_RELEASE);
+}
+
+/* Write the captured packets in the ring to the file. */
+static unsigned capture_write(void)
+{
+	struct rte_mbuf *pkts[CAPTURE_WRITE_BURST];
+	unsigned n;
+
+	n = rte_ring_sc_dequeue_burst(cap.ring, (void **)pkts,
+				CAPTURE_WRITE_BURST, NULL);
+	if (!n)
+		return 0;
+	if (rte_pcapng_write_packets(cap.pcapng, pkts, n) < 0) {
+		__atomic_fetch_add(&cap.dropped, n, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_add(&cap.captured, n, __ATOMIC_RELAXED);
+	}
+	rte_pktmbuf_free_bulk(pkts, n);
+
+	return n;
+}
+
+static void *capture_thread(void *arg __attribute__((unused)))
+{
+	log_debug("Capture thread started");
+	while (cap.running) {
+		if (!capture_write())
+			usleep(CAPTURE_IDLE_US);
+	}
+	/* The workers have let go: flush what they left. */
+	while (capture_write())
+		;
+	log_debug("Capture thread ended");
+
+	return NULL;
+}
+
+#ifdef PKT_CAPTURE_FILTER
+static int capture_compile(const char *expr)
+{
+	struct bpf_program prog;
+	struct rte_bpf_prm *prm;
+	pcap_t *pcap;
+
+	pcap = pcap_open_dead(DLT_EN10MB, cap.snaplen);
+	if (!pcap)
+		return -ENOMEM;
+	if (pcap_compile(pcap, &prog, expr, 1, PCAP_NETMASK_UNKNOWN)) {
+		log_error("Invalid capture filter '%s': %s", expr,
+			pcap_geterr(pcap));
+		pcap_close(pcap);
+		return -EINVAL;
+	}
+	prm = rte_bpf_convert(&prog);
+	pcap_freecode(&prog);
+	pcap_close(pcap);
+	if (!prm) {
+		log_error("Could not convert capture filter '%s': %s", expr,
+			rte_strerror(rte_errno));
+		return -EINVAL;
+	}
+	cap.filter = rte_bpf_load(prm);
+	rte_free(prm);
+	if (!cap.filter) {
+		log_error("Could not load capture filter '%s': %s", expr,
+			rte_strerror(rte_errno));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+#endif
+
+/* Release the resources of a session. The workers must have let go. */
+static void capture_free(void)
+{
+	if (cap.pcapng)
+		rte_pcapng_close(cap.pcapng);
+	else if (cap.fd >= 0)
+		close(cap.fd);
+	cap.pcapng = NULL;
+	cap.fd = -1;
+	rte_ring_free(cap.ring);
+	cap.ring = NULL;
+	rte_mempool_free(cap.pool);
+	cap.pool = NULL;
+#ifdef PKT_CAPTURE_FILTER
+	if (cap.filter)
+		rte_bpf_destroy(cap.filter);
+	cap.filter = NULL;
+#endif
+}
+
+static int capture_setup(const struct pkt_capture_conf *conf,
+			const vio_vf_relay_t *relay)
+{
+	char comment[64];
+	int dirfd;
+	int ret;
+
+	cap.relay_id = conf->relay_id;
+	cap.port = relay->dpdk.dpdk_port;
+	cap.queue = conf->queue;
+	cap.snaplen = conf->snaplen ? conf->snaplen :
+				PKT_CAPTURE_SNAPLEN_DEFAULT;
+	cap.captured = 0;
+	cap.dropped = 0;
+
+	if (conf->filter && *conf->filter) {
+#ifdef PKT_CAPTURE_FILTER
+		ret = capture_compile(conf->filter);
+		if (ret)
+			return ret;
+#else
+		log_error("Capture filters are not supported by this build");
+		return -ENOTSUP;
+#endif
+	}
+
+	cap.pool = rte_pktmbuf_pool_create("vio4wd_capture",
+			CAPTURE_POOL_SIZE, CAPTURE_POOL_CACHE, 0,
+			rte_pcapng_mbuf_size(RTE_MIN(cap.snaplen,
+						CAPTURE_MBUF_DATA)),
+			SOCKET_ID_ANY);
+	cap.ring = rte_ring_create("vio4wd_capture", CAPTURE_RING_SIZE,
+			SOCKET_ID_ANY, RING_F_SC_DEQ);
+	if (!cap.pool || !cap.ring) {
+		log_error("Could not allocate capture buffers: %s",
+			rte_strerror(rte_errno));
+		return -ENOMEM;
+	}
+
+	/* The daemon runs as root on behalf of the ZMQ client: only create
+	 * new files, in the capture directory, without following links. */
+	dirfd = open(cap.dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		ret = -errno;
+		log_error("Could not open capture directory '%s': %s", cap.dir,
+			strerror(errno));
+		return ret;
+	}
+	cap.fd = openat(dirfd, conf->path,
+			O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+			0640);
+	ret = -errno;
+	close(dirfd);
+	if (cap.fd < 0) {
+		log_error("Could not create capture file '%s' in '%s': %s",
+			conf->path, cap.dir, strerror(-ret));
+		return ret;
+	}
+	snprintf(comment, sizeof(comment), "virtio-forwarder relay %u",
+		conf->relay_id);
+	cap.pcapng = rte_pcapng_fdopen(cap.fd, NULL, NULL, "virtio-forwarder",
+				comment);
+	if (!cap.pcapng) {
+		log_error("Could not start pcapng file '%s': %s", conf->path,
+			rte_strerror(rte_errno));
+		return -EIO;
+	}
+#if RTE_VERSION_NUM(23, 3, 0, 0) <= RTE_VERSION
+	if (rte_pcapng_add_interface(cap.pcapng, cap.port, NULL, comment,
+				conf->filter) < 0) {
+		log_error("Could not describe relay %u in '%s'",
+			conf->relay_id, conf->path);
+		return -EIO;
+	}
+#endif
+
+	return 0;
+}
+
+int pkt_capture_start(const struct pkt_capture_conf *conf)
+{
+	vio_vf_relay_t *relay = get_relay_from_id(conf->relay_id);
+	int ret;
+
+	if (!relay)
+		return -EINVAL;
+	if (!(conf->dirs & ((1 << RELAY_NB_DIRS) - 1)) || !conf->path ||
+			!*conf->path)
+		return -EINVAL;
+	if (!*cap.dir) {
+		log_error("Captures are disabled: no capture directory is configured");
+		return -EPERM;
+	}
+	if (strchr(conf->path, '/') || !strcmp(conf->path, ".") ||
+			!strcmp(conf->path, "..")) {
+		log_error("Capture file '%s' is not a plain file name",
+			conf->path);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&cap.lock);
+	if (cap.running) {
+		log_error("A capture is already running on relay %u",
+			cap.relay_id);
+		ret = -EBUSY;
+		goto out;
+	}
+	if (relay->dpdk.state != DPDK_READY) {
+		log_error("Cannot capture on relay %u: no VF is ready",
+			conf->relay_id);
+		ret = -ENODEV;
+		goto out;
+	}
+	ret = capture_setup(conf, relay);
+	if (ret)
+		goto fail;
+
+	cap.running = true;
+	if (pthread_create(&cap.thread, NULL, capture_thread, NULL)) {
+		log_error("Could not create capture thread!");
+		cap.running = false;
+		ret = -EAGAIN;
+		goto fail;
+	}
+	__atomic_store_n(&cap.active, true, __ATOMIC_SEQ_CST);
+	relay->capture = conf->dirs;
+	log_info("Capturing relay %u to '%s/%s' (directions 0x%x, queue %d, snap length %u%s%s)",
+		conf->relay_id, cap.dir, conf->path, conf->dirs, conf->queue,
+		cap.snaplen, conf->filter ? ", filter " : "",
+		conf->filter ? conf->filter : "");
+	goto out;
+
+fail:
+	capture_free();
+out:
+	pthread_mutex_unlock(&cap.lock);
+
+	return ret;
+}
+
+int pkt_capture_stop(unsigned relay_id, struct pkt_capture_stats *stats)
+{
+	pthread_mutex_lock(&cap.lock);
+	if (!cap.running || cap.relay_id != relay_id) {
+		pthread_mutex_unlock(&cap.lock);
+		return -ENOENT;
+	}
+
+	/* Stop the workers first, then let the writer flush the ring. */
+	get_relay_from_id(relay_id)->capture = 0;
+	__atomic_store_n(&cap.active, false, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&cap.users, __ATOMIC_SEQ_CST))
+		rte_pause();
+	cap.running = false;
+	pthread_join(cap.thread, NULL);
+	capture_free();
+
+	log_info("Stopped capturing relay %u: %"PRIu64" packets captured, %"PRIu64" dropped",
+		relay_id, cap.captured, cap.dropped);
+	if (stats) {
+		stats->captured = cap.captured;
+		stats->dropped = cap.dropped;
+	}
+	pthread_mutex_unlock(&cap.lock);
+
+	return 0;
+}
+
+#else
+
+void pkt_capture_burst(enum relay_dir dir __attribute__((unused)),
+		unsigned queue __attribute__((unused)),
+		struct rte_mbuf **pkts __attribute__((unused)),
+		unsigned n __attribute__((unused)))
+{
+}
+
+int pkt_capture_start(const struct pkt_capture_conf *conf
+			__attribute__((unused)))
+{
+	log_error("Packet capture requires DPDK 21.11 or newer");
+	return -ENOTSUP;
+}
+
+int pkt_capture_stop(unsigned relay_id __attribute__((unused)),
+		struct pkt_capture_stats *stats __attribute__((unused)))
+{
+	return -ENOENT;
+}
+
+#endif
+
+int pkt_capture_init(const char *dir)
+{
+	if (!dir)
+		dir = "";
+	if (strlcpy(cap.dir, dir, sizeof(cap.dir)) >= sizeof(cap.dir)) {
+		cap.dir[0] = '\0';
+		return -ENAMETOOLONG;
+	}
+
+	return 0;
+}
+
+void pkt_capture_stop_all(void)
+{
+	if (cap.running)
+		pkt_capture_stop(cap.relay_id, NULL);
+}
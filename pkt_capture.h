@@ -0,0 +1,108 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _PKT_CAPTURE_H
+#define _PKT_CAPTURE_H
+
+#include <stdint.h>
+#include "virtio_worker.h"
+
+/** Default snap length: whole packets. */
+#define PKT_CAPTURE_SNAPLEN_DEFAULT 65535
+
+/** Parameters of a capture session. */
+struct pkt_capture_conf {
+	unsigned relay_id;
+	uint8_t dirs; /* Directions to capture, as a mask of 1 << enum relay_dir. */
+	int queue; /* Guest virtqueue pair to capture VM to VF packets of, or -1. */
+	uint32_t snaplen; /* Bytes kept of each packet, 0 for the default. */
+	const char *filter; /* pcap-filter(7) expression, or NULL. */
+	const char *path; /* pcapng file to create in the capture directory. */
+};
+
+/** Counters of a capture session. */
+struct pkt_capture_stats {
+	uint64_t captured; /* Written to the file. */
+	uint64_t dropped; /* Matched, but lost for lack of mbufs or ring space. */
+};
+
+/**
+ * @brief Start capturing the packets received by a relay into a pcapng file.
+ *
+ * The workers copy matching packets into a private mempool and hand them over
+ * through a ring to a writer thread; when the ring or the mempool runs out,
+ * packets are counted as dropped from the capture, never from the relay. Only
+ * one session may run at a time.
+ *
+ * The file is created in the capture directory and must not exist yet: the
+ * path requested by the client is a plain file name, so that it cannot
+ * overwrite or follow links to files elsewhere on the host.
+ *
+ * @return 0 on success, or a negative errno: -EBUSY if a session is already
+ * running, -ENODEV if the relay has no ready VF, -ENOTSUP if this build cannot
+ * capture or compile filters, -EPERM if no capture directory is configured,
+ * -EINVAL if the path is not a plain file name, -EEXIST if the file exists.
+ */
+int pkt_capture_start(const struct pkt_capture_conf *conf);
+
+/**
+ * @brief Stop the capture session on relay @a relay_id, flushing the file.
+ * @param stats If not NULL, receives the counters of the session.
+ * @return 0 on success, -ENOENT if no session runs on that relay.
+ */
+int pkt_capture_stop(unsigned relay_id, struct pkt_capture_stats *stats);
+
+/**
+ * @brief Set the directory capture files are created in.
+ * @param dir Directory path, or NULL or blank to refuse all captures.
+ * @return 0 on success, -ENAMETOOLONG if the path does not fit.
+ */
+int pkt_capture_init(const char *dir);
+
+/** @brief Stop any capture session, at shutdown. */
+void pkt_capture_stop_all(void);
+
+/**
+ * @brief Capture a burst of packets just received by a relay direction.
+ *
+ * Only called by the workers for directions whose bit is set in the relay's
+ * capture mask.
+ *
+ * @param queue The guest virtqueue pair VM to VF packets came from, 0 for VF
+ * to VM packets, which are captured before they are steered.
+ */
+void pkt_capture_burst(enum relay_dir dir, unsigned queue,
+		struct rte_mbuf **pkts, unsigned n);
+
+#endif /* _PKT_CAPTURE_H */
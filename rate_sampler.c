@@ -0,0 +1,144 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rate_sampler.h"
+
+#define __MODULE__ "rate_sampler"
+#include "log.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <rte_cycles.h>
+
+static const unsigned rate_windows_s[RATE_NB_WINDOWS] = RATE_WINDOWS_S;
+
+static struct {
+	pthread_t thread;
+	volatile bool running;
+	uint64_t prev_tsc;
+	uint64_t prev[MAX_RELAYS][RELAY_NB_COUNTERS];
+	pthread_mutex_t lock; /* Protects the averages. */
+	float rates[MAX_RELAYS][RATE_NB_WINDOWS][RELAY_NB_COUNTERS];
+} rs = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Fold the counters of every relay since the previous sample into the
+ * averages. The weight of a sample is that of a first order low-pass filter
+ * with the window as time constant, so that irregular sampling intervals are
+ * accounted for. The first sample only records the counters.
+ */
+static void rate_sampler_round(void)
+{
+	uint64_t now = rte_rdtsc();
+	double elapsed = (double)(now - rs.prev_tsc) / rte_get_tsc_hz();
+	bool first = (rs.prev_tsc == 0);
+	double alpha[RATE_NB_WINDOWS];
+
+	for (unsigned w=0; w<RATE_NB_WINDOWS; ++w)
+		alpha[w] = first ? 0 : elapsed / (rate_windows_s[w] + elapsed);
+
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		uint64_t cur[RELAY_NB_COUNTERS];
+		double rate[RELAY_NB_COUNTERS];
+
+		virtio_forwarder_get_counters(id, cur);
+		for (unsigned c=0; c<RELAY_NB_COUNTERS; ++c) {
+			rate[c] = (first || cur[c] < rs.prev[id][c]) ? 0 :
+				(cur[c] - rs.prev[id][c]) / elapsed;
+			rs.prev[id][c] = cur[c];
+		}
+
+		pthread_mutex_lock(&rs.lock);
+		for (unsigned w=0; w<RATE_NB_WINDOWS; ++w) {
+			float *avg = rs.rates[id][w];
+
+			for (unsigned c=0; c<RELAY_NB_COUNTERS; ++c)
+				avg[c] += alpha[w] * (rate[c] - avg[c]);
+		}
+		pthread_mutex_unlock(&rs.lock);
+	}
+	rs.prev_tsc = now;
+}
+
+static void *rate_sampler_thread(void *arg __attribute__((unused)))
+{
+	log_debug("Rate sampler thread started");
+	while (rs.running) {
+		rate_sampler_round();
+		usleep(RATE_SAMPLE_MS * 1000);
+	}
+	log_debug("Rate sampler thread ended");
+
+	return NULL;
+}
+
+int rate_sampler_start(void)
+{
+	rs.running = true;
+	if (pthread_create(&rs.thread, NULL, rate_sampler_thread, NULL)) {
+		log_error("Could not create rate sampler thread!");
+		rs.running = false;
+		return -1;
+	}
+
+	return 0;
+}
+
+void rate_sampler_stop(void)
+{
+	if (!rs.running)
+		return;
+
+	rs.running = false;
+	pthread_join(rs.thread, NULL);
+}
+
+unsigned rate_sampler_window_s(unsigned w)
+{
+	return w < RATE_NB_WINDOWS ? rate_windows_s[w] : 0;
+}
+
+void rate_sampler_get(unsigned relay_id,
+		float rates[RATE_NB_WINDOWS][RELAY_NB_COUNTERS])
+{
+	if (relay_id >= MAX_RELAYS) {
+		memset(rates, 0, sizeof(rs.rates[0]));
+		return;
+	}
+
+	pthread_mutex_lock(&rs.lock);
+	memcpy(rates, rs.rates[relay_id], sizeof(rs.rates[relay_id]));
+	pthread_mutex_unlock(&rs.lock);
+}
@@ -0,0 +1,74 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RATE_SAMPLER_H
+#define _RATE_SAMPLER_H
+
+#include "virtio_worker.h"
+
+/** Time between two samples of the relay counters. */
+#define RATE_SAMPLE_MS 250
+
+/** Time windows the rates are averaged over, in seconds. */
+#define RATE_WINDOWS_S {1, 10, 60}
+#define RATE_NB_WINDOWS 3
+
+/**
+ * @brief Start the rate sampler thread.
+ *
+ * The thread samples the traffic counters of every relay at fixed intervals,
+ * and keeps exponentially weighted moving averages of their rates over each
+ * window.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int rate_sampler_start(void);
+
+/** @brief Stop the rate sampler thread. */
+void rate_sampler_stop(void);
+
+/** @brief Get the length of window @a w, in seconds. */
+unsigned rate_sampler_window_s(unsigned w);
+
+/**
+ * @brief Get the rates of relay @a relay_id.
+ *
+ * Any number of readers may call this at any time; it neither resets nor
+ * waits for anything.
+ *
+ * @param rates Receives the rate of each counter, per second, for each window.
+ */
+void rate_sampler_get(unsigned relay_id,
+		float rates[RATE_NB_WINDOWS][RELAY_NB_COUNTERS]);
+
+#endif /* _RATE_SAMPLER_H */
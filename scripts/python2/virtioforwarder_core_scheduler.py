@@ -70,6 +70,20 @@ def _syntax():
         '--global-numa-opt', action='store_true',
         help='Do not condider NUMA affinities when optimizing'
     )
+    parser.add_argument(
+        '--native', choices=['on', 'off', 'status'],
+        help=("query or switch the core scheduler built into the daemon,"
+            " then exit")
+    )
+    parser.add_argument(
+        '--native-interval-ms', type=int,
+        help='set the rebalancing interval of the native core scheduler'
+    )
+    parser.add_argument(
+        '--native-sensitivity', type=int,
+        help=("set the minimum relief, in percent of a CPU, of the busiest"
+            " worker for the native core scheduler to migrate")
+    )
 
     return parser
 # ]
@@ -282,9 +296,41 @@ def sig_handler(signum, frame):
     must_run = False
 
 # [ main
+def configure_native(args):
+    # Query, and optionally change, the core scheduler built into the daemon.
+    sched_ep = args.sched_ep if args.sched_ep else "ipc:///var/run/virtio-forwarder/core_sched"
+    sched_sock = open_socket(sched_ep)
+    sched_request = relay_pb2.CoreSchedRequest(op=relay_pb2.CoreSchedRequest.CONFIGURE)
+    if args.native != 'status':
+        sched_request.native_enable = (args.native == 'on')
+    if args.native_interval_ms is not None:
+        sched_request.native_interval_ms = args.native_interval_ms
+    if args.native_sensitivity is not None:
+        sched_request.native_sensitivity = args.native_sensitivity
+    sched_response = relay_pb2.CoreSchedResponse()
+    try:
+        sched_sock.send(sched_request.SerializePartialToString())
+        sched_response.ParseFromString(sched_sock.recv())
+    except zmq.Again:
+        sys.stderr.write("No response from core scheduler server on %s\n" % sched_ep)
+        return 1
+    finally:
+        stop_socket(sched_sock)
+    if sched_response.status != relay_pb2.CoreSchedResponse.OK:
+        sys.stderr.write("Invalid native core scheduler configuration\n")
+        return 1
+    print("native.enabled=%d" % sched_response.native_enabled)
+    print("native.interval_ms=%d" % sched_response.native_interval_ms)
+    print("native.sensitivity=%d" % sched_response.native_sensitivity)
+    print("native.rounds=%d" % sched_response.native_rounds)
+    print("native.migrations=%d" % sched_response.native_migrations)
+    return 0
+
 def main():
     global must_run
     args = _syntax().parse_args()
+    if args.native:
+        return configure_native(args)
 
     # Define signal handler
     signal.signal(signal.SIGTERM, sig_handler)
@@ -458,4 +504,4 @@ def main():
 # ] End main().
 
 if __name__ == '__main__':
-    main()
+    sys.exit(main())
@@ -0,0 +1,202 @@
+#!/usr/bin/python2
+#   BSD LICENSE
+#
+#   Copyright(c) 2016-2017 Netronome.
+#   All rights reserved.
+#
+#   Redistribution and use in source and binary forms, with or without
+#   modification, are permitted provided that the following conditions
+#   are met:
+#
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in
+#       the documentation and/or other materials provided with the
+#       distribution.
+#     * Neither the name of Netronome nor the names of its
+#       contributors may be used to endorse or promote products derived
+#       from this software without specific prior written permission.
+#
+#   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+#   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+#   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+#   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+#   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+#   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+#   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+#   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+#   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+#   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+"""Measure the forwarding throughput of a running virtio-forwarder.
+
+Run once per engine under the same offered load, e.g. once with the default
+static CPU assignment and once with --eventdev, saving each run with
+--output. Then compare the two runs with --compare.
+"""
+
+import argparse
+import json
+import os
+import sys
+import time
+import zmq
+
+try:
+    from protobuf.virtioforwarder import virtioforwarder_pb2 as relay_pb2
+except ImportError:
+    PWD = os.path.dirname(os.path.abspath(__file__))
+    sys.path.append(PWD + '/../build/protobuf/virtioforwarder')
+    import virtioforwarder_pb2 as relay_pb2
+
+# Result fields and their descriptions, in display order.
+METRICS = [
+    ('vm2vf_mpps', 'VM to VF throughput (Mpps)'),
+    ('vf2vm_mpps', 'VF to VM throughput (Mpps)'),
+    ('vm2vf_gbps', 'VM to VF throughput (Gbps)'),
+    ('vf2vm_gbps', 'VF to VM throughput (Gbps)'),
+    ('min_sample_mpps', 'Lowest sampled total rate (Mpps)'),
+    ('drop_ratio', 'Dropped / received packets'),
+    ('fairness', 'Jain fairness of relay throughput'),
+]
+
+# [ Argument parser
+def _syntax():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--stats-ep', help='ZeroMQ statistics endpoint')
+    parser.add_argument(
+        '--duration', type=float, default=30.,
+        help='measurement duration in seconds'
+    )
+    parser.add_argument(
+        '--interval', type=float, default=1.,
+        help='rate sampling interval in seconds'
+    )
+    parser.add_argument('--label', default='', help='name of this run')
+    parser.add_argument('--output', help='save the results to a JSON file')
+    parser.add_argument(
+        '--compare', nargs=2, metavar=('BASE', 'NEW'),
+        help='compare two saved runs instead of measuring'
+    )
+    return parser
+# ]
+
+def get_stats(sock):
+    request = relay_pb2.StatsRequest()
+    request.include_inactive = False
+    sock.send(request.SerializeToString())
+    response = relay_pb2.StatsResponse()
+    response.ParseFromString(sock.recv())
+    assert response.IsInitialized()
+    return response
+
+def counters(response):
+    """Per relay delivered, received and dropped packet and byte counts."""
+    c = {}
+    for r in response.relay:
+        c[r.id] = {
+            'vm2vf_pkts': r.vm_to_vf.pkts_tx_to_vf,
+            'vm2vf_bytes': r.vm_to_vf.bytes_tx_to_vf,
+            'vf2vm_pkts': r.vf_to_vm.pkts_tx_to_vm,
+            'vf2vm_bytes': r.vf_to_vm.bytes_tx_to_vm,
+            'rx_pkts': (r.vm_to_vf.pkts_rx_from_vm +
+                        r.vf_to_vm.pkts_rx_from_vf),
+            'drops': (r.vm_to_vf.pkts_dropped_vf_queue_full +
+                      r.vm_to_vf.pkts_dropped_vf_not_connected +
+                      r.vf_to_vm.pkts_dropped_vm_queue_full +
+                      r.vf_to_vm.pkts_dropped_vm_not_connected),
+        }
+    return c
+
+def measure(sock, duration, interval):
+    first = counters(get_stats(sock))
+    start = time.time()
+    samples = []
+    while time.time() - start < duration:
+        # The rates are averaged by the server over its shortest window.
+        time.sleep(interval)
+        response = get_stats(sock)
+        samples.append(sum(r.vm_to_vf.pkt_rate_tx_to_vf +
+                           r.vf_to_vm.pkt_rate_tx_to_vm
+                           for r in response.relay) * 1e-6)
+    last = counters(get_stats(sock))
+    elapsed = time.time() - start
+
+    # Relays attached or detached during the run are left out.
+    ids = [i for i in last if i in first]
+    delta = {}
+    for i in ids:
+        delta[i] = dict((k, last[i][k] - first[i][k]) for k in last[i])
+
+    def total(k):
+        return sum(d[k] for d in delta.values())
+
+    per_relay = [d['vm2vf_pkts'] + d['vf2vm_pkts'] for d in delta.values()]
+    squares = sum(x * x for x in per_relay)
+    return {
+        'relays': len(ids),
+        'duration': elapsed,
+        'vm2vf_mpps': total('vm2vf_pkts') / elapsed * 1e-6,
+        'vf2vm_mpps': total('vf2vm_pkts') / elapsed * 1e-6,
+        'vm2vf_gbps': total('vm2vf_bytes') * 8 / elapsed * 1e-9,
+        'vf2vm_gbps': total('vf2vm_bytes') * 8 / elapsed * 1e-9,
+        'min_sample_mpps': min(samples) if samples else 0.,
+        'drop_ratio': (float(total('drops')) / total('rx_pkts')
+                       if total('rx_pkts') else 0.),
+        'fairness': (float(sum(per_relay)) ** 2 / (len(per_relay) * squares)
+                     if squares else 1.),
+    }
+
+def print_results(results):
+    print('{} ({} relays, {:.1f}s)'.format(
+        results.get('label') or 'run', results['relays'],
+        results['duration']))
+    for key, desc in METRICS:
+        print('  {:<36}{:>12.4f}'.format(desc, results[key]))
+
+def compare(base_file, new_file):
+    with open(base_file) as f:
+        base = json.load(f)
+    with open(new_file) as f:
+        new = json.load(f)
+    print('{:<36}{:>12}{:>12}{:>10}'.format(
+        '', base.get('label') or 'base', new.get('label') or 'new', 'change'))
+    for key, desc in METRICS:
+        if base[key]:
+            change = '{:+.1f}%'.format((new[key] / base[key] - 1.) * 100.)
+        else:
+            change = '-'
+        print('{:<36}{:>12.4f}{:>12.4f}{:>10}'.format(
+            desc, base[key], new[key], change))
+    return 0
+
+def main():
+    args = _syntax().parse_args()
+    if args.compare:
+        return compare(*args.compare)
+
+    stats_ep = args.stats_ep if args.stats_ep else "ipc:///var/run/virtio-forwarder/stats"
+    context = zmq.Context()
+    sock = context.socket(zmq.REQ)
+    sock.setsockopt(zmq.LINGER, 0)
+    sock.setsockopt(zmq.SNDTIMEO, 0)
+    sock.setsockopt(zmq.RCVTIMEO, 2000 + int(args.interval * 1000))
+    sock.connect(stats_ep)
+
+    try:
+        results = measure(sock, args.duration, args.interval)
+    except zmq.Again:
+        sys.stderr.write('No response from the stats server at {}\n'.format(
+            stats_ep))
+        return 1
+    results['label'] = args.label
+    print_results(results)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -46,6 +46,8 @@ except ImportError:
 
 logger = logging.getLogger(os.path.split(sys.argv[0])[-1])
 
+PERF_FIELDS = ('instructions', 'cycles', 'llc_misses', 'branch_misses')
+
 
 def _syntax():
     parser = argparse.ArgumentParser()
@@ -55,8 +57,38 @@ def _syntax():
         help='include inactive relays in response',
     )
     parser.add_argument(
-        '--delay', type=int, default=200,
-        help='Delay in ms to use for calculating rate statistics.',
+        '--delay', type=int, default=0,
+        help='Ignored, rates are averaged continuously by the server.',
+    )
+    parser.add_argument(
+        '--latency-buckets', action='store_true',
+        help='include the buckets of the latency histograms',
+    )
+    parser.add_argument(
+        '--queues', action='store_true',
+        help='include per virtqueue pair counters',
+    )
+    parser.add_argument(
+        '--xstats', action='store_true',
+        help='include the extended statistics of the VFs',
+    )
+    parser.add_argument(
+        '--xstats-filter', action='append', default=[], metavar='SUBSTRING',
+        help='only include extended statistics whose name contains '
+             'SUBSTRING, may be repeated',
+    )
+    parser.add_argument(
+        '--flows', action='store_true',
+        help='include the heaviest flows of each relay direction',
+    )
+    parser.add_argument(
+        '--flight-recorder', action='store_true',
+        help='include the last events recorded by each thread',
+    )
+    parser.add_argument(
+        '--history', type=int, metavar='SECONDS',
+        help='only show the traffic history of the last SECONDS, if the '
+             'server records it (see --stats-history)',
     )
     parser.add_argument(
         '--output-format', choices=('flat', 'protobuf'), default='flat',
@@ -107,12 +139,70 @@ def _output_flat(reply, suppress_zero):
                         [relay_str] + middle + ['{}={}'.format(k, v)]
                     )
 
+        def out_latency(o):
+            if not o.HasField('latency'):
+                return
+            middle.append('latency')
+            for k in ('count', 'sum_ns', 'max_ns', 'p50_ns', 'p90_ns',
+                      'p99_ns', 'p999_ns'):
+                out(o.latency, k)
+            for b in o.latency.bucket:
+                print '.'.join([relay_str] + middle + [
+                    'bucket_{}ns={}'.format(b.low_ns, b.count)])
+            middle.pop()
+
+        def out_bursts(o):
+            for n, c in enumerate(o.rx_burst_sizes):
+                if suppress_zero and c == 0:
+                    continue
+                print '.'.join([relay_str] + middle + [
+                    'rx_bursts_{}={}'.format(n, c)])
+
+        def out_rates(o):
+            for w in o.rates:
+                middle.append('rate_{}s'.format(w.window_s))
+                for k in ('pkt_rate_rx', 'byte_rate_rx', 'pkt_rate_tx',
+                          'byte_rate_tx'):
+                    out(w, k)
+                middle.pop()
+
+        def out_flows(o):
+            for i, f in enumerate(o.flow):
+                middle.append('flow_{}'.format(i))
+                for k in ('hash', 'src', 'dst', 'proto', 'sport', 'dport',
+                          'pkt_rate', 'byte_rate'):
+                    out(f, k)
+                middle.pop()
+
+        def out_perf(o):
+            if not o.HasField('perf'):
+                return
+            middle.append('perf')
+            for k in PERF_FIELDS + ('polls', 'pkts'):
+                out(o.perf, k)
+            middle.pop()
+
+        def out_gauge(o, k):
+            if not o.HasField(k):
+                return
+            g = getattr(o, k)
+            middle.append(k)
+            out(g, 'last')
+            middle.pop()
+            print '.'.join([relay_str] + middle + [
+                '{}.mean={:.1f}'.format(k, float(g.sum) / g.samples)])
+
         out(r, 'active')
         middle = ['cpu']
         out(r.cpu, 'vf_to_vm')
         out(r.cpu, 'vm_to_vf')
         middle = ['vf']
         out(r.vf, 'pci_addr_str')
+        middle = ['vf', 'xstat']
+        for x in r.vf.xstat:
+            if not (suppress_zero and x.value == 0):
+                print '.'.join([relay_str] + middle + [
+                    '{}.{}={}'.format(x.port, x.name, x.value)])
 
         middle = ['vhost']
         out(r.vhost, 'vhost_socket_name')
@@ -138,6 +228,24 @@ def _output_flat(reply, suppress_zero):
         out(v, 'bytes_dropped_vm_queue_full')
         out(v, 'pkts_dropped_vm_not_connected')
         out(v, 'bytes_dropped_vm_not_connected')
+        out(v, 'pkts_dropped_flushed')
+        out(v, 'pkts_queue_fallback')
+        out(v, 'guest_rx_ring_empty')
+        out(v, 'pkts_vf_missed')
+        out(v, 'pkts_vf_rx_nombuf')
+        out(v, 'pkts_vf_rx_errors')
+        out(v, 'pkts_csum_good')
+        out(v, 'pkts_csum_bad')
+        out(v, 'cpu_migrations')
+        out(v, 'cpu_steals')
+        out(v, 'cycles')
+        out_perf(v)
+        out_latency(v)
+        out_bursts(v)
+        out_rates(v)
+        out_flows(v)
+        out_gauge(v, 'guest_rx_free')
+        out_gauge(v, 'vf_rx_queue_depth')
 
         middle = ['vm_to_vf']
         v = r.vm_to_vf
@@ -158,6 +266,89 @@ def _output_flat(reply, suppress_zero):
         out(v, 'bytes_dropped_vf_queue_full')
         out(v, 'pkts_dropped_vf_not_connected')
         out(v, 'bytes_dropped_vf_not_connected')
+        out(v, 'pkts_dropped_flushed')
+        out(v, 'guest_tx_nombuf')
+        out(v, 'pkts_vf_tx_errors')
+        out(v, 'pkts_csum_sw')
+        out(v, 'pkts_csum_offload')
+        out(v, 'pkts_csum_trunc')
+        out(v, 'cpu_migrations')
+        out(v, 'cpu_steals')
+        out(v, 'cycles')
+        out_perf(v)
+        out_latency(v)
+        out_bursts(v)
+        out_rates(v)
+        out_flows(v)
+
+        for q in r.queue:
+            middle = ['queue_{}'.format(q.id)]
+            for k in ('pkts_rx_from_vm', 'bytes_rx_from_vm', 'pkts_tx_to_vm',
+                      'bytes_tx_to_vm', 'pkts_dropped_tx_to_vm',
+                      'pkts_steered'):
+                out(q, k)
+
+    for n in reply.graph_node:
+        for k in ('calls', 'objs', 'cycles'):
+            v = getattr(n, k)
+            if not (suppress_zero and v == 0):
+                print 'graph.{}.{}={}'.format(n.name, k, v)
+
+    for h in reply.history.relay:
+        relay_str = 'relay_{}'.format(h.id)
+        for i, t in enumerate(h.time_s):
+            for k in ('pkts_rx_from_vm', 'pkts_tx_to_vf', 'pkts_rx_from_vf',
+                      'pkts_tx_to_vm', 'bytes_rx_from_vm', 'bytes_tx_to_vf',
+                      'bytes_rx_from_vf', 'bytes_tx_to_vm',
+                      'pkts_dropped_vm_to_vf', 'pkts_dropped_vf_to_vm'):
+                v = getattr(h, k)[i]
+                if not (suppress_zero and v == 0):
+                    print '{}.history.{}.{}={}'.format(relay_str, t, k, v)
+
+    if reply.history.truncated:
+        logging.warning('History truncated')
+
+    if reply.xstats_truncated:
+        logging.warning('Extended statistics truncated')
+
+    for w in reply.worker:
+        for k in ('relays', 'tsc_hz', 'iterations', 'busy_cycles',
+                  'idle_cycles', 'sleep_cycles', 'overhead_cycles'):
+            v = getattr(w, k)
+            if not (suppress_zero and v == 0):
+                print 'worker.{}.{}={}'.format(w.cpu, k, v)
+        for k in PERF_FIELDS:
+            if w.perf.HasField(k):
+                v = getattr(w.perf, k)
+                if not (suppress_zero and v == 0):
+                    print 'worker.{}.perf.{}={}'.format(w.cpu, k, v)
+        if w.isolation_issue:
+            print 'worker.{}.isolation_issues={}'.format(
+                w.cpu, ','.join(w.isolation_issue))
+        if not (suppress_zero and w.irqs == 0):
+            print 'worker.{}.irqs={}'.format(w.cpu, w.irqs)
+        if w.HasField('pass_gap'):
+            for k in ('count', 'max_ns', 'p50_ns', 'p90_ns', 'p99_ns',
+                      'p999_ns'):
+                print 'worker.{}.pass_gap.{}={}'.format(
+                    w.cpu, k, getattr(w.pass_gap, k))
+            print 'worker.{}.stalls={}'.format(w.cpu, w.stalls)
+            for i, st in enumerate(w.stall):
+                print 'worker.{}.stall_{}.time_ns={}'.format(
+                    w.cpu, i, st.time_ns)
+                print 'worker.{}.stall_{}.duration_ns={}'.format(
+                    w.cpu, i, st.duration_ns)
+
+    seen = {}
+    for f in reply.flight:
+        thread = 'cpu_{}'.format(f.cpu) if f.HasField('cpu') else 'other'
+        n = seen[thread] = seen.get(thread, -1) + 1
+        for k in ('age_ns', 'event', 'relay', 'state', 'direction',
+                  'from_cpu', 'to_cpu', 'stolen', 'active_relays',
+                  'pkts_held'):
+            if f.HasField(k):
+                print 'flight.{}.{}.{}={}'.format(
+                    thread, n, k, getattr(f, k))
 
 
 def _output_protobuf(reply):
@@ -180,6 +371,14 @@ def main():
     msg = relay.StatsRequest(relay=None)
     msg.include_inactive = args.include_inactive
     msg.delay = args.delay
+    msg.latency_buckets = args.latency_buckets
+    msg.queues = args.queues
+    msg.xstats = args.xstats or bool(args.xstats_filter)
+    msg.xstats_filter.extend(args.xstats_filter)
+    msg.flows = args.flows
+    msg.flight_recorder = args.flight_recorder
+    if args.history is not None:
+        msg.history.last_s = args.history
     socket.send(msg.SerializeToString())
 
     reply = relay.StatsResponse()
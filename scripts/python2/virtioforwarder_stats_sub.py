@@ -0,0 +1,161 @@
+#!/usr/bin/python2
+#   BSD LICENSE
+#
+#   Copyright(c) 2016-2017 Netronome.
+#   All rights reserved.
+#
+#   Redistribution and use in source and binary forms, with or without
+#   modification, are permitted provided that the following conditions
+#   are met:
+#
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in
+#       the documentation and/or other materials provided with the
+#       distribution.
+#     * Neither the name of Netronome nor the names of its
+#       contributors may be used to endorse or promote products derived
+#       from this software without specific prior written permission.
+#
+#   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+#   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+#   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+#   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+#   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+#   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+#   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+#   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+#   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+#   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+#   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import argparse
+import logging
+import os
+import sys
+import zmq
+
+try:
+    from protobuf.virtioforwarder import virtioforwarder_pb2 as relay
+except ImportError:
+    PWD = os.path.dirname(os.path.abspath(__file__))
+    sys.path.append(PWD + '/../build/protobuf/virtioforwarder')
+    import virtioforwarder_pb2 as relay
+
+logger = logging.getLogger(os.path.split(sys.argv[0])[-1])
+
+
+def _syntax():
+    parser = argparse.ArgumentParser(
+        description='Follow the stats updates published by virtio-forwarder '
+                    '(--zmq-stats-pub-ep) and print the relay counters.'
+    )
+    parser.add_argument(
+        '--stats-pub-ep', default='ipc:///var/run/virtio-forwarder/stats_pub',
+        help='ZeroMQ statistics publisher endpoint',
+    )
+    parser.add_argument(
+        '--rates', action='store_true',
+        help='print the change of the counters per second instead of their '
+             'values',
+    )
+    parser.add_argument(
+        '-n', '--count', type=int, default=0,
+        help='exit after this many updates (default: follow forever)',
+    )
+    parser.add_argument(
+        '-z', '--suppress-zero', action='store_true',
+        help="don't show counters that are zero",
+    )
+    return parser
+
+
+class RelayView(object):
+    """Absolute counters and state of the relays, rebuilt from updates."""
+
+    def __init__(self):
+        self.names = []
+        self.relays = {}
+        self.sequence = None
+
+    def apply(self, update):
+        """Apply an update, return the per relay counter deltas, or None if
+        the view is not in sync."""
+        if update.keyframe:
+            self.names = list(update.counter_name)
+            self.relays = {}
+        elif self.sequence is None or update.sequence != self.sequence + 1:
+            if self.sequence is not None:
+                logger.warning('Missed updates, waiting for a keyframe')
+            self.sequence = None
+            return None
+        self.sequence = update.sequence
+
+        deltas = {}
+        for r in update.relay:
+            state = self.relays.setdefault(
+                r.id, {'counters': [0] * len(self.names)})
+            for k in ('vm_to_vf_active', 'vf_to_vm_active', 'vm_to_vf_cpu',
+                      'vf_to_vm_cpu', 'vhost_socket_name', 'pci_addr_str'):
+                if r.HasField(k):
+                    state[k] = getattr(r, k)
+            if r.counters:
+                if update.keyframe:
+                    state['counters'] = list(r.counters)
+                else:
+                    state['counters'] = [
+                        a + d for a, d in zip(state['counters'], r.counters)]
+                    deltas[r.id] = list(r.counters)
+        return deltas
+
+
+def _output(view, update, deltas, args):
+    interval_s = update.interval_ms / 1000.0
+    for rid in sorted(view.relays):
+        state = view.relays[rid]
+        if not (state.get('vm_to_vf_active') or state.get('vf_to_vm_active')):
+            continue
+        relay_str = 'relay_{}'.format(rid)
+        for k in ('vhost_socket_name', 'pci_addr_str', 'vm_to_vf_cpu',
+                  'vf_to_vm_cpu'):
+            if k in state:
+                print '{}.{}={}'.format(relay_str, k, state[k])
+        if args.rates:
+            values = [float(d) / interval_s for d in
+                      deltas.get(rid, [0] * len(view.names))]
+        else:
+            values = state['counters']
+        for name, v in zip(view.names, values):
+            if not (args.suppress_zero and v == 0):
+                print '{}.{}={}'.format(relay_str, name, v)
+    print ''
+    sys.stdout.flush()
+
+
+def main():
+    logging.basicConfig(level=logging.DEBUG)
+
+    args = _syntax().parse_args()
+
+    context = zmq.Context()
+    socket = context.socket(zmq.SUB)
+    socket.setsockopt(zmq.LINGER, 0)
+    socket.setsockopt(zmq.SUBSCRIBE, b'')
+    socket.connect(args.stats_pub_ep)
+
+    view = RelayView()
+    printed = 0
+    while args.count == 0 or printed < args.count:
+        update = relay.StatsUpdate()
+        update.ParseFromString(socket.recv())
+        deltas = view.apply(update)
+        # Rates need two consecutive updates.
+        if deltas is None or (args.rates and update.keyframe):
+            continue
+        _output(view, update, deltas, args)
+        printed += 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
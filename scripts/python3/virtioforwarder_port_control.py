@@ -34,6 +34,7 @@
 from __future__ import print_function
 
 import argparse
+import os
 import zmq
 import re
 try:
@@ -50,7 +51,8 @@ def _syntax():
     parser = argparse.ArgumentParser()
     parser.add_argument(
         'op', metavar='OP',
-        choices=('add', 'remove', 'add_sock', 'remove_sock', 'query_pci'),
+        choices=('add', 'remove', 'add_sock', 'remove_sock', 'query_pci',
+                 'set_rss', 'capture_start', 'capture_stop'),
         help='port control operation',
     )
     parser.add_argument(
@@ -79,6 +81,45 @@ def _syntax():
         help='Bond mode: 0=ROUND_ROBIN; 1=ACTIVE_BACKUP; 2=BALANCE;'
              ' 3=BROADCAST; 4=8023AD; 5=TLB; 6=ALB'
     )
+    parser.add_argument(
+        '--rss-key', help='set_rss: 40-byte Toeplitz key as a hex string'
+    )
+    parser.add_argument(
+        '--rss-table', default='',
+        help='set_rss: comma separated indirection table of queue numbers.'
+             ' Leave empty to disable RSS'
+    )
+    parser.add_argument(
+        '--rss-hash-types', type=lambda x: int(x, 0), default=0x3f,
+        help='set_rss: mask of VIRTIO_NET_RSS_HASH_TYPE_* flags'
+             ' (default: 0x3f, IPv4/IPv6 with TCP and UDP ports)'
+    )
+    parser.add_argument(
+        '--rss-unclassified-queue', type=int,
+        help='set_rss: queue for packets not matching the hash types'
+    )
+    parser.add_argument(
+        '--capture-path',
+        help='capture_start: name of the pcapng file to create in the'
+             ' capture directory of the server'
+    )
+    parser.add_argument(
+        '--capture-direction', choices=('both', 'vm_to_vf', 'vf_to_vm'),
+        default='both', help='capture_start: relay directions to capture'
+    )
+    parser.add_argument(
+        '--capture-queue', type=int,
+        help='capture_start: only capture VM to VF packets of this guest'
+             ' virtqueue pair'
+    )
+    parser.add_argument(
+        '--capture-snaplen', type=int,
+        help='capture_start: bytes to keep of each packet (default: 65535)'
+    )
+    parser.add_argument(
+        '--capture-filter',
+        help='capture_start: pcap-filter expression, e.g. "tcp port 80"'
+    )
     parser.add_argument('--zmq_ep', help='ZeroMQ port control endpoint')
     parser.add_argument(
         '--conditional', action='store_true',
@@ -147,6 +188,25 @@ def main():
         msg.mode = args.mode
     if args.vhost_path is not None:
         msg.vhost_path = args.vhost_path
+    if args.op == 'set_rss':
+        if args.rss_key is not None:
+            msg.rss_key = bytes(bytearray.fromhex(args.rss_key))
+        msg.rss_indirection_table.extend(
+            [int(q) for q in args.rss_table.split(',') if q != ''])
+        msg.rss_hash_types = args.rss_hash_types
+        if args.rss_unclassified_queue is not None:
+            msg.rss_unclassified_queue = args.rss_unclassified_queue
+    if args.op == 'capture_start':
+        if args.capture_path is not None:
+            msg.capture_path = args.capture_path
+        msg.capture_direction = getattr(relay.PortControlRequest,
+                                        args.capture_direction.upper())
+        if args.capture_queue is not None:
+            msg.capture_queue = args.capture_queue
+        if args.capture_snaplen is not None:
+            msg.capture_snaplen = args.capture_snaplen
+        if args.capture_filter is not None:
+            msg.capture_filter = args.capture_filter
 
     if not args.send_garbage:
         socket.send(msg.SerializePartialToString())
@@ -165,6 +225,9 @@ def main():
     # If the reply contains a generic string response then output it here
     if reply.query_string != '':
         print(reply.query_string)
+    if reply.HasField('capture_packets'):
+        print('captured={} dropped={}'.format(reply.capture_packets,
+                                              reply.capture_dropped))
     return 0
 
 
@@ -77,6 +77,8 @@ fi
     ${VIRTIOFWD_ZMQ_CONFIG_EP:+--zmq-config-ep="$VIRTIOFWD_ZMQ_CONFIG_EP"} \
     ${VIRTIOFWD_ZMQ_PORT_CONTROL_EP:+--zmq-port-control-ep="$VIRTIOFWD_ZMQ_PORT_CONTROL_EP"} \
     ${VIRTIOFWD_ZMQ_STATS_EP:+--zmq-stats-ep="$VIRTIOFWD_ZMQ_STATS_EP"} \
+    ${VIRTIOFWD_ZMQ_STATS_PUB_EP:+--zmq-stats-pub-ep="$VIRTIOFWD_ZMQ_STATS_PUB_EP"} \
+    ${VIRTIOFWD_STATS_PUB_INTERVAL:+--stats-pub-interval="$VIRTIOFWD_STATS_PUB_INTERVAL"} \
     ${CORE_SCHED_CMD_LINE} \
     ${VIRTIOFWD_IPC_PORT_CONTROL:+--ipc} \
     ${VIRTIOFWD_SOCKET_OWNER:+-u"$VIRTIOFWD_SOCKET_OWNER"} \
@@ -88,8 +90,24 @@ fi
     ${VIRTIOFWD_VHOST_CLIENT:+--vhostuser-client} \
     ${VIRTIOFWD_ZERO_COPY:+--zero-copy} \
     ${VIRTIOFWD_TSO:+--enable-tso} \
+    ${VIRTIOFWD_TUNNEL_HASH:+--tunnel-hash} \
     ${VIRTIOFWD_DYNAMIC_SOCKETS:+--dynamic-sockets} \
     ${VIRTIOFWD_CPU_NIC_SAME_NUMA:+--same-numa} \
     ${CPU_PINS_CMD_LINE} \
+    ${VIRTIOFWD_PIPELINE_CPUS:+--pipeline-cpu="$VIRTIOFWD_PIPELINE_CPUS"} \
+    ${VIRTIOFWD_EVENTDEV:+--eventdev} \
+    ${VIRTIOFWD_GRAPH:+--graph} \
+    ${VIRTIOFWD_WORK_STEALING:+--work-stealing} \
+    ${VIRTIOFWD_NATIVE_CORE_SCHED:+--native-core-sched} \
+    ${VIRTIOFWD_LATENCY_SAMPLE:+--latency-sample="$VIRTIOFWD_LATENCY_SAMPLE"} \
+    ${VIRTIOFWD_FLOW_SAMPLE:+--flow-sample="$VIRTIOFWD_FLOW_SAMPLE"} \
+    ${VIRTIOFWD_PERF_SAMPLE:+--perf-sample="$VIRTIOFWD_PERF_SAMPLE"} \
+    ${VIRTIOFWD_STALL_THRESHOLD:+--stall-threshold="$VIRTIOFWD_STALL_THRESHOLD"} \
+    ${VIRTIOFWD_TRACE:+--trace="$VIRTIOFWD_TRACE"} \
+    ${VIRTIOFWD_XSTATS_INTERVAL:+--xstats-interval="$VIRTIOFWD_XSTATS_INTERVAL"} \
+    ${VIRTIOFWD_STATS_SHM:+--stats-shm="$VIRTIOFWD_STATS_SHM"} \
+    ${VIRTIOFWD_STATS_HISTORY:+--stats-history="$VIRTIOFWD_STATS_HISTORY"} \
+    ${VIRTIOFWD_STATS_HISTORY_FILE:+--stats-history-file="$VIRTIOFWD_STATS_HISTORY_FILE"} \
+    ${VIRTIOFWD_CAPTURE_DIR:+--capture-dir="$VIRTIOFWD_CAPTURE_DIR"} \
     ${VIRTIOFWD_VFIO_VF_TOKEN:+--vfio-vf-token="$VIRTIOFWD_VFIO_VF_TOKEN"} \
     ${STATIC_VFS_CMD_LINE}
@@ -0,0 +1,403 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "stats_history.h"
+
+#define __MODULE__ "stats_history"
+#include "log.h"
+#include "virtio_worker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTORY_MAGIC 0x54534856 /* "VHST" in little endian memory order */
+#define HISTORY_VERSION 2
+/* Byte counters are kept in units of this many bytes. */
+#define HISTORY_BYTES_SHIFT 6
+
+/*
+ * Traffic of a relay during one second, as differences of its counters.
+ * Packet counts are exact; byte counts are rounded down to units of 64 bytes
+ * so that they fit 32 bits up to 2Tbit/s. Values saturate.
+ */
+struct history_slot {
+	uint32_t pkts[STATS_HISTORY_NB_COUNTERS];
+	uint32_t bytes[STATS_HISTORY_NB_COUNTERS];
+	uint32_t drops_vm_to_vf;
+	uint32_t drops_vf_to_vm;
+};
+
+/*
+ * Vhost-user socket a relay's history was recorded for. A relay ID may serve
+ * another guest after a restart, so the history of a relay is only valid from
+ * second @a since, when its socket last changed.
+ */
+struct history_owner {
+	char socket[128];
+	uint64_t since;
+};
+
+/*
+ * The history, in memory or in a file. The sample of second t is in slot
+ * t % depth of each relay, and slot_time tells which second a slot holds, so
+ * that history from before a restart is told apart from the current one.
+ */
+struct history_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t depth;
+	uint32_t nb_relays;
+	uint32_t slot_size;
+	uint32_t pad;
+	/* Followed by struct history_owner owners[nb_relays], by
+	 * uint32_t slot_time[depth], and then by
+	 * struct history_slot slots[nb_relays][depth]. */
+};
+
+/* Counters a sample is derived from. */
+struct history_counters {
+	uint64_t pkts[STATS_HISTORY_NB_COUNTERS];
+	uint64_t bytes[STATS_HISTORY_NB_COUNTERS];
+	uint64_t drops_vm_to_vf;
+	uint64_t drops_vf_to_vm;
+	/* The counters of a direction read 0 while it is inactive. */
+	bool vm_to_vf_active;
+	bool vf_to_vm_active;
+	char socket[128];
+};
+
+static struct {
+	pthread_t thread;
+	volatile bool running;
+	pthread_mutex_t lock; /* Protects the slots. */
+	struct history_header *hdr;
+	size_t size;
+	bool mapped; /* hdr is mapped from a file rather than allocated. */
+	struct history_owner *owners;
+	uint32_t *slot_time;
+	struct history_slot *slots;
+	struct history_counters prev[MAX_RELAYS];
+} hist = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static size_t history_size(unsigned depth)
+{
+	return sizeof(struct history_header) +
+		MAX_RELAYS * sizeof(struct history_owner) +
+		depth * sizeof(uint32_t) +
+		(size_t)MAX_RELAYS * depth * sizeof(struct history_slot);
+}
+
+static void history_layout(void)
+{
+	hist.owners = (struct history_owner *)(hist.hdr + 1);
+	hist.slot_time = (uint32_t *)(hist.owners + MAX_RELAYS);
+	hist.slots = (struct history_slot *)(hist.slot_time + hist.hdr->depth);
+}
+
+static void history_init(unsigned depth)
+{
+	memset(hist.hdr, 0, hist.size);
+	hist.hdr->magic = HISTORY_MAGIC;
+	hist.hdr->version = HISTORY_VERSION;
+	hist.hdr->depth = depth;
+	hist.hdr->nb_relays = MAX_RELAYS;
+	hist.hdr->slot_size = sizeof(struct history_slot);
+}
+
+/* Map the history file, and keep its contents if they have the same layout. */
+static int history_map(unsigned depth, const char *path)
+{
+	struct stat st;
+	bool keep;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("Could not open stats history file %s: %s", path,
+			strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) || (st.st_size != (off_t)hist.size &&
+			ftruncate(fd, hist.size))) {
+		log_error("Could not size stats history file %s: %s", path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	keep = (st.st_size == (off_t)hist.size);
+	hist.hdr = mmap(NULL, hist.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+	if (hist.hdr == MAP_FAILED) {
+		log_error("Could not map stats history file %s: %s", path,
+			strerror(errno));
+		hist.hdr = NULL;
+		return -1;
+	}
+	hist.mapped = true;
+
+	keep = keep && hist.hdr->magic == HISTORY_MAGIC &&
+		hist.hdr->version == HISTORY_VERSION &&
+		hist.hdr->depth == depth &&
+		hist.hdr->nb_relays == MAX_RELAYS &&
+		hist.hdr->slot_size == sizeof(struct history_slot);
+	if (keep)
+		log_info("Carrying over the stats history in %s", path);
+	else
+		history_init(depth);
+
+	return 0;
+}
+
+static uint32_t sat32(uint64_t v)
+{
+	return v > UINT32_MAX ? UINT32_MAX : v;
+}
+
+/*
+ * Difference of two counters of a direction, or @a cur if the counter was
+ * reset. A direction that was inactive at the previous sample reads 0 there,
+ * and its counters carry on from before it went away: start over from the
+ * current values instead of taking them all as this second's traffic.
+ */
+static uint64_t counter_diff(uint64_t cur, uint64_t prev, bool was_active)
+{
+	if (!was_active)
+		return 0;
+	return cur >= prev ? cur - prev : cur;
+}
+
+static void history_read_counters(unsigned id, struct history_counters *c)
+{
+	struct virtio_worker_stats s;
+
+	virtio_forwarder_get_stats(id, &s);
+	c->pkts[STATS_HISTORY_VIRTIO_RX] = s.virtio_rx;
+	c->bytes[STATS_HISTORY_VIRTIO_RX] = s.virtio_rx_bytes;
+	c->pkts[STATS_HISTORY_DPDK_TX] = s.dpdk_tx;
+	c->bytes[STATS_HISTORY_DPDK_TX] = s.dpdk_tx_bytes;
+	c->pkts[STATS_HISTORY_DPDK_RX] = s.dpdk_rx;
+	c->bytes[STATS_HISTORY_DPDK_RX] = s.dpdk_rx_bytes;
+	c->pkts[STATS_HISTORY_VIRTIO_TX] = s.virtio_tx;
+	c->bytes[STATS_HISTORY_VIRTIO_TX] = s.virtio_tx_bytes;
+	c->drops_vm_to_vf = s.dpdk_drop_full + s.dpdk_drop_unavail +
+		s.dpdk_drop_flush;
+	c->drops_vf_to_vm = s.virtio_drop_full + s.virtio_drop_unavail +
+		s.virtio_drop_flush + s.vf_imissed;
+	c->vm_to_vf_active = s.virtio2vf_active;
+	c->vf_to_vm_active = s.vf2virtio_active;
+	strncpy(c->socket, s.vhost_socket_name, sizeof(c->socket) - 1);
+	c->socket[sizeof(c->socket) - 1] = '\0';
+}
+
+/* Start the history of relay @a id over if it now serves another socket. */
+static void history_check_owner(unsigned id, const char *socket, uint64_t t)
+{
+	struct history_owner *o = &hist.owners[id];
+
+	if (strcmp(socket, "NONE") == 0 || strcmp(socket, o->socket) == 0)
+		return;
+	if (o->socket[0] != '\0')
+		log_info("Relay %u now serves %s, discarding its history of %s",
+			id, socket, o->socket);
+	strncpy(o->socket, socket, sizeof(o->socket) - 1);
+	o->socket[sizeof(o->socket) - 1] = '\0';
+	o->since = t;
+}
+
+/* Record the traffic of every relay since the previous call as second @a t. */
+static void history_record(uint64_t t, bool first)
+{
+	const unsigned depth = hist.hdr->depth;
+	const unsigned slot = t % depth;
+	struct history_slot slots[MAX_RELAYS];
+
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		struct history_counters cur;
+		struct history_counters *prev = &hist.prev[id];
+		struct history_slot *s = &slots[id];
+
+		history_read_counters(id, &cur);
+		for (unsigned c=0; c<STATS_HISTORY_NB_COUNTERS; ++c) {
+			bool was_active = (c == STATS_HISTORY_VIRTIO_RX ||
+					c == STATS_HISTORY_DPDK_TX) ?
+				prev->vm_to_vf_active : prev->vf_to_vm_active;
+
+			s->pkts[c] = sat32(counter_diff(cur.pkts[c],
+				prev->pkts[c], was_active));
+			s->bytes[c] = sat32(counter_diff(cur.bytes[c],
+				prev->bytes[c], was_active) >>
+				HISTORY_BYTES_SHIFT);
+		}
+		s->drops_vm_to_vf = sat32(counter_diff(cur.drops_vm_to_vf,
+			prev->drops_vm_to_vf, prev->vm_to_vf_active));
+		s->drops_vf_to_vm = sat32(counter_diff(cur.drops_vf_to_vm,
+			prev->drops_vf_to_vm, prev->vf_to_vm_active));
+		*prev = cur;
+	}
+	/* The first call only records the counters. */
+	if (first)
+		return;
+
+	pthread_mutex_lock(&hist.lock);
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		history_check_owner(id, hist.prev[id].socket, t);
+		hist.slots[(size_t)id * depth + slot] = slots[id];
+	}
+	hist.slot_time[slot] = t;
+	pthread_mutex_unlock(&hist.lock);
+}
+
+static void *history_thread(void *arg __attribute__((unused)))
+{
+	uint64_t last = 0;
+
+	log_debug("Stats history thread started");
+	while (hist.running) {
+		struct timespec now;
+
+		/* Sample at the start of every second. */
+		clock_gettime(CLOCK_REALTIME, &now);
+		if ((uint64_t)now.tv_sec != last) {
+			history_record(now.tv_sec, last == 0);
+			last = now.tv_sec;
+		}
+		usleep(1000000 - now.tv_nsec / 1000);
+	}
+	log_debug("Stats history thread ended");
+
+	return NULL;
+}
+
+int stats_history_start(unsigned depth_s, const char *path)
+{
+	if (depth_s == 0)
+		return 0;
+
+	hist.size = history_size(depth_s);
+	if (path && path[0] != '\0') {
+		if (history_map(depth_s, path))
+			return -1;
+	} else {
+		hist.hdr = malloc(hist.size);
+		if (!hist.hdr) {
+			log_error("Could not allocate %zu bytes of stats history",
+				hist.size);
+			return -1;
+		}
+		history_init(depth_s);
+	}
+	history_layout();
+
+	hist.running = true;
+	if (pthread_create(&hist.thread, NULL, history_thread, NULL)) {
+		log_error("Could not create stats history thread!");
+		hist.running = false;
+		stats_history_stop();
+		return -1;
+	}
+	log_info("Keeping %u s of stats history", depth_s);
+
+	return 0;
+}
+
+void stats_history_stop(void)
+{
+	if (hist.running) {
+		hist.running = false;
+		pthread_join(hist.thread, NULL);
+	}
+	if (!hist.hdr)
+		return;
+
+	if (hist.mapped) {
+		msync(hist.hdr, hist.size, MS_SYNC);
+		munmap(hist.hdr, hist.size);
+	} else {
+		free(hist.hdr);
+	}
+	hist.hdr = NULL;
+	hist.mapped = false;
+}
+
+bool stats_history_enabled(void)
+{
+	return hist.hdr != NULL;
+}
+
+unsigned stats_history_get(unsigned relay_id, uint64_t start_s,
+		uint64_t end_s, struct stats_history_point *points,
+		unsigned max)
+{
+	unsigned depth, n = 0;
+
+	if (!hist.hdr || relay_id >= MAX_RELAYS)
+		return 0;
+
+	depth = hist.hdr->depth;
+	/* Older seconds have been overwritten, whatever the slots say. */
+	if (end_s >= depth && start_s <= end_s - depth)
+		start_s = end_s - depth + 1;
+
+	pthread_mutex_lock(&hist.lock);
+	for (uint64_t t=start_s; t<=end_s && n<max; ++t) {
+		const unsigned slot = t % depth;
+		const struct history_slot *s;
+		struct stats_history_point *p = &points[n];
+
+		if (hist.slot_time[slot] != t || t < hist.owners[relay_id].since)
+			continue;
+		s = &hist.slots[(size_t)relay_id * depth + slot];
+		p->time_s = t;
+		for (unsigned c=0; c<STATS_HISTORY_NB_COUNTERS; ++c) {
+			p->pkts[c] = s->pkts[c];
+			p->bytes[c] = (uint64_t)s->bytes[c] <<
+				HISTORY_BYTES_SHIFT;
+		}
+		p->drops_vm_to_vf = s->drops_vm_to_vf;
+		p->drops_vf_to_vm = s->drops_vf_to_vm;
+		++n;
+	}
+	pthread_mutex_unlock(&hist.lock);
+
+	return n;
+}
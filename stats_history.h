@@ -0,0 +1,94 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _STATS_HISTORY_H
+#define _STATS_HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Longest history that may be kept, in seconds. */
+#define STATS_HISTORY_MAX_S 86400
+
+/* Traffic counters of a history sample. */
+enum stats_history_counter {
+	STATS_HISTORY_VIRTIO_RX,
+	STATS_HISTORY_DPDK_TX,
+	STATS_HISTORY_DPDK_RX,
+	STATS_HISTORY_VIRTIO_TX,
+	STATS_HISTORY_NB_COUNTERS
+};
+
+/** Traffic of a relay during one second. */
+struct stats_history_point {
+	uint64_t time_s; /* CLOCK_REALTIME second the sample was taken at. */
+	uint64_t pkts[STATS_HISTORY_NB_COUNTERS];
+	uint64_t bytes[STATS_HISTORY_NB_COUNTERS];
+	uint64_t drops_vm_to_vf; /* Dropped by the relay. */
+	uint64_t drops_vf_to_vm; /* Dropped by the relay or missed by the VF. */
+};
+
+/**
+ * @brief Start recording the traffic of every relay once per second, for the
+ * last @a depth_s seconds.
+ *
+ * @param path If not empty, the history is kept in this file instead of
+ * anonymous memory, and the history in the file is carried over if it was
+ * recorded with the same depth. The history of a relay is only carried over
+ * while it serves the same vhost-user socket.
+ * @return 0 on success or if @a depth_s is 0, -1 on error.
+ */
+int stats_history_start(unsigned depth_s, const char *path);
+
+/** @brief Stop recording the history, and release it. */
+void stats_history_stop(void);
+
+/** @brief Check whether the history is being recorded. */
+bool stats_history_enabled(void);
+
+/**
+ * @brief Get the history of relay @a relay_id between @a start_s and
+ * @a end_s, both included, oldest first.
+ *
+ * Seconds without a sample, e.g. while virtio-forwarder was not running, are
+ * skipped.
+ *
+ * @param points Array receiving up to @a max samples.
+ * @return Number of samples filled in.
+ */
+unsigned stats_history_get(unsigned relay_id, uint64_t start_s,
+		uint64_t end_s, struct stats_history_point *points,
+		unsigned max);
+
+#endif /* _STATS_HISTORY_H */
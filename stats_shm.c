@@ -0,0 +1,300 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "stats_shm.h"
+
+#define __MODULE__ "stats_shm"
+#include "log.h"
+#include "rate_sampler.h"
+#include "virtio_worker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <bsd/string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+
+static struct {
+	pthread_t thread;
+	volatile bool running;
+	char path[128];
+	struct stats_shm_header *hdr;
+	size_t size;
+	struct stats_shm_relay *relays;
+	struct stats_shm_worker *workers;
+} shm;
+
+/*
+ * Copy a record behind its sequence lock. Records start with their sequence
+ * number, which is not part of the copy.
+ */
+static void
+seq_publish(volatile uint32_t *seq, const void *src, size_t size)
+{
+	const size_t skip = sizeof(*seq);
+
+	*seq += 1;
+	rte_smp_wmb();
+	memcpy((uint8_t *)seq + skip, (const uint8_t *)src + skip, size - skip);
+	rte_smp_wmb();
+	*seq += 1;
+}
+
+void stats_shm_snapshot_relay(unsigned id, struct stats_shm_relay *r)
+{
+	struct virtio_worker_stats stats;
+	float rates[RATE_NB_WINDOWS][RELAY_NB_COUNTERS];
+	uint64_t *c = r->counters;
+
+	virtio_forwarder_get_stats(id, &stats);
+	rate_sampler_get(id, rates);
+
+	memset(r, 0, sizeof(*r));
+	r->virtio2vf_cpu = -1;
+	r->vf2virtio_cpu = -1;
+	if (stats.virtio2vf_active) {
+		r->flags |= STATS_SHM_VIRTIO2VF_ACTIVE;
+		r->virtio2vf_cpu = stats.virtio2vf_cpu;
+		strlcpy(r->vhost_socket_name, stats.vhost_socket_name,
+			sizeof(r->vhost_socket_name));
+		c[STATS_SHM_VIRTIO_RX] = stats.virtio_rx;
+		c[STATS_SHM_VIRTIO_RX_BYTES] = stats.virtio_rx_bytes;
+		c[STATS_SHM_DPDK_TX] = stats.dpdk_tx;
+		c[STATS_SHM_DPDK_TX_BYTES] = stats.dpdk_tx_bytes;
+		c[STATS_SHM_DPDK_DROP_FULL] = stats.dpdk_drop_full;
+		c[STATS_SHM_DPDK_DROP_UNAVAIL] = stats.dpdk_drop_unavail;
+		c[STATS_SHM_DPDK_DROP_FLUSH] = stats.dpdk_drop_flush;
+		c[STATS_SHM_VIRTIO_RX_NOMBUF] = stats.virtio_rx_nombuf;
+		c[STATS_SHM_VF_OERRORS] = stats.vf_oerrors;
+		c[STATS_SHM_VIRTIO2VF_CYCLES] = stats.virtio2vf_cycles;
+	}
+	if (stats.vf2virtio_active) {
+		r->flags |= STATS_SHM_VF2VIRTIO_ACTIVE;
+		r->vf2virtio_cpu = stats.vf2virtio_cpu;
+		strlcpy(r->pci_dbdf, stats.pci_dbdf, sizeof(r->pci_dbdf));
+		c[STATS_SHM_DPDK_RX] = stats.dpdk_rx;
+		c[STATS_SHM_DPDK_RX_BYTES] = stats.dpdk_rx_bytes;
+		c[STATS_SHM_VIRTIO_TX] = stats.virtio_tx;
+		c[STATS_SHM_VIRTIO_TX_BYTES] = stats.virtio_tx_bytes;
+		c[STATS_SHM_VIRTIO_DROP_FULL] = stats.virtio_drop_full;
+		c[STATS_SHM_VIRTIO_DROP_UNAVAIL] = stats.virtio_drop_unavail;
+		c[STATS_SHM_VIRTIO_DROP_FLUSH] = stats.virtio_drop_flush;
+		c[STATS_SHM_VIRTIO_RING_EMPTY] = stats.virtio_ring_empty;
+		c[STATS_SHM_VF_IMISSED] = stats.vf_imissed;
+		c[STATS_SHM_VF_RX_NOMBUF] = stats.vf_rx_nombuf;
+		c[STATS_SHM_VF_IERRORS] = stats.vf_ierrors;
+		c[STATS_SHM_VF2VIRTIO_CYCLES] = stats.vf2virtio_cycles;
+	}
+	/* The rates follow enum relay_counter. */
+	for (unsigned w=0; w<RATE_NB_WINDOWS; ++w)
+		memcpy(r->rates[w], rates[w], sizeof(rates[w]));
+}
+
+static void stats_shm_publish_relay(unsigned id)
+{
+	struct stats_shm_relay r;
+
+	stats_shm_snapshot_relay(id, &r);
+	seq_publish(&shm.relays[id].seq, &r, sizeof(r));
+}
+
+static void stats_shm_publish(void)
+{
+	struct virtio_worker_state states[MAX_CPUS];
+	unsigned nb_states;
+	struct timespec now;
+
+	for (unsigned id=0; id<MAX_RELAYS; ++id)
+		stats_shm_publish_relay(id);
+
+	nb_states = virtio_forwarder_get_worker_states(states, MAX_CPUS);
+	for (unsigned i=0; i<MAX_CPUS; ++i) {
+		struct stats_shm_worker w;
+
+		memset(&w, 0, sizeof(w));
+		w.cpu = -1;
+		if (i < nb_states) {
+			w.cpu = states[i].cpu;
+			w.nb_relays = states[i].nb_relays;
+			w.iterations = states[i].iterations;
+			w.busy_cycles = states[i].busy_cycles;
+			w.idle_cycles = states[i].idle_cycles;
+			w.sleep_cycles = states[i].sleep_cycles;
+			w.overhead_cycles = states[i].overhead_cycles;
+		}
+		seq_publish(&shm.workers[i].seq, &w, sizeof(w));
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	shm.hdr->update_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	rte_smp_wmb();
+	shm.hdr->generation++;
+}
+
+static void *stats_shm_thread(void *arg __attribute__((unused)))
+{
+	log_debug("Stats segment thread started");
+	while (shm.running) {
+		stats_shm_publish();
+		usleep(STATS_SHM_PERIOD_MS * 1000);
+	}
+	log_debug("Stats segment thread ended");
+
+	return NULL;
+}
+
+/*
+ * Lay out the segment in a temporary file and rename it into place, so that
+ * readers never map a partially initialized segment.
+ */
+static int stats_shm_create(const char *path)
+{
+	const size_t relay_offset = RTE_ALIGN(sizeof(*shm.hdr), 64);
+	const size_t worker_offset = relay_offset +
+		RTE_ALIGN(MAX_RELAYS * sizeof(*shm.relays), 64);
+	char tmp_path[sizeof(shm.path) + 4];
+	void *map;
+	int fd;
+
+	RTE_BUILD_BUG_ON((unsigned)RELAY_NB_COUNTERS != STATS_SHM_NB_RATES);
+	RTE_BUILD_BUG_ON(RATE_NB_WINDOWS > STATS_SHM_MAX_WINDOWS);
+	RTE_BUILD_BUG_ON(STATS_SHM_NB_COUNTERS > STATS_SHM_MAX_COUNTERS);
+	RTE_BUILD_BUG_ON(STATS_SHM_NB_RATES > STATS_SHM_MAX_RATES);
+
+	if (strlcpy(shm.path, path, sizeof(shm.path)) >= sizeof(shm.path)) {
+		log_error("Stats segment path '%s' is too long", path);
+		return -1;
+	}
+	snprintf(tmp_path, sizeof(tmp_path), "%s.new", shm.path);
+	shm.size = worker_offset + MAX_CPUS * sizeof(*shm.workers);
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("Could not create stats segment %s: %s", tmp_path,
+			strerror(errno));
+		return -1;
+	}
+	/* Readable by monitoring agents regardless of the umask. */
+	if (fchmod(fd, 0644) || ftruncate(fd, shm.size)) {
+		log_error("Could not size stats segment %s: %s", tmp_path,
+			strerror(errno));
+		goto err_close;
+	}
+	map = mmap(NULL, shm.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		log_error("Could not map stats segment %s: %s", tmp_path,
+			strerror(errno));
+		goto err_close;
+	}
+	close(fd);
+
+	shm.hdr = map;
+	shm.relays = (struct stats_shm_relay *)((uint8_t *)map + relay_offset);
+	shm.workers = (struct stats_shm_worker *)((uint8_t *)map + worker_offset);
+
+	shm.hdr->magic = STATS_SHM_MAGIC;
+	shm.hdr->version = STATS_SHM_VERSION;
+	shm.hdr->header_size = sizeof(*shm.hdr);
+	shm.hdr->pid = getpid();
+	shm.hdr->tsc_hz = rte_get_tsc_hz();
+	shm.hdr->nb_counters = STATS_SHM_NB_COUNTERS;
+	shm.hdr->nb_rates = STATS_SHM_NB_RATES;
+	shm.hdr->nb_windows = RATE_NB_WINDOWS;
+	for (unsigned w=0; w<RATE_NB_WINDOWS; ++w)
+		shm.hdr->windows_s[w] = rate_sampler_window_s(w);
+	shm.hdr->nb_relays = MAX_RELAYS;
+	shm.hdr->relay_size = sizeof(*shm.relays);
+	shm.hdr->nb_workers = MAX_CPUS;
+	shm.hdr->worker_size = sizeof(*shm.workers);
+	shm.hdr->relay_offset = relay_offset;
+	shm.hdr->worker_offset = worker_offset;
+	for (unsigned i=0; i<MAX_CPUS; ++i)
+		shm.workers[i].cpu = -1;
+
+	if (rename(tmp_path, shm.path)) {
+		log_error("Could not move stats segment to %s: %s", shm.path,
+			strerror(errno));
+		munmap(map, shm.size);
+		unlink(tmp_path);
+		shm.hdr = NULL;
+		return -1;
+	}
+
+	return 0;
+
+err_close:
+	close(fd);
+	unlink(tmp_path);
+	return -1;
+}
+
+int stats_shm_start(const char *path)
+{
+	if (!path || path[0] == '\0')
+		return 0;
+
+	if (stats_shm_create(path))
+		return -1;
+
+	shm.running = true;
+	if (pthread_create(&shm.thread, NULL, stats_shm_thread, NULL)) {
+		log_error("Could not create stats segment thread!");
+		shm.running = false;
+		stats_shm_stop();
+		return -1;
+	}
+	log_info("Publishing stats in %s", shm.path);
+
+	return 0;
+}
+
+void stats_shm_stop(void)
+{
+	if (shm.running) {
+		shm.running = false;
+		pthread_join(shm.thread, NULL);
+	}
+	if (!shm.hdr)
+		return;
+
+	unlink(shm.path);
+	munmap(shm.hdr, shm.size);
+	shm.hdr = NULL;
+}
@@ -0,0 +1,236 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Statistics shared memory segment.
+ *
+ * virtio-forwarder can publish its relay counters, rates and worker cycle
+ * counters in a file mapped into memory, so that local tools read them with
+ * plain loads instead of a stats service request. The segment is read-only
+ * for readers and consists of a header followed by an array of relay records
+ * and an array of worker records, at the offsets and with the record sizes
+ * given in the header. Fields are only ever appended to the records, and
+ * counters and rates to their arrays, which have room to spare: a reader must
+ * use the sizes and counts from the header rather than its own.
+ *
+ * Each record is protected by a sequence lock: the writer makes the sequence
+ * number odd while it updates the record, and even again when done. The
+ * reader functions below copy a record until they get a consistent snapshot.
+ *
+ * This header does not depend on DPDK, and together with stats_shm_reader.c
+ * forms the reader library.
+ */
+
+#ifndef _STATS_SHM_H
+#define _STATS_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_SHM_MAGIC 0x54534656 /* "VFST" in little endian memory order */
+/* Incremented on incompatible layout changes only. */
+#define STATS_SHM_VERSION 1
+
+/** Time between two updates of the segment. */
+#define STATS_SHM_PERIOD_MS 250
+
+#define STATS_SHM_MAX_WINDOWS 4
+#define STATS_SHM_MAX_COUNTERS 48
+#define STATS_SHM_MAX_RATES 16
+#define STATS_SHM_NAME_CCH_MAX 128
+
+/** Counters of a relay record. */
+enum stats_shm_counter {
+	/* VM to VF */
+	STATS_SHM_VIRTIO_RX,
+	STATS_SHM_VIRTIO_RX_BYTES,
+	STATS_SHM_DPDK_TX,
+	STATS_SHM_DPDK_TX_BYTES,
+	STATS_SHM_DPDK_DROP_FULL,
+	STATS_SHM_DPDK_DROP_UNAVAIL,
+	STATS_SHM_DPDK_DROP_FLUSH,
+	STATS_SHM_VIRTIO_RX_NOMBUF,
+	STATS_SHM_VF_OERRORS,
+	STATS_SHM_VIRTIO2VF_CYCLES,
+	/* VF to VM */
+	STATS_SHM_DPDK_RX,
+	STATS_SHM_DPDK_RX_BYTES,
+	STATS_SHM_VIRTIO_TX,
+	STATS_SHM_VIRTIO_TX_BYTES,
+	STATS_SHM_VIRTIO_DROP_FULL,
+	STATS_SHM_VIRTIO_DROP_UNAVAIL,
+	STATS_SHM_VIRTIO_DROP_FLUSH,
+	STATS_SHM_VIRTIO_RING_EMPTY,
+	STATS_SHM_VF_IMISSED,
+	STATS_SHM_VF_RX_NOMBUF,
+	STATS_SHM_VF_IERRORS,
+	STATS_SHM_VF2VIRTIO_CYCLES,
+	STATS_SHM_NB_COUNTERS
+};
+
+/** Rates of a relay record, per second. */
+enum stats_shm_rate {
+	STATS_SHM_RATE_VIRTIO_RX,
+	STATS_SHM_RATE_VIRTIO_RX_BYTES,
+	STATS_SHM_RATE_DPDK_TX,
+	STATS_SHM_RATE_DPDK_TX_BYTES,
+	STATS_SHM_RATE_DPDK_RX,
+	STATS_SHM_RATE_DPDK_RX_BYTES,
+	STATS_SHM_RATE_VIRTIO_TX,
+	STATS_SHM_RATE_VIRTIO_TX_BYTES,
+	STATS_SHM_NB_RATES
+};
+
+/* Relay record flags. */
+#define STATS_SHM_VIRTIO2VF_ACTIVE (1 << 0)
+#define STATS_SHM_VF2VIRTIO_ACTIVE (1 << 1)
+
+struct stats_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t pid; /* Of the writer, to tell a stale segment. */
+	uint64_t tsc_hz; /* Unit of the cycle counters. */
+	volatile uint64_t generation; /* Incremented after every update. */
+	volatile uint64_t update_ns; /* CLOCK_REALTIME of the last update. */
+	uint32_t nb_counters; /* Valid entries of stats_shm_relay.counters. */
+	uint32_t nb_rates; /* Valid entries of each window of rates. */
+	uint32_t nb_windows;
+	uint32_t windows_s[STATS_SHM_MAX_WINDOWS];
+	uint32_t nb_relays;
+	uint32_t relay_size;
+	uint32_t nb_workers;
+	uint32_t worker_size;
+	uint64_t relay_offset;
+	uint64_t worker_offset;
+};
+
+/** Relay record, indexed by relay ID. */
+struct stats_shm_relay {
+	volatile uint32_t seq;
+	uint32_t flags; /* STATS_SHM_*_ACTIVE */
+	int32_t virtio2vf_cpu;
+	int32_t vf2virtio_cpu;
+	char vhost_socket_name[STATS_SHM_NAME_CCH_MAX];
+	char pci_dbdf[STATS_SHM_NAME_CCH_MAX];
+	uint64_t counters[STATS_SHM_MAX_COUNTERS]; /* enum stats_shm_counter */
+	float rates[STATS_SHM_MAX_WINDOWS][STATS_SHM_MAX_RATES];
+};
+
+/** Worker CPU record; records with a negative CPU are unused. */
+struct stats_shm_worker {
+	volatile uint32_t seq;
+	int32_t cpu;
+	uint32_t nb_relays;
+	uint32_t pad;
+	uint64_t iterations;
+	uint64_t busy_cycles;
+	uint64_t idle_cycles;
+	uint64_t sleep_cycles;
+	uint64_t overhead_cycles;
+};
+
+/*
+ * Writer, in virtio-forwarder.
+ */
+
+/**
+ * @brief Create the segment at @a path and start the thread updating it.
+ * @return 0 on success, -1 on error.
+ */
+int stats_shm_start(const char *path);
+
+/** @brief Stop updating the segment and remove it. */
+void stats_shm_stop(void);
+
+/**
+ * @brief Take a snapshot of the counters and rates of relay @a id, as they
+ * would appear in its record. Also used by the stats publisher.
+ */
+void stats_shm_snapshot_relay(unsigned id, struct stats_shm_relay *r);
+
+/*
+ * Reader.
+ */
+
+/** A mapping of the segment. */
+struct stats_shm {
+	const struct stats_shm_header *hdr;
+	size_t size;
+};
+
+/**
+ * @brief Map the segment at @a path and check its layout.
+ * @return 0 on success, -1 with errno set on error; EPROTO if the segment has
+ * an unknown layout.
+ */
+int stats_shm_open(const char *path, struct stats_shm *shm);
+
+/** @brief Unmap a segment. */
+void stats_shm_close(struct stats_shm *shm);
+
+/**
+ * @brief Copy a consistent snapshot of the record of relay @a id.
+ *
+ * Fields the writer does not know of are zeroed.
+ *
+ * @return 0 on success, -1 if @a id is out of range, or with errno set to
+ * ESRCH if the writer died while updating the record.
+ */
+int stats_shm_read_relay(const struct stats_shm *shm, unsigned id,
+			struct stats_shm_relay *relay);
+
+/**
+ * @brief Copy a consistent snapshot of worker record @a idx.
+ * @return 0 on success, -1 if @a idx is out of range, or with errno set to
+ * ESRCH if the writer died while updating the record.
+ */
+int stats_shm_read_worker(const struct stats_shm *shm, unsigned idx,
+			struct stats_shm_worker *worker);
+
+/** @brief Get the name of counter @a c, NULL if unknown. */
+const char *stats_shm_counter_name(unsigned c);
+
+/** @brief Get the name of rate @a r, NULL if unknown. */
+const char *stats_shm_rate_name(unsigned r);
+
+/**
+ * @brief Check whether the writer of the segment is still running.
+ *
+ * A segment left behind by a crashed writer keeps its last values.
+ */
+bool stats_shm_alive(const struct stats_shm *shm);
+
+#endif /* _STATS_SHM_H */
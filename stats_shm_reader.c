@@ -0,0 +1,213 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Reader library of the statistics shared memory segment, see stats_shm.h.
+ * It does not depend on DPDK and can be linked into monitoring agents.
+ */
+
+#include "stats_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Spins on an update in progress between checks that the writer lives. */
+#define SEQ_READ_SPINS 100000
+
+static const char *counter_names[STATS_SHM_NB_COUNTERS] = {
+	[STATS_SHM_VIRTIO_RX] = "virtio_rx",
+	[STATS_SHM_VIRTIO_RX_BYTES] = "virtio_rx_bytes",
+	[STATS_SHM_DPDK_TX] = "dpdk_tx",
+	[STATS_SHM_DPDK_TX_BYTES] = "dpdk_tx_bytes",
+	[STATS_SHM_DPDK_DROP_FULL] = "dpdk_drop_full",
+	[STATS_SHM_DPDK_DROP_UNAVAIL] = "dpdk_drop_unavail",
+	[STATS_SHM_DPDK_DROP_FLUSH] = "dpdk_drop_flush",
+	[STATS_SHM_VIRTIO_RX_NOMBUF] = "virtio_rx_nombuf",
+	[STATS_SHM_VF_OERRORS] = "vf_oerrors",
+	[STATS_SHM_VIRTIO2VF_CYCLES] = "virtio2vf_cycles",
+	[STATS_SHM_DPDK_RX] = "dpdk_rx",
+	[STATS_SHM_DPDK_RX_BYTES] = "dpdk_rx_bytes",
+	[STATS_SHM_VIRTIO_TX] = "virtio_tx",
+	[STATS_SHM_VIRTIO_TX_BYTES] = "virtio_tx_bytes",
+	[STATS_SHM_VIRTIO_DROP_FULL] = "virtio_drop_full",
+	[STATS_SHM_VIRTIO_DROP_UNAVAIL] = "virtio_drop_unavail",
+	[STATS_SHM_VIRTIO_DROP_FLUSH] = "virtio_drop_flush",
+	[STATS_SHM_VIRTIO_RING_EMPTY] = "virtio_ring_empty",
+	[STATS_SHM_VF_IMISSED] = "vf_imissed",
+	[STATS_SHM_VF_RX_NOMBUF] = "vf_rx_nombuf",
+	[STATS_SHM_VF_IERRORS] = "vf_ierrors",
+	[STATS_SHM_VF2VIRTIO_CYCLES] = "vf2virtio_cycles",
+};
+
+static const char *rate_names[STATS_SHM_NB_RATES] = {
+	[STATS_SHM_RATE_VIRTIO_RX] = "virtio_rx_rate",
+	[STATS_SHM_RATE_VIRTIO_RX_BYTES] = "virtio_rx_byte_rate",
+	[STATS_SHM_RATE_DPDK_TX] = "dpdk_tx_rate",
+	[STATS_SHM_RATE_DPDK_TX_BYTES] = "dpdk_tx_byte_rate",
+	[STATS_SHM_RATE_DPDK_RX] = "dpdk_rx_rate",
+	[STATS_SHM_RATE_DPDK_RX_BYTES] = "dpdk_rx_byte_rate",
+	[STATS_SHM_RATE_VIRTIO_TX] = "virtio_tx_rate",
+	[STATS_SHM_RATE_VIRTIO_TX_BYTES] = "virtio_tx_byte_rate",
+};
+
+int stats_shm_open(const char *path, struct stats_shm *shm)
+{
+	const struct stats_shm_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = map;
+	if (hdr->magic != STATS_SHM_MAGIC ||
+			hdr->version != STATS_SHM_VERSION ||
+			hdr->relay_offset + (uint64_t)hdr->nb_relays *
+				hdr->relay_size > (uint64_t)st.st_size ||
+			hdr->worker_offset + (uint64_t)hdr->nb_workers *
+				hdr->worker_size > (uint64_t)st.st_size) {
+		munmap(map, st.st_size);
+		errno = EPROTO;
+		return -1;
+	}
+	shm->hdr = hdr;
+	shm->size = st.st_size;
+
+	return 0;
+}
+
+void stats_shm_close(struct stats_shm *shm)
+{
+	if (!shm->hdr)
+		return;
+
+	munmap((void *)shm->hdr, shm->size);
+	shm->hdr = NULL;
+}
+
+/*
+ * Copy the record at @a src until no update of the writer overlapped the
+ * copy. Only the common part of the writer's and the reader's record is
+ * copied, the rest is zeroed. Fails with ESRCH if the writer died in the
+ * middle of an update, which would never complete.
+ */
+static int
+seq_read(const struct stats_shm *shm, const uint8_t *src, size_t src_size,
+	void *dst, size_t dst_size)
+{
+	const volatile uint32_t *seq = (const volatile uint32_t *)src;
+	size_t n = src_size < dst_size ? src_size : dst_size;
+	unsigned spins;
+	uint32_t begin;
+
+	memset((uint8_t *)dst + n, 0, dst_size - n);
+	do {
+		spins = 0;
+		while ((begin = *seq) & 1) {
+			if (++spins < SEQ_READ_SPINS)
+				continue;
+			if (!stats_shm_alive(shm)) {
+				errno = ESRCH;
+				return -1;
+			}
+			spins = 0;
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		memcpy(dst, src, n);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (*seq != begin);
+
+	return 0;
+}
+
+int stats_shm_read_relay(const struct stats_shm *shm, unsigned id,
+			struct stats_shm_relay *relay)
+{
+	const struct stats_shm_header *hdr = shm->hdr;
+
+	if (id >= hdr->nb_relays)
+		return -1;
+
+	return seq_read(shm, (const uint8_t *)hdr + hdr->relay_offset +
+			(size_t)id * hdr->relay_size, hdr->relay_size,
+		relay, sizeof(*relay));
+}
+
+int stats_shm_read_worker(const struct stats_shm *shm, unsigned idx,
+			struct stats_shm_worker *worker)
+{
+	const struct stats_shm_header *hdr = shm->hdr;
+
+	if (idx >= hdr->nb_workers)
+		return -1;
+
+	return seq_read(shm, (const uint8_t *)hdr + hdr->worker_offset +
+			(size_t)idx * hdr->worker_size, hdr->worker_size,
+		worker, sizeof(*worker));
+}
+
+const char *stats_shm_counter_name(unsigned c)
+{
+	return c < STATS_SHM_NB_COUNTERS ? counter_names[c] : NULL;
+}
+
+const char *stats_shm_rate_name(unsigned r)
+{
+	return r < STATS_SHM_NB_RATES ? rate_names[r] : NULL;
+}
+
+bool stats_shm_alive(const struct stats_shm *shm)
+{
+	return kill(shm->hdr->pid, 0) == 0 || errno == EPERM;
+}
@@ -0,0 +1,277 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vf_xstats.h"
+
+#define __MODULE__ "vf_xstats"
+#include "log.h"
+#include "virtio_worker.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bsd/string.h>
+#include <unistd.h>
+#include <rte_version.h>
+#if RTE_VERSION_NUM(21, 00, 0, 0) <= RTE_VERSION
+#ifdef RTE_NET_BOND
+#define RTE_LIBRTE_PMD_BOND
+#endif
+#endif
+#ifdef RTE_LIBRTE_PMD_BOND
+#include <rte_eth_bond.h>
+#endif
+
+/* How often the thread checks whether it must stop. */
+#define VF_XSTATS_POLL_MS 100
+
+/* Cached extended statistics of a DPDK port. */
+struct xstats_port {
+	dpdk_port_t port;
+	char name[RTE_ETH_NAME_MAX_LEN];
+	unsigned n;
+	struct rte_eth_xstat_name *names; /* Indexed by statistic ID. */
+	uint64_t *values; /* Indexed by statistic ID. */
+};
+
+/* Ports of a relay: the VF, and the slaves of a bond. */
+struct xstats_relay {
+	unsigned nb_ports;
+	struct xstats_port ports[1 + MAX_NUM_BOND_SLAVES];
+};
+
+static struct {
+	pthread_t thread;
+	volatile bool running;
+	unsigned interval_ms;
+	pthread_mutex_t lock; /* Protects the cache. */
+	struct xstats_relay relays[MAX_RELAYS];
+} xs = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void port_reset(struct xstats_port *p)
+{
+	free(p->names);
+	free(p->values);
+	p->names = NULL;
+	p->values = NULL;
+	p->n = 0;
+}
+
+/*
+ * Read the extended statistics of @a port into @a p. The names are only read
+ * again when the port or its number of statistics changes. Called with
+ * xs.lock held.
+ */
+static void port_refresh(struct xstats_port *p, dpdk_port_t port)
+{
+	struct rte_eth_xstat *xstats;
+	int n = rte_eth_xstats_get(port, NULL, 0);
+
+	if (n <= 0) {
+		port_reset(p);
+		return;
+	}
+
+	if (p->port != port || p->n != (unsigned)n || !p->names) {
+		port_reset(p);
+		p->names = calloc(n, sizeof(*p->names));
+		p->values = calloc(n, sizeof(*p->values));
+		if (!p->names || !p->values ||
+				rte_eth_xstats_get_names(port, p->names, n) != n) {
+			port_reset(p);
+			return;
+		}
+		p->port = port;
+		p->n = n;
+		if (rte_eth_dev_get_name_by_port(port, p->name))
+			snprintf(p->name, sizeof(p->name), "port%u",
+				(unsigned)port);
+	}
+
+	xstats = malloc(n * sizeof(*xstats));
+	if (!xstats)
+		return;
+	if (rte_eth_xstats_get(port, xstats, n) != n) {
+		/* The statistics changed, read the names next round. */
+		port_reset(p);
+	} else {
+		for (int i=0; i<n; ++i)
+			if (xstats[i].id < p->n)
+				p->values[xstats[i].id] = xstats[i].value;
+	}
+	free(xstats);
+}
+
+/* Collect the ports of a held relay, whose VF is @a port, into @a ports. */
+static unsigned relay_ports(const vio_vf_relay_t *relay, dpdk_port_t port,
+			dpdk_port_t *ports)
+{
+	unsigned n = 0;
+
+	ports[n++] = port;
+#ifdef RTE_LIBRTE_PMD_BOND
+	if (relay->dpdk.is_bond) {
+		dpdk_port_t slaves[MAX_NUM_BOND_SLAVES];
+		int nb_slaves = rte_eth_bond_slaves_get(port,
+						slaves, MAX_NUM_BOND_SLAVES);
+
+		for (int i=0; i<nb_slaves; ++i)
+			ports[n++] = slaves[i];
+	}
+#endif
+
+	return n;
+}
+
+static void vf_xstats_round(void)
+{
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		const vio_vf_relay_t *relay = get_relay_from_id(id);
+		struct xstats_relay *r = &xs.relays[id];
+		dpdk_port_t ports[1 + MAX_NUM_BOND_SLAVES];
+		dpdk_port_t port;
+		unsigned n = 0, i;
+		bool held;
+
+		/* Keep the VF from being detached while it is read. */
+		held = virtio_forwarder_vf_hold(id, &port);
+		if (held)
+			n = relay_ports(relay, port, ports);
+
+		pthread_mutex_lock(&xs.lock);
+		for (i=0; i<n; ++i)
+			port_refresh(&r->ports[i], ports[i]);
+		for (; i<r->nb_ports; ++i)
+			port_reset(&r->ports[i]);
+		r->nb_ports = n;
+		pthread_mutex_unlock(&xs.lock);
+		if (held)
+			virtio_forwarder_vf_release(id);
+	}
+}
+
+static void *vf_xstats_thread(void *arg __attribute__((unused)))
+{
+	log_debug("VF xstats thread started");
+	while (xs.running) {
+		vf_xstats_round();
+		for (unsigned ms=0; ms<xs.interval_ms && xs.running;
+				ms+=VF_XSTATS_POLL_MS)
+			usleep(VF_XSTATS_POLL_MS * 1000);
+	}
+	log_debug("VF xstats thread ended");
+
+	return NULL;
+}
+
+int vf_xstats_start(unsigned interval_ms)
+{
+	if (!interval_ms)
+		return 0;
+
+	xs.interval_ms = interval_ms;
+	xs.running = true;
+	if (pthread_create(&xs.thread, NULL, vf_xstats_thread, NULL)) {
+		log_error("Could not create VF xstats thread!");
+		xs.running = false;
+		return -1;
+	}
+	log_info("Reading VF extended statistics every %u ms", interval_ms);
+
+	return 0;
+}
+
+void vf_xstats_stop(void)
+{
+	if (!xs.running)
+		return;
+
+	xs.running = false;
+	pthread_join(xs.thread, NULL);
+
+	pthread_mutex_lock(&xs.lock);
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		for (unsigned i=0; i<xs.relays[id].nb_ports; ++i)
+			port_reset(&xs.relays[id].ports[i]);
+		xs.relays[id].nb_ports = 0;
+	}
+	pthread_mutex_unlock(&xs.lock);
+}
+
+static bool name_matches(const char *name, char *const *filters,
+			size_t n_filters)
+{
+	if (!n_filters)
+		return true;
+	for (size_t i=0; i<n_filters; ++i)
+		if (strstr(name, filters[i]))
+			return true;
+
+	return false;
+}
+
+unsigned vf_xstats_get(unsigned relay_id, char *const *filters,
+			size_t n_filters, struct vf_xstat *xstats, unsigned max,
+			bool *truncated)
+{
+	unsigned n = 0;
+
+	*truncated = false;
+	if (relay_id >= MAX_RELAYS)
+		return 0;
+
+	pthread_mutex_lock(&xs.lock);
+	const struct xstats_relay *r = &xs.relays[relay_id];
+	for (unsigned i=0; i<r->nb_ports; ++i) {
+		const struct xstats_port *p = &r->ports[i];
+
+		for (unsigned id=0; id<p->n; ++id) {
+			if (!name_matches(p->names[id].name, filters, n_filters))
+				continue;
+			if (n == max) {
+				*truncated = true;
+				goto out;
+			}
+			strlcpy(xstats[n].port, p->name, sizeof(xstats[n].port));
+			strlcpy(xstats[n].name, p->names[id].name,
+				sizeof(xstats[n].name));
+			xstats[n].value = p->values[id];
+			++n;
+		}
+	}
+out:
+	pthread_mutex_unlock(&xs.lock);
+
+	return n;
+}
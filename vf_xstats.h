@@ -0,0 +1,76 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VF_XSTATS_H
+#define _VF_XSTATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <rte_ethdev.h>
+
+/** An extended statistic of the VF of a relay, or of a slave of its bond. */
+struct vf_xstat {
+	char port[RTE_ETH_NAME_MAX_LEN]; /* Name of the DPDK port. */
+	char name[RTE_ETH_XSTATS_NAME_SIZE];
+	uint64_t value;
+};
+
+/**
+ * @brief Start the VF extended statistics housekeeping thread.
+ *
+ * Every @a interval_ms, the thread reads the extended statistics of the VF of
+ * every ready relay, and of the slaves of bonds, into a cache. The workers
+ * are not involved.
+ *
+ * @param interval_ms Time between two reads, 0 to not start the thread.
+ * @return 0 on success, -1 on error.
+ */
+int vf_xstats_start(unsigned interval_ms);
+
+/** @brief Stop the VF extended statistics housekeeping thread. */
+void vf_xstats_stop(void);
+
+/**
+ * @brief Get the cached extended statistics of relay @a relay_id.
+ * @param filters Substrings, one of which a statistic's name must contain,
+ *                or NULL if @a n_filters is 0 to get all statistics.
+ * @param xstats Array receiving up to @a max statistics.
+ * @param truncated Set if the statistics did not all fit.
+ * @return Number of entries filled in.
+ */
+unsigned vf_xstats_get(unsigned relay_id, char *const *filters,
+			size_t n_filters, struct vf_xstat *xstats, unsigned max,
+			bool *truncated);
+
+#endif /* _VF_XSTATS_H */
@@ -43,6 +43,7 @@
 #define rte_ipv4_hdr ipv4_hdr
 #define rte_ipv6_hdr ipv6_hdr
 #define rte_udp_hdr udp_hdr
+#define rte_tcp_hdr tcp_hdr
 #endif /* RTE_VERSION_NUM(19, 8, 0, 0) > RTE_VERSION */
 
 #if RTE_VERSION_NUM(20, 11, 0, 0) > RTE_VERSION
@@ -51,3 +52,20 @@
 
 #define rte_get_main_lcore rte_get_master_lcore
 #endif /* RTE_VERSION_NUM(20, 11, 0, 0) > RTE_VERSION */
+
+#if RTE_VERSION_NUM(21, 11, 0, 0) > RTE_VERSION
+#define RTE_MBUF_F_TX_L4_MASK PKT_TX_L4_MASK
+#define RTE_MBUF_F_TX_TCP_CKSUM PKT_TX_TCP_CKSUM
+#define RTE_MBUF_F_TX_UDP_CKSUM PKT_TX_UDP_CKSUM
+#define RTE_MBUF_F_TX_TCP_SEG PKT_TX_TCP_SEG
+#define RTE_MBUF_F_TX_IPV4 PKT_TX_IPV4
+#define RTE_MBUF_F_RX_L4_CKSUM_MASK PKT_RX_L4_CKSUM_MASK
+#define RTE_MBUF_F_RX_L4_CKSUM_GOOD PKT_RX_L4_CKSUM_GOOD
+#define RTE_MBUF_F_RX_L4_CKSUM_BAD PKT_RX_L4_CKSUM_BAD
+#define RTE_MBUF_F_RX_RSS_HASH PKT_RX_RSS_HASH
+#endif /* RTE_VERSION_NUM(21, 11, 0, 0) > RTE_VERSION */
+
+#if RTE_VERSION_NUM(22, 03, 0, 0) > RTE_VERSION
+#define RTE_ETH_TX_OFFLOAD_UDP_CKSUM DEV_TX_OFFLOAD_UDP_CKSUM
+#define RTE_ETH_TX_OFFLOAD_TCP_CKSUM DEV_TX_OFFLOAD_TCP_CKSUM
+#endif /* RTE_VERSION_NUM(22, 03, 0, 0) > RTE_VERSION */
@@ -35,6 +35,7 @@
 #include "log.h"
 #include "cmdline.h"
 #include "virtio_vhostuser.h"
+#include "virtio_worker.h"
 #include "dpdk_eal.h"
 #include "ovsdb_mon.h"
 #include "file_mon.h"
@@ -43,6 +44,8 @@
 #include "zmq_port_control.h"
 #include "zmq_server.h"
 #include "zmq_stats.h"
+#include "zmq_stats_pub.h"
+#include "stats_history.h"
 #include "zmq_core_sched.h"
 #include "rte_version.h"
 
@@ -72,6 +75,8 @@
 #define DEFAULT_ZMQ_CONFIG_EP "ipc:///var/run/virtio-forwarder/config"
 #define DEFAULT_ZMQ_PORT_CONTROL_EP "ipc:///var/run/virtio-forwarder/port_control"
 #define DEFAULT_ZMQ_STATS_EP "ipc:///var/run/virtio-forwarder/stats"
+#define DEFAULT_ZMQ_STATS_PUB_EP "ipc:///var/run/virtio-forwarder/stats_pub"
+#define DEFAULT_STATS_PUB_INTERVAL_MS 1000
 #define DEFAULT_ZMQ_CORE_SCHED_EP "ipc:///var/run/virtio-forwarder/core_sched"
 
 #define DEFAULT_VHOSTUSER_USERNAME "libvirt-qemu"
@@ -93,6 +98,7 @@ static bool log_syslog = true;
 static bool use_zmq_config = false;
 static bool use_zmq_port_control = false;
 static bool use_zmq_stats = false;
+static bool use_zmq_stats_pub = false;
 static bool use_zmq_core_sched = false;
 static bool use_ipc = false;
 static bool show_version = false;
@@ -103,6 +109,8 @@ static struct ovsdb_mon_conf ovsdb_cfg = {.ovsdb_sock_path=""};
 static char zmq_config_ep[1024] = {'\0'};
 static char zmq_port_control_ep[1024] = {'\0'};
 static char zmq_stats_ep[1024] = {'\0'};
+static char zmq_stats_pub_ep[1024] = {'\0'};
+static unsigned stats_pub_interval_ms = DEFAULT_STATS_PUB_INTERVAL_MS;
 static char zmq_core_sched_ep[1024] = {'\0'};
 struct virtio_vhostuser_conf vhost_conf = { 0 };
 static bool create_vhostuser_sockets = true;
@@ -138,6 +146,7 @@ __backtrace_signal_handler(int sig, siginfo_t *info __attribute__((unused)),
 	} else {
 		log_critical("-- no backtrace available --");
 	}
+	virtio_forwarder_dump_flight();
 	exit(1);
 }
 
@@ -370,6 +379,36 @@ cmdline_set_zmq_stats_ep(void *opaque __attribute__((unused)),
 	return 0;
 }
 
+static int
+cmdline_set_zmq_stats_pub_ep(void *opaque __attribute__((unused)),
+				const char *arg,
+				int opt_index __attribute__((unused)))
+{
+	if (arg)
+		strlcpy(zmq_stats_pub_ep, arg, sizeof zmq_stats_pub_ep);
+	use_zmq_stats_pub = true;
+
+	return 0;
+}
+
+static int
+cmdline_set_stats_pub_interval(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long interval = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || interval < 10 ||
+			interval > 3600000) {
+		fprintf(stderr, "Invalid stats publisher interval '%s'\n", arg);
+		return -1;
+	}
+	stats_pub_interval_ms = interval;
+
+	return 0;
+}
+
 static int
 cmdline_set_zmq_core_sched_ep(void *opaque __attribute__((unused)),
 				const char *arg,
@@ -488,6 +527,71 @@ static int cmdline_set_vf_cpus(void *opaque, const char *arg, int opt_index)
 	return rc;
 }
 
+static int
+cmdline_set_pipeline_cpu(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	unsigned virtio, cpu;
+	uint64_t cpus = 0;
+	const char *p;
+	char *eptr;
+	int n;
+
+	if (sscanf(arg, "%u:%n", &virtio, &n) != 1) {
+		fprintf(stderr, "Invalid pipeline CPU specifier '%s', format: <virtio>:<cpu>[,<cpu>...]\n",
+			arg);
+		return 1;
+	}
+	if (virtio >= MAX_RELAYS) {
+		fprintf(stderr, "Invalid virtio %u specified, must be 0-%u!\n",
+			virtio, MAX_RELAYS - 1);
+		return 1;
+	}
+	p = arg + n;
+	do {
+		cpu = strtoul(p, &eptr, 10);
+		if (eptr == p || cpu >= 64) {
+			fprintf(stderr, "Invalid pipeline CPU for virtio %u specified, must be 0-63!\n",
+				virtio);
+			return 1;
+		}
+		cpus |= (1ULL << cpu);
+		p = eptr + 1;
+	} while (*eptr == ',');
+	if (*eptr != '\0') {
+		fprintf(stderr, "Invalid pipeline CPU specifier '%s', format: <virtio>:<cpu>[,<cpu>...]\n",
+			arg);
+		return 1;
+	}
+	vhost_conf.relay_cpus[virtio].pipeline_cpus = cpus;
+
+	return 0;
+}
+
+static int cmdline_set_pipeline_cpus(void *opaque, const char *arg, int opt_index)
+{
+	char *input, *saveptr, *tok;
+	int rc;
+
+	if (!(input = strdup(arg))) {
+		fprintf(stderr, "%s: strdup: %m\n", __func__);
+		return 1;
+	}
+
+	tok = strtok_r(input, ";", &saveptr);
+	rc = 0;
+	while (tok) {
+		if ((rc = cmdline_set_pipeline_cpu(opaque, tok, opt_index)))
+			break;
+
+		tok = strtok_r(NULL, ";", &saveptr);
+	}
+	free(input);
+
+	return rc;
+}
+
 static int
 cmdline_show_version(void *opaque __attribute__((unused)),
 			const char *arg __attribute__((unused)),
@@ -609,6 +713,203 @@ cmdline_enable_dynamic_sockets(void *opaque __attribute__((unused)),
 }
 #endif
 
+static int
+cmdline_enable_tunnel_hash(void *opaque __attribute__((unused)),
+			const char *arg __attribute__((unused)),
+			int opt_index __attribute__((unused)))
+{
+	vhost_conf.tunnel_hash = 1;
+
+	return 0;
+}
+
+static int
+cmdline_enable_eventdev(void *opaque __attribute__((unused)),
+			const char *arg __attribute__((unused)),
+			int opt_index __attribute__((unused)))
+{
+	vhost_conf.eventdev = 1;
+
+	return 0;
+}
+
+static int
+cmdline_enable_graph(void *opaque __attribute__((unused)),
+			const char *arg __attribute__((unused)),
+			int opt_index __attribute__((unused)))
+{
+	vhost_conf.graph = 1;
+
+	return 0;
+}
+
+static int
+cmdline_enable_work_stealing(void *opaque __attribute__((unused)),
+			const char *arg __attribute__((unused)),
+			int opt_index __attribute__((unused)))
+{
+	vhost_conf.work_stealing = 1;
+
+	return 0;
+}
+
+static int
+cmdline_enable_native_core_sched(void *opaque __attribute__((unused)),
+			const char *arg __attribute__((unused)),
+			int opt_index __attribute__((unused)))
+{
+	vhost_conf.core_sched = 1;
+
+	return 0;
+}
+
+static int
+cmdline_set_latency_sample(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long sample = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || sample > UINT32_MAX) {
+		fprintf(stderr, "Invalid latency sampling rate '%s'\n", arg);
+		return -1;
+	}
+	vhost_conf.latency_sample = sample;
+
+	return 0;
+}
+
+static int
+cmdline_set_flow_sample(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long sample = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || sample > UINT32_MAX) {
+		fprintf(stderr, "Invalid flow sampling rate '%s'\n", arg);
+		return -1;
+	}
+	vhost_conf.flow_sample = sample;
+
+	return 0;
+}
+
+static int
+cmdline_set_perf_sample(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long sample = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || sample > UINT32_MAX) {
+		fprintf(stderr, "Invalid performance counter sampling rate '%s'\n", arg);
+		return -1;
+	}
+	vhost_conf.perf_sample = sample;
+
+	return 0;
+}
+
+static int
+cmdline_set_stall_threshold(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long threshold = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || threshold > 1000000) {
+		fprintf(stderr, "Invalid stall threshold '%s'\n", arg);
+		return -1;
+	}
+	vhost_conf.stall_threshold_us = threshold;
+
+	return 0;
+}
+
+static int
+cmdline_set_xstats_interval(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long interval = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || interval > 3600000) {
+		fprintf(stderr, "Invalid xstats interval '%s'\n", arg);
+		return -1;
+	}
+	vhost_conf.xstats_interval_ms = interval;
+
+	return 0;
+}
+
+static int
+cmdline_set_stats_history(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	char *eptr;
+	unsigned long depth = strtoul(arg, &eptr, 10);
+
+	if (*arg == '\0' || *eptr != '\0' || depth > STATS_HISTORY_MAX_S) {
+		fprintf(stderr, "Invalid stats history length '%s'\n", arg);
+		return -1;
+	}
+	vhost_conf.stats_history_s = depth;
+
+	return 0;
+}
+
+static int
+cmdline_set_stats_history_file(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	if (strlcpy(vhost_conf.stats_history_path, arg,
+			sizeof(vhost_conf.stats_history_path)) >=
+			sizeof(vhost_conf.stats_history_path)) {
+		fprintf(stderr, "Stats history path '%s' is too long\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+cmdline_set_capture_dir(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	if (strlcpy(vhost_conf.capture_dir, arg,
+			sizeof(vhost_conf.capture_dir)) >=
+			sizeof(vhost_conf.capture_dir)) {
+		fprintf(stderr, "Capture directory '%s' is too long\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+cmdline_set_stats_shm(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	if (strlcpy(vhost_conf.stats_shm_path, arg,
+			sizeof(vhost_conf.stats_shm_path)) >=
+			sizeof(vhost_conf.stats_shm_path)) {
+		fprintf(stderr, "Stats segment path '%s' is too long\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 cmdline_enable_same_numa(void *opaque __attribute__((unused)),
 			const char *arg __attribute__((unused)),
@@ -637,6 +938,22 @@ cmdline_set_vfio_vf_token(void *opaque __attribute__((unused)),
 }
 #endif
 
+#if RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+static int
+cmdline_set_trace(void *opaque __attribute__((unused)),
+			const char *arg,
+			int opt_index __attribute__((unused)))
+{
+	if (*arg == '\0' || strlen(arg) >= TRACE_PATTERN_LEN) {
+		fprintf(stderr, "Invalid trace pattern '%s'\n", arg);
+		return -1;
+	}
+	strlcpy(dpdk_cfg.trace, arg, TRACE_PATTERN_LEN);
+
+	return 0;
+}
+#endif
+
 static int configure_signals(void)
 {
 	sigset_t sigset;
@@ -683,6 +1000,8 @@ cmdline_opt_t opts[] = {
 	{ "zmq-config-ep", 'Y', 0, cmdline_set_zmq_config_ep, 2, "Use ZeroMQ IPC on the given endpoint to respond to configuration queries (default: "DEFAULT_ZMQ_CONFIG_EP")" },
 	{ "zmq-port-control-ep", 'Z', 0, cmdline_set_zmq_port_control_ep, 2, "Use ZeroMQ IPC on the given endpoint to add/remove VF&virtio instead of OVSDB (default: "DEFAULT_ZMQ_PORT_CONTROL_EP")" },
 	{ "zmq-stats-ep", 'z', 0, cmdline_set_zmq_stats_ep, 2, "Use ZeroMQ IPC on the given endpoint to report stats instead of PTY (default: "DEFAULT_ZMQ_STATS_EP")" },
+	{ "zmq-stats-pub-ep", 'f', 0, cmdline_set_zmq_stats_pub_ep, 2, "Publish periodic, delta encoded stats updates with ZeroMQ on the given endpoint (default: "DEFAULT_ZMQ_STATS_PUB_EP")" },
+	{ "stats-pub-interval", 'Q', 0, cmdline_set_stats_pub_interval, 1, "Time between two stats updates on the publisher endpoint, in milliseconds (default: 1000)" },
 	{ "zmq-core-sched-ep", 's', 0, cmdline_set_zmq_core_sched_ep, 2, "Use ZeroMQ IPC on the given endpoint to enable CPU load balancing (default: "DEFAULT_ZMQ_CORE_SCHED_EP")" },
 	{ "ipc", 'I', 0, cmdline_set_ipc, 0, "Use IPC to add/remove VF&virtio instead of OVSDB (default: use OVSDB monitoring)" },
 	{ "vhost-username", 'u', 0, cmdline_set_vhost_username, 2, "vhost-user unix socket ownership username, omit value to inherit process username (default: "DEFAULT_VHOSTUSER_USERNAME")" },
@@ -690,6 +1009,7 @@ cmdline_opt_t opts[] = {
 	{ "vhost-path", 'V', 0, cmdline_set_vhost_path, 1, "vhost-user unix socket directory path (default: "DEFAULT_VHOSTUSER_PATH")" },
 	{ "vhost-socket", 'S', 0, cmdline_set_vhost_socket, 1, "vhost-user unix socket file name, must contain exactly one %u to denote VirtIO ID (default: "DEFAULT_VHOSTUSER_SOCKNAME")" },
 	{ "virtio-cpu", 'c', 0, cmdline_set_vf_cpus, 1, "Semicolon-delimited list of '<virtio>:<cpu>[,<cpu>]' strings specifying which CPU(s) to use for the specified virtio IDs. Can be specified more than once." },
+	{ "pipeline-cpu", 'e', 0, cmdline_set_pipeline_cpus, 1, "Semicolon-delimited list of '<virtio>:<cpu>[,<cpu>...]' strings. Runs the VF to VM direction of the specified virtio IDs in pipeline mode, copying into the guest's queues on up to 4 additional CPUs. Can be specified more than once." },
 	{ "enable-jumbo", 'J', 0, cmdline_enable_jumbo, 0, "Enable jumbo frame support for the relay (increases hugepage memory requirement)" },
 	{ "enable-mrgbuf", 'R', 0, cmdline_enable_mrgbuf, 0, "Enable virtio RX buffer merging (can impact small packet performance)" },
 	{ "add-pci-vf", 'P', 0, cmdline_add_static_vf, 1, "Add a static VF, <PCI>=<virtio_id>, e.g. 0000:05:08.1=1" },
@@ -706,6 +1026,29 @@ cmdline_opt_t opts[] = {
 #if RTE_VERSION_NUM(17, 5, 0, 0) <= RTE_VERSION
 	{ "dynamic-sockets", 'd', 0, cmdline_enable_dynamic_sockets, 0, "Connect to sockets dynamically instead of creating the default sockets (default: disabled)" },
 #endif
+	{ "tunnel-hash", 'U', 0, cmdline_enable_tunnel_hash, 0, "Steer VXLAN and GENEVE packets to multiqueue guests by their inner headers (default: disabled)" },
+#if RTE_VERSION_NUM(17, 11, 0, 0) <= RTE_VERSION
+	{ "eventdev", 'E', 0, cmdline_enable_eventdev, 0, "Schedule packet transmission of all relays over all worker CPUs through an event device, instead of on the relay CPUs (default: disabled)" },
+#endif
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+	{ "graph", 'G', 0, cmdline_enable_graph, 0, "Run the datapath of each worker CPU as a graph of nodes, with per node statistics (default: disabled)" },
+#endif
+	{ "work-stealing", 'W', 0, cmdline_enable_work_stealing, 0, "Let lightly loaded worker CPUs take over relay directions from busier ones on the same NUMA node (default: disabled)" },
+	{ "native-core-sched", 'N', 0, cmdline_enable_native_core_sched, 0, "Periodically rebalance relay directions over the worker CPUs from their measured cycles, without an external core scheduler (default: disabled)" },
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+	{ "latency-sample", 'L', 0, cmdline_set_latency_sample, 1, "Measure the forwarding latency of 1 in this many packets, reported per relay direction as a histogram (default: 0, disabled)" },
+	{ "flow-sample", 'w', 0, cmdline_set_flow_sample, 1, "Track the heaviest flows of every relay direction, counting 1 in this many packets (default: 0, disabled)" },
+#endif
+	{ "perf-sample", 'm', 0, cmdline_set_perf_sample, 1, "Count the worker hardware performance counters, and attribute them to the relay directions polled on 1 in this many worker passes (default: 0, disabled)" },
+	{ "stall-threshold", 'j', 0, cmdline_set_stall_threshold, 1, "Measure the gaps between the passes of every worker, and report those of this many microseconds and more as stalls, e.g. preemptions by the kernel (default: 0, disabled)" },
+#if RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+	{ "trace", 'x', 0, cmdline_set_trace, 1, "Record the DPDK tracepoints matching this regular expression, e.g. 'vio4wd' for the relay tracepoints of a build with WORKER_TRACE, saved when the daemon stops (default: disabled)" },
+#endif
+	{ "xstats-interval", 'X', 0, cmdline_set_xstats_interval, 1, "Read the extended statistics of the VFs every this many milliseconds, for the stats service (default: 0, disabled)" },
+	{ "stats-history", 'k', 0, cmdline_set_stats_history, 1, "Keep this many seconds of per relay traffic history at one second resolution, for the stats service (default: 0, disabled)" },
+	{ "stats-history-file", 'K', 0, cmdline_set_stats_history_file, 1, "Keep the traffic history in this file, so that it survives a restart (default: in memory only)" },
+	{ "capture-dir", 'D', 0, cmdline_set_capture_dir, 1, "Write the packet captures requested over the port control socket into this directory, as new files only (default: captures disabled)" },
+	{ "stats-shm", 'F', 0, cmdline_set_stats_shm, 1, "Publish the relay and worker counters in a shared memory segment at this path, for local monitoring tools (default: disabled)" },
 	{ "same-numa", 'a', 0, cmdline_enable_same_numa, 0, "No longer reserve hugapage on all numa, just reserve hugapage on numa that been used (default: disable)" },
 	{ "version", 'v', CMDLINE_PARAM_FLAG_TERMINATE, cmdline_show_version, 0, "Show version number and exit" },
 	{ 0, 0, 0, 0, 0, "\n\nVirtio-forwarder daemon: forward packets between SR-IOV VFs (serviced by DPDK) and VirtIO network backend.\n" }
@@ -740,6 +1083,8 @@ int main(int argc, char *argv[])
 	snprintf(zmq_port_control_ep, sizeof zmq_port_control_ep,
 			DEFAULT_ZMQ_PORT_CONTROL_EP);
 	snprintf(zmq_stats_ep, sizeof zmq_stats_ep, DEFAULT_ZMQ_STATS_EP);
+	snprintf(zmq_stats_pub_ep, sizeof zmq_stats_pub_ep,
+			DEFAULT_ZMQ_STATS_PUB_EP);
 	snprintf(zmq_core_sched_ep, sizeof zmq_core_sched_ep,
 			DEFAULT_ZMQ_CORE_SCHED_EP);
 
@@ -787,6 +1132,38 @@ int main(int argc, char *argv[])
 			exit(1);
 		}
 	}
+	for (int i=0; i<MAX_RELAYS; ++i) {
+		if (vhost_conf.relay_cpus[i].pipeline_cpus &
+				~vhost_conf.worker_core_bitmap) {
+			log_error("Invalid pipeline CPUs specified for virtio %u (not in CPU worker list)!",
+				i);
+			exit(1);
+		}
+		if (vhost_conf.relay_cpus[i].pipeline_cpus &&
+				vhost_conf.eventdev) {
+			log_error("Pipeline CPUs specified for virtio %u cannot be used in event mode!",
+				i);
+			exit(1);
+		}
+		if (vhost_conf.relay_cpus[i].pipeline_cpus &&
+				vhost_conf.graph) {
+			log_error("Pipeline CPUs specified for virtio %u cannot be used in graph mode!",
+				i);
+			exit(1);
+		}
+	}
+	if (vhost_conf.eventdev && vhost_conf.graph) {
+		log_error("Event mode and graph mode are mutually exclusive!");
+		exit(1);
+	}
+	if (vhost_conf.core_sched && (vhost_conf.eventdev || vhost_conf.graph)) {
+		log_error("The native core scheduler cannot be used in event or graph mode!");
+		exit(1);
+	}
+	if (vhost_conf.core_sched && vhost_conf.work_stealing) {
+		log_error("The native core scheduler and work stealing are mutually exclusive!");
+		exit(1);
+	}
 
 	if (daemonize) {
 		if (daemon(1, 0) != 0) {
@@ -848,6 +1225,14 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Start the stats publisher. */
+	if (use_zmq_stats_pub) {
+		if (zmq_stats_pub_start(zmq_stats_pub_ep, stats_pub_interval_ms)) {
+			log_critical("Exiting: Error starting ZeroMQ stats publisher");
+			exit(-1);
+		}
+	}
+
 	/* Start the VF addition/removal service. */
 	if (use_zmq_port_control) {
 		port_control_service = zmq_port_control_service_alloc();
@@ -924,6 +1309,10 @@ int main(int argc, char *argv[])
 		ovsdb_mon_stop();
 	}
 
+	/* Stop the stats publisher. */
+	if (use_zmq_stats_pub)
+		zmq_stats_pub_stop();
+
 	/* Stop the stats service. */
 	if (use_zmq_stats) {
 		if (stats_server) {
@@ -0,0 +1,113 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* A short program to illustrate how to read the statistics shared memory
+   segment of virtio-forwarder, see stats_shm.h */
+
+#include "stats_shm.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEFAULT_STATS_SHM "/var/run/virtio-forwarder/stats.shm"
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : DEFAULT_STATS_SHM;
+	const struct stats_shm_header *hdr;
+	struct stats_shm shm;
+
+	if (stats_shm_open(path, &shm)) {
+		fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	hdr = shm.hdr;
+	if (!stats_shm_alive(&shm))
+		printf("# virtio-forwarder (pid %u) is not running, the values "
+			"are stale\n", hdr->pid);
+	printf("update_ns=%" PRIu64 "\n", hdr->update_ns);
+	printf("tsc_hz=%" PRIu64 "\n", hdr->tsc_hz);
+
+	for (unsigned id=0; id<hdr->nb_relays; ++id) {
+		struct stats_shm_relay r;
+
+		if (stats_shm_read_relay(&shm, id, &r) || !r.flags)
+			continue;
+		printf("relay.%u.vhost_socket_name=%s\n", id,
+			r.vhost_socket_name);
+		printf("relay.%u.pci_dbdf=%s\n", id, r.pci_dbdf);
+		printf("relay.%u.virtio2vf_cpu=%d\n", id, r.virtio2vf_cpu);
+		printf("relay.%u.vf2virtio_cpu=%d\n", id, r.vf2virtio_cpu);
+		for (unsigned c=0; c<hdr->nb_counters; ++c) {
+			const char *name = stats_shm_counter_name(c);
+
+			if (name)
+				printf("relay.%u.%s=%" PRIu64 "\n", id, name,
+					r.counters[c]);
+		}
+		for (unsigned w=0; w<hdr->nb_windows; ++w) {
+			for (unsigned i=0; i<hdr->nb_rates; ++i) {
+				const char *name = stats_shm_rate_name(i);
+
+				if (name)
+					printf("relay.%u.%s_%us=%.1f\n", id,
+						name, hdr->windows_s[w],
+						r.rates[w][i]);
+			}
+		}
+	}
+
+	for (unsigned i=0; i<hdr->nb_workers; ++i) {
+		struct stats_shm_worker w;
+
+		if (stats_shm_read_worker(&shm, i, &w) || w.cpu < 0)
+			continue;
+		printf("worker.%d.relays=%u\n", w.cpu, w.nb_relays);
+		printf("worker.%d.iterations=%" PRIu64 "\n", w.cpu,
+			w.iterations);
+		printf("worker.%d.busy_cycles=%" PRIu64 "\n", w.cpu,
+			w.busy_cycles);
+		printf("worker.%d.idle_cycles=%" PRIu64 "\n", w.cpu,
+			w.idle_cycles);
+		printf("worker.%d.sleep_cycles=%" PRIu64 "\n", w.cpu,
+			w.sleep_cycles);
+		printf("worker.%d.overhead_cycles=%" PRIu64 "\n", w.cpu,
+			w.overhead_cycles);
+	}
+
+	stats_shm_close(&shm);
+	return 0;
+}
@@ -48,6 +48,7 @@
 struct relay_cpus {
    int vf2vio_cpu;
    int vio2vf_cpu;
+   uint64_t pipeline_cpus; /** VF to VM vhost enqueue CPUs in pipeline mode */
 };
 
 struct static_relay_entry {
@@ -71,6 +72,20 @@ struct virtio_vhostuser_conf {
     unsigned vhost_client:1;
     unsigned zerocopy:1;
     unsigned enable_tso:1;
+    unsigned tunnel_hash:1; /** Steer VXLAN/GENEVE packets on their inner headers */
+    unsigned eventdev:1; /** Schedule relay transmission through an event device */
+    unsigned graph:1; /** Run the datapath as a graph of nodes */
+    unsigned work_stealing:1; /** Let idle workers take over relay directions */
+    unsigned core_sched:1; /** Run the in-daemon core scheduler */
+    unsigned latency_sample; /** Stamp 1 in this many packets to measure forwarding latency, 0 to disable */
+    unsigned flow_sample; /** Count 1 in this many packets in the heavy hitter flow sketches, 0 to disable */
+    unsigned perf_sample; /** Attribute the hardware performance counters on 1 in this many worker passes, 0 to disable */
+    unsigned stall_threshold_us; /** Worker pass gaps reported as stalls, 0 to disable stall detection */
+    unsigned xstats_interval_ms; /** Period of the VF extended statistics reads, 0 to disable */
+    char stats_shm_path[128]; /** File the stats segment is published in, blank to disable */
+    unsigned stats_history_s; /** Seconds of per relay traffic history to keep, 0 to disable */
+    char stats_history_path[128]; /** File the history is kept in across restarts, blank for memory only */
+    char capture_dir[128]; /** Directory packet captures are written to, blank to disable captures */
 };
 
 int virtio_vhostuser_start(const struct virtio_vhostuser_conf *conf,
@@ -41,10 +41,24 @@
 #include <rte_virtio_net.h>
 #endif
 #include "rte_errno.h"
+#include "rte_malloc.h"
 #include "rte_mbuf.h"
 #include "dpdk_eal.h"
 #include "rte_ethdev.h"
 #include "cpuinfo.h"
+#include "flow_hash.h"
+#include "flow_sketch.h"
+#include "flight_rec.h"
+#include "perf_counters.h"
+#include "cpu_isolation.h"
+#include "core_sched.h"
+#include "vf_xstats.h"
+#include "dpdk_telemetry.h"
+#include "pkt_capture.h"
+#include "rate_sampler.h"
+#include "stats_history.h"
+#include "stats_shm.h"
+#include "worker_trace.h"
 #include <stdbool.h>
 #include <pthread.h>
 #include <string.h>
@@ -53,6 +67,7 @@
 #include <unistd.h>
 #include <sched.h>
 #include <sys/time.h>
+#include <time.h>
 #include <assert.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
@@ -61,8 +76,22 @@
 #include <rte_sctp.h>
 #include <rte_arp.h>
 #include <rte_jhash.h>
+#include <rte_thash.h>
 #include <rte_spinlock.h>
+#include <rte_ring.h>
 #include <rte_cycles.h>
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+#include <rte_mbuf_dyn.h>
+#endif
+#if RTE_VERSION_NUM(17, 11, 0, 0) <= RTE_VERSION
+#include <rte_eventdev.h>
+#include <rte_bus_vdev.h>
+#include <rte_service.h>
+#endif
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+#include <rte_graph.h>
+#include <rte_graph_worker.h>
+#endif
 #if RTE_VERSION_NUM(16, 7, 0, 0) > RTE_VERSION
 #include <numaif.h>
 #endif
@@ -79,7 +108,27 @@
 static worker_thread_t worker_threads[MAX_CPUS];
 static uint64_t worker_core_bitmap;
 static vio_vf_relay_t virtio_vf_relays[MAX_RELAYS];
-static relay_prev_counters_t relay_prev_counters[MAX_RELAYS];
+
+/* Event mode: relay transmission is scheduled over all workers through an
+ * event device, while reception stays on the relay CPUs. */
+static struct {
+	bool enabled;
+	uint8_t dev_id;
+	bool has_service; /* Software PMDs schedule from a service. */
+	uint32_t service_id;
+} event_engine;
+
+/* Graph mode: each worker walks a graph of datapath nodes over the relay
+ * directions it owns. */
+static struct {
+	bool enabled;
+	struct rte_graph *graphs[MAX_CPUS];
+	struct rte_graph_cluster_stats *stats;
+	rte_spinlock_t stats_sl; /* Serializes stats readers. */
+	struct virtio_graph_node_stats *stats_out;
+	unsigned stats_max;
+	unsigned stats_n;
+} graph_engine;
 
 vio_vf_relay_t * get_relay_from_id(unsigned id) {
 	if (id >= MAX_RELAYS) {
@@ -90,6 +139,50 @@ vio_vf_relay_t * get_relay_from_id(unsigned id) {
 	return &virtio_vf_relays[id];
 }
 
+/* Flight recorder: the last events of each lcore, and of the threads outside
+ * of the EAL. Only control events are recorded, so it is always on. */
+static struct flight_ring flight[MAX_CPUS + 1];
+
+static void
+flight_add(enum flight_event event, unsigned relay, uint32_t a, uint64_t b)
+{
+	unsigned lcore = rte_lcore_id();
+
+	flight_record(&flight[lcore < MAX_CPUS ? lcore : MAX_CPUS], rte_rdtsc(),
+		event, relay, a, b);
+}
+
+/* Relay state changes, with their tracepoint and flight record. */
+static void
+relay_set_vio_state(vio_vf_relay_t *relay, vio_state_t state)
+{
+	vio_state_t old = relay->vio.state;
+
+	relay->vio.state = state;
+	worker_trace_virtio_state(relay->id, old, state);
+	flight_add(FLIGHT_VIRTIO_STATE, relay->id, state, old);
+}
+
+static void
+relay_set_dpdk_state(vio_vf_relay_t *relay, dpdk_state_t state)
+{
+	dpdk_state_t old = relay->dpdk.state;
+
+	relay->dpdk.state = state;
+	worker_trace_dpdk_state(relay->id, old, state);
+	flight_add(FLIGHT_DPDK_STATE, relay->id, state, old);
+}
+
+/* A relay direction changed worker, the CPUs are packed in the record. */
+static void
+relay_migrated(vio_vf_relay_t *relay, enum relay_dir dir, int from, int to,
+		bool stolen)
+{
+	worker_trace_migrate(relay->id, dir, from, to, stolen);
+	flight_add(FLIGHT_MIGRATE, relay->id, dir | (stolen << 8),
+		(uint64_t)(uint32_t)from << 32 | (uint32_t)to);
+}
+
 static bool have_worker_on_node(int node)
 {
 	cpuinfo_t *c = get_cpuinfo();
@@ -165,9 +258,14 @@ static void find_vf2virtio_cpu(vio_vf_relay_t *relay)
 		worker_threads[relay->dpdk.vf2vio_cpu].need_update = true;
 		relay->dpdk.vf2vio_cpu = -1;
 	}
-	idlest_cpu = naive_get_idlest_worker(relay->vio.mempool_socket_id);
+	/* The core scheduler places on measured rather than estimated load. */
+	idlest_cpu = core_sched_place(relay->vio.mempool_socket_id);
+	if (idlest_cpu < 0)
+		idlest_cpu = naive_get_idlest_worker(
+					relay->vio.mempool_socket_id);
 	assert(idlest_cpu >= 0);
 	relay->dpdk.vf2vio_cpu = idlest_cpu;
+	relay->steal[RELAY_VF2VM].owned_tsc = rte_rdtsc();
 	log_debug("Found CPU %u for relay %u vf2virtio",
 		relay->dpdk.vf2vio_cpu, relay->id);
 }
@@ -575,6 +673,17 @@ static int dev_queue_configure(const char *name, dpdk_port_t port_id,
 #else
 	rte_eth_dev_info_get(port_id, &dev_info);
 #endif
+	/* Guests may request L4 checksum completion regardless of what the VF
+	 * supports. Fill in the gaps in software. */
+	relay->dpdk.sw_tcp_csum =
+		!(dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_TCP_CKSUM);
+	relay->dpdk.sw_udp_csum =
+		!(dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_UDP_CKSUM);
+	if (relay->dpdk.sw_tcp_csum || relay->dpdk.sw_udp_csum)
+		log_info("Port %hhu lacks%s%s checksum offload, using software fallback",
+			port_id, relay->dpdk.sw_tcp_csum ? " TCP" : "",
+			relay->dpdk.sw_udp_csum ? " UDP" : "");
+
 	get_tx_conf(&dev_info, &tx_conf);
 	err = rte_eth_tx_queue_setup(port_id, 0, 1024,
 				relay->vio.mempool_socket_id, &tx_conf);
@@ -666,7 +775,7 @@ static int configure_dev_with_virtio(const char *pci_dbdf, dpdk_port_t port_id,
 	relay->dpdk.dpdk_port = port_id;
 	strlcpy(relay->dpdk.pci_dbdf, pci_dbdf, 20);
 	find_vf2virtio_cpu(relay);
-	relay->dpdk.state = dpdk_state;
+	relay_set_dpdk_state(relay, dpdk_state);
 	relay->dpdk.is_bond = is_bond;
 	relay->dpdk.num_slaves = num_slaves;
 	__sync_synchronize();
@@ -854,11 +963,30 @@ error_bond_deconfigure:
 #endif
 }
 
+/*
+ * In event mode, packets of a relay may still be queued in the event device,
+ * or be transmitted by any worker, after the relay threads have let go of a
+ * device. Wait for them before the device or its mempool goes away.
+ */
+static void event_engine_quiesce(vio_vf_relay_t *relay)
+{
+	unsigned retries = 0;
+
+	if (!event_engine.enabled)
+		return;
+
+	while (relay->event_inflight && retries++ < 20)
+		usleep(50000);
+	if (relay->event_inflight)
+		log_warning("Timeout waiting for %u in-flight packets of relay %u!",
+			relay->event_inflight, relay->id);
+}
+
 static int stop_vm2vf_thread(vio_vf_relay_t *relay)
 {
 	if (relay->dpdk.vf2vio_cpu >= 0) {
 		unsigned retries = 0;
-		relay->dpdk.state = DPDK_REMOVING1;
+		relay_set_dpdk_state(relay, DPDK_REMOVING1);
 		while (relay->dpdk.state != DPDK_UNINIT && retries++ < 20)
 			usleep(50000);
 		if (relay->dpdk.state != DPDK_UNINIT) {
@@ -913,6 +1041,7 @@ static int detach_device(vio_vf_relay_t *relay)
 	err = stop_vm2vf_thread(relay);
 	if (err)
 		return err;
+	event_engine_quiesce(relay);
 
 	/* Update workers. */
 	tmpidx = relay->dpdk.vf2vio_cpu;
@@ -920,8 +1049,9 @@ static int detach_device(vio_vf_relay_t *relay)
 	__sync_synchronize();
 	worker_threads[tmpidx].need_update = true;
 
-	/* Detach VF. */
+	/* Detach VF, once the stats readers are done with it. */
 	log_debug("Stopping PCI '%s' device (port %hhu)", pci_dbdf, port_id);
+	pthread_mutex_lock(&relay->dpdk.port_lock);
 	if (relay->dpdk.is_bond) {
 		detach_slaves(relay);
 		rte_eth_dev_stop(port_id);
@@ -936,6 +1066,7 @@ static int detach_device(vio_vf_relay_t *relay)
 		log_debug("Removed PCI '%s' device as port %hhu",
 			pci_dbdf, port_id);
 	} else {
+		pthread_mutex_unlock(&relay->dpdk.port_lock);
 		return 2;
 	}
 	log_info("removing DPDK port %hhu ('%s') from virtio %u", port_id,
@@ -944,6 +1075,7 @@ static int detach_device(vio_vf_relay_t *relay)
 	relay->dpdk.pci_dbdf[0] = 0;
 	relay->dpdk.is_bond = false;
 	relay->dpdk.num_slaves = 0;
+	pthread_mutex_unlock(&relay->dpdk.port_lock);
 #if RTE_VERSION_NUM(16, 7, 0, 0) <= RTE_VERSION
 	if (relay->vio.state == VIRTIO_UNINIT) {
 		rte_mempool_free(relay->vio.mempool);
@@ -1002,6 +1134,23 @@ int virtio_forwarder_remove_vf(const char *pci_dbdf, unsigned virtio_id)
 	return virtio_forwarder_remove_vf2(pci_dbdf, virtio_id, false);
 }
 
+/*
+ * Check whether this worker could not allocate @a n mbufs from @a mp: they
+ * come from the worker's cache, then from the common pool. Unlike
+ * rte_mempool_avail_count(), this does not walk the caches of every lcore.
+ */
+static inline bool mempool_short(struct rte_mempool *mp, unsigned n)
+{
+	struct rte_mempool_cache *cache =
+		rte_mempool_default_cache(mp, rte_lcore_id());
+	unsigned avail = rte_mempool_ops_get_count(mp);
+
+	if (cache)
+		avail += cache->len;
+
+	return avail < n;
+}
+
 #if RTE_VERSION_NUM(16, 7, 0, 0) > RTE_VERSION
 static inline uint16_t __attribute__((always_inline))
 vring_available_entries(struct virtio_net *dev, uint16_t queue_id)
@@ -1015,89 +1164,91 @@ vring_available_entries(struct virtio_net *dev, uint16_t queue_id)
 }
 #endif
 
-static inline uint32_t calc_eth_header_hash(struct rte_ether_hdr *eth_hdr)
-{
-	struct rte_udp_hdr *udp_h;
-	struct rte_ipv4_hdr *ipv4_h;
-	uint32_t buf[16];
-	uint32_t hashwords=0;
-	const unsigned int IPV6_HDR_LEN = 40;
-
-	if (likely(eth_hdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))) {
-		ipv4_h = (struct rte_ipv4_hdr *)(eth_hdr + 1);
-		buf[hashwords++] = ipv4_h->src_addr;
-		buf[hashwords++] = ipv4_h->dst_addr;
-		buf[hashwords++] = ipv4_h->next_proto_id;
-		int ipv4_hdrlen = (ipv4_h->version_ihl & RTE_IPV4_HDR_IHL_MASK) *
-					RTE_IPV4_IHL_MULTIPLIER;
-		if (likely(ipv4_h->next_proto_id == IPPROTO_TCP ||
-				ipv4_h->next_proto_id == IPPROTO_UDP ||
-				ipv4_h->next_proto_id == IPPROTO_SCTP)) {
-			udp_h = (struct rte_udp_hdr *)((unsigned char *)ipv4_h +
-					ipv4_hdrlen);
-			buf[hashwords++] = (udp_h->dst_port<<16) +
-						udp_h->src_port;
-		}
-	} else if (eth_hdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6)) {
-		struct rte_ipv6_hdr *ipv6_h;
-		uint32_t *p;
-		ipv6_h = (struct rte_ipv6_hdr *)(eth_hdr + 1);
-		p = (uint32_t*)(ipv6_h->src_addr);
-		/* ipv6 source addr */
-		buf[hashwords++] = *(p++);
-		buf[hashwords++] = *(p++);
-		buf[hashwords++] = *(p++);
-		buf[hashwords++] = *(p++);
-
-		/* ipv6 destination addr */
-		buf[hashwords++] = *(p++);
-		buf[hashwords++] = *(p++);
-		buf[hashwords++] = *(p++);
-		buf[hashwords++] = *(p++);
-
-		/* Protocol type */
-		buf[hashwords++] = ipv6_h->proto;
-
-		/* Now L4 source and destination */
-		if (likely(ipv6_h->proto == IPPROTO_TCP ||
-				ipv6_h->proto == IPPROTO_UDP ||
-				ipv6_h->proto == IPPROTO_SCTP)) {
-			/* A cast to struct rte_udp_hdr is used here for the
-			 * TCP, UDP and SCTP case because the first 32 bits
-			 * of these L4 protocols are always the source and
-			 * destination ports
-			 */
-			udp_h = (struct rte_udp_hdr *)((unsigned char *)ipv6_h +
-					IPV6_HDR_LEN);
-			buf[hashwords++] = (udp_h->dst_port<<16) +
-						udp_h->src_port;
-		}
+static inline uint32_t calc_eth_header_hash(struct rte_mbuf *m)
+{
+	uint32_t key[FLOW_HASH_KEY_WORDS];
+	unsigned hashwords;
+
+	hashwords = flow_hash_key(rte_pktmbuf_mtod(m, const uint8_t *),
+				rte_pktmbuf_data_len(m),
+				g_vio_worker_conf.tunnel_hash, key);
+
+	return rte_jhash_32b(key, hashwords, 0xdeadbee5);
+}
 
+/*
+ * Select a queue as the guest's RSS configuration would. Returns -1 if the
+ * default steering hash should be used instead.
+ */
+static inline int calc_rss_queue(const vio_vf_relay_t *relay, struct rte_mbuf *m)
+{
+	const struct relay_rss *rss = &relay->vio.rss;
+	uint32_t input[RTE_THASH_V6_L4_LEN];
+	struct flow_tuple t;
+	uint32_t l3_type, l4_type = 0;
+	unsigned len = 0, naddr, i;
+
+	if (!flow_hash_tuple(rte_pktmbuf_mtod(m, const uint8_t *),
+				rte_pktmbuf_data_len(m), &t))
+		return rss->unclassified_queue;
+
+	if (t.ip_version == 4) {
+		naddr = 1;
+		l3_type = VIRTIO_NET_RSS_HASH_TYPE_IPv4;
+		if (t.proto == IPPROTO_TCP)
+			l4_type = VIRTIO_NET_RSS_HASH_TYPE_TCPv4;
+		else if (t.proto == IPPROTO_UDP)
+			l4_type = VIRTIO_NET_RSS_HASH_TYPE_UDPv4;
 	} else {
-		/* Non-IPv4 ethernet. */
-		buf[hashwords++] = *((uint32_t*)(eth_hdr)+0);
-		buf[hashwords++] = *((uint32_t*)(eth_hdr)+1);
-		buf[hashwords++] = *((uint32_t*)(eth_hdr)+2);
-		buf[hashwords++] = eth_hdr->ether_type;
+		naddr = 4;
+		l3_type = VIRTIO_NET_RSS_HASH_TYPE_IPv6;
+		if (t.proto == IPPROTO_TCP)
+			l4_type = VIRTIO_NET_RSS_HASH_TYPE_TCPv6;
+		else if (t.proto == IPPROTO_UDP)
+			l4_type = VIRTIO_NET_RSS_HASH_TYPE_UDPv6;
 	}
 
-	return rte_jhash_32b(buf, hashwords, 0xdeadbee5);
+	for (i=0; i<naddr; ++i)
+		input[len++] = t.src[i];
+	for (i=0; i<naddr; ++i)
+		input[len++] = t.dst[i];
+	if (t.has_ports && (rss->hash_types & l4_type))
+		input[len++] = ((uint32_t)t.sport << 16) | t.dport;
+	else if (!(rss->hash_types & l3_type))
+		return rss->unclassified_queue;
+
+	return rss->reta[rte_softrss_be(input, len, (const uint8_t *)rss->key_be) &
+		(VIRTIO_RSS_RETA_SIZE - 1)];
 }
 
 static inline void
 calc_mbuf_queue(vio_vf_relay_t *relay, struct rte_mbuf **pkts, uint16_t nb_pkts)
 {
+	bool rss = relay->vio.rss.enabled;
+	unsigned fallback = 0;
 	uint16_t i;
 	uint32_t h;
-	struct rte_ether_hdr *eth_hdr;
+	int q;
 
 	for (i=0; i<nb_pkts; ++i) {
 		rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
 	}
 
 	for (i=0; i<nb_pkts; ++i) {
-		eth_hdr = rte_pktmbuf_mtod(pkts[i], struct rte_ether_hdr *);
-		h = calc_eth_header_hash(eth_hdr);
+		if (rss) {
+			/* The guest may not have enabled every queue its
+			 * indirection table points at yet. */
+			q = calc_rss_queue(relay, pkts[i]);
+			if (q >= 0 && (relay->vio.rx_q_bitmap & (1ULL<<q))) {
+				pkts[i]->hash.fdir.id = q;
+				++relay->queue_steered[q];
+				continue;
+			}
+			if (q >= 0)
+				++fallback;
+		}
+
+		h = calc_eth_header_hash(pkts[i]);
 
 		/* Determine queue that is to be used for each packet. */
 		if (likely(relay->vio.pow2queues))
@@ -1110,7 +1261,12 @@ calc_mbuf_queue(vio_vf_relay_t *relay, struct rte_mbuf **pkts, uint16_t nb_pkts)
 
 		/* Batch same queue packets. */
 		pkts[i]->hash.fdir.id = h;
+		++relay->queue_steered[h];
 	}
+	/* Also counted when the packets are sent, hence atomic. */
+	if (unlikely(fallback))
+		__sync_fetch_and_add(&relay->stats.vio_queue_fallback,
+				fallback);
 }
 
 #if defined(VIRTIO_RETRY_ENQUEUE)
@@ -1142,6 +1298,64 @@ worker_vhost_enqueue_burst(struct virtio_net *dev, uint16_t q,
 }
 #endif
 
+/* Worker CPU field of a relay direction. */
+static inline int *relay_dir_cpu(vio_vf_relay_t *relay, enum relay_dir dir)
+{
+	return dir == RELAY_VM2VF ? &relay->vio.vio2vf_cpu :
+				&relay->dpdk.vf2vio_cpu;
+}
+
+/* Packets received so far by a relay direction. */
+static inline uint64_t relay_dir_pkts(const vio_vf_relay_t *relay,
+					enum relay_dir dir)
+{
+	return dir == RELAY_VM2VF ? relay->stats.vio_rx : relay->stats.dpdk_rx;
+}
+
+/*
+ * Move one direction of a relay to worker @a new_cpu. Returns 1 if it moved,
+ * 0 if it already was there and -1 if it cannot be moved.
+ */
+static int
+move_relay_dir(vio_vf_relay_t *relay, enum relay_dir dir, int new_cpu)
+{
+	int *cpu = relay_dir_cpu(relay, dir);
+	int old_lcore = *cpu;
+
+	if (!worker_threads[new_cpu].initialized) {
+		log_warning("Cannot move to uninitialized cpu.");
+		return -1;
+	}
+	if (dir == RELAY_VM2VF && relay->vio.state != VIRTIO_READY) {
+		log_warning("Will not attempt to alter virtio2vf cpu state before the VM has connected.");
+		return -1;
+	}
+	if (dir == RELAY_VF2VM && !(relay->dpdk.state == DPDK_ADDED ||
+			relay->dpdk.state == DPDK_READY)) {
+		log_warning("Will not attempt to alter vf2virtio cpu state before the VF has been initialized.");
+		return -1;
+	}
+	if (old_lcore == new_cpu)
+		return 0;
+
+	/* Update data structures. */
+	*cpu = new_cpu;
+	relay->steal[dir].owned_tsc = rte_rdtsc();
+	if (dir == RELAY_VM2VF)
+		__sync_fetch_and_add(&relay->stats.vio2vf_migrations, 1);
+	else
+		__sync_fetch_and_add(&relay->stats.vf2vio_migrations, 1);
+	relay_migrated(relay, dir, old_lcore, new_cpu, false);
+	worker_threads[old_lcore].need_update = true;
+	worker_threads[new_cpu].need_update = true;
+	/* thread->active_relays field will be updated in worker_func
+	 * due to the need_update flag. */
+	log_debug("Moved relay %u's %s cpu to %d.", relay->id,
+		dir == RELAY_VM2VF ? "virtio2vf" : "vf2virtio", new_cpu);
+
+	return 1;
+}
+
 int
 migrate_relay_cpus(int relay_number, int new_virtio2vf_cpu,
 			int new_vf2virtio_cpu)
@@ -1154,54 +1368,47 @@ migrate_relay_cpus(int relay_number, int new_virtio2vf_cpu,
 			relay->id);
 		return -1;
 	}
-	worker_thread_t *thread;
 
-	/* Move virtio2vf. */
-	if (!worker_threads[new_virtio2vf_cpu].initialized) {
-		log_warning("Cannot move to uninitialized cpu.");
-	}
-	else if (relay->vio.state != VIRTIO_READY) {
-		log_warning("Will not attempt to alter virtio2vf cpu state before the VM has connected.");
-	}
-	else if (relay->vio.vio2vf_cpu != new_virtio2vf_cpu) {
-		/* Update data structures. */
-		unsigned old_lcore = relay->vio.vio2vf_cpu;
-		relay->vio.vio2vf_cpu = new_virtio2vf_cpu;
-		thread = &worker_threads[old_lcore];
-		thread->need_update = true;
-		thread = &worker_threads[new_virtio2vf_cpu];
-		thread->need_update = true;
-		/* thread->active_relays field will be updated in worker_func
-		 * due to the need_update flag. */
-		log_debug("Moved relay %u's virtio2vf cpu to %d.",
-			relay->id, new_virtio2vf_cpu);
-	}
-
-	/* Move vf2virtio. */
-	if (!worker_threads[new_vf2virtio_cpu].initialized) {
-		log_warning("Cannot move to uninitialized cpu.");
-	}
-	else if (!(relay->dpdk.state == DPDK_ADDED ||
-			relay->dpdk.state == DPDK_READY)) {
-		log_warning("Will not attempt to alter vf2virtio cpu state before the VF has been initialized.");
-	}
-	else if (relay->dpdk.vf2vio_cpu != new_vf2virtio_cpu) {
-		/* Update data structures. */
-		unsigned old_lcore = relay->dpdk.vf2vio_cpu;
-		relay->dpdk.vf2vio_cpu = new_vf2virtio_cpu;
-		thread = &worker_threads[old_lcore];
-		thread->need_update = true;
-		thread = &worker_threads[new_vf2virtio_cpu];
-		thread->need_update = true;
-		/* thread->active_relays field will be updated in worker_func
-		 * due to the need_update flag. */
-		log_debug("Moved relay %u's vf2virtio cpu to %d.",
-			relay->id, new_vf2virtio_cpu);
-	}
+	move_relay_dir(relay, RELAY_VM2VF, new_virtio2vf_cpu);
+	move_relay_dir(relay, RELAY_VF2VM, new_vf2virtio_cpu);
 
 	return 0;
 }
 
+int
+migrate_relay_dir(unsigned relay_number, enum relay_dir dir, int cpu)
+{
+	if (relay_number >= MAX_RELAYS || cpu < 0 || cpu >= MAX_CPUS ||
+			((1ULL<<cpu) & worker_core_bitmap) == 0) {
+		log_warning("Attempted to assign an invalid cpu when migrating relay %u.",
+			relay_number);
+		return -1;
+	}
+
+	return move_relay_dir(&virtio_vf_relays[relay_number], dir, cpu);
+}
+
+void
+virtio_forwarder_get_relay_load(unsigned id,
+				struct virtio_relay_load load[RELAY_NB_DIRS])
+{
+	assert(id < MAX_RELAYS);
+	const vio_vf_relay_t *relay = &virtio_vf_relays[id];
+	const struct relay_cpus *conf = &g_vio_worker_conf.relay_cpus[id];
+
+	load[RELAY_VM2VF].active = (relay->vio.state == VIRTIO_READY);
+	load[RELAY_VM2VF].cpu = relay->vio.vio2vf_cpu;
+	load[RELAY_VM2VF].pinned = (conf->vio2vf_cpu != -1);
+	load[RELAY_VF2VM].active = (relay->dpdk.state == DPDK_READY);
+	load[RELAY_VF2VM].cpu = relay->dpdk.vf2vio_cpu;
+	load[RELAY_VF2VM].pinned = (conf->vf2vio_cpu != -1);
+	for (int dir=0; dir<RELAY_NB_DIRS; ++dir) {
+		load[dir].socket_id = relay->vio.mempool_socket_id;
+		load[dir].cycles = relay->cycles[dir];
+		load[dir].owned_tsc = relay->steal[dir].owned_tsc;
+	}
+}
+
 static inline void update_thread(worker_thread_t *thread)
 {
 	uint64_t active_relays = 0;
@@ -1213,14 +1420,383 @@ static inline void update_thread(worker_thread_t *thread)
 		if ((relay->dpdk.state != DPDK_UNINIT &&
 				relay->dpdk.vf2vio_cpu == thread->cpu) ||
 				(relay->vio.state != VIRTIO_UNINIT &&
-				relay->vio.vio2vf_cpu == thread->cpu))
+				relay->vio.vio2vf_cpu == thread->cpu) ||
+				(relay->pipeline.cpu_mask & (1ULL << thread->cpu)))
 			active_relays |= (1ULL << w);
 	}
 	thread->active_relays = active_relays;
+	worker_trace_update(thread->cpu, active_relays);
+	flight_add(FLIGHT_WORKER_UPDATE, 0, thread->cpu, active_relays);
 	log_debug("Worker %u got signal to update state, active_relays=0x%08llX",
 		thread->cpu, (unsigned long long)active_relays);
 }
 
+/*
+ * Whether a relay direction may be stolen: it must be forwarding, must not
+ * have been pinned on the command line, and must have stayed on its current
+ * CPU for STEAL_RESIDENCY_MS.
+ */
+static bool relay_dir_stealable(const vio_vf_relay_t *relay,
+				enum relay_dir dir, uint64_t now)
+{
+	const struct relay_cpus *conf = &g_vio_worker_conf.relay_cpus[relay->id];
+
+	if (dir == RELAY_VM2VF) {
+		if (relay->vio.state != VIRTIO_READY || conf->vio2vf_cpu != -1)
+			return false;
+	} else {
+		if (relay->dpdk.state != DPDK_READY || conf->vf2vio_cpu != -1)
+			return false;
+	}
+
+	return now - relay->steal[dir].owned_tsc >=
+		rte_get_tsc_hz() / 1000 * STEAL_RESIDENCY_MS;
+}
+
+/*
+ * Try to take a relay direction over from the busiest worker on the NUMA node
+ * of @a thief. The direction with the highest load that still narrows the gap
+ * between both workers is taken. Ownership changes hands with a compare and
+ * swap of the direction's CPU field; the direction's spinlock keeps the two
+ * workers from forwarding it at the same time until the victim has noticed.
+ */
+static void steal_work(worker_thread_t *thief, uint64_t now)
+{
+	cpuinfo_t *c = get_cpuinfo();
+	worker_thread_t *victim = NULL;
+	vio_vf_relay_t *best = NULL;
+	enum relay_dir best_dir = RELAY_VM2VF;
+	uint64_t gap, best_load = 0, relays;
+
+	for (int cpu=0; cpu<MAX_CPUS; ++cpu) {
+		worker_thread_t *w = &worker_threads[cpu];
+
+		if (cpu == thief->cpu || !w->initialized ||
+				((1ULL<<cpu) & worker_core_bitmap) == 0 ||
+				c->cpus[cpu].numanode != c->cpus[thief->cpu].numanode)
+			continue;
+		if (!victim || w->steal_load > victim->steal_load)
+			victim = w;
+	}
+	if (!victim || victim->steal_load <= thief->steal_load)
+		return;
+
+	/* Hysteresis: only act on a significant imbalance. */
+	gap = victim->steal_load - thief->steal_load;
+	if (gap < STEAL_MIN_PKTS ||
+			gap * 100 < victim->steal_load * STEAL_IMBALANCE_PCT)
+		return;
+
+	for (relays = victim->active_relays; relays; ) {
+		unsigned w = __builtin_ffsll(relays) - 1;
+		vio_vf_relay_t *relay = &virtio_vf_relays[w];
+
+		relays &= ~(1ULL << w);
+		for (int dir=0; dir<RELAY_NB_DIRS; ++dir) {
+			uint64_t load = relay->steal[dir].load;
+
+			if (*relay_dir_cpu(relay, dir) != victim->cpu ||
+					load <= best_load || 2 * load >= gap ||
+					!relay_dir_stealable(relay, dir, now))
+				continue;
+			best = relay;
+			best_dir = dir;
+			best_load = load;
+		}
+	}
+	if (!best || !__sync_bool_compare_and_swap(relay_dir_cpu(best, best_dir),
+						victim->cpu, thief->cpu))
+		return;
+
+	best->steal[best_dir].owned_tsc = now;
+	best->steal[best_dir].prev_pkts = relay_dir_pkts(best, best_dir);
+	if (best_dir == RELAY_VM2VF) {
+		__sync_fetch_and_add(&best->stats.vio2vf_migrations, 1);
+		__sync_fetch_and_add(&best->stats.vio2vf_steals, 1);
+	} else {
+		__sync_fetch_and_add(&best->stats.vf2vio_migrations, 1);
+		__sync_fetch_and_add(&best->stats.vf2vio_steals, 1);
+	}
+	relay_migrated(best, best_dir, victim->cpu, thief->cpu, true);
+	thief->steal_load += best_load;
+	victim->need_update = true;
+	thief->need_update = true;
+	log_debug("CPU %d stole relay %u %s from CPU %d (%"PRIu64" vs %"PRIu64" packets)",
+		thief->cpu, best->id,
+		best_dir == RELAY_VM2VF ? "virtio2vf" : "vf2virtio",
+		victim->cpu, thief->steal_load - best_load,
+		victim->steal_load);
+}
+
+/*
+ * Work stealing step of a worker, run every STEAL_INTERVAL_MS: sample the load
+ * of the relay directions it owns, then look for work if it is the less busy.
+ */
+static void steal_interval(worker_thread_t *thread, uint64_t now)
+{
+	uint64_t relays = thread->active_relays, load = 0;
+
+	while (relays) {
+		unsigned w = __builtin_ffsll(relays) - 1;
+		vio_vf_relay_t *relay = &virtio_vf_relays[w];
+
+		relays &= ~(1ULL << w);
+		for (int dir=0; dir<RELAY_NB_DIRS; ++dir) {
+			struct relay_steal *st = &relay->steal[dir];
+			uint64_t pkts;
+
+			if (*relay_dir_cpu(relay, dir) != thread->cpu)
+				continue;
+			pkts = relay_dir_pkts(relay, dir);
+			st->load = pkts - st->prev_pkts;
+			st->prev_pkts = pkts;
+			load += st->load;
+		}
+	}
+	thread->steal_load = load;
+	thread->steal_tsc = now + rte_get_tsc_hz() / 1000 * STEAL_INTERVAL_MS;
+
+	steal_work(thread, now);
+}
+
+/*
+ * Complete the L4 checksum of a packet received from virtio. The guest leaves
+ * the pseudo-header sum in the checksum field and flags the packet in the
+ * virtio-net header, which vhost translates to mbuf TX offload flags.
+ * Returns 1 once done, 0 if the packet cannot be handled and -1 if its IP
+ * header declares more data than the packet holds. The packet is left
+ * untouched unless 1 is returned.
+ */
+static inline int sw_csum_finalize(struct rte_mbuf *m)
+{
+	uint64_t l4 = m->ol_flags & RTE_MBUF_F_TX_L4_MASK;
+	uint16_t l4_off = m->l2_len + m->l3_len;
+	uint32_t l4_len, len;
+	void *l3_hdr, *l4_hdr;
+	uint16_t *cksum;
+
+	/* Segmentation offload implies per-segment checksums in hardware. */
+	if (m->ol_flags & RTE_MBUF_F_TX_TCP_SEG)
+		return 0;
+#if RTE_VERSION_NUM(22, 03, 0, 0) <= RTE_VERSION
+	len = rte_pktmbuf_pkt_len(m);
+#else
+	if (m->nb_segs > 1)
+		return 0;
+	len = rte_pktmbuf_data_len(m);
+#endif
+
+	l4_hdr = rte_pktmbuf_mtod_offset(m, void *, l4_off);
+	if (l4 == RTE_MBUF_F_TX_TCP_CKSUM) {
+		if (unlikely(rte_pktmbuf_data_len(m) <
+				l4_off + sizeof(struct rte_tcp_hdr)))
+			return 0;
+		cksum = &((struct rte_tcp_hdr *)l4_hdr)->cksum;
+	} else if (l4 == RTE_MBUF_F_TX_UDP_CKSUM) {
+		if (unlikely(rte_pktmbuf_data_len(m) <
+				l4_off + sizeof(struct rte_udp_hdr)))
+			return 0;
+		cksum = &((struct rte_udp_hdr *)l4_hdr)->dgram_cksum;
+	} else {
+		return 0;
+	}
+
+	/* The checksum helpers take the L4 length from the IP header, which
+	 * is the guest's word: keep them within the packet. IPv4 helpers
+	 * before DPDK 19.08 ignore options, hence the fixed header size. */
+	l3_hdr = rte_pktmbuf_mtod_offset(m, void *, m->l2_len);
+	if (m->ol_flags & RTE_MBUF_F_TX_IPV4) {
+		struct rte_ipv4_hdr *ip = l3_hdr;
+		uint16_t ip_len = rte_be_to_cpu_16(ip->total_length);
+
+		if (unlikely(m->l3_len < sizeof(*ip) ||
+				(ip->version_ihl & 0xf) * 4 != m->l3_len ||
+				ip_len < m->l3_len))
+			return -1;
+		l4_len = ip_len - sizeof(*ip);
+	} else {
+		struct rte_ipv6_hdr *ip = l3_hdr;
+
+		if (unlikely(m->l3_len < sizeof(*ip)))
+			return -1;
+		l4_len = rte_be_to_cpu_16(ip->payload_len);
+	}
+	if (unlikely(l4_off + l4_len > len))
+		return -1;
+
+	*cksum = 0;
+#if RTE_VERSION_NUM(22, 03, 0, 0) <= RTE_VERSION
+	if (m->ol_flags & RTE_MBUF_F_TX_IPV4)
+		*cksum = rte_ipv4_udptcp_cksum_mbuf(m, l3_hdr, l4_off);
+	else
+		*cksum = rte_ipv6_udptcp_cksum_mbuf(m, l3_hdr, l4_off);
+#else
+	if (m->ol_flags & RTE_MBUF_F_TX_IPV4)
+		*cksum = rte_ipv4_udptcp_cksum(l3_hdr, l4_hdr);
+	else
+		*cksum = rte_ipv6_udptcp_cksum(l3_hdr, l4_hdr);
+#endif
+	m->ol_flags &= ~RTE_MBUF_F_TX_L4_MASK;
+
+	return 1;
+}
+
+/*
+ * Finalize checksums the VF cannot offload and account for the checksum work
+ * requested by the guest on a burst received from virtio. Truncated packets
+ * are sent as they are, without asking the VF for a checksum: it would read
+ * past the packet as well.
+ */
+static inline void
+sw_csum_burst(vio_vf_relay_t *relay, struct rte_mbuf **pkts, int nb_pkts)
+{
+	unsigned sw = 0, offload = 0, trunc = 0;
+
+	for (int i=0; i<nb_pkts; ++i) {
+		uint64_t l4 = pkts[i]->ol_flags & RTE_MBUF_F_TX_L4_MASK;
+		bool need_sw;
+		int ret = 0;
+
+		if (likely(l4 == 0))
+			continue;
+
+		if (l4 == RTE_MBUF_F_TX_TCP_CKSUM)
+			need_sw = relay->dpdk.sw_tcp_csum;
+		else if (l4 == RTE_MBUF_F_TX_UDP_CKSUM)
+			need_sw = relay->dpdk.sw_udp_csum;
+		else
+			need_sw = false;
+
+		if (need_sw)
+			ret = sw_csum_finalize(pkts[i]);
+		if (ret > 0) {
+			++sw;
+		} else if (ret < 0) {
+			pkts[i]->ol_flags &= ~RTE_MBUF_F_TX_L4_MASK;
+			++trunc;
+		} else {
+			++offload;
+		}
+	}
+	relay->stats.csum_sw += sw;
+	relay->stats.csum_offload += offload;
+	relay->stats.csum_trunc += trunc;
+}
+
+/* Forwarding latency sampling, see latency_setup(). */
+static struct {
+	unsigned sample; /* Stamp one packet in this many, 0 when disabled. */
+	int offset; /* Of the dynfield holding the receive TSC. */
+	uint64_t flag; /* Dynflag marking stamped packets. */
+} latency;
+
+/*
+ * Stamp every latency.sample-th packet of a burst just received by a relay
+ * direction with the current TSC. Freshly received mbufs never carry the
+ * dynflag, so the others need not be touched.
+ */
+static inline void
+latency_stamp(vio_vf_relay_t *relay, enum relay_dir dir,
+		struct rte_mbuf **pkts, unsigned n)
+{
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+	unsigned i;
+	uint64_t now;
+
+	if (likely(!latency.sample))
+		return;
+
+	i = relay->latency_skip[dir];
+	if (i < n) {
+		now = rte_rdtsc();
+		for (; i<n; i+=latency.sample) {
+			*RTE_MBUF_DYNFIELD(pkts[i], latency.offset,
+					uint64_t *) = now;
+			pkts[i]->ol_flags |= latency.flag;
+		}
+	}
+	relay->latency_skip[dir] = i - n;
+#endif
+}
+
+/*
+ * Record the residency of the stamped packets among @a pkts, which were just
+ * transmitted or enqueued, in @a hist. @a mt must be set when several workers
+ * may transmit for the relay direction at once.
+ */
+static inline void
+latency_record(struct lat_hist *hist, struct rte_mbuf **pkts, unsigned n,
+		bool mt)
+{
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+	uint64_t now;
+
+	if (likely(!latency.sample) || !n)
+		return;
+
+	now = rte_rdtsc();
+	for (unsigned i=0; i<n; ++i) {
+		uint64_t v;
+
+		if (!(pkts[i]->ol_flags & latency.flag))
+			continue;
+		v = now - *RTE_MBUF_DYNFIELD(pkts[i], latency.offset,
+					uint64_t *);
+		if (mt)
+			lat_hist_record_mt(hist, v);
+		else
+			lat_hist_record(hist, v);
+	}
+#endif
+}
+
+/* Heavy hitter flow sampling, see flows_setup(). */
+#define FLOWS_EPOCH_MS 1000
+
+static struct {
+	unsigned sample; /* Count one packet in this many, 0 when disabled. */
+	uint64_t epoch_tsc;
+} flows;
+
+/*
+ * Count every flows.sample-th packet of a burst just received by a relay
+ * direction in its flow sketch. The flow hash of the VF is used when it
+ * provides one, saving the parse of the headers.
+ */
+static inline void
+flows_sample(vio_vf_relay_t *relay, enum relay_dir dir,
+		struct rte_mbuf **pkts, unsigned n)
+{
+	struct flow_sketch *s = relay->flows[dir];
+	unsigned i;
+	uint64_t now;
+
+	if (likely(!flows.sample))
+		return;
+
+	i = relay->flow_skip[dir];
+	if (i < n) {
+		now = rte_rdtsc();
+		for (; i<n; i+=flows.sample) {
+			struct rte_mbuf *m = pkts[i];
+			uint32_t h = (m->ol_flags & RTE_MBUF_F_RX_RSS_HASH) ?
+					m->hash.rss : calc_eth_header_hash(m);
+
+			flow_sketch_add(s, h, m->pkt_len,
+				rte_pktmbuf_mtod(m, const uint8_t *),
+				rte_pktmbuf_data_len(m), now);
+		}
+	}
+	relay->flow_skip[dir] = i - n;
+}
+
+static inline void gauge_sample(struct relay_gauge *g, uint64_t v)
+{
+	g->last = v;
+	g->sum += v;
+	++g->samples;
+}
+
 static inline int virtio_rx(vio_vf_relay_t *relay)
 {
 #if RTE_VERSION_NUM(16, 7, 0, 0) <= RTE_VERSION
@@ -1231,19 +1807,33 @@ static inline int virtio_rx(vio_vf_relay_t *relay)
 	int rcvd;
 	int try_rcv = BURST_LEN;
 	struct rte_mbuf **pkts = relay->vio.tx_pkts;
+	unsigned q = relay->vio.tx_q_rr;
 
 	if (relay->vio.state != VIRTIO_READY)
 		return -1;
 
-	if (likely((1ULL<<(relay->vio.tx_q_rr)) & relay->vio.tx_q_bitmap))
+	if (likely((1ULL<<(relay->vio.tx_q_rr)) & relay->vio.tx_q_bitmap)) {
 		rcvd = rte_vhost_dequeue_burst(dev, relay->vio.tx_q_rr*2+1,
 						relay->vio.mempool, pkts,
 						try_rcv);
-	else
+#if RTE_VERSION_NUM(17, 2, 0, 0) <= RTE_VERSION
+		/* The vhost library leaves packets in the guest's ring when it
+		 * runs out of mbufs. Tell that apart from an idle guest, asking
+		 * vhost only when the allocation must have failed. */
+		if (unlikely(rcvd < try_rcv) &&
+				mempool_short(relay->vio.mempool,
+					try_rcv - rcvd) &&
+				rte_vhost_rx_queue_count(dev,
+					relay->vio.tx_q_rr*2+1) > 0)
+			++relay->stats.vio_rx_nombuf;
+#endif
+	} else {
 		rcvd = 0;
+	}
 
 	relay->vio.tx_pkts_avail = rcvd;
 	relay->vio.tx_pkts_used = 0;
+	++relay->telemetry[RELAY_VM2VF].bursts[rcvd];
 	do { /* Increment tx_q_rr to the next valid index. */
 		++relay->vio.tx_q_rr;
 		if (relay->vio.tx_q_rr >= relay->vio.max_queue_pairs)
@@ -1258,6 +1848,13 @@ static inline int virtio_rx(vio_vf_relay_t *relay)
 			bytes += pkts[i]->pkt_len;
 		relay->stats.vio_rx += rcvd;
 		relay->stats.vio_rx_bytes += bytes;
+		relay->queue_stats[RELAY_VM2VF][q].pkts += rcvd;
+		relay->queue_stats[RELAY_VM2VF][q].bytes += bytes;
+		worker_trace_rx_burst(relay->id, RELAY_VM2VF, rcvd);
+		latency_stamp(relay, RELAY_VM2VF, pkts, rcvd);
+		flows_sample(relay, RELAY_VM2VF, pkts, rcvd);
+		if (unlikely(relay->capture & (1 << RELAY_VM2VF)))
+			pkt_capture_burst(RELAY_VM2VF, q, pkts, rcvd);
 	}
 
 	return rcvd;
@@ -1295,6 +1892,7 @@ static inline int dpdk_tx(vio_vf_relay_t *relay)
 			bytes += pkts[i]->pkt_len;
 		relay->stats.dpdk_tx+=sent;
 		relay->stats.dpdk_tx_bytes+=bytes;
+		latency_record(&relay->latency[RELAY_VM2VF], pkts, sent, false);
 	}
 
 	return sent;
@@ -1311,7 +1909,7 @@ static void worker_remove_vf(vio_vf_relay_t *relay)
 		log_debug("Freeing %u cached RX packets",
 			relay->dpdk.rx_pkts_avail);
 		rcvd = relay->dpdk.rx_pkts_avail;
-		relay->stats.vio_drop_unavail += rcvd;
+		relay->stats.vio_drop_flush += rcvd;
 		pkts = relay->dpdk.rx_pkts + relay->dpdk.rx_pkts_used;
 		while (rcvd) {
 			--rcvd;
@@ -1325,7 +1923,7 @@ static void worker_remove_vf(vio_vf_relay_t *relay)
 		log_debug("Freeing %u cached TX packets",
 			relay->vio.tx_pkts_avail);
 		rcvd = relay->vio.tx_pkts_avail;
-		relay->stats.dpdk_drop_unavail += rcvd;
+		relay->stats.dpdk_drop_flush += rcvd;
 		pkts = relay->vio.tx_pkts + relay->vio.tx_pkts_used;
 		while (rcvd) {
 			--rcvd;
@@ -1334,25 +1932,325 @@ static void worker_remove_vf(vio_vf_relay_t *relay)
 		relay->vio.tx_pkts_avail = 0;
 		relay->vio.tx_pkts_used = 0;
 	}
-	relay->dpdk.state = DPDK_UNINIT; /* Signal main thread. */
+	relay_set_dpdk_state(relay, DPDK_UNINIT); /* Signal main thread. */
 }
 
+/* Attempts at transmitting a burst before the remainder is dropped. */
+#define RELAY_TX_RETRIES 4
+
 /*
- * Forward virtio->DPDK
+ * Transmit a run of VM to VF packets of a relay, dropping what the VF does not
+ * take. Used by the engines that hand packets between workers, which must
+ * guarantee that only one worker at a time transmits for a given relay.
  */
-static inline int relay_vm2vf_traffic(vio_vf_relay_t *relay)
+static inline void
+relay_vf_tx_burst(vio_vf_relay_t *relay, struct rte_mbuf **pkts, unsigned n)
 {
-	int sent = 0;
+	unsigned sent = 0, bytes = 0, i;
+	int retries = RELAY_TX_RETRIES;
+
+	if (likely(relay->dpdk.state == DPDK_READY)) {
+		do {
+			sent += rte_eth_tx_burst(relay->dpdk.dpdk_port, 0,
+						pkts + sent, n - sent);
+		} while (sent < n && --retries);
+		for (i=0; i<sent; ++i)
+			bytes += pkts[i]->pkt_len;
+		relay->stats.dpdk_tx += sent;
+		relay->stats.dpdk_tx_bytes += bytes;
+		relay->stats.dpdk_drop_full += n - sent;
+		latency_record(&relay->latency[RELAY_VM2VF], pkts, sent, false);
+	} else {
+		/* Also counted by the relay's VM to VF CPU. */
+		__sync_fetch_and_add(&relay->stats.dpdk_drop_unavail, n);
+	}
 
-	/* There are no buffered packets in the internal
-	 * tx queue. Try to fetch packets from virtio
-	 * into mbufs. */
-	if (likely(relay->vio.tx_pkts_avail == 0))
-		virtio_rx(relay);
+	for (i=sent; i<n; ++i)
+		rte_pktmbuf_free(pkts[i]);
+}
+
+/*
+ * Transmit a run of VF to VM packets of a relay to virtio queue @a q and free
+ * them, for the event and graph engines. Packets for a queue the guest
+ * disabled since they were steered are dropped: the queue they would fall
+ * back to may be served by another worker.
+ */
+static inline void
+relay_vhost_tx_burst(vio_vf_relay_t *relay, unsigned q, struct rte_mbuf **pkts,
+		unsigned n)
+{
+	unsigned sent = 0, bytes = 0, i;
+	struct relay_queue_stats *qs;
+
+	if (likely(relay->vio.state == VIRTIO_READY &&
+			q < MAX_MULTIQUEUE_PAIRS &&
+			((1ULL << q) & relay->vio.rx_q_bitmap))) {
+		qs = &relay->queue_stats[RELAY_VF2VM][q];
+#if defined(VIRTIO_RETRY_ENQUEUE)
+		sent = worker_vhost_enqueue_burst(relay->vio.vio_dev, q*2,
+						pkts, n);
+#else
+		sent = rte_vhost_enqueue_burst(relay->vio.vio_dev, q*2,
+						pkts, n);
+#endif
+		for (i=0; i<sent; ++i)
+			bytes += pkts[i]->pkt_len;
+		/* The event device schedules the queues of a relay to
+		 * several workers at once, and the relay counters, unlike
+		 * the queue ones, are shared by every queue: update both
+		 * atomically. */
+		__sync_fetch_and_add(&relay->stats.vio_tx, sent);
+		__sync_fetch_and_add(&relay->stats.vio_tx_bytes, bytes);
+		latency_record(&relay->latency[RELAY_VF2VM], pkts, sent, true);
+		__sync_fetch_and_add(&qs->pkts, sent);
+		__sync_fetch_and_add(&qs->bytes, bytes);
+		if (sent < n) {
+			__sync_fetch_and_add(&relay->stats.vio_drop_full,
+						n - sent);
+			__sync_fetch_and_add(&qs->drops, n - sent);
+		}
+	} else {
+		__sync_fetch_and_add(&relay->stats.vio_drop_unavail, n);
+		if (q < MAX_MULTIQUEUE_PAIRS)
+			__sync_fetch_and_add(
+				&relay->queue_stats[RELAY_VF2VM][q].drops, n);
+	}
+
+	/* Enqueued packets were copied into the guest. */
+	for (i=0; i<n; ++i)
+		rte_pktmbuf_free(pkts[i]);
+}
+
+#if RTE_VERSION_NUM(17, 11, 0, 0) <= RTE_VERSION
+/* Event queues, one per transmit direction. */
+enum {EVENT_Q_VM2VF, EVENT_Q_VF2VM, EVENT_NB_QUEUES};
+
+/*
+ * Atomic flow of a relay direction. The VF is served by a single TX queue, so
+ * VM to VF traffic of a relay is one flow, while VF to VM traffic gets a flow
+ * per virtio RX queue. Devices without RTE_EVENT_DEV_CAP_CARRY_FLOW_ID do not
+ * hand the flow back on dequeue, so as in graph mode, mbuf->port carries the
+ * relay ID and hash.fdir.id the virtio RX queue.
+ */
+#define EVENT_FLOW(relay_id, q) ((relay_id) * MAX_MULTIQUEUE_PAIRS + (q))
+
+/*
+ * Hand @a n packets of a relay to the event device through the calling
+ * worker's port. Returns the number of packets accepted; the others remain
+ * with the caller, as if the TX queue was full.
+ */
+static inline unsigned
+event_inject(vio_vf_relay_t *relay, uint8_t queue_id, struct rte_mbuf **pkts,
+		unsigned n)
+{
+	struct rte_event ev[BURST_LEN];
+	bool multiqueue = (queue_id == EVENT_Q_VF2VM &&
+				relay->vio.rx_q_bitmap > 1);
+	unsigned i, sent;
+
+	for (i=0; i<n; ++i) {
+		unsigned q = multiqueue ? pkts[i]->hash.fdir.id : 0;
+
+		q %= MAX_MULTIQUEUE_PAIRS;
+		pkts[i]->port = relay->id;
+		pkts[i]->hash.fdir.id = q;
+		ev[i].event = 0;
+		ev[i].queue_id = queue_id;
+		ev[i].flow_id = EVENT_FLOW(relay->id, q);
+		ev[i].sched_type = RTE_SCHED_TYPE_ATOMIC;
+		ev[i].op = RTE_EVENT_OP_NEW;
+		ev[i].event_type = RTE_EVENT_TYPE_CPU;
+		ev[i].mbuf = pkts[i];
+	}
+
+	/* Account first: another worker may transmit them right away. */
+	__sync_fetch_and_add(&relay->event_inflight, n);
+	sent = rte_event_enqueue_new_burst(event_engine.dev_id,
+				worker_threads[rte_lcore_id()].event_port,
+				ev, n);
+	if (unlikely(sent < n))
+		__sync_fetch_and_sub(&relay->event_inflight, n - sent);
+
+	return sent;
+}
+
+/* Event mode replacement for dpdk_tx(). */
+static inline int event_vm2vf_dispatch(vio_vf_relay_t *relay)
+{
+	unsigned sent;
+
+	if (relay->dpdk.state != DPDK_READY)
+		return -1;
+
+	sent = event_inject(relay, EVENT_Q_VM2VF,
+			relay->vio.tx_pkts + relay->vio.tx_pkts_used,
+			relay->vio.tx_pkts_avail);
+	relay->vio.tx_pkts_avail -= sent;
+	relay->vio.tx_pkts_used += sent;
+
+	return sent;
+}
+
+/* Event mode replacement for virtio_tx(). */
+static inline int event_vf2vm_dispatch(vio_vf_relay_t *relay)
+{
+	unsigned sent;
+
+	if (relay->vio.state != VIRTIO_READY)
+		return -1;
+
+	sent = event_inject(relay, EVENT_Q_VF2VM,
+			relay->dpdk.rx_pkts + relay->dpdk.rx_pkts_used,
+			relay->dpdk.rx_pkts_avail);
+	relay->dpdk.rx_pkts_avail -= sent;
+	relay->dpdk.rx_pkts_used += sent;
+
+	return sent;
+}
+
+/*
+ * Event mode transmit stage, run by every worker: take a burst of events from
+ * the worker's port and transmit them. Atomic scheduling keeps the events of
+ * a flow in order and on one worker at a time. Returns the number of events
+ * taken.
+ */
+static unsigned event_worker_poll(worker_thread_t *thread)
+{
+	struct rte_event ev[BURST_LEN];
+	struct rte_mbuf *pkts[BURST_LEN];
+	unsigned n, i, j, k;
+
+	if (event_engine.has_service)
+		rte_service_run_iter_on_app_lcore(event_engine.service_id, 1);
+
+	n = rte_event_dequeue_burst(event_engine.dev_id, thread->event_port,
+				ev, BURST_LEN, 0);
+	for (i=0; i<n; i=j) {
+		struct rte_mbuf *m = ev[i].mbuf;
+		vio_vf_relay_t *relay = &virtio_vf_relays[m->port];
+
+		/* Transmit runs of events of the same flow together. */
+		for (j=i, k=0; j<n && ev[j].queue_id == ev[i].queue_id &&
+				ev[j].mbuf->port == m->port &&
+				ev[j].mbuf->hash.fdir.id == m->hash.fdir.id; ++j)
+			pkts[k++] = ev[j].mbuf;
+		if (ev[i].queue_id == EVENT_Q_VM2VF)
+			relay_vf_tx_burst(relay, pkts, k);
+		else
+			relay_vhost_tx_burst(relay, m->hash.fdir.id, pkts, k);
+		__sync_fetch_and_sub(&relay->event_inflight, k);
+	}
+
+	return n;
+}
+#else
+static inline int event_vm2vf_dispatch(vio_vf_relay_t *relay
+					__attribute__((unused)))
+{
+	return -1;
+}
+
+static inline int event_vf2vm_dispatch(vio_vf_relay_t *relay
+					__attribute__((unused)))
+{
+	return -1;
+}
+
+static unsigned
+event_worker_poll(worker_thread_t *thread __attribute__((unused)))
+{
+	return 0;
+}
+#endif
+
+static void pipeline_drain(vio_vf_relay_t *relay);
+
+/*
+ * Consecutive passes a relay direction must keep packets held for want of TX
+ * room before it is reported as backpressured. Shorter episodes are normal at
+ * high load.
+ */
+#define RELAY_BACKPRESSURE_PASSES 16
+
+static void __attribute__((noinline, cold))
+backpressure_event(vio_vf_relay_t *relay, enum relay_dir dir, unsigned held)
+{
+	worker_trace_backpressure(relay->id, dir, held);
+	flight_add(FLIGHT_BACKPRESSURE, relay->id, dir, held);
+}
+
+/*
+ * Track the packets a relay direction still holds after transmitting, and
+ * record when it becomes backpressured and when it drains again.
+ */
+static inline void
+backpressure_update(vio_vf_relay_t *relay, enum relay_dir dir, unsigned held)
+{
+	uint16_t *passes = &relay->backpressure[dir];
+
+	if (likely(held == 0 && *passes == 0))
+		return;
+	if (held) {
+		if (*passes < RELAY_BACKPRESSURE_PASSES &&
+				++*passes == RELAY_BACKPRESSURE_PASSES)
+			backpressure_event(relay, dir, held);
+	} else {
+		if (*passes == RELAY_BACKPRESSURE_PASSES)
+			backpressure_event(relay, dir, 0);
+		*passes = 0;
+	}
+}
+
+/*
+ * Advance the removal handshake of the VM->VF thread of a relay, once it holds
+ * no packets in flight. Returns 1 while the virtio side is ready.
+ */
+static inline int relay_vm2vf_sync(vio_vf_relay_t *relay)
+{
+	if (unlikely(relay->vio.state == VIRTIO_REMOVING1)) {
+		relay_set_vio_state(relay, VIRTIO_REMOVING2); /* Signal other thread. */
+		if (relay->dpdk.vf2vio_cpu == -1) {
+			/* There is no other thread. */
+			pipeline_drain(relay);
+			relay_set_vio_state(relay, VIRTIO_UNINIT);
+		}
+	}
 
-	/* Send virtio to VF. */
-	if (likely(relay->vio.tx_pkts_avail))
-		sent = dpdk_tx(relay);
+	if (unlikely(relay->dpdk.state == DPDK_REMOVING2))
+		worker_remove_vf(relay);
+
+	return (relay->vio.state == VIRTIO_READY) ? 1 : 0;
+}
+
+/*
+ * Forward virtio->DPDK. Returns the packets received and transmitted, and
+ * sets @a ready to whether the virtio side is ready.
+ */
+static inline int relay_vm2vf_traffic(vio_vf_relay_t *relay, int *ready)
+{
+	int rcvd = 0, sent = 0;
+
+	/* There are no buffered packets in the internal
+	 * tx queue. Try to fetch packets from virtio
+	 * into mbufs. */
+	if (likely(relay->vio.tx_pkts_avail == 0)) {
+		rcvd = virtio_rx(relay);
+		if (rcvd > 0)
+			sw_csum_burst(relay, relay->vio.tx_pkts,
+					relay->vio.tx_pkts_avail);
+	}
+
+	/* Send virtio to VF, or to the event device in event mode. */
+	if (likely(relay->vio.tx_pkts_avail)) {
+		unsigned offered = relay->vio.tx_pkts_avail;
+
+		if (event_engine.enabled)
+			sent = event_vm2vf_dispatch(relay);
+		else
+			sent = dpdk_tx(relay);
+		worker_trace_tx_burst(relay->id, RELAY_VM2VF, offered,
+				offered - relay->vio.tx_pkts_avail);
+	}
 
 	if (sent == -1 && relay->vio.tx_pkts_avail) {
 		/* DPDK not ready.
@@ -1360,36 +2258,33 @@ static inline int relay_vm2vf_traffic(vio_vf_relay_t *relay)
 		struct rte_mbuf **pkts = relay->vio.tx_pkts +
 					relay->vio.tx_pkts_used;
 		int avail = relay->vio.tx_pkts_avail;
-		relay->stats.dpdk_drop_unavail += avail;
+		/* Event mode workers may count at the same time. */
+		__sync_fetch_and_add(&relay->stats.dpdk_drop_unavail, avail);
 		while (avail > 0) {
 			--avail;
 			rte_pktmbuf_free(pkts[avail]);
 		}
 		relay->vio.tx_pkts_avail = 0;
 	}
+	backpressure_update(relay, RELAY_VM2VF, relay->vio.tx_pkts_avail);
 
-	if (unlikely(relay->vio.state == VIRTIO_REMOVING1)) {
-		relay->vio.state = VIRTIO_REMOVING2; /* Signal other thread. */
-		if (relay->dpdk.vf2vio_cpu == -1)
-			/* There is no other thread. */
-			relay->vio.state = VIRTIO_UNINIT;
-	}
-
-	if (unlikely(relay->dpdk.state == DPDK_REMOVING2))
-		worker_remove_vf(relay);
-
-	return (relay->vio.state == VIRTIO_READY) ? 1 : 0;
+	*ready = relay_vm2vf_sync(relay);
+	return (rcvd > 0 ? rcvd : 0) + (sent > 0 ? sent : 0);
 }
 
 static inline int dpdk_rx(vio_vf_relay_t *relay)
 {
 	int rcvd, try_rcv;
 	struct rte_mbuf **pkts = relay->dpdk.rx_pkts;
+	struct relay_telemetry *t = &relay->telemetry[RELAY_VF2VM];
+	bool sample;
 
 #ifndef VIRTIO_ECHO
 	if (relay->dpdk.state != DPDK_READY)
 		return -1;
 #endif
+	sample = (t->sample_countdown == 0);
+	--t->sample_countdown;
 
 	/* The following check prevents a segmentation fault during live
 	 * migration when using DPDK >= 17.11. */
@@ -1402,6 +2297,12 @@ static inline int dpdk_rx(vio_vf_relay_t *relay)
 					(struct virtio_net *)relay->vio.vio_dev,
 					VIRTIO_RXQ);
 #endif
+		if (unlikely(sample))
+			gauge_sample(&relay->guest_rx_free, try_rcv);
+		/* Packets are left to the VF, which counts them in imissed
+		 * once its queue overflows. */
+		if (unlikely(try_rcv == 0))
+			++relay->stats.vio_ring_empty;
 		if (try_rcv > BURST_LEN)
 			try_rcv = BURST_LEN;
 	} else {
@@ -1415,17 +2316,38 @@ static inline int dpdk_rx(vio_vf_relay_t *relay)
 #endif
 	relay->dpdk.rx_pkts_avail = rcvd;
 	relay->dpdk.rx_pkts_used = 0;
+	++t->bursts[rcvd];
+#ifndef VIRTIO_ECHO
+	if (unlikely(sample)) {
+		/* What the VF holds beyond this burst. Not all PMDs can tell. */
+		int depth = rte_eth_rx_queue_count(relay->dpdk.dpdk_port, 0);
 
-	if (relay->vio.rx_q_bitmap > 1)
-		calc_mbuf_queue(relay, pkts, rcvd);
+		if (depth >= 0)
+			gauge_sample(&relay->vf_rx_depth, depth);
+	}
+#endif
+	if (unlikely(sample))
+		t->sample_countdown = GAUGE_SAMPLE_CALLS - 1;
 
-	/* Update stats. */
+	/* Update stats. The VF's checksum verdict comes for free. */
 	if (rcvd) {
-		unsigned bytes=0;
-		for (int i=0; i<rcvd; ++i)
+		unsigned bytes=0, csum_good=0, csum_bad=0;
+		for (int i=0; i<rcvd; ++i) {
+			uint64_t l4_csum = pkts[i]->ol_flags &
+						RTE_MBUF_F_RX_L4_CKSUM_MASK;
 			bytes += pkts[i]->pkt_len;
+			csum_good += (l4_csum == RTE_MBUF_F_RX_L4_CKSUM_GOOD);
+			csum_bad += (l4_csum == RTE_MBUF_F_RX_L4_CKSUM_BAD);
+		}
 		relay->stats.dpdk_rx+=rcvd;
 		relay->stats.dpdk_rx_bytes+=bytes;
+		relay->stats.rx_csum_good+=csum_good;
+		relay->stats.rx_csum_bad+=csum_bad;
+		worker_trace_rx_burst(relay->id, RELAY_VF2VM, rcvd);
+		latency_stamp(relay, RELAY_VF2VM, pkts, rcvd);
+		flows_sample(relay, RELAY_VF2VM, pkts, rcvd);
+		if (unlikely(relay->capture & (1 << RELAY_VF2VM)))
+			pkt_capture_burst(RELAY_VF2VM, 0, pkts, rcvd);
 	}
 
 	return rcvd;
@@ -1433,7 +2355,9 @@ static inline int dpdk_rx(vio_vf_relay_t *relay)
 
 static inline int virtio_tx(vio_vf_relay_t *relay)
 {
-	bool multiqueue = (relay->vio.rx_q_bitmap > 1);
+	/* The bitmap changes under our feet: read it once. */
+	uint64_t bitmap = relay->vio.rx_q_bitmap;
+	bool multiqueue = (bitmap > 1);
 	int sent = 0;
 	struct rte_mbuf **pkts = relay->dpdk.rx_pkts + relay->dpdk.rx_pkts_used;
 
@@ -1441,24 +2365,34 @@ static inline int virtio_tx(vio_vf_relay_t *relay)
 		return -1;
 
 	if (multiqueue) {
-		unsigned i, k=0, q;
+		unsigned i, k=0, q, fallback=0;
 		int j;
-		uint8_t q_len[relay->vio.rx_q_active];
-		struct rte_mbuf *q_pkts[relay->vio.rx_q_active][BURST_LEN];
+		/* Packets are tagged with queue numbers, which may exceed
+		 * rx_q_active when the enabled queues are not contiguous. */
+		unsigned nb_q = 64 - __builtin_clzll(bitmap | 1);
+		uint8_t q_len[nb_q];
+		struct rte_mbuf *q_pkts[nb_q][BURST_LEN];
 
 		/* Batch same queue packets.
 		 * Optimization hint: This may be done redundantly when we fail
 		 * to enqueue all the packets in one go. Per-relay queues are
 		 * required to implement that though, and it won't play nice
 		 * with our disconnect logic... */
-		memset(q_len, 0, relay->vio.rx_q_active * sizeof(uint8_t));
+		memset(q_len, 0, nb_q * sizeof(uint8_t));
 		for (i=0; i<relay->dpdk.rx_pkts_avail; ++i) {
 			q = pkts[i]->hash.fdir.id;
+			if (unlikely(q >= nb_q)) { /* Queue was disabled since. */
+				q = 0;
+				++fallback;
+			}
 			q_pkts[q][q_len[q]++] = pkts[i];
 		}
+		if (unlikely(fallback))
+			__sync_fetch_and_add(&relay->stats.vio_queue_fallback,
+					fallback);
 
 		/* Send for each queue. */
-		for (i=0; i<relay->vio.rx_q_active; ++i) {
+		for (i=0; i<nb_q; ++i) {
 			if (!q_len[i])
 				continue;
 
@@ -1477,6 +2411,10 @@ static inline int virtio_tx(vio_vf_relay_t *relay)
 					bytes += q_pkts[i][j]->pkt_len;
 				relay->stats.vio_tx_bytes += bytes;
 				relay->stats.vio_tx += sent;
+				relay->queue_stats[RELAY_VF2VM][i].pkts += sent;
+				relay->queue_stats[RELAY_VF2VM][i].bytes += bytes;
+				latency_record(&relay->latency[RELAY_VF2VM],
+						q_pkts[i], sent, false);
 			}
 
 			/* Add unsuccessful packets back to the internal buffer.
@@ -1519,6 +2457,10 @@ static inline int virtio_tx(vio_vf_relay_t *relay)
 				bytes += pkts[i]->pkt_len;
 			relay->stats.vio_tx_bytes += bytes;
 			relay->stats.vio_tx += sent;
+			relay->queue_stats[RELAY_VF2VM][0].pkts += sent;
+			relay->queue_stats[RELAY_VF2VM][0].bytes += bytes;
+			latency_record(&relay->latency[RELAY_VF2VM], pkts,
+					sent, false);
 		}
 
 		/* Free packets that have been enqueued. */
@@ -1528,147 +2470,1575 @@ static inline int virtio_tx(vio_vf_relay_t *relay)
 		}
 	}
 
-	return sent;
+	return sent;
+}
+
+#if RTE_VERSION_NUM(17, 5, 0, 0) <= RTE_VERSION
+#define pipeline_ring_enqueue(r, pkts, n) \
+	rte_ring_sp_enqueue_burst(r, (void **)(pkts), n, NULL)
+#define pipeline_ring_dequeue(r, pkts, n) \
+	rte_ring_sc_dequeue_burst(r, (void **)(pkts), n, NULL)
+#else
+#define pipeline_ring_enqueue(r, pkts, n) \
+	rte_ring_sp_enqueue_burst(r, (void **)(pkts), n)
+#define pipeline_ring_dequeue(r, pkts, n) \
+	rte_ring_sc_dequeue_burst(r, (void **)(pkts), n)
+#endif
+
+/*
+ * Pipeline mode replacement for virtio_tx(): hand the received packets to the
+ * stages owning their virtio RX queues. Packets that do not fit are kept in
+ * the internal buffer for the next call.
+ */
+static inline int pipeline_dispatch(vio_vf_relay_t *relay)
+{
+	struct relay_pipeline *pl = &relay->pipeline;
+	struct rte_mbuf **pkts = relay->dpdk.rx_pkts + relay->dpdk.rx_pkts_used;
+	struct rte_mbuf *s_pkts[MAX_PIPELINE_STAGES][BURST_LEN];
+	unsigned s_len[MAX_PIPELINE_STAGES] = {0};
+	bool multiqueue = (relay->vio.rx_q_bitmap > 1);
+	unsigned i, j, s, sent, k=0;
+	int total = 0;
+
+	if (relay->vio.state != VIRTIO_READY)
+		return -1;
+
+	for (i=0; i<relay->dpdk.rx_pkts_avail; ++i) {
+		s = multiqueue ? pkts[i]->hash.fdir.id % pl->nb_stages : 0;
+		s_pkts[s][s_len[s]++] = pkts[i];
+	}
+
+	for (s=0; s<pl->nb_stages; ++s) {
+		if (!s_len[s])
+			continue;
+		sent = pipeline_ring_enqueue(pl->stages[s].ring, s_pkts[s],
+					s_len[s]);
+		total += sent;
+		for (j=sent; j<s_len[s]; ++j)
+			pkts[k++] = s_pkts[s][j];
+	}
+	relay->dpdk.rx_pkts_avail = k;
+
+	return total;
+}
+
+/*
+ * Pipeline enqueue stage @a s: copy packets handed over by the vf2vio CPU into
+ * the virtio RX queues owned by the stage. Returns the number of packets
+ * enqueued, 0 if there was nothing to do.
+ */
+static inline int
+relay_vf2vm_enqueue(vio_vf_relay_t *relay, struct relay_pipeline_stage *st,
+			unsigned s)
+{
+	unsigned nb_stages = relay->pipeline.nb_stages;
+	uint64_t bitmap = relay->vio.rx_q_bitmap;
+	unsigned i, q, nb_q, k=0;
+	int j, sent, total=0;
+
+	if (relay->vio.state != VIRTIO_READY || !bitmap)
+		return 0;
+
+	if (!st->pkts_avail) {
+		st->pkts_avail = pipeline_ring_dequeue(st->ring, st->pkts,
+						BURST_LEN);
+		if (!st->pkts_avail)
+			return 0;
+	}
+
+	nb_q = 64 - __builtin_clzll(bitmap);
+	uint8_t q_len[nb_q];
+	struct rte_mbuf *q_pkts[nb_q][BURST_LEN];
+
+	memset(q_len, 0, nb_q * sizeof(uint8_t));
+	for (i=0; i<st->pkts_avail; ++i) {
+		q = (bitmap > 1) ? st->pkts[i]->hash.fdir.id : 0;
+		/* The guest changed its queues after the packet was steered:
+		 * another stage may own the queue now. */
+		if (unlikely(q >= nb_q || !(bitmap & (1ULL<<q)) ||
+				q % nb_stages != s)) {
+			rte_pktmbuf_free(st->pkts[i]);
+			++st->vio_drop_unavail;
+			if (q < MAX_MULTIQUEUE_PAIRS) /* Not ours, hence atomic. */
+				__sync_fetch_and_add(
+				    &relay->queue_stats[RELAY_VF2VM][q].drops, 1);
+			continue;
+		}
+		q_pkts[q][q_len[q]++] = st->pkts[i];
+	}
+
+	for (q=s; q<nb_q; q+=nb_stages) {
+		if (!q_len[q])
+			continue;
+
+#if defined(VIRTIO_RETRY_ENQUEUE)
+		sent = worker_vhost_enqueue_burst(relay->vio.vio_dev,
+				q*2, q_pkts[q], q_len[q]);
+#else
+		sent = rte_vhost_enqueue_burst(relay->vio.vio_dev,
+				q*2, q_pkts[q], q_len[q]);
+#endif
+
+		if (sent) {
+			unsigned bytes=0;
+			for (j=0; j<sent; ++j)
+				bytes += q_pkts[q][j]->pkt_len;
+			st->vio_tx_bytes += bytes;
+			st->vio_tx += sent;
+			total += sent;
+			relay->queue_stats[RELAY_VF2VM][q].pkts += sent;
+			relay->queue_stats[RELAY_VF2VM][q].bytes += bytes;
+			latency_record(&relay->latency[RELAY_VF2VM],
+					q_pkts[q], sent, true);
+		}
+
+		/* Keep the rest, in order, for the next call. */
+		for (j=sent; j<q_len[q]; ++j)
+			st->pkts[k++] = q_pkts[q][j];
+
+		while (sent) {
+			--sent;
+			rte_pktmbuf_free(q_pkts[q][sent]);
+		}
+	}
+	st->pkts_avail = k;
+
+	return total;
+}
+
+/*
+ * Free the packets held by the pipeline stages of a relay. Each stage is
+ * locked in turn, so that a stage still running on another CPU finishes its
+ * burst and then sees the new virtio state.
+ */
+static void pipeline_drain(vio_vf_relay_t *relay)
+{
+	unsigned s, n;
+
+	for (s=0; s<relay->pipeline.nb_stages; ++s) {
+		struct relay_pipeline_stage *st = &relay->pipeline.stages[s];
+
+		rte_spinlock_lock(&st->sl);
+		n = st->pkts_avail;
+		while (n || (n = pipeline_ring_dequeue(st->ring, st->pkts,
+							BURST_LEN))) {
+			st->vio_drop_flush += n;
+			while (n) {
+				--n;
+				rte_pktmbuf_free(st->pkts[n]);
+			}
+		}
+		st->pkts_avail = 0;
+		rte_spinlock_unlock(&st->sl);
+	}
+}
+
+static void worker_remove_virtio(vio_vf_relay_t *relay)
+{
+	int rcvd;
+	struct rte_mbuf **pkts;
+
+	log_debug("Removing virtio instance from worker");
+	if (relay->dpdk.rx_pkts_avail) {
+		log_debug("Freeing %u cached RX packets",
+			relay->dpdk.rx_pkts_avail);
+		rcvd = relay->dpdk.rx_pkts_avail;
+		relay->stats.vio_drop_flush += rcvd;
+		pkts = relay->dpdk.rx_pkts + relay->dpdk.rx_pkts_used;
+		while (rcvd) {
+			--rcvd;
+			rte_pktmbuf_free(pkts[rcvd]);
+		}
+		relay->dpdk.rx_pkts_avail = 0;
+		relay->dpdk.rx_pkts_used = 0;
+	}
+	while (rte_spinlock_trylock(&relay->vio.sl));
+	if (relay->vio.tx_pkts_avail) {
+		log_debug("Freeing %u cached TX packets",
+			relay->vio.tx_pkts_avail);
+		rcvd = relay->vio.tx_pkts_avail;
+		relay->stats.dpdk_drop_flush += rcvd;
+		pkts = relay->vio.tx_pkts + relay->vio.tx_pkts_used;
+		while (rcvd) {
+			--rcvd;
+			rte_pktmbuf_free(pkts[rcvd]);
+		}
+		relay->vio.tx_pkts_avail = 0;
+		relay->vio.tx_pkts_used = 0;
+	}
+	rte_spinlock_unlock(&relay->vio.sl);
+	pipeline_drain(relay);
+	relay_set_vio_state(relay, VIRTIO_UNINIT); /* Signal main thread. */
+}
+
+/*
+ * Advance the removal handshake of the VF->VM thread of a relay, once it holds
+ * no packets in flight. Returns 1 while the VF side is ready.
+ */
+static inline int relay_vf2vm_sync(vio_vf_relay_t *relay)
+{
+	if (unlikely(relay->vio.state == VIRTIO_REMOVING2))
+		worker_remove_virtio(relay);
+
+	if (unlikely(relay->dpdk.state == DPDK_REMOVING1)) {
+		relay_set_dpdk_state(relay, DPDK_REMOVING2); /* Signal other thread. */
+		if (relay->vio.vio2vf_cpu == -1)
+			/* There is no other thread. */
+			relay_set_dpdk_state(relay, DPDK_UNINIT);
+	}
+
+	return (relay->dpdk.state == DPDK_READY) ? 1 : 0;
+}
+
+/*
+ * Forward DPDK->virtio. Returns the packets received and transmitted, and
+ * sets @a ready to whether the VF side is ready.
+ */
+static inline int relay_vf2vm_traffic(vio_vf_relay_t *relay, int *ready)
+{
+	int rcvd = 0, sent = 0;
+
+	/* There are no buffered packets in the internal
+	 * rx queue. Try to fetch packets from the VF
+	 * into mbufs. */
+	if (likely(relay->dpdk.rx_pkts_avail == 0)) {
+		rcvd = dpdk_rx(relay);
+		if (rcvd > 0 && relay->vio.rx_q_bitmap > 1)
+			calc_mbuf_queue(relay, relay->dpdk.rx_pkts,
+					relay->dpdk.rx_pkts_avail);
+	}
+
+	/* Send dpdk to VM, or to the enqueue stages in pipeline mode, or to
+	 * the event device in event mode. */
+	if (likely(relay->dpdk.rx_pkts_avail)) {
+		unsigned offered = relay->dpdk.rx_pkts_avail;
+
+		if (relay->pipeline.nb_stages)
+			sent = pipeline_dispatch(relay);
+		else if (event_engine.enabled)
+			sent = event_vf2vm_dispatch(relay);
+		else
+			sent = virtio_tx(relay);
+		worker_trace_tx_burst(relay->id, RELAY_VF2VM, offered,
+				offered - relay->dpdk.rx_pkts_avail);
+	}
+
+	if (sent == -1 && relay->dpdk.rx_pkts_avail) {
+		/* Virtio not ready.
+		 * Free buffered packets. */
+		struct rte_mbuf **pkts = relay->dpdk.rx_pkts +
+					relay->dpdk.rx_pkts_used;
+		int avail = relay->dpdk.rx_pkts_avail;
+		relay->stats.vio_drop_unavail += avail;
+		while (avail > 0) {
+			--avail;
+			rte_pktmbuf_free(pkts[avail]);
+		}
+		relay->dpdk.rx_pkts_avail = 0;
+	}
+	backpressure_update(relay, RELAY_VF2VM, relay->dpdk.rx_pkts_avail);
+
+	*ready = relay_vf2vm_sync(relay);
+	return (rcvd > 0 ? rcvd : 0) + (sent > 0 ? sent : 0);
+}
+
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+/*
+ * Graph mode nodes. Within the graph, mbuf->port carries the ID of the relay a
+ * packet belongs to. The source nodes pick the next edge per relay, so nodes
+ * for features a relay does not use are left out of its path.
+ */
+#define GRAPH_WORKER_NAME_FMT "vio4wd_worker_%d"
+
+enum {GRAPH_VHOST_RX_NEXT_VF_TX, GRAPH_VHOST_RX_NEXT_SW_CSUM,
+	GRAPH_VHOST_RX_NB_NEXT};
+enum {GRAPH_VF_RX_NEXT_VHOST_TX, GRAPH_VF_RX_NEXT_STEER, GRAPH_VF_RX_NB_NEXT};
+
+/*
+ * Length of the run of packets of the same relay at the start of @a pkts,
+ * looking at no more than @a n packets.
+ */
+static inline unsigned
+graph_relay_run(struct rte_mbuf **pkts, unsigned n)
+{
+	unsigned i;
+
+	for (i=1; i<n && pkts[i]->port == pkts[0]->port; ++i)
+		;
+
+	return i;
+}
+
+/* Move the @a n packets received for @a relay to edge @a next of @a node. */
+static inline void
+graph_source_put(struct rte_graph *graph, struct rte_node *node,
+		rte_edge_t next, vio_vf_relay_t *relay, struct rte_mbuf **pkts,
+		unsigned n)
+{
+	void **to = rte_node_next_stream_get(graph, node, next, n);
+
+	for (unsigned i=0; i<n; ++i) {
+		pkts[i]->port = relay->id;
+		to[i] = pkts[i];
+	}
+	rte_node_next_stream_put(graph, node, next, n);
+}
+
+/* Source node: dequeue from the virtio TX queues of the locked relays. */
+static uint16_t
+graph_vhost_rx_process(struct rte_graph *graph, struct rte_node *node,
+		void **objs __attribute__((unused)),
+		uint16_t nb_objs __attribute__((unused)))
+{
+	uint64_t relays = worker_threads[rte_lcore_id()].graph_vm2vf;
+	uint16_t total = 0;
+
+	while (relays) {
+		unsigned w = __builtin_ffsll(relays) - 1;
+		vio_vf_relay_t *relay = &virtio_vf_relays[w];
+		int rcvd;
+
+		relays &= ~(1ULL << w);
+		rcvd = virtio_rx(relay);
+		if (rcvd <= 0)
+			continue;
+		graph_source_put(graph, node,
+			(relay->dpdk.sw_tcp_csum || relay->dpdk.sw_udp_csum) ?
+				GRAPH_VHOST_RX_NEXT_SW_CSUM :
+				GRAPH_VHOST_RX_NEXT_VF_TX,
+			relay, relay->vio.tx_pkts, rcvd);
+		relay->vio.tx_pkts_avail = 0;
+		total += rcvd;
+	}
+
+	return total;
+}
+
+/* Finalize the checksums the VF of a relay cannot offload. */
+static uint16_t
+graph_sw_csum_process(struct rte_graph *graph, struct rte_node *node,
+		void **objs, uint16_t nb_objs)
+{
+	struct rte_mbuf **pkts = (struct rte_mbuf **)objs;
+	unsigned i, n;
+
+	for (i=0; i<nb_objs; i+=n) {
+		n = graph_relay_run(pkts + i, nb_objs - i);
+		sw_csum_burst(&virtio_vf_relays[pkts[i]->port], pkts + i, n);
+	}
+	rte_node_next_stream_move(graph, node, 0);
+
+	return nb_objs;
+}
+
+/* Sink node: transmit to the VFs. */
+static uint16_t
+graph_vf_tx_process(struct rte_graph *graph __attribute__((unused)),
+		struct rte_node *node __attribute__((unused)),
+		void **objs, uint16_t nb_objs)
+{
+	struct rte_mbuf **pkts = (struct rte_mbuf **)objs;
+	unsigned i, n;
+
+	for (i=0; i<nb_objs; i+=n) {
+		n = graph_relay_run(pkts + i, RTE_MIN(nb_objs - i, BURST_LEN));
+		relay_vf_tx_burst(&virtio_vf_relays[pkts[i]->port], pkts + i, n);
+	}
+
+	return nb_objs;
+}
+
+/* Source node: receive from the VFs of the locked relays. */
+static uint16_t
+graph_vf_rx_process(struct rte_graph *graph, struct rte_node *node,
+		void **objs __attribute__((unused)),
+		uint16_t nb_objs __attribute__((unused)))
+{
+	uint64_t relays = worker_threads[rte_lcore_id()].graph_vf2vm;
+	uint16_t total = 0;
+
+	while (relays) {
+		unsigned w = __builtin_ffsll(relays) - 1;
+		vio_vf_relay_t *relay = &virtio_vf_relays[w];
+		int rcvd;
+
+		relays &= ~(1ULL << w);
+		rcvd = dpdk_rx(relay);
+		if (rcvd <= 0)
+			continue;
+		graph_source_put(graph, node,
+			relay->vio.rx_q_bitmap > 1 ?
+				GRAPH_VF_RX_NEXT_STEER :
+				GRAPH_VF_RX_NEXT_VHOST_TX,
+			relay, relay->dpdk.rx_pkts, rcvd);
+		relay->dpdk.rx_pkts_avail = 0;
+		total += rcvd;
+	}
+
+	return total;
+}
+
+/* Classify packets onto the virtio RX queues of their relay. */
+static uint16_t
+graph_steer_process(struct rte_graph *graph, struct rte_node *node,
+		void **objs, uint16_t nb_objs)
+{
+	struct rte_mbuf **pkts = (struct rte_mbuf **)objs;
+	unsigned i, n;
+
+	for (i=0; i<nb_objs; i+=n) {
+		n = graph_relay_run(pkts + i, nb_objs - i);
+		calc_mbuf_queue(&virtio_vf_relays[pkts[i]->port], pkts + i, n);
+	}
+	rte_node_next_stream_move(graph, node, 0);
+
+	return nb_objs;
+}
+
+/* Enqueue a run of packets of one relay, batched per virtio queue. */
+static inline void
+graph_vhost_tx_run(vio_vf_relay_t *relay, struct rte_mbuf **pkts, unsigned n)
+{
+	unsigned nb_q = 64 - __builtin_clzll(relay->vio.rx_q_bitmap | 1);
+	unsigned i, q, fallback = 0;
+
+	if (nb_q == 1) {
+		relay_vhost_tx_burst(relay, 0, pkts, n);
+		return;
+	}
+
+	uint8_t q_len[nb_q];
+	struct rte_mbuf *q_pkts[nb_q][BURST_LEN];
+
+	memset(q_len, 0, nb_q * sizeof(uint8_t));
+	for (i=0; i<n; ++i) {
+		q = pkts[i]->hash.fdir.id;
+		if (unlikely(q >= nb_q)) { /* Queue was disabled since. */
+			q = 0;
+			++fallback;
+		}
+		q_pkts[q][q_len[q]++] = pkts[i];
+	}
+	if (unlikely(fallback))
+		__sync_fetch_and_add(&relay->stats.vio_queue_fallback,
+				fallback);
+	for (q=0; q<nb_q; ++q)
+		if (q_len[q])
+			relay_vhost_tx_burst(relay, q, q_pkts[q], q_len[q]);
+}
+
+/* Sink node: enqueue to the virtio RX queues. */
+static uint16_t
+graph_vhost_tx_process(struct rte_graph *graph __attribute__((unused)),
+		struct rte_node *node __attribute__((unused)),
+		void **objs, uint16_t nb_objs)
+{
+	struct rte_mbuf **pkts = (struct rte_mbuf **)objs;
+	unsigned i, n;
+
+	for (i=0; i<nb_objs; i+=n) {
+		n = graph_relay_run(pkts + i, RTE_MIN(nb_objs - i, BURST_LEN));
+		graph_vhost_tx_run(&virtio_vf_relays[pkts[i]->port], pkts + i, n);
+	}
+
+	return nb_objs;
+}
+
+static struct rte_node_register graph_vhost_rx_node = {
+	.name = "vio4wd_vhost_rx",
+	.flags = RTE_NODE_SOURCE_F,
+	.process = graph_vhost_rx_process,
+	.nb_edges = GRAPH_VHOST_RX_NB_NEXT,
+	.next_nodes = {
+		[GRAPH_VHOST_RX_NEXT_VF_TX] = "vio4wd_vf_tx",
+		[GRAPH_VHOST_RX_NEXT_SW_CSUM] = "vio4wd_sw_csum",
+	},
+};
+RTE_NODE_REGISTER(graph_vhost_rx_node);
+
+static struct rte_node_register graph_sw_csum_node = {
+	.name = "vio4wd_sw_csum",
+	.process = graph_sw_csum_process,
+	.nb_edges = 1,
+	.next_nodes = {"vio4wd_vf_tx"},
+};
+RTE_NODE_REGISTER(graph_sw_csum_node);
+
+static struct rte_node_register graph_vf_tx_node = {
+	.name = "vio4wd_vf_tx",
+	.process = graph_vf_tx_process,
+};
+RTE_NODE_REGISTER(graph_vf_tx_node);
+
+static struct rte_node_register graph_vf_rx_node = {
+	.name = "vio4wd_vf_rx",
+	.flags = RTE_NODE_SOURCE_F,
+	.process = graph_vf_rx_process,
+	.nb_edges = GRAPH_VF_RX_NB_NEXT,
+	.next_nodes = {
+		[GRAPH_VF_RX_NEXT_VHOST_TX] = "vio4wd_vhost_tx",
+		[GRAPH_VF_RX_NEXT_STEER] = "vio4wd_steer",
+	},
+};
+RTE_NODE_REGISTER(graph_vf_rx_node);
+
+static struct rte_node_register graph_steer_node = {
+	.name = "vio4wd_steer",
+	.process = graph_steer_process,
+	.nb_edges = 1,
+	.next_nodes = {"vio4wd_vhost_tx"},
+};
+RTE_NODE_REGISTER(graph_steer_node);
+
+static struct rte_node_register graph_vhost_tx_node = {
+	.name = "vio4wd_vhost_tx",
+	.process = graph_vhost_tx_process,
+};
+RTE_NODE_REGISTER(graph_vhost_tx_node);
+
+/*
+ * Graph mode iteration of a worker: lock the relay directions it owns, walk
+ * its graph over them, then advance their removal handshakes. A walk leaves no
+ * packets behind, the sinks drop what cannot be transmitted. Returns 1 if any
+ * relay direction is ready.
+ */
+static int graph_worker_walk(worker_thread_t *thread)
+{
+	uint64_t relays = thread->active_relays;
+	int cpu_processed = 0;
+	unsigned w;
+
+	thread->graph_vm2vf = thread->graph_vf2vm = 0;
+	while (relays) {
+		w = __builtin_ffsll(relays) - 1;
+		vio_vf_relay_t *relay = &virtio_vf_relays[w];
+
+		relays &= ~(1ULL << w);
+		if (relay->vio.vio2vf_cpu == thread->cpu &&
+				likely(rte_spinlock_trylock(&relay->vio.sl)))
+			thread->graph_vm2vf |= 1ULL << w;
+		if (relay->dpdk.vf2vio_cpu == thread->cpu &&
+				likely(rte_spinlock_trylock(&relay->dpdk.sl)))
+			thread->graph_vf2vm |= 1ULL << w;
+	}
+
+	rte_graph_walk(graph_engine.graphs[thread->cpu]);
+
+	/* The handshake of a direction takes the lock of the other direction,
+	 * so only hold one lock per relay at a time, as the static engine. */
+	for (relays = thread->graph_vf2vm; relays; relays &= ~(1ULL << w)) {
+		w = __builtin_ffsll(relays) - 1;
+		rte_spinlock_unlock(&virtio_vf_relays[w].dpdk.sl);
+	}
+	for (relays = thread->graph_vm2vf; relays; relays &= ~(1ULL << w)) {
+		w = __builtin_ffsll(relays) - 1;
+		cpu_processed |= relay_vm2vf_sync(&virtio_vf_relays[w]);
+		rte_spinlock_unlock(&virtio_vf_relays[w].vio.sl);
+	}
+	for (relays = thread->graph_vf2vm; relays; relays &= ~(1ULL << w)) {
+		w = __builtin_ffsll(relays) - 1;
+		if (likely(rte_spinlock_trylock(&virtio_vf_relays[w].dpdk.sl))) {
+			cpu_processed |= relay_vf2vm_sync(&virtio_vf_relays[w]);
+			rte_spinlock_unlock(&virtio_vf_relays[w].dpdk.sl);
+		}
+	}
+
+	return cpu_processed;
+}
+
+/* Collects the node entries of a cluster stats query into graph_engine. */
+static int
+graph_stats_collect(bool is_first, bool is_last __attribute__((unused)),
+		void *cookie __attribute__((unused)),
+		const struct rte_graph_cluster_node_stats *st)
+{
+	struct virtio_graph_node_stats *out;
+
+	if (is_first)
+		graph_engine.stats_n = 0;
+	if (graph_engine.stats_n >= graph_engine.stats_max)
+		return 0;
+
+	out = &graph_engine.stats_out[graph_engine.stats_n++];
+	strlcpy(out->name, st->name, sizeof(out->name));
+	out->calls = st->calls;
+	out->objs = st->objs;
+	out->cycles = st->cycles;
+
+	return 0;
+}
+#else
+static int graph_worker_walk(worker_thread_t *thread __attribute__((unused)))
+{
+	return 0;
+}
+#endif
+
+/*
+ * Charge the cycles since checkpoint @a tsc to @a counter, and move the
+ * checkpoint. Returns the cycles charged.
+ */
+static inline uint64_t worker_charge(uint64_t *counter, uint64_t *tsc)
+{
+	uint64_t now = rte_rdtsc();
+	uint64_t delta = now - *tsc;
+
+	*counter += delta;
+	*tsc = now;
+
+	return delta;
+}
+
+/*
+ * Totals of the counters of a worker, as it last published them, for the
+ * stats service: reading the group of another CPU would interrupt it.
+ */
+struct perf_totals {
+	/* Under a sequence lock: odd while being written. */
+	volatile uint32_t seq;
+	unsigned mask; /* Counters published, 0 if none. */
+	uint64_t counters[PERF_NB_COUNTERS];
+} __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
+
+/* Hardware performance counter sampling, see perf_setup(). */
+static struct {
+	unsigned sample; /* Attribute one pass in this many, 0 when disabled. */
+	unsigned nb_open; /* Workers counting. */
+	unsigned mask; /* Counters open on every worker counting. */
+	rte_spinlock_t sl; /* Serializes opening and closing groups. */
+	struct perf_group group[MAX_CPUS];
+	struct perf_totals totals[MAX_CPUS];
+} perf;
+
+/*
+ * Publish the totals of worker @a cpu, from the worker itself, or none if
+ * @a mask is 0.
+ */
+static void
+perf_publish(unsigned cpu, const uint64_t counters[PERF_NB_COUNTERS],
+		unsigned mask)
+{
+	struct perf_totals *t = &perf.totals[cpu];
+
+	__atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	t->mask = mask;
+	if (mask)
+		memcpy(t->counters, counters, sizeof(t->counters));
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&t->seq, t->seq + 1, __ATOMIC_RELAXED);
+}
+
+/* Read the counters of worker @a cpu on a sampled pass, and publish them. */
+static inline void perf_sample_totals(unsigned cpu)
+{
+	uint64_t counters[PERF_NB_COUNTERS];
+
+	if (!perf_group_read(&perf.group[cpu], counters, true))
+		perf_publish(cpu, counters, perf.group[cpu].mask);
+}
+
+/* Copy the totals last published by worker @a cpu into @a s. */
+static void perf_read(unsigned cpu, struct virtio_worker_state *s)
+{
+	const struct perf_totals *t = &perf.totals[cpu];
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&t->seq, __ATOMIC_ACQUIRE);
+		s->perf_mask = t->mask;
+		memcpy(s->perf, t->counters, sizeof(s->perf));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+			seq != __atomic_load_n(&t->seq, __ATOMIC_RELAXED));
+}
+
+/*
+ * Open the performance counters of worker @a cpu, from the worker itself. A
+ * worker that cannot open them forwards without.
+ */
+static void perf_open(unsigned cpu)
+{
+	struct perf_group *g = &perf.group[cpu];
+	int ret;
+
+	if (!perf.sample)
+		return;
+
+	rte_spinlock_lock(&perf.sl);
+	ret = perf_group_open(g);
+	if (ret < 0) {
+		log_warning("No performance counters on worker CPU %u: %s "
+			"(see kernel.perf_event_paranoid)", cpu, strerror(-ret));
+	} else {
+		perf.mask = perf.nb_open++ ? perf.mask & g->mask : g->mask;
+		for (int c=0; c<PERF_NB_COUNTERS; ++c) {
+			if (!(g->mask & (1U << c)))
+				log_info("No %s counter on worker CPU %u",
+					perf_counter_name(c), cpu);
+		}
+	}
+	rte_spinlock_unlock(&perf.sl);
+}
+
+static void perf_close(unsigned cpu)
+{
+	if (!perf.sample)
+		return;
+
+	perf_publish(cpu, NULL, 0);
+	rte_spinlock_lock(&perf.sl);
+	perf_group_close(&perf.group[cpu]);
+	rte_spinlock_unlock(&perf.sl);
+}
+
+/* Counters at the start of a sampled poll of a relay direction. */
+struct perf_mark {
+	uint64_t pkts;
+	uint64_t counters[PERF_NB_COUNTERS];
+};
+
+/*
+ * Read the counters of worker @a cpu before it polls direction @a dir of
+ * @a relay. The read is charged as overhead. Returns false if the counters
+ * could not be read.
+ */
+static inline bool
+perf_mark(unsigned cpu, const vio_vf_relay_t *relay, enum relay_dir dir,
+		struct perf_mark *m, struct worker_cycles *wc, uint64_t *tsc)
+{
+	int ret;
+
+	m->pkts = relay_dir_pkts(relay, dir);
+	ret = perf_group_read(&perf.group[cpu], m->counters, false);
+	worker_charge(&wc->overhead, tsc);
+
+	return ret == 0;
+}
+
+/*
+ * Charge the counters of worker @a cpu since @a m to direction @a dir of
+ * @a relay, after a poll that moved packets. Polls that received none, e.g.
+ * that only retried a held burst, are left out, so that the counts per
+ * packet hold. The counts are not scaled: if the PMU multiplexed the group
+ * out meanwhile, they are all short alike.
+ */
+static void
+perf_charge(unsigned cpu, vio_vf_relay_t *relay, enum relay_dir dir,
+		const struct perf_mark *m, struct worker_cycles *wc,
+		uint64_t *tsc)
+{
+	struct relay_perf *p = &relay->perf[dir];
+	uint64_t pkts = relay_dir_pkts(relay, dir) - m->pkts;
+	uint64_t now[PERF_NB_COUNTERS];
+
+	if (pkts && !perf_group_read(&perf.group[cpu], now, false)) {
+		++p->polls;
+		p->pkts += pkts;
+		for (int c=0; c<PERF_NB_COUNTERS; ++c)
+			p->counters[c] += now[c] - m->counters[c];
+	}
+	worker_charge(&wc->overhead, tsc);
+}
+
+/* Worker stall detection, see jitter_setup(). */
+#define STALL_WARN_INTERVAL_MS 1000
+
+struct worker_jitter {
+	uint64_t last_tsc; /* Start of the previous pass, 0 after a sleep. */
+	uint64_t stalls; /* Gaps above the threshold. */
+	uint64_t warn_tsc; /* No stall warning before this. */
+	/* Largest stalls, under a sequence lock: odd while being written. */
+	volatile uint32_t seq;
+	unsigned nb_stalls;
+	struct worker_stall stall[WORKER_STALL_LOG];
+	struct lat_hist gaps;
+} __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
+
+static struct {
+	uint64_t threshold; /* In TSC cycles, 0 when disabled. */
+	struct worker_jitter worker[MAX_CPUS];
+} jitter;
+
+/* Isolation of the worker CPUs, checked at startup. */
+static struct cpu_isolation_report isolation;
+
+/*
+ * Record a gap of @a gap cycles of worker @a cpu above the threshold: keep
+ * it if it is among the largest, and warn at most once per
+ * STALL_WARN_INTERVAL_MS.
+ */
+static void __attribute__((noinline, cold))
+jitter_stall(struct worker_jitter *j, unsigned cpu, uint64_t gap,
+		uint64_t now)
+{
+	uint64_t hz = rte_get_tsc_hz();
+	unsigned i = j->nb_stalls;
+
+	++j->stalls;
+	if (i == WORKER_STALL_LOG) {
+		/* Replace the smallest, if smaller. */
+		i = 0;
+		for (unsigned k=1; k<WORKER_STALL_LOG; ++k) {
+			if (j->stall[k].cycles < j->stall[i].cycles)
+				i = k;
+		}
+	}
+	if (i == j->nb_stalls || gap > j->stall[i].cycles) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		__atomic_store_n(&j->seq, j->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		j->stall[i].time_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		j->stall[i].cycles = gap;
+		if (i == j->nb_stalls)
+			++j->nb_stalls;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&j->seq, j->seq + 1, __ATOMIC_RELAXED);
+	}
+
+	if (now >= j->warn_tsc) {
+		log_warning("Worker CPU %u stalled for %"PRIu64"us, %"PRIu64" stalls so far",
+			cpu, gap * 1000000 / hz, j->stalls);
+		j->warn_tsc = now + hz / 1000 * STALL_WARN_INTERVAL_MS;
+		/* Leave the warning out of the next gap. */
+		j->last_tsc = rte_rdtsc();
+	}
+}
+
+/* Measure the gap since the previous pass of worker @a cpu. */
+static inline void jitter_pass(unsigned cpu)
+{
+	struct worker_jitter *j = &jitter.worker[cpu];
+	uint64_t now = rte_rdtsc();
+	uint64_t gap = now - j->last_tsc;
+	bool measured = j->last_tsc != 0;
+
+	j->last_tsc = now;
+	if (!measured)
+		return;
+	lat_hist_record(&j->gaps, gap);
+	if (unlikely(gap >= jitter.threshold))
+		jitter_stall(j, cpu, gap, now);
+}
+
+/* Copy the stalls of worker @a cpu into @a s, the largest first. */
+static void jitter_read(unsigned cpu, struct virtio_worker_state *s)
+{
+	const struct worker_jitter *j = &jitter.worker[cpu];
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&j->seq, __ATOMIC_ACQUIRE);
+		s->stalls = j->stalls;
+		s->nb_stalls = j->nb_stalls;
+		memcpy(s->stall, j->stall, sizeof(s->stall));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || s->nb_stalls > WORKER_STALL_LOG ||
+			seq != __atomic_load_n(&j->seq, __ATOMIC_RELAXED));
+
+	/* Insertion sort, by decreasing length. */
+	for (unsigned i=1; i<s->nb_stalls; ++i) {
+		struct worker_stall t = s->stall[i];
+		unsigned k;
+
+		for (k=i; k>0 && s->stall[k-1].cycles < t.cycles; --k)
+			s->stall[k] = s->stall[k-1];
+		s->stall[k] = t;
+	}
+}
+
+static int worker_func(void *arg __attribute__((unused)))
+{
+	unsigned cpu = rte_lcore_id();
+	worker_thread_t *this_thread = &worker_threads[cpu];
+	struct worker_cycles *wc = &this_thread->cycles;
+	uint64_t tsc;
+	unsigned perf_countdown = 1;
+
+	this_thread->running=true;
+	this_thread->must_stop=false;
+	log_debug("New worker thread on CPU %u", this_thread->cpu);
+	perf_open(cpu);
+	tsc = rte_rdtsc();
+	while (this_thread->running && !this_thread->must_stop) {
+		int cpu_processed = 0;
+		unsigned long long _active_relays = this_thread->active_relays;
+		bool perf_pass = false;
+
+		++wc->iterations;
+		if (unlikely(jitter.threshold))
+			jitter_pass(cpu);
+		if (unlikely(perf.sample) && --perf_countdown == 0) {
+			perf_countdown = perf.sample;
+			perf_pass = perf.group[cpu].nb != 0;
+			if (perf_pass)
+				perf_sample_totals(cpu);
+		}
+		if (unlikely(this_thread->need_update))
+			update_thread(this_thread);
+
+		if (g_vio_worker_conf.work_stealing) {
+			uint64_t now = rte_rdtsc();
+			if (unlikely(now >= this_thread->steal_tsc))
+				steal_interval(this_thread, now);
+		}
+		worker_charge(&wc->overhead, &tsc);
+
+		/* Graph mode walks all relays of this worker at once. */
+		if (graph_engine.enabled) {
+			cpu_processed = graph_worker_walk(this_thread);
+			worker_charge(cpu_processed ? &wc->busy : &wc->idle,
+				&tsc);
+			_active_relays = 0;
+		}
+
+		while (_active_relays) {
+			unsigned w = __builtin_ffsll(_active_relays) - 1;
+			assert(w < MAX_RELAYS);
+			_active_relays &= (~(1ULL<<w));
+			vio_vf_relay_t *relay = &virtio_vf_relays[w];
+
+			/* Forward VM->VF. */
+			if (relay->vio.vio2vf_cpu == this_thread->cpu &&
+					likely(rte_spinlock_trylock(&relay->vio.sl))) {
+				struct perf_mark mark;
+				bool sampled = unlikely(perf_pass) &&
+					perf_mark(cpu, relay, RELAY_VM2VF, &mark,
+						wc, &tsc);
+				int ready;
+				int moved = relay_vm2vf_traffic(relay, &ready);
+
+				if (moved) {
+					relay->cycles[RELAY_VM2VF] +=
+						worker_charge(&wc->busy, &tsc);
+					if (unlikely(sampled))
+						perf_charge(cpu, relay, RELAY_VM2VF,
+							&mark, wc, &tsc);
+				} else {
+					worker_charge(&wc->idle, &tsc);
+				}
+				cpu_processed |= ready;
+				rte_spinlock_unlock(&relay->vio.sl);
+			}
+
+			/* Forward VF->VM. */
+			if (relay->dpdk.vf2vio_cpu == this_thread->cpu &&
+					likely(rte_spinlock_trylock(&relay->dpdk.sl))) {
+				struct perf_mark mark;
+				bool sampled = unlikely(perf_pass) &&
+					perf_mark(cpu, relay, RELAY_VF2VM, &mark,
+						wc, &tsc);
+				int ready;
+				int moved = relay_vf2vm_traffic(relay, &ready);
+
+				if (moved) {
+					relay->cycles[RELAY_VF2VM] +=
+						worker_charge(&wc->busy, &tsc);
+					if (unlikely(sampled))
+						perf_charge(cpu, relay, RELAY_VF2VM,
+							&mark, wc, &tsc);
+				} else {
+					worker_charge(&wc->idle, &tsc);
+				}
+				cpu_processed |= ready;
+				rte_spinlock_unlock(&relay->dpdk.sl);
+			}
+
+			/* Pipeline mode VF->VM enqueue stages. */
+			if (relay->pipeline.cpu_mask & (1ULL << this_thread->cpu)) {
+				for (unsigned s=0; s<relay->pipeline.nb_stages; ++s) {
+					struct relay_pipeline_stage *st =
+						&relay->pipeline.stages[s];
+					if (st->cpu == this_thread->cpu &&
+							likely(rte_spinlock_trylock(&st->sl))) {
+						int processed = relay_vf2vm_enqueue(relay, st, s);
+
+						worker_charge(processed ? &wc->busy :
+							&wc->idle, &tsc);
+						/* The dispatcher may refill the ring at
+						 * any time: keep polling while the guest
+						 * is ready, not only while packets flow. */
+						cpu_processed |= relay->vio.state ==
+							VIRTIO_READY;
+						rte_spinlock_unlock(&st->sl);
+					}
+				}
+			}
+
+		}
+		/* Event mode transmit stage. Workers keep polling, since
+		 * a sleeping worker would sit on the events scheduled to
+		 * its port. */
+		if (event_engine.enabled) {
+			worker_charge(event_worker_poll(this_thread) ?
+				&wc->busy : &wc->idle, &tsc);
+			cpu_processed = 1;
+		}
+
+		if (cpu_processed==0) {
+		  worker_charge(&wc->overhead, &tsc);
+		  usleep(1000);
+		  worker_charge(&wc->sleep, &tsc);
+		  /* Sleeps are not stalls. */
+		  jitter.worker[cpu].last_tsc = 0;
+		}
+	}
+	perf_close(cpu);
+	this_thread->running=false;
+	log_debug("Worker thread on CPU %u ended", this_thread->cpu);
+	return 0;
+}
+
+static void *init_static_vfs(void *ptr __attribute__((unused)))
+{
+	const struct virtio_vhostuser_conf *conf = &g_vio_worker_conf;
+
+	for (unsigned w=0; w<conf->static_relay_conf.num_static_entries; ++w) {
+		const char *dbdf = conf->static_relay_conf.static_relays[w].pci_dbdf;
+		int vio_id = conf->static_relay_conf.static_relays[w].virtio_id;
+		log_info("Adding static PCI VF '%s' to virtio %d", dbdf, vio_id);
+		virtio_forwarder_add_vf(dbdf, vio_id);
+	}
+
+	return NULL;
+}
+
+/* Create the enqueue stages of a relay configured for pipeline mode. */
+static int pipeline_setup(vio_vf_relay_t *relay, uint64_t cpus, int socket_id)
+{
+	struct relay_pipeline *pl = &relay->pipeline;
+	char name[RTE_RING_NAMESIZE];
+	unsigned s = 0;
+
+	if (__builtin_popcountll(cpus) > MAX_PIPELINE_STAGES) {
+		log_error("Too many pipeline CPUs for relay %u, max is %u!",
+			relay->id, MAX_PIPELINE_STAGES);
+		return -1;
+	}
+
+	while (cpus) {
+		struct relay_pipeline_stage *st = &pl->stages[s];
+		int cpu = __builtin_ffsll(cpus) - 1;
+
+		cpus &= ~(1ULL << cpu);
+		snprintf(name, sizeof(name), "vf2vm_%u_%u", relay->id, s);
+		st->ring = rte_ring_create(name, PIPELINE_RING_SIZE, socket_id,
+					RING_F_SP_ENQ | RING_F_SC_DEQ);
+		if (!st->ring) {
+			log_error("Could not create pipeline ring for relay %u! rte_errno = %d (%s)",
+				relay->id, rte_errno, rte_strerror(rte_errno));
+			return -1;
+		}
+		st->cpu = cpu;
+		st->pkts_avail = 0;
+		rte_spinlock_init(&st->sl);
+		pl->cpu_mask |= (1ULL << cpu);
+		log_info("Relay %u pipeline stage %u: vhost enqueue on CPU %d",
+			relay->id, s, cpu);
+		++s;
+	}
+	pl->nb_stages = s;
+
+	return 0;
+}
+
+static void pipeline_free(vio_vf_relay_t *relay)
+{
+	pipeline_drain(relay);
+	for (unsigned s=0; s<relay->pipeline.nb_stages; ++s)
+		rte_ring_free(relay->pipeline.stages[s].ring);
+	relay->pipeline.nb_stages = 0;
+	relay->pipeline.cpu_mask = 0;
+}
+
+/* Sum of the VF to VM counters kept by the pipeline stages of a relay. */
+static void
+pipeline_tx_counters(const vio_vf_relay_t *relay, uint64_t *pkts,
+			uint64_t *bytes)
+{
+	*pkts = *bytes = 0;
+	for (unsigned s=0; s<relay->pipeline.nb_stages; ++s) {
+		*pkts += relay->pipeline.stages[s].vio_tx;
+		*bytes += relay->pipeline.stages[s].vio_tx_bytes;
+	}
+}
+
+/*
+ * Set up event mode: the first event device probed by the EAL is used, or the
+ * software event PMD is created, which runs on any machine. Every worker gets
+ * a port linked to both transmit queues.
+ */
+static int event_engine_setup(void)
+{
+#if RTE_VERSION_NUM(17, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+	struct rte_event_dev_info info;
+	struct rte_event_dev_config dev_conf;
+	struct rte_event_queue_conf q_conf;
+	uint8_t dev_id = 0, port = 0, q;
+	unsigned nb_ports = 0;
+	int cpu, err;
+
+	if (rte_event_dev_count() == 0) {
+		err = rte_vdev_init(EVENTDEV_SW_NAME, NULL);
+		if (err) {
+			log_error("Could not create event device '%s'! err=%d",
+				EVENTDEV_SW_NAME, err);
+			return -1;
+		}
+	}
+	rte_event_dev_info_get(dev_id, &info);
+
+	RTE_LCORE_FOREACH_WORKER(cpu)
+		++nb_ports;
+	if (nb_ports > info.max_event_ports ||
+			EVENT_NB_QUEUES > info.max_event_queues) {
+		log_error("Event device %s supports %u ports and %u queues, %u and %u needed!",
+			info.driver_name, info.max_event_ports,
+			info.max_event_queues, nb_ports, EVENT_NB_QUEUES);
+		return -1;
+	}
+
+	memset(&dev_conf, 0, sizeof(dev_conf));
+	dev_conf.nb_event_queues = EVENT_NB_QUEUES;
+	dev_conf.nb_event_ports = nb_ports;
+	dev_conf.nb_events_limit = EVENTDEV_NB_EVENTS;
+	if (info.max_num_events > 0 &&
+			dev_conf.nb_events_limit > (unsigned)info.max_num_events)
+		dev_conf.nb_events_limit = info.max_num_events;
+	dev_conf.nb_event_queue_flows = RTE_MIN(MAX_RELAYS * MAX_MULTIQUEUE_PAIRS,
+						info.max_event_queue_flows);
+	dev_conf.nb_event_port_dequeue_depth = RTE_MIN(BURST_LEN,
+					info.max_event_port_dequeue_depth);
+	dev_conf.nb_event_port_enqueue_depth = RTE_MIN(BURST_LEN,
+					info.max_event_port_enqueue_depth);
+	dev_conf.dequeue_timeout_ns = info.min_dequeue_timeout_ns;
+	err = rte_event_dev_configure(dev_id, &dev_conf);
+	if (err) {
+		log_error("Could not configure event device %s! err=%d",
+			info.driver_name, err);
+		return -1;
+	}
+
+	for (q=0; q<EVENT_NB_QUEUES; ++q) {
+		rte_event_queue_default_conf_get(dev_id, q, &q_conf);
+		q_conf.schedule_type = RTE_SCHED_TYPE_ATOMIC;
+		q_conf.nb_atomic_flows = dev_conf.nb_event_queue_flows;
+		if (rte_event_queue_setup(dev_id, q, &q_conf)) {
+			log_error("Could not set up event queue %u!", q);
+			return -1;
+		}
+	}
+
+	RTE_LCORE_FOREACH_WORKER(cpu) {
+		if (rte_event_port_setup(dev_id, port, NULL) ||
+				rte_event_port_link(dev_id, port, NULL, NULL, 0)
+					!= EVENT_NB_QUEUES) {
+			log_error("Could not set up event port %u for CPU %d!",
+				port, cpu);
+			return -1;
+		}
+		worker_threads[cpu].event_port = port++;
+	}
+
+	/* The workers run the scheduler of software PMDs between bursts. */
+	if (rte_event_dev_service_id_get(dev_id,
+			&event_engine.service_id) == 0) {
+		event_engine.has_service = true;
+		rte_service_runstate_set(event_engine.service_id, 1);
+		rte_service_set_runstate_mapped_check(event_engine.service_id,
+							0);
+	}
+
+	err = rte_event_dev_start(dev_id);
+	if (err) {
+		log_error("Could not start event device %s! err=%d",
+			info.driver_name, err);
+		return -1;
+	}
+	event_engine.dev_id = dev_id;
+	event_engine.enabled = true;
+	log_info("Event mode: scheduling relay transmission on %u workers through %s",
+		nb_ports, info.driver_name);
+
+	return 0;
+#else
+	log_error("Event mode not supported for this version of DPDK");
+
+	return -1;
+#endif
+}
+
+static void event_engine_free(void)
+{
+#if RTE_VERSION_NUM(17, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+	if (!event_engine.enabled)
+		return;
+
+	event_engine.enabled = false;
+	rte_event_dev_stop(event_engine.dev_id);
+	rte_event_dev_close(event_engine.dev_id);
+#endif
+}
+
+/*
+ * Set up graph mode: every worker gets its own instance of the datapath graph,
+ * and a cluster stats object sums the node counters over all of them.
+ */
+static int graph_engine_setup(void)
+{
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+	static const char *node_patterns[] = {"vio4wd_*"};
+	static const char *graph_patterns[] = {"vio4wd_worker_*"};
+	struct rte_graph_cluster_stats_param stats_prm;
+	struct rte_graph_param prm;
+	char name[RTE_GRAPH_NAMESIZE];
+	unsigned nb_graphs = 0;
+	int cpu;
+
+	memset(&prm, 0, sizeof(prm));
+	prm.node_patterns = node_patterns;
+	prm.nb_node_patterns = RTE_DIM(node_patterns);
+	RTE_LCORE_FOREACH_WORKER(cpu) {
+		prm.socket_id = rte_lcore_to_socket_id(cpu);
+		snprintf(name, sizeof(name), GRAPH_WORKER_NAME_FMT, cpu);
+		if (rte_graph_create(name, &prm) == RTE_GRAPH_ID_INVALID) {
+			log_error("Could not create graph for CPU %d! rte_errno = %d (%s)",
+				cpu, rte_errno, rte_strerror(rte_errno));
+			return -1;
+		}
+		graph_engine.graphs[cpu] = rte_graph_lookup(name);
+		++nb_graphs;
+	}
+
+	rte_spinlock_init(&graph_engine.stats_sl);
+	memset(&stats_prm, 0, sizeof(stats_prm));
+	stats_prm.fn = graph_stats_collect;
+	stats_prm.socket_id = SOCKET_ID_ANY;
+	stats_prm.graph_patterns = graph_patterns;
+	stats_prm.nb_graph_patterns = RTE_DIM(graph_patterns);
+	graph_engine.stats = rte_graph_cluster_stats_create(&stats_prm);
+	if (!graph_engine.stats)
+		log_warning("Graph node statistics are not available");
+
+	graph_engine.enabled = true;
+	log_info("Graph mode: walking the datapath graph on %u workers",
+		nb_graphs);
+
+	return 0;
+#else
+	log_error("Graph mode not supported for this version of DPDK");
+
+	return -1;
+#endif
+}
+
+static void graph_engine_free(void)
+{
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+	if (!graph_engine.enabled)
+		return;
+
+	rte_spinlock_lock(&graph_engine.stats_sl);
+	graph_engine.enabled = false;
+	if (graph_engine.stats)
+		rte_graph_cluster_stats_destroy(graph_engine.stats);
+	graph_engine.stats = NULL;
+	rte_spinlock_unlock(&graph_engine.stats_sl);
+	for (unsigned cpu=0; cpu<MAX_CPUS; ++cpu) {
+		if (graph_engine.graphs[cpu])
+			rte_graph_destroy(graph_engine.graphs[cpu]->id);
+		graph_engine.graphs[cpu] = NULL;
+	}
+#endif
+}
+
+int
+virtio_forwarder_get_graph_stats(
+	struct virtio_graph_node_stats *stats __attribute__((unused)),
+	unsigned max __attribute__((unused)))
+{
+	int n = -1;
+
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION && !defined(VIRTIO_ECHO)
+	if (!graph_engine.enabled)
+		return -1;
+
+	rte_spinlock_lock(&graph_engine.stats_sl);
+	if (graph_engine.stats) {
+		graph_engine.stats_out = stats;
+		graph_engine.stats_max = max;
+		graph_engine.stats_n = 0;
+		rte_graph_cluster_stats_get(graph_engine.stats, false);
+		n = graph_engine.stats_n;
+	}
+	rte_spinlock_unlock(&graph_engine.stats_sl);
+#endif
+
+	return n;
+}
+
+unsigned
+virtio_forwarder_get_worker_states(struct virtio_worker_state *states,
+				unsigned max)
+{
+	uint64_t workers = worker_core_bitmap;
+	unsigned n = 0;
+
+	while (workers && n < max) {
+		int cpu = __builtin_ffsll(workers) - 1;
+		const worker_thread_t *worker = &worker_threads[cpu];
+		struct virtio_worker_state *s = &states[n];
+
+		workers &= ~(1ULL << cpu);
+		if (!worker->initialized)
+			continue;
+		s->cpu = cpu;
+		s->nb_relays = __builtin_popcountll(worker->active_relays);
+		s->tsc_hz = rte_get_tsc_hz();
+		s->iterations = worker->cycles.iterations;
+		s->busy_cycles = worker->cycles.busy;
+		s->idle_cycles = worker->cycles.idle;
+		s->sleep_cycles = worker->cycles.sleep;
+		s->overhead_cycles = worker->cycles.overhead;
+		s->isolation = 0;
+		for (int c=0; c<CPU_ISOL_NB; ++c) {
+			if (isolation.failed[c] & (1ULL << cpu))
+				s->isolation |= 1U << c;
+		}
+		s->irqs = isolation.irqs[cpu];
+		jitter_read(cpu, s);
+		s->perf_mask = 0;
+		if (perf.sample)
+			perf_read(cpu, s);
+		++n;
+	}
+
+	return n;
 }
 
-static void worker_remove_virtio(vio_vf_relay_t *relay)
+unsigned
+virtio_forwarder_get_queue_stats(unsigned virtio_id,
+				struct virtio_queue_stats *stats, unsigned max)
 {
-	int rcvd;
-	struct rte_mbuf **pkts;
+	assert(virtio_id < MAX_RELAYS);
+	const vio_vf_relay_t *r = virtio_vf_relays + virtio_id;
+	unsigned n, q;
 
-	log_debug("Removing virtio instance from worker");
-	if (relay->dpdk.rx_pkts_avail) {
-		log_debug("Freeing %u cached RX packets",
-			relay->dpdk.rx_pkts_avail);
-		rcvd = relay->dpdk.rx_pkts_avail;
-		relay->stats.vio_drop_unavail += rcvd;
-		pkts = relay->dpdk.rx_pkts + relay->dpdk.rx_pkts_used;
-		while (rcvd) {
-			--rcvd;
-			rte_pktmbuf_free(pkts[rcvd]);
-		}
-		relay->dpdk.rx_pkts_avail = 0;
-		relay->dpdk.rx_pkts_used = 0;
-	}
-	while (rte_spinlock_trylock(&relay->vio.sl));
-	if (relay->vio.tx_pkts_avail) {
-		log_debug("Freeing %u cached TX packets",
-			relay->vio.tx_pkts_avail);
-		rcvd = relay->vio.tx_pkts_avail;
-		relay->stats.dpdk_drop_unavail += rcvd;
-		pkts = relay->vio.tx_pkts + relay->vio.tx_pkts_used;
-		while (rcvd) {
-			--rcvd;
-			rte_pktmbuf_free(pkts[rcvd]);
-		}
-		relay->vio.tx_pkts_avail = 0;
-		relay->vio.tx_pkts_used = 0;
+	if (r->vio.state != VIRTIO_READY)
+		return 0;
+
+	n = RTE_MIN(r->vio.max_queue_pairs, (unsigned)MAX_MULTIQUEUE_PAIRS);
+	n = RTE_MIN(n, max);
+	for (q=0; q<n; ++q) {
+		const struct relay_queue_stats *rx =
+			&r->queue_stats[RELAY_VM2VF][q];
+		const struct relay_queue_stats *tx =
+			&r->queue_stats[RELAY_VF2VM][q];
+
+		stats[q].id = q;
+		stats[q].virtio_rx = rx->pkts;
+		stats[q].virtio_rx_bytes = rx->bytes;
+		stats[q].virtio_tx = tx->pkts;
+		stats[q].virtio_tx_bytes = tx->bytes;
+		stats[q].virtio_drop = tx->drops;
+		stats[q].steered = r->queue_steered[q];
 	}
-	rte_spinlock_unlock(&relay->vio.sl);
-	relay->vio.state = VIRTIO_UNINIT; /* Signal main thread. */
+
+	return n;
 }
 
 /*
- * Forward DPDK->virtio
+ * Register the mbuf dynfield and dynflag used to stamp one in @a sample
+ * received packets, and enable latency sampling.
  */
-static inline int relay_vf2vm_traffic(vio_vf_relay_t *relay)
+static int latency_setup(unsigned sample)
 {
-	int sent = 0;
+	if (!sample)
+		return 0;
 
-	/* There are no buffered packets in the internal
-	 * rx queue. Try to fetch packets from the VF
-	 * into mbufs. */
-	if (likely(relay->dpdk.rx_pkts_avail == 0))
-		dpdk_rx(relay);
+#if RTE_VERSION_NUM(20, 11, 0, 0) <= RTE_VERSION
+	static const struct rte_mbuf_dynfield field = {
+		.name = "vio4wd_dynfield_rx_tsc",
+		.size = sizeof(uint64_t),
+		.align = __alignof__(uint64_t),
+	};
+	static const struct rte_mbuf_dynflag flag = {
+		.name = "vio4wd_dynflag_rx_tsc",
+	};
+	int bit;
+
+	latency.offset = rte_mbuf_dynfield_register(&field);
+	bit = rte_mbuf_dynflag_register(&flag);
+	if (latency.offset < 0 || bit < 0) {
+		log_error("Could not register mbuf fields for latency sampling! rte_errno = %d (%s)",
+			rte_errno, rte_strerror(rte_errno));
+		return -1;
+	}
+	latency.flag = 1ULL << bit;
+	latency.sample = sample;
+	log_info("Sampling the forwarding latency of 1 in %u packets",
+		sample);
 
-	/* Send dpdk to VM. */
-	if (likely(relay->dpdk.rx_pkts_avail))
-		sent = virtio_tx(relay);
+	return 0;
+#else
+	log_error("Latency sampling requires DPDK 20.11 or newer!");
+	return -1;
+#endif
+}
 
-	if (sent == -1 && relay->dpdk.rx_pkts_avail) {
-		/* Virtio not ready.
-		 * Free buffered packets. */
-		struct rte_mbuf **pkts = relay->dpdk.rx_pkts +
-					relay->dpdk.rx_pkts_used;
-		int avail = relay->dpdk.rx_pkts_avail;
-		relay->stats.vio_drop_unavail += avail;
-		while (avail > 0) {
-			--avail;
-			rte_pktmbuf_free(pkts[avail]);
-		}
-		relay->dpdk.rx_pkts_avail = 0;
-	}
+int
+virtio_forwarder_get_latency(unsigned id, enum relay_dir dir,
+				struct lat_hist *hist)
+{
+	assert(id < MAX_RELAYS && dir < RELAY_NB_DIRS);
+	if (!latency.sample)
+		return -1;
 
-	if (unlikely(relay->vio.state == VIRTIO_REMOVING2))
-		worker_remove_virtio(relay);
+	memcpy(hist, &virtio_vf_relays[id].latency[dir], sizeof(*hist));
 
-	if (unlikely(relay->dpdk.state == DPDK_REMOVING1)) {
-		relay->dpdk.state = DPDK_REMOVING2; /* Signal other thread. */
-		if (relay->vio.vio2vf_cpu == -1)
-			/* There is no other thread. */
-			relay->dpdk.state = DPDK_UNINIT;
+	return 0;
+}
+
+/*
+ * Allocate the flow sketches of every relay direction, and enable heavy
+ * hitter flow sampling.
+ */
+static int flows_setup(unsigned sample)
+{
+	if (!sample)
+		return 0;
+
+	flows.epoch_tsc = rte_get_tsc_hz() / 1000 * FLOWS_EPOCH_MS;
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		for (int dir=0; dir<RELAY_NB_DIRS; ++dir) {
+			struct flow_sketch *s = rte_malloc("flow_sketch",
+					sizeof(*s), RTE_CACHE_LINE_SIZE);
+
+			if (!s) {
+				log_error("Could not allocate flow sketches!");
+				return -1;
+			}
+			flow_sketch_init(s, flows.epoch_tsc);
+			virtio_vf_relays[id].flows[dir] = s;
+		}
 	}
+	flows.sample = sample;
+	log_info("Tracking the heaviest flows of every relay on 1 in %u packets",
+		sample);
 
-	return (relay->dpdk.state == DPDK_READY) ? 1 : 0;
+	return 0;
 }
 
-static int worker_func(void *arg __attribute__((unused)))
+int
+virtio_forwarder_get_flows(unsigned id, enum relay_dir dir,
+				struct virtio_flow_stats *out, unsigned max)
 {
-	unsigned cpu = rte_lcore_id();
-	worker_thread_t *this_thread = &worker_threads[cpu];
+	struct flow_sketch_entry top[FLOW_SKETCH_TOP_K];
+	uint64_t start, end;
+	double scale;
+	unsigned n;
 
-	this_thread->running=true;
-	this_thread->must_stop=false;
-	log_debug("New worker thread on CPU %u", this_thread->cpu);
-	while (this_thread->running && !this_thread->must_stop) {
-		int cpu_processed = 0;
-		unsigned long long _active_relays = this_thread->active_relays;
+	assert(id < MAX_RELAYS && dir < RELAY_NB_DIRS);
+	if (!flows.sample)
+		return -1;
 
-		if (unlikely(this_thread->need_update))
-			update_thread(this_thread);
+	n = flow_sketch_read(virtio_vf_relays[id].flows[dir], top, &start,
+			&end);
+	/* Epochs only end on a sampled packet: if the traffic dwindled, the
+	 * last one is stale. */
+	if (!end || rte_rdtsc() - end > 2 * flows.epoch_tsc)
+		return 0;
+	scale = (double)flows.sample * rte_get_tsc_hz() / (end - start);
+	if (n > max)
+		n = max;
+	for (unsigned i=0; i<n; ++i) {
+		out[i].hash = top[i].hash;
+		out[i].tuple = top[i].tuple;
+		out[i].pkt_rate = top[i].pkts * scale;
+		out[i].byte_rate = top[i].bytes * scale;
+	}
 
-		while (_active_relays) {
-			unsigned w = __builtin_ffsll(_active_relays) - 1;
-			assert(w < MAX_RELAYS);
-			_active_relays &= (~(1ULL<<w));
-			vio_vf_relay_t *relay = &virtio_vf_relays[w];
+	return n;
+}
 
-			/* Forward VM->VF. */
-			if (relay->vio.vio2vf_cpu == this_thread->cpu &&
-					likely(rte_spinlock_trylock(&relay->vio.sl))) {
-				cpu_processed |= relay_vm2vf_traffic(relay);
-				rte_spinlock_unlock(&relay->vio.sl);
-			}
+/*
+ * Enable hardware performance counter sampling: the workers open their
+ * counters as they start, and attribute them to the relay directions they
+ * poll on one pass in @a sample.
+ */
+static void perf_setup(unsigned sample)
+{
+	if (!sample)
+		return;
 
-			/* Forward VF->VM. */
-			if (relay->dpdk.vf2vio_cpu == this_thread->cpu &&
-					likely(rte_spinlock_trylock(&relay->dpdk.sl))) {
-				cpu_processed |= relay_vf2vm_traffic(relay);
-				rte_spinlock_unlock(&relay->dpdk.sl);
-			}
+	rte_spinlock_init(&perf.sl);
+	perf.sample = sample;
+	log_info("Attributing performance counters to relays on 1 in %u worker passes",
+		sample);
+}
 
-		}
-		if (cpu_processed==0) {
-		  usleep(1000);
+/* Enable worker stall detection, for gaps of @a threshold_us and more. */
+static void jitter_setup(unsigned threshold_us)
+{
+	if (!threshold_us)
+		return;
+
+	jitter.threshold = rte_get_tsc_hz() / 1000000 * threshold_us;
+	log_info("Detecting worker stalls of %uus and more", threshold_us);
+}
+
+/*
+ * Check that the worker CPUs in @a cpus are isolated from the kernel, and
+ * warn about those that are not.
+ */
+static void isolation_check(uint64_t cpus)
+{
+	if (cpu_isolation_check(cpus, &isolation))
+		log_warning("Could not list the interrupts to check the affinity of the worker CPUs");
+
+	if (isolation.failed[CPU_ISOL_SCHED])
+		log_warning("Worker CPUs 0x%08llX are not in isolcpus=, other tasks may preempt them",
+			(unsigned long long)isolation.failed[CPU_ISOL_SCHED]);
+	if (isolation.failed[CPU_ISOL_TICK])
+		log_warning("Worker CPUs 0x%08llX are not in nohz_full=, they take the scheduler tick",
+			(unsigned long long)isolation.failed[CPU_ISOL_TICK]);
+	if (isolation.failed[CPU_ISOL_IRQ]) {
+		log_warning("Worker CPUs 0x%08llX are in the affinity of device interrupts",
+			(unsigned long long)isolation.failed[CPU_ISOL_IRQ]);
+		for (int cpu=0; cpu<MAX_CPUS; ++cpu) {
+			if (isolation.irqs[cpu])
+				log_info("%u device interrupts may land on worker CPU %d",
+					isolation.irqs[cpu], cpu);
 		}
 	}
-	this_thread->running=false;
-	log_debug("Worker thread on CPU %u ended", this_thread->cpu);
+}
+
+int
+virtio_forwarder_get_worker_gaps(unsigned cpu, struct lat_hist *hist)
+{
+	assert(cpu < MAX_CPUS);
+	if (!jitter.threshold || !(worker_core_bitmap & (1ULL << cpu)))
+		return -1;
+
+	memcpy(hist, &jitter.worker[cpu].gaps, sizeof(*hist));
+
 	return 0;
 }
 
-static void *init_static_vfs(void *ptr __attribute__((unused)))
+int
+virtio_forwarder_get_perf(unsigned id, enum relay_dir dir,
+				struct relay_perf *out, unsigned *mask)
 {
-	const struct virtio_vhostuser_conf *conf = &g_vio_worker_conf;
+	assert(id < MAX_RELAYS && dir < RELAY_NB_DIRS);
+	if (!perf.sample || !perf.nb_open)
+		return -1;
 
-	for (unsigned w=0; w<conf->static_relay_conf.num_static_entries; ++w) {
-		const char *dbdf = conf->static_relay_conf.static_relays[w].pci_dbdf;
-		int vio_id = conf->static_relay_conf.static_relays[w].virtio_id;
-		log_info("Adding static PCI VF '%s' to virtio %d", dbdf, vio_id);
-		virtio_forwarder_add_vf(dbdf, vio_id);
-	}
+	memcpy(out, &virtio_vf_relays[id].perf[dir], sizeof(*out));
+	*mask = perf.mask;
 
-	return NULL;
+	return 0;
 }
 
 int virtio_forwarders_initialize(void)
@@ -1678,6 +4048,11 @@ int virtio_forwarders_initialize(void)
 	cpuinfo_t *c = get_cpuinfo();
 	pthread_t static_vfs_init;
 	const struct virtio_vhostuser_conf *conf = &g_vio_worker_conf;
+	const struct core_sched_conf sched_conf = {
+		.enabled = conf->core_sched,
+		.interval_ms = CORE_SCHED_DEFAULT_INTERVAL_MS,
+		.sensitivity = CORE_SCHED_DEFAULT_SENSITIVITY,
+	};
 
 	memset(virtio_vf_relays, 0, sizeof(*virtio_vf_relays) * MAX_RELAYS);
 
@@ -1736,6 +4111,12 @@ int virtio_forwarders_initialize(void)
 		virtio_vf_relays[w].vio.lm_pending = false;
 		rte_spinlock_init(&virtio_vf_relays[w].vio.sl);
 		rte_spinlock_init(&virtio_vf_relays[w].dpdk.sl);
+		pthread_mutex_init(&virtio_vf_relays[w].dpdk.port_lock, NULL);
+		if (conf->relay_cpus[w].pipeline_cpus &&
+				pipeline_setup(&virtio_vf_relays[w],
+					conf->relay_cpus[w].pipeline_cpus,
+					socket_id))
+			return -1;
 	}
 
 	/* Launch worker_func on all slaves. */
@@ -1748,8 +4129,38 @@ int virtio_forwarders_initialize(void)
 		worker_thread_t *worker = &worker_threads[cpu];
 		worker->cpu = cpu;
 		worker->initialized = true;
+		/* Pick up pipeline stages, which are pinned from the start. */
+		worker->need_update = true;
 	}
+	if (conf->eventdev && event_engine_setup())
+		return -1;
+	if (conf->graph && graph_engine_setup())
+		return -1;
+	if (latency_setup(conf->latency_sample))
+		return -1;
+	if (flows_setup(conf->flow_sample))
+		return -1;
+	perf_setup(conf->perf_sample);
+	jitter_setup(conf->stall_threshold_us);
+	isolation_check(worker_core_bitmap);
 	rte_eal_mp_remote_launch(worker_func, NULL, SKIP_MAIN);
+	if (core_sched_start(&sched_conf))
+		return -1;
+	if (rate_sampler_start())
+		return -1;
+#ifndef VIRTIO_ECHO
+	if (vf_xstats_start(conf->xstats_interval_ms))
+		return -1;
+#endif
+	if (stats_shm_start(conf->stats_shm_path))
+		return -1;
+	if (stats_history_start(conf->stats_history_s,
+			conf->stats_history_path))
+		return -1;
+	if (pkt_capture_init(conf->capture_dir))
+		return -1;
+	if (dpdk_telemetry_register())
+		return -1;
 
 	/* Need to add static VFs from a separate thread: The memory required
 	 * for initializing a netdev is reserved according to the socket of
@@ -1771,6 +4182,13 @@ void virtio_forwarders_shutdown(void)
 {
 	int cpu;
 
+	core_sched_stop();
+	pkt_capture_stop_all();
+	stats_shm_stop();
+	stats_history_stop();
+	vf_xstats_stop();
+	rate_sampler_stop();
+
 	for (cpu=0; cpu<MAX_CPUS; ++cpu) {
 		if (((1ULL<<cpu) & worker_core_bitmap) == 0)
 			continue;
@@ -1789,6 +4207,11 @@ void virtio_forwarders_shutdown(void)
 			log_debug("Worker on CPU %d stopped", cpu);
 		}
 	}
+
+	for (unsigned w=0; w<MAX_RELAYS; ++w)
+		pipeline_free(&virtio_vf_relays[w]);
+	event_engine_free();
+	graph_engine_free();
 }
 
 static void find_virtio2vf_cpu(vio_vf_relay_t *relay)
@@ -1807,9 +4230,14 @@ static void find_virtio2vf_cpu(vio_vf_relay_t *relay)
 		worker_threads[relay->vio.vio2vf_cpu].need_update = true;
 		relay->vio.vio2vf_cpu = -1;
 	}
-	idlest_cpu = naive_get_idlest_worker(relay->vio.mempool_socket_id);
+	/* The core scheduler places on measured rather than estimated load. */
+	idlest_cpu = core_sched_place(relay->vio.mempool_socket_id);
+	if (idlest_cpu < 0)
+		idlest_cpu = naive_get_idlest_worker(
+					relay->vio.mempool_socket_id);
 	assert(idlest_cpu >= 0);
 	relay->vio.vio2vf_cpu = idlest_cpu;
+	relay->steal[RELAY_VM2VF].owned_tsc = rte_rdtsc();
 	log_debug("Found CPU %u for relay %u virtio2vf",
 		relay->vio.vio2vf_cpu, relay->id);
 }
@@ -1932,13 +4360,13 @@ int virtio_forwarder_add_virtio(void *virtionet, unsigned id)
 			rte_strerror(rte_errno));
 		return -1;
 	}
-	relay->dpdk.state = DPDK_READY;
+	relay_set_dpdk_state(relay, DPDK_READY);
 	find_vf2virtio_cpu(relay);
 	__sync_synchronize();
 	worker_threads[relay->dpdk.vf2vio_cpu].need_update = true;
 #endif
 
-	relay->vio.state = VIRTIO_READY;
+	relay_set_vio_state(relay, VIRTIO_READY);
 	__sync_synchronize();
 	worker_threads[relay->vio.vio2vf_cpu].need_update = true;
 
@@ -1955,7 +4383,7 @@ int virtio_forwarder_add_virtio(void *virtionet, unsigned id)
 				relay->dpdk.dpdk_port, err, rte_strerror(-err));
 		} else {
 			relay->vio.lm_pending = false;
-			relay->dpdk.state = DPDK_READY;
+			relay_set_dpdk_state(relay, DPDK_READY);
 			__sync_synchronize();
 			worker_threads[relay->dpdk.vf2vio_cpu].need_update = true;
 		}
@@ -1979,12 +4407,13 @@ void virtio_forwarder_remove_virtio(unsigned id)
 		return;
 
 	log_debug("Removing virtio-forwarder %u", id);
-	relay->vio.state = VIRTIO_REMOVING1;
+	relay_set_vio_state(relay, VIRTIO_REMOVING1);
 	while (relay->vio.state != VIRTIO_UNINIT && retries++ < 20)
 		usleep(50000);
 	if (retries >= 20)
 		log_warning("Timeout waiting for thread to release virtio %u!",
 			id);
+	event_engine_quiesce(relay);
 	log_debug("Removed virtio-forwarder %u from CPU %u", id,
 		relay->vio.vio2vf_cpu);
 
@@ -1992,6 +4421,7 @@ void virtio_forwarder_remove_virtio(unsigned id)
 	relay->vio.vio2vf_cpu = -1;
 	relay->vio.tx_q_bitmap = 0;
 	relay->vio.rx_q_bitmap = 0;
+	relay->vio.rss.enabled = false; /* Reset with the guest device. */
 	__sync_synchronize();
 	worker_threads[tmpidx].need_update = true;
 
@@ -2011,10 +4441,13 @@ void virtio_forwarder_remove_virtio(unsigned id)
 	log_debug("stats: dpdk_rx=%"PRIu64", virtio_tx=%"PRIu64", virtio_drop_full=%"PRIu64", virtio_drop_unavail=%"PRIu64,
 		relay->stats.dpdk_rx, relay->stats.vio_tx,
 		relay->stats.vio_drop_full, relay->stats.vio_drop_unavail);
+	log_debug("stats: dpdk_drop_flush=%"PRIu64", virtio_drop_flush=%"PRIu64", virtio_rx_nombuf=%"PRIu64", virtio_ring_empty=%"PRIu64,
+		relay->stats.dpdk_drop_flush, relay->stats.vio_drop_flush,
+		relay->stats.vio_rx_nombuf, relay->stats.vio_ring_empty);
 
 #ifdef VIRTIO_ECHO
 	rte_ring_free(relay->echo_ring);
-	relay->dpdk.state=DPDK_UNINIT;
+	relay_set_dpdk_state(relay, DPDK_UNINIT);
 	tmpidx=relay->dpdk.vf2vio_cpu;
 	relay->dpdk.vf2vio_cpu = -1;
 	__sync_synchronize();
@@ -2025,7 +4458,7 @@ void virtio_forwarder_remove_virtio(unsigned id)
 	if (relay->dpdk.state == DPDK_READY) {
 		log_debug("Stopping VF for relay %u", relay->id);
 		rte_eth_dev_stop(relay->dpdk.dpdk_port);
-		relay->dpdk.state = DPDK_ADDED;
+		relay_set_dpdk_state(relay, DPDK_ADDED);
 		__sync_synchronize();
 		worker_threads[relay->dpdk.vf2vio_cpu].need_update = true;
 	}
@@ -2086,6 +4519,68 @@ void virtio_forwarder_vring_state_change(unsigned id, unsigned queue_id, int ena
 		relay->vio.tx_q_bitmap, relay->vio.rx_q_active);
 }
 
+int
+virtio_forwarder_set_rss(unsigned id, const uint8_t *key,
+			const uint32_t *reta, unsigned reta_len,
+			uint32_t hash_types, bool has_unclassified_queue,
+			unsigned unclassified_queue)
+{
+	vio_vf_relay_t *relay;
+	struct relay_rss *rss;
+	uint32_t key_words[VIRTIO_RSS_KEY_LEN / 4];
+	unsigned i;
+
+	if (id >= MAX_RELAYS) {
+		log_error("Tried to set RSS on virtio with invalid ID '%u'", id);
+		return -1;
+	}
+	relay = &virtio_vf_relays[id];
+	rss = &relay->vio.rss;
+
+	if (reta_len == 0) {
+		while (rte_spinlock_trylock(&relay->dpdk.sl) == 0);
+		rss->enabled = false;
+		rte_spinlock_unlock(&relay->dpdk.sl);
+		log_info("Disabled RSS steering on relay %u", id);
+		return 0;
+	}
+	if (reta_len > VIRTIO_RSS_RETA_SIZE || (reta_len & (reta_len - 1))) {
+		log_error("Invalid RSS indirection table size %u on relay %u",
+			reta_len, id);
+		return -1;
+	}
+	for (i=0; i<reta_len; ++i) {
+		if (reta[i] >= MAX_MULTIQUEUE_PAIRS) {
+			log_error("Invalid RSS queue %u on relay %u", reta[i], id);
+			return -1;
+		}
+	}
+	if (has_unclassified_queue &&
+			unclassified_queue >= MAX_MULTIQUEUE_PAIRS) {
+		log_error("Invalid RSS unclassified queue %u on relay %u",
+			unclassified_queue, id);
+		return -1;
+	}
+
+	/* Packets are steered by whoever holds the VF to VM lock of the
+	 * relay, in every engine: rewrite the configuration under it. */
+	memcpy(key_words, key, sizeof(key_words));
+	while (rte_spinlock_trylock(&relay->dpdk.sl) == 0);
+	rte_convert_rss_key(key_words, rss->key_be, VIRTIO_RSS_KEY_LEN);
+	/* Replicate smaller tables, so that the mask is constant. */
+	for (i=0; i<VIRTIO_RSS_RETA_SIZE; ++i)
+		rss->reta[i] = reta[i & (reta_len - 1)];
+	rss->hash_types = hash_types;
+	rss->unclassified_queue = has_unclassified_queue ?
+				(int)unclassified_queue : -1;
+	rss->enabled = true;
+	rte_spinlock_unlock(&relay->dpdk.sl);
+
+	log_info("Enabled RSS steering on relay %u: %u-entry table, hash types 0x%x",
+		id, reta_len, hash_types);
+	return 0;
+}
+
 void virtio_forwarders_remove_all(void)
 {
 	for (unsigned id=0; id<MAX_RELAYS; ++id) {
@@ -2155,47 +4650,200 @@ dpdk_state_to_str(dpdk_state_t state, char *ans, size_t cch_max_ans)
 	}
 }
 
-static void reset_rate_stats(unsigned id)
+static const char *flight_event_names[FLIGHT_NB_EVENTS] = {
+	[FLIGHT_VIRTIO_STATE] = "virtio_state",
+	[FLIGHT_DPDK_STATE] = "dpdk_state",
+	[FLIGHT_WORKER_UPDATE] = "worker_update",
+	[FLIGHT_MIGRATE] = "migrate",
+	[FLIGHT_BACKPRESSURE] = "backpressure",
+};
+
+const char *flight_event_name(enum flight_event event)
+{
+	return event < FLIGHT_NB_EVENTS ? flight_event_names[event] : "unknown";
+}
+
+static void
+flight_decode(const struct flight_entry *e, uint64_t now,
+		struct virtio_flight_event *ev)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->age_ns = (double)(now - e->tsc) * 1E9 / rte_get_tsc_hz();
+	ev->event = e->event;
+	ev->relay = e->relay;
+	switch (e->event) {
+	case FLIGHT_VIRTIO_STATE:
+		virtio_state_to_str(e->a, ev->state, sizeof(ev->state));
+		break;
+	case FLIGHT_DPDK_STATE:
+		dpdk_state_to_str(e->a, ev->state, sizeof(ev->state));
+		break;
+	case FLIGHT_WORKER_UPDATE:
+		ev->active_relays = e->b;
+		break;
+	case FLIGHT_MIGRATE:
+		ev->dir = e->a & 0xff;
+		ev->stolen = e->a >> 8;
+		ev->from_cpu = (int32_t)(e->b >> 32);
+		ev->to_cpu = (int32_t)e->b;
+		break;
+	case FLIGHT_BACKPRESSURE:
+		ev->dir = e->a;
+		ev->pkts_held = e->b;
+		break;
+	}
+}
+
+unsigned
+virtio_forwarder_get_flight(unsigned cpu, struct virtio_flight_event *events,
+				unsigned max)
+{
+	struct flight_entry e[FLIGHT_REC_SIZE];
+	uint64_t now = rte_rdtsc();
+	unsigned n;
+
+	if (cpu > MAX_CPUS)
+		return 0;
+	n = flight_read(&flight[cpu], e, max);
+	for (unsigned i=0; i<n; ++i)
+		flight_decode(&e[i], now, &events[i]);
+
+	return n;
+}
+
+/* Events logged per flight recorder by virtio_forwarder_dump_flight(). */
+#define FLIGHT_DUMP_EVENTS 32
+
+void
+virtio_forwarder_dump_flight(void)
+{
+	struct virtio_flight_event ev[FLIGHT_DUMP_EVENTS];
+
+	for (unsigned cpu=0; cpu<=MAX_CPUS; ++cpu) {
+		unsigned n = virtio_forwarder_get_flight(cpu, ev,
+						FLIGHT_DUMP_EVENTS);
+
+		if (n == 0)
+			continue;
+		if (cpu < MAX_CPUS)
+			log_critical("-- flight recorder, CPU %u --", cpu);
+		else
+			log_critical("-- flight recorder, other threads --");
+		for (unsigned i=0; i<n; ++i) {
+			const struct virtio_flight_event *e = &ev[i];
+			const char *dir = (e->dir == RELAY_VM2VF) ?
+						"virtio2vf" : "vf2virtio";
+
+			switch (e->event) {
+			case FLIGHT_VIRTIO_STATE:
+			case FLIGHT_DPDK_STATE:
+				log_critical("-%"PRIu64"ns relay %u %s",
+					e->age_ns, e->relay, e->state);
+				break;
+			case FLIGHT_WORKER_UPDATE:
+				log_critical("-%"PRIu64"ns active_relays=0x%08"PRIx64,
+					e->age_ns, e->active_relays);
+				break;
+			case FLIGHT_MIGRATE:
+				log_critical("-%"PRIu64"ns relay %u %s %s from CPU %d to %d",
+					e->age_ns, e->relay, dir,
+					e->stolen ? "stolen" : "moved",
+					e->from_cpu, e->to_cpu);
+				break;
+			case FLIGHT_BACKPRESSURE:
+				if (e->pkts_held)
+					log_critical("-%"PRIu64"ns relay %u %s backpressured, %u packets held",
+						e->age_ns, e->relay, dir,
+						e->pkts_held);
+				else
+					log_critical("-%"PRIu64"ns relay %u %s drained",
+						e->age_ns, e->relay, dir);
+				break;
+			default:
+				log_critical("-%"PRIu64"ns %s", e->age_ns,
+					flight_event_name(e->event));
+				break;
+			}
+		}
+	}
+}
+
+bool
+virtio_forwarder_vf_hold(unsigned virtio_id, dpdk_port_t *port)
+{
+	assert(virtio_id < MAX_RELAYS);
+	vio_vf_relay_t *r = virtio_vf_relays + virtio_id;
+
+	/* detach_device() closes the port under the lock, and clears
+	 * pci_dbdf before it lets go of it. */
+	pthread_mutex_lock(&r->dpdk.port_lock);
+	if (r->dpdk.state == DPDK_READY && r->dpdk.pci_dbdf[0] != '\0') {
+		*port = r->dpdk.dpdk_port;
+		return true;
+	}
+	pthread_mutex_unlock(&r->dpdk.port_lock);
+
+	return false;
+}
+
+void
+virtio_forwarder_vf_release(unsigned virtio_id)
+{
+	assert(virtio_id < MAX_RELAYS);
+	pthread_mutex_unlock(&virtio_vf_relays[virtio_id].dpdk.port_lock);
+}
+
+void
+virtio_forwarder_get_counters(unsigned virtio_id,
+				uint64_t counters[RELAY_NB_COUNTERS])
 {
-	vio_vf_relay_t const *r = virtio_vf_relays + id;
-	relay_prev_counters_t *prev_stats = relay_prev_counters + id;
+	assert(virtio_id < MAX_RELAYS);
+	vio_vf_relay_t const *r = virtio_vf_relays + virtio_id;
+
 	/* VM2VF */
-	prev_stats->virtio_rx = r->stats.vio_rx;
-	prev_stats->virtio_rx_bytes = r->stats.vio_rx_bytes;
-	prev_stats->dpdk_tx = r->stats.dpdk_tx;
-	prev_stats->dpdk_tx_bytes = r->stats.dpdk_tx_bytes;
+	counters[RELAY_CNT_VIRTIO_RX] = r->stats.vio_rx;
+	counters[RELAY_CNT_VIRTIO_RX_BYTES] = r->stats.vio_rx_bytes;
+	counters[RELAY_CNT_DPDK_TX] = r->stats.dpdk_tx;
+	counters[RELAY_CNT_DPDK_TX_BYTES] = r->stats.dpdk_tx_bytes;
 	/* VF2VM */
-	prev_stats->dpdk_rx = r->stats.dpdk_rx;
-	prev_stats->dpdk_rx_bytes = r->stats.dpdk_rx_bytes;
-	prev_stats->virtio_tx = r->stats.vio_tx;
-	prev_stats->virtio_tx_bytes = r->stats.vio_tx_bytes;
-	/* Time. */
-	prev_stats->time_prev = rte_get_timer_cycles();
+	counters[RELAY_CNT_DPDK_RX] = r->stats.dpdk_rx;
+	counters[RELAY_CNT_DPDK_RX_BYTES] = r->stats.dpdk_rx_bytes;
+	pipeline_tx_counters(r, &counters[RELAY_CNT_VIRTIO_TX],
+			&counters[RELAY_CNT_VIRTIO_TX_BYTES]);
+	counters[RELAY_CNT_VIRTIO_TX] += r->stats.vio_tx;
+	counters[RELAY_CNT_VIRTIO_TX_BYTES] += r->stats.vio_tx_bytes;
 }
 
-void reset_all_rate_stats(unsigned delay_ms)
+#ifndef VIRTIO_ECHO
+/*
+ * Fold in the loss counters the VF keeps itself: packets it could not queue
+ * (imissed), found no mbuf for (rx_nombuf), received corrupted (ierrors), or
+ * failed to transmit (oerrors).
+ */
+static void
+vf_drop_counters(dpdk_port_t port_id, struct virtio_worker_stats *stats)
 {
-	for (unsigned id=0; id<MAX_RELAYS; ++id)
-		reset_rate_stats(id);
+	struct rte_eth_stats eth_stats;
+
+	if (rte_eth_stats_get(port_id, &eth_stats) != 0)
+		return;
 
-	if (delay_ms > 0)
-		rte_delay_ms(delay_ms);
+	stats->vf_imissed = eth_stats.imissed;
+	stats->vf_rx_nombuf = eth_stats.rx_nombuf;
+	stats->vf_ierrors = eth_stats.ierrors;
+	stats->vf_oerrors = eth_stats.oerrors;
 }
+#endif
 
 void
-virtio_forwarder_get_stats(unsigned virtio_id, struct virtio_worker_stats *stats,
-			const float *tic_period)
+virtio_forwarder_get_stats(unsigned virtio_id, struct virtio_worker_stats *stats)
 {
 	assert(virtio_id < MAX_RELAYS);
 	vio_vf_relay_t const *r = virtio_vf_relays + virtio_id;
-	relay_prev_counters_t *prev_stats = relay_prev_counters + virtio_id;
+	float rates[RATE_NB_WINDOWS][RELAY_NB_COUNTERS];
 
 	memset(stats, 0, sizeof(struct virtio_worker_stats));
-
-	/**/
-	/* Calculate time since last call/reset. */
-	float elapsed = (rte_get_timer_cycles() - prev_stats->time_prev) *
-		(*tic_period);
+	rate_sampler_get(virtio_id, rates);
 
 	vio_state_t virtio_state = r->vio.state;
 	virtio_state_to_str(virtio_state, stats->virtio_internal_state,
@@ -2218,15 +4866,22 @@ virtio_forwarder_get_stats(unsigned virtio_id, struct virtio_worker_stats *stats
 		stats->dpdk_tx_bytes = r->stats.dpdk_tx_bytes;
 		stats->dpdk_drop_full = r->stats.dpdk_drop_full;
 		stats->dpdk_drop_unavail = r->stats.dpdk_drop_unavail;
+		stats->dpdk_drop_flush = r->stats.dpdk_drop_flush;
+		stats->virtio_rx_nombuf = r->stats.vio_rx_nombuf;
+		stats->csum_sw = r->stats.csum_sw;
+		stats->csum_offload = r->stats.csum_offload;
+		stats->csum_trunc = r->stats.csum_trunc;
+		stats->virtio2vf_migrations = r->stats.vio2vf_migrations;
+		stats->virtio2vf_steals = r->stats.vio2vf_steals;
+		stats->virtio2vf_cycles = r->cycles[RELAY_VM2VF];
+		memcpy(stats->virtio_rx_bursts,
+			r->telemetry[RELAY_VM2VF].bursts,
+			sizeof(stats->virtio_rx_bursts));
 		/* Rates. */
-		stats->virtio_rx_rate = (stats->virtio_rx -
-			prev_stats->virtio_rx) / elapsed;
-		stats->virtio_rx_byte_rate = (stats->virtio_rx_bytes -
-			prev_stats->virtio_rx_bytes) / elapsed;
-		stats->dpdk_tx_rate = (stats->dpdk_tx - prev_stats->dpdk_tx) /
-			elapsed;
-		stats->dpdk_tx_byte_rate = (stats->dpdk_tx_bytes -
-			prev_stats->dpdk_tx_bytes) / elapsed;
+		stats->virtio_rx_rate = rates[0][RELAY_CNT_VIRTIO_RX];
+		stats->virtio_rx_byte_rate = rates[0][RELAY_CNT_VIRTIO_RX_BYTES];
+		stats->dpdk_tx_rate = rates[0][RELAY_CNT_DPDK_TX];
+		stats->dpdk_tx_byte_rate = rates[0][RELAY_CNT_DPDK_TX_BYTES];
 	}
 
 	/**/
@@ -2241,21 +4896,45 @@ virtio_forwarder_get_stats(unsigned virtio_id, struct virtio_worker_stats *stats
 		stats->vf2virtio_cpu = r->dpdk.vf2vio_cpu;
 		stats->dpdk_rx = r->stats.dpdk_rx;
 		stats->dpdk_rx_bytes = r->stats.dpdk_rx_bytes;
-		stats->virtio_tx = r->stats.vio_tx;
-		stats->virtio_tx_bytes = r->stats.vio_tx_bytes;
+		pipeline_tx_counters(r, &stats->virtio_tx,
+				&stats->virtio_tx_bytes);
+		stats->virtio_tx += r->stats.vio_tx;
+		stats->virtio_tx_bytes += r->stats.vio_tx_bytes;
 		stats->virtio_drop_full = r->stats.vio_drop_full;
 		stats->virtio_drop_unavail = r->stats.vio_drop_unavail;
+		stats->virtio_drop_flush = r->stats.vio_drop_flush;
+		stats->virtio_queue_fallback = r->stats.vio_queue_fallback;
+		stats->virtio_ring_empty = r->stats.vio_ring_empty;
+		stats->rx_csum_good = r->stats.rx_csum_good;
+		stats->rx_csum_bad = r->stats.rx_csum_bad;
+		stats->vf2virtio_migrations = r->stats.vf2vio_migrations;
+		stats->vf2virtio_steals = r->stats.vf2vio_steals;
+		stats->vf2virtio_cycles = r->cycles[RELAY_VF2VM];
+		memcpy(stats->dpdk_rx_bursts,
+			r->telemetry[RELAY_VF2VM].bursts,
+			sizeof(stats->dpdk_rx_bursts));
+		stats->guest_rx_free = r->guest_rx_free;
+		stats->vf_rx_depth = r->vf_rx_depth;
+		for (unsigned s=0; s<r->pipeline.nb_stages; ++s) {
+			stats->virtio_drop_unavail +=
+				r->pipeline.stages[s].vio_drop_unavail;
+			stats->virtio_drop_flush +=
+				r->pipeline.stages[s].vio_drop_flush;
+		}
+#ifndef VIRTIO_ECHO
+		dpdk_port_t port;
+
+		if (virtio_forwarder_vf_hold(virtio_id, &port)) {
+			vf_drop_counters(port, stats);
+			virtio_forwarder_vf_release(virtio_id);
+		}
+#endif
 		/* Rates. */
-		stats->dpdk_rx_rate = (stats->dpdk_rx - prev_stats->dpdk_rx) /
-			elapsed;
-		stats->dpdk_rx_byte_rate = (stats->dpdk_rx_bytes -
-			prev_stats->dpdk_rx_bytes) / elapsed;
-		stats->virtio_tx_rate = (stats->virtio_tx -
-			prev_stats->virtio_tx) / elapsed;
-		stats->virtio_tx_byte_rate = (stats->virtio_tx_bytes -
-			prev_stats->virtio_tx_bytes) / elapsed;
-	}
-	reset_rate_stats(virtio_id);
+		stats->dpdk_rx_rate = rates[0][RELAY_CNT_DPDK_RX];
+		stats->dpdk_rx_byte_rate = rates[0][RELAY_CNT_DPDK_RX_BYTES];
+		stats->virtio_tx_rate = rates[0][RELAY_CNT_VIRTIO_TX];
+		stats->virtio_tx_byte_rate = rates[0][RELAY_CNT_VIRTIO_TX_BYTES];
+	}
 
 	/* Note, this is slightly different than AND-ing together
 	 * virtio2vf_active with vf2virtio_active, because vf2virtio_active is
@@ -35,6 +35,11 @@
 #define _VIRTIO_WORKER_THREAD
 
 #include "virtio_vhostuser.h"
+#include "lat_hist.h"
+#include "flow_hash.h"
+#include "perf_counters.h"
+#include "cpu_isolation.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <rte_version.h>
 #include <stdbool.h>
@@ -52,6 +57,35 @@
 #define MAX_CPUS 64
 #define BURST_LEN 32
 #define NUM_PKTMBUF_POOL 4096
+#define MAX_PIPELINE_STAGES 4
+#define PIPELINE_RING_SIZE 1024
+#define EVENTDEV_NB_EVENTS 4096
+#define EVENTDEV_SW_NAME "event_sw0"
+#define GRAPH_MAX_NODES 16
+/* Work stealing: sampling interval, minimum time a relay direction stays on a
+ * CPU, minimum load gap (percent of the victim's load) and minimum load, in
+ * packets per interval, for a steal. */
+#define STEAL_INTERVAL_MS 10
+#define STEAL_RESIDENCY_MS 500
+#define STEAL_IMBALANCE_PCT 25
+#define STEAL_MIN_PKTS 1000
+#define GRAPH_NODE_NAME_CCH_MAX 64
+/* Receive calls between two samples of the ring occupancy gauges. */
+#define GAUGE_SAMPLE_CALLS 256
+
+/* Receive-side scaling limits of the virtio-net device (VIRTIO_NET_F_RSS). */
+#define VIRTIO_RSS_KEY_LEN 40
+#define VIRTIO_RSS_RETA_SIZE 128
+
+/* Hash types from the virtio specification, as used in rss_config. */
+#ifndef VIRTIO_NET_RSS_HASH_TYPE_IPv4
+#define VIRTIO_NET_RSS_HASH_TYPE_IPv4 (1 << 0)
+#define VIRTIO_NET_RSS_HASH_TYPE_TCPv4 (1 << 1)
+#define VIRTIO_NET_RSS_HASH_TYPE_UDPv4 (1 << 2)
+#define VIRTIO_NET_RSS_HASH_TYPE_IPv6 (1 << 3)
+#define VIRTIO_NET_RSS_HASH_TYPE_TCPv6 (1 << 4)
+#define VIRTIO_NET_RSS_HASH_TYPE_UDPv6 (1 << 5)
+#endif
 
 /**
  * Required size of char[] buffer for virtio worker internal state debug
@@ -78,6 +112,15 @@ extern struct virtio_vhostuser_conf g_vio_worker_conf;
 enum {VIRTIO_RXQ, VIRTIO_TXQ, VIRTIO_QNUM};
 #endif
 
+/* TSC cycle accounting of a worker CPU, only written by the worker itself. */
+struct worker_cycles {
+	uint64_t iterations; /* Passes over the active relays. */
+	uint64_t busy; /* Forwarding calls that moved packets. */
+	uint64_t idle; /* Polls that found nothing to forward. */
+	uint64_t sleep; /* Sleeping after a pass without work. */
+	uint64_t overhead; /* Everything else, e.g. picking up relay changes. */
+};
+
 typedef struct {
 	union {
 		struct {
@@ -88,11 +131,23 @@ typedef struct {
 			bool must_stop;
 			volatile bool need_update;
 			uint64_t active_relays;
+			uint8_t event_port; /* Only valid in event mode. */
+			/* Relay directions locked for the current graph walk. */
+			uint64_t graph_vm2vf;
+			uint64_t graph_vf2vm;
+			/* Work stealing: packets of the owned relay directions
+			 * in the last interval, and end of the interval. */
+			volatile uint64_t steal_load;
+			uint64_t steal_tsc;
+			struct worker_cycles cycles;
 		};
-		uint8_t _buf[RTE_CACHE_LINE_SIZE];
+		uint8_t _buf[2 * RTE_CACHE_LINE_SIZE];
 	};
 } worker_thread_t  __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
 
+/* Relay directions, each served by a single worker CPU. */
+enum relay_dir {RELAY_VM2VF, RELAY_VF2VM, RELAY_NB_DIRS};
+
 typedef enum {
 	VIRTIO_UNINIT,
 	VIRTIO_READY,
@@ -108,6 +163,13 @@ typedef enum {
 	DPDK_REMOVING2
 } dpdk_state_t;
 
+/* Ring occupancy samples. */
+struct relay_gauge {
+	uint64_t last;
+	uint64_t sum;
+	uint64_t samples;
+};
+
 /** Statistics for an individual worker. */
 struct virtio_worker_stats
 {
@@ -126,6 +188,16 @@ struct virtio_worker_stats
 	uint64_t dpdk_tx_bytes;
 	uint64_t dpdk_drop_full;
 	uint64_t dpdk_drop_unavail;
+	uint64_t dpdk_drop_flush;
+	uint64_t virtio_rx_nombuf;
+	uint64_t vf_oerrors; /* Taken from the VF, see vf_imissed. */
+	uint64_t csum_sw;
+	uint64_t csum_offload;
+	uint64_t csum_trunc;
+	uint64_t virtio2vf_migrations;
+	uint64_t virtio2vf_steals;
+	uint64_t virtio2vf_cycles;
+	uint64_t virtio_rx_bursts[BURST_LEN + 1];
 	/* Rates. */
 	float virtio_rx_rate;
 	float virtio_rx_byte_rate;
@@ -149,6 +221,22 @@ struct virtio_worker_stats
 	uint64_t virtio_tx_bytes;
 	uint64_t virtio_drop_full;
 	uint64_t virtio_drop_unavail;
+	uint64_t virtio_drop_flush;
+	uint64_t virtio_queue_fallback;
+	uint64_t virtio_ring_empty;
+	/* Counters of the VF itself, only valid if dpdk_internal_state is
+	 * DPDK_READY. */
+	uint64_t vf_imissed;
+	uint64_t vf_rx_nombuf;
+	uint64_t vf_ierrors;
+	uint64_t rx_csum_good;
+	uint64_t rx_csum_bad;
+	uint64_t vf2virtio_migrations;
+	uint64_t vf2virtio_steals;
+	uint64_t vf2virtio_cycles;
+	uint64_t dpdk_rx_bursts[BURST_LEN + 1];
+	struct relay_gauge guest_rx_free;
+	struct relay_gauge vf_rx_depth;
 	/* Rates. */
 	float dpdk_rx_rate;
 	float dpdk_rx_byte_rate;
@@ -164,6 +252,15 @@ struct virtio_worker_stats
 	unsigned socket_id;
 };
 
+/* Guest RSS configuration for steering VF to VM traffic. */
+struct relay_rss {
+	volatile bool enabled;
+	uint32_t hash_types;
+	int unclassified_queue; /* -1 to use the default steering hash. */
+	uint32_t key_be[VIRTIO_RSS_KEY_LEN / 4]; /* As rte_convert_rss_key(). */
+	uint8_t reta[VIRTIO_RSS_RETA_SIZE];
+};
+
 /* Structure describing the virtio side of a relay */
 struct relay_virtio {
 	int vio2vf_cpu;
@@ -174,6 +271,7 @@ struct relay_virtio {
 	uint8_t rx_q_lut[MAX_MULTIQUEUE_PAIRS];
 	unsigned tx_q_rr; /* round robin state of tx queue processing for multi-queue, 0 <= tx_q_rr < max_queue_pairs. */
 	bool pow2queues;
+	struct relay_rss rss;
 	volatile vio_state_t state;
 #if RTE_VERSION_NUM(16, 7, 0, 0) <= RTE_VERSION
 	int vio_dev;
@@ -196,9 +294,15 @@ struct relay_dpdk {
 	unsigned num_slaves;
 	dpdk_port_t dpdk_port;
 	char pci_dbdf[20];
+	/* L4 checksums the VF cannot offload; finalized in software instead. */
+	bool sw_tcp_csum;
+	bool sw_udp_csum;
 	struct rte_mbuf *rx_pkts[BURST_LEN];
 	unsigned rx_pkts_avail, rx_pkts_used;
 	rte_spinlock_t sl;
+	/* Keeps the VF attached while it is read outside the datapath, see
+	 * virtio_forwarder_vf_hold(). */
+	pthread_mutex_t port_lock;
 } __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
 
 /* Per relay statistics */
@@ -210,6 +314,13 @@ struct relay_stats {
 	uint64_t dpdk_tx_bytes; /* bytes sent to the VF */
 	uint64_t dpdk_drop_full; /* packets from virtio dropped because VF queue full */
 	uint64_t dpdk_drop_unavail; /* packets from virtio dropped because VF not ready */
+	uint64_t dpdk_drop_flush; /* packets from virtio freed when the relay was torn down */
+	uint64_t vio_rx_nombuf; /* virtio dequeues cut short by an exhausted mempool */
+	uint64_t csum_sw; /* packets from virtio whose L4 checksum was finalized in software */
+	uint64_t csum_offload; /* packets from virtio whose L4 checksum was left to the VF */
+	uint64_t csum_trunc; /* packets from virtio whose IP length overran the packet */
+	uint64_t vio2vf_migrations; /* moves of the VM to VF direction to another CPU */
+	uint64_t vio2vf_steals; /* moves of the VM to VF direction by work stealing */
 	/* VF to VM */
 	uint64_t dpdk_rx; /* packets received from the VF */
 	uint64_t dpdk_rx_bytes; /* bytes received from the VF */
@@ -217,8 +328,71 @@ struct relay_stats {
 	uint64_t vio_tx_bytes; /* bytes sent to virtio */
 	uint64_t vio_drop_full; /* packets from VF dropped because virtio queue full */
 	uint64_t vio_drop_unavail; /* packets from VF dropped because virtio not avail */
+	uint64_t vio_drop_flush; /* packets from VF freed when the relay was torn down */
+	uint64_t vio_queue_fallback; /* packets from VF steered to a guest queue not enabled, sent through another */
+	uint64_t vio_ring_empty; /* VF polls skipped for lack of free guest RX descriptors */
+	uint64_t rx_csum_good; /* packets from the VF with a hardware verified L4 checksum */
+	uint64_t rx_csum_bad; /* packets from the VF with a hardware rejected L4 checksum */
+	uint64_t vf2vio_migrations; /* moves of the VF to VM direction to another CPU */
+	uint64_t vf2vio_steals; /* moves of the VF to VM direction by work stealing */
+} __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
+
+/*
+ * Pipeline mode: a vhost enqueue stage of the VF to VM direction. Stage s of n
+ * owns the virtio RX queues q with q % n == s, and is fed by the relay's
+ * vf2vio CPU through its ring.
+ */
+struct relay_pipeline_stage {
+	int cpu;
+	struct rte_ring *ring;
+	rte_spinlock_t sl;
+	struct rte_mbuf *pkts[BURST_LEN];
+	unsigned pkts_avail;
+	/* Written by the stage only; added to relay_stats when queried. */
+	uint64_t vio_tx;
+	uint64_t vio_tx_bytes;
+	uint64_t vio_drop_unavail;
+	uint64_t vio_drop_flush;
+} __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
+
+/*
+ * Counters of a virtqueue of a relay: a guest TX queue for VM to VF, a guest RX
+ * queue for VF to VM. Each queue has a single writer at a time, but the queues
+ * of a relay may be served by different CPUs, hence one cache line each.
+ */
+struct relay_queue_stats {
+	uint64_t pkts;
+	uint64_t bytes;
+	uint64_t drops;
 } __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
 
+/* Receive telemetry of a relay direction, written by its receiving worker. */
+struct relay_telemetry {
+	uint64_t bursts[BURST_LEN + 1]; /* Receive calls by packets received. */
+	unsigned sample_countdown; /* Receive calls until the next gauge sample. */
+};
+
+/* Hardware performance counters of a relay direction, summed over the
+ * sampled polls that moved packets, see perf_counters.h. */
+struct relay_perf {
+	uint64_t polls;
+	uint64_t pkts; /* Packets received in those polls. */
+	uint64_t counters[PERF_NB_COUNTERS];
+};
+
+/* Work stealing state of a relay direction. */
+struct relay_steal {
+	uint64_t prev_pkts; /* Received packets at the last sample. */
+	volatile uint64_t load; /* Received packets in the last interval. */
+	uint64_t owned_tsc; /* When the direction last changed CPU. */
+};
+
+struct relay_pipeline {
+	unsigned nb_stages; /* 0 unless the relay runs in pipeline mode. */
+	uint64_t cpu_mask;
+	struct relay_pipeline_stage stages[MAX_PIPELINE_STAGES];
+};
+
 /* Main relay type definition. Combines the virtio and VF side structs among other things */
 typedef struct {
 	union {
@@ -230,37 +404,270 @@ typedef struct {
 			struct relay_virtio vio;
 			struct relay_dpdk dpdk;
 			struct relay_stats stats;
+			struct relay_pipeline pipeline;
+			struct relay_steal steal[RELAY_NB_DIRS];
+			/* TSC cycles spent forwarding each direction, in
+			 * calls that moved packets. */
+			uint64_t cycles[RELAY_NB_DIRS];
+			/* Event mode: packets injected into the event device
+			 * and not yet transmitted or dropped by a worker. */
+			volatile uint32_t event_inflight;
 			unsigned use_jumbo:1;
+			/* Latency sampling: packets to skip before the next
+			 * stamp, and residency of the stamped packets. */
+			unsigned latency_skip[RELAY_NB_DIRS];
+			struct lat_hist latency[RELAY_NB_DIRS];
+			/* Heavy hitter flow sampling: packets to skip before
+			 * the next sample, and the flow sketches. */
+			unsigned flow_skip[RELAY_NB_DIRS];
+			struct flow_sketch *flows[RELAY_NB_DIRS];
+			/* Directions being captured, as a mask of
+			 * 1 << enum relay_dir, see pkt_capture.h. */
+			uint8_t capture;
+			/* Consecutive passes that left packets held for want
+			 * of TX room, up to RELAY_BACKPRESSURE_PASSES. */
+			uint16_t backpressure[RELAY_NB_DIRS];
+			struct relay_telemetry telemetry[RELAY_NB_DIRS];
+			struct relay_perf perf[RELAY_NB_DIRS];
+			/* VF to VM ring occupancy. */
+			struct relay_gauge guest_rx_free;
+			struct relay_gauge vf_rx_depth;
+			struct relay_queue_stats
+				queue_stats[RELAY_NB_DIRS][MAX_MULTIQUEUE_PAIRS];
+			/* VF to VM packets steered to each guest RX queue,
+			 * written by the receiving worker. */
+			uint64_t queue_steered[MAX_MULTIQUEUE_PAIRS];
 		};
 		uint8_t _buf[RTE_CACHE_LINE_SIZE];
 	};
 } vio_vf_relay_t __attribute__ ((aligned (RTE_CACHE_LINE_SIZE)));
 
-typedef struct {
+/**
+ * Traffic counters of a relay that rates are derived from. Each byte counter
+ * follows its packet counter.
+ */
+enum relay_counter {
+	/* VM to VF */
+	RELAY_CNT_VIRTIO_RX,
+	RELAY_CNT_VIRTIO_RX_BYTES,
+	RELAY_CNT_DPDK_TX,
+	RELAY_CNT_DPDK_TX_BYTES,
+	/* VF to VM */
+	RELAY_CNT_DPDK_RX,
+	RELAY_CNT_DPDK_RX_BYTES,
+	RELAY_CNT_VIRTIO_TX,
+	RELAY_CNT_VIRTIO_TX_BYTES,
+	RELAY_NB_COUNTERS
+};
+
+/**
+ * @brief Gets statistics for the individual worker @a virtio_id.
+ *
+ * The rates are averaged over the shortest window of the rate sampler.
+ */
+void
+virtio_forwarder_get_stats(unsigned virtio_id, struct virtio_worker_stats *stats);
+
+/**
+ * @brief Gets the traffic counters of relay @a virtio_id, for the rate
+ * sampler.
+ */
+void
+virtio_forwarder_get_counters(unsigned virtio_id,
+				uint64_t counters[RELAY_NB_COUNTERS]);
+
+/**
+ * @brief Keep the VF of relay @a virtio_id from being detached, so that its
+ * port can be queried from outside the datapath.
+ *
+ * Not to be called by workers. Must be followed by virtio_forwarder_vf_release()
+ * if it succeeds.
+ *
+ * @param port Receives the port of the VF.
+ * @return true if the VF is ready, false if there is nothing to hold.
+ */
+bool
+virtio_forwarder_vf_hold(unsigned virtio_id, dpdk_port_t *port);
+
+/** @brief Let the VF held by virtio_forwarder_vf_hold() be detached again. */
+void
+virtio_forwarder_vf_release(unsigned virtio_id);
+
+/** Counters of a virtqueue pair of a relay. */
+struct virtio_queue_stats
+{
+	unsigned id;
+	/* Guest TX queue. */
 	uint64_t virtio_rx;
 	uint64_t virtio_rx_bytes;
-	uint64_t dpdk_tx;
-	uint64_t dpdk_tx_bytes;
-	uint64_t dpdk_rx;
-	uint64_t dpdk_rx_bytes;
+	/* Guest RX queue. */
 	uint64_t virtio_tx;
 	uint64_t virtio_tx_bytes;
-	uint64_t time_prev;
-} relay_prev_counters_t;
+	uint64_t virtio_drop;
+	uint64_t steered;
+};
 
 /**
- * @brief Gets statistics for the individual worker @a virtio_id.
- * @param tic_period Pointer to the processor tic period in seconds
+ * @brief Gets the per virtqueue pair counters of relay @a virtio_id.
+ * @param stats Array receiving up to @a max queue pair entries.
+ * @return Number of entries filled in, 0 if the guest is not connected.
  */
-void
-virtio_forwarder_get_stats(unsigned virtio_id, struct virtio_worker_stats *stats,
-			const float *tic_period);
+unsigned
+virtio_forwarder_get_queue_stats(unsigned virtio_id,
+				struct virtio_queue_stats *stats, unsigned max);
+
+/** Counters of a graph mode node, summed over all workers. */
+struct virtio_graph_node_stats
+{
+	char name[GRAPH_NODE_NAME_CCH_MAX];
+	uint64_t calls;
+	uint64_t objs;
+	uint64_t cycles;
+};
+
+/**
+ * @brief Gets the per node statistics of the graph mode datapath.
+ * @param stats Array receiving up to @a max node entries.
+ * @return Number of entries filled in, or -1 if graph mode is not in use.
+ */
+int
+virtio_forwarder_get_graph_stats(struct virtio_graph_node_stats *stats,
+				unsigned max);
+
+/* Largest stalls kept per worker, see the stall-threshold option. */
+#define WORKER_STALL_LOG 8
+
+/** A gap between two passes of a worker over its relays, above the stall
+ * threshold. */
+struct worker_stall {
+	uint64_t time_ns; /* CLOCK_REALTIME at the end of the gap. */
+	uint64_t cycles; /* Length of the gap, in TSC cycles. */
+};
+
+/** Cycle accounting of a worker CPU, see struct worker_cycles. */
+struct virtio_worker_state
+{
+	int cpu;
+	unsigned nb_relays; /* Relays with a direction served by the worker. */
+	uint64_t tsc_hz;
+	uint64_t iterations;
+	uint64_t busy_cycles;
+	uint64_t idle_cycles;
+	uint64_t sleep_cycles;
+	uint64_t overhead_cycles;
+	/* Hardware performance counters of the worker thread since it
+	 * started, as of its last sampled pass, none if perf_mask is 0. */
+	unsigned perf_mask; /* 1 << enum perf_counter of the counters. */
+	uint64_t perf[PERF_NB_COUNTERS];
+	/* Isolation checks the CPU failed at startup, as 1 << enum
+	 * cpu_isolation, and device interrupts that may land on it. */
+	unsigned isolation;
+	unsigned irqs;
+	/* Gaps above the stall threshold, and the largest of them by
+	 * decreasing length. */
+	uint64_t stalls;
+	unsigned nb_stalls;
+	struct worker_stall stall[WORKER_STALL_LOG];
+};
+
+/**
+ * @brief Gets the cycle accounting of the worker CPUs.
+ * @param states Array receiving up to @a max worker entries.
+ * @return Number of entries filled in.
+ */
+unsigned
+virtio_forwarder_get_worker_states(struct virtio_worker_state *states,
+				unsigned max);
+
+/**
+ * @brief Gets the histogram of the gaps between the passes of worker @a cpu
+ * over its relays, leaving out the sleeps of an idle worker.
+ * @param hist Receives the histogram, in TSC cycles.
+ * @return 0 on success, -1 if stall detection is disabled.
+ */
+int
+virtio_forwarder_get_worker_gaps(unsigned cpu, struct lat_hist *hist);
+
+/* Events of the flight recorder. */
+enum flight_event {
+	FLIGHT_VIRTIO_STATE, /* State change of the virtio side of a relay. */
+	FLIGHT_DPDK_STATE, /* State change of the VF side of a relay. */
+	FLIGHT_WORKER_UPDATE, /* Worker picked up its relay assignment. */
+	FLIGHT_MIGRATE, /* Relay direction moved to another worker. */
+	FLIGHT_BACKPRESSURE, /* Relay direction stuck on TX, or freed again. */
+	FLIGHT_NB_EVENTS
+};
+
+/** An event of the flight recorder, decoded. */
+struct virtio_flight_event {
+	uint64_t age_ns; /* Time elapsed since the event. */
+	enum flight_event event;
+	unsigned relay; /* Not set for worker updates. */
+	char state[20]; /* New state, of state changes. */
+	enum relay_dir dir; /* Of migrations and backpressure. */
+	int from_cpu; /* Of migrations. */
+	int to_cpu;
+	bool stolen; /* Migration by work stealing. */
+	uint64_t active_relays; /* Relay bitmap, of worker updates. */
+	unsigned pkts_held; /* Of backpressure, 0 once it cleared. */
+};
+
+/**
+ * @brief Gets the last events recorded by the thread running on lcore @a cpu,
+ * oldest first. Threads outside of the EAL share the recorder of @a cpu
+ * MAX_CPUS.
+ * @param events Array receiving up to @a max events, the most recent ones.
+ * @return Number of entries filled in.
+ */
+unsigned
+virtio_forwarder_get_flight(unsigned cpu, struct virtio_flight_event *events,
+				unsigned max);
+
+/**
+ * @brief Logs the events of all flight recorders, e.g. on a fatal signal.
+ */
+void virtio_forwarder_dump_flight(void);
+
+const char *flight_event_name(enum flight_event event);
 
 /**
- * @brief Reset the rate statistics for all relays.
- * @param delay_ms Time in milliseconds to wait after resetting the counters.
+ * @brief Gets the forwarding latency histogram of a relay direction.
+ * @param hist Receives the histogram, in TSC cycles.
+ * @return 0 on success, -1 if latency sampling is disabled.
  */
-void reset_all_rate_stats(unsigned delay_ms);
+int
+virtio_forwarder_get_latency(unsigned id, enum relay_dir dir,
+				struct lat_hist *hist);
+
+/**
+ * @brief Gets the hardware performance counters of a relay direction.
+ * @param perf Receives the counters, see struct relay_perf.
+ * @param mask Receives 1 << enum perf_counter of the counters available.
+ * @return 0 on success, -1 if performance counter sampling is disabled or
+ * unavailable.
+ */
+int
+virtio_forwarder_get_perf(unsigned id, enum relay_dir dir,
+				struct relay_perf *perf, unsigned *mask);
+
+/** A heavy hitter flow of a relay direction. */
+struct virtio_flow_stats
+{
+	uint32_t hash;
+	struct flow_tuple tuple; /* ip_version is 0 for non-IP flows. */
+	double pkt_rate; /* Estimates, per second. */
+	double byte_rate;
+};
+
+/**
+ * @brief Gets the heaviest flows of a relay direction over the last epoch of
+ * its flow sketch, by decreasing packet rate.
+ * @param flows Array receiving up to @a max flows.
+ * @return Number of entries filled in, or -1 if flow sampling is disabled.
+ */
+int
+virtio_forwarder_get_flows(unsigned id, enum relay_dir dir,
+				struct virtio_flow_stats *flows, unsigned max);
 
 /**
  * @brief Get index of the first idle relay.
@@ -312,6 +719,25 @@ void virtio_forwarders_remove_all(void);
 void
 virtio_forwarder_vring_state_change(unsigned id, unsigned queue_id, int enable);
 
+/**
+ * @brief Apply a guest RSS configuration to VF to VM queue selection
+ * @param id virtio/relay instance
+ * @param key Toeplitz key of VIRTIO_RSS_KEY_LEN bytes
+ * @param reta Indirection table of queue numbers; its size must be a power
+ * of two no larger than VIRTIO_RSS_RETA_SIZE. An empty table disables RSS.
+ * @param reta_len Number of entries in @p reta
+ * @param hash_types Mask of VIRTIO_NET_RSS_HASH_TYPE_* flags
+ * @param has_unclassified_queue False to keep the default steering hash for
+ * packets not matching @p hash_types
+ * @param unclassified_queue Queue for packets not matching @p hash_types
+ * @return 0 if success, non-zero on failure
+ */
+int
+virtio_forwarder_set_rss(unsigned id, const uint8_t *key,
+			const uint32_t *reta, unsigned reta_len,
+			uint32_t hash_types, bool has_unclassified_queue,
+			unsigned unclassified_queue);
+
 /**
  * @brief Add an SR-IOV VF to the virtio-forwarder using DPDK hotplug
  * @param pci_dbdf PCI domain:bus:device.function address string, e.g. "0000:05:0f.5"
@@ -362,6 +788,36 @@ int
 migrate_relay_cpus(int relay_number, int new_virtio2vf_cpu,
 			int new_vf2virtio_cpu);
 
+/**
+ * @brief Change the cpu that services one direction of a relay.
+ * @param relay_number Relay instance to be altered.
+ * @param dir Direction to move.
+ * @param cpu New worker cpu.
+ * @return 1 if moved, 0 if already there, -1 if the direction cannot be moved
+ */
+int
+migrate_relay_dir(unsigned relay_number, enum relay_dir dir, int cpu);
+
+/** Load of a relay direction, as measured by its worker. */
+struct virtio_relay_load
+{
+	bool active; /* Direction is forwarding. */
+	bool pinned; /* CPU was set on the command line. */
+	int cpu;
+	int socket_id; /* NUMA node of the relay's memory. */
+	/* TSC cycles of the polls that moved packets, cumulative. Empty
+	 * polls are left out, so that idle directions weigh nothing. */
+	uint64_t cycles;
+	uint64_t owned_tsc; /* TSC of the last change of CPU. */
+};
+
+/**
+ * @brief Gets the load of both directions of relay @a id.
+ */
+void
+virtio_forwarder_get_relay_load(unsigned id,
+				struct virtio_relay_load load[RELAY_NB_DIRS]);
+
 /**
  * @brief Get the worker core mask.
  * @return The worker core mask.
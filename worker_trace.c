@@ -0,0 +1,49 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <rte_version.h>
+#if defined(WORKER_TRACE) && RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+/* Makes the tracepoints of the header definitions, rather than declarations. */
+#include <rte_trace_point_register.h>
+#endif
+#include "worker_trace.h"
+
+#ifdef WORKER_TRACE_ENABLED
+RTE_TRACE_POINT_REGISTER(worker_trace_virtio_state, vio4wd.relay.virtio_state)
+RTE_TRACE_POINT_REGISTER(worker_trace_dpdk_state, vio4wd.relay.dpdk_state)
+RTE_TRACE_POINT_REGISTER(worker_trace_update, vio4wd.worker.update)
+RTE_TRACE_POINT_REGISTER(worker_trace_migrate, vio4wd.relay.migrate)
+RTE_TRACE_POINT_REGISTER(worker_trace_backpressure, vio4wd.relay.backpressure)
+RTE_TRACE_POINT_REGISTER(worker_trace_rx_burst, vio4wd.relay.rx_burst)
+RTE_TRACE_POINT_REGISTER(worker_trace_tx_burst, vio4wd.relay.tx_burst)
+#endif
@@ -0,0 +1,156 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WORKER_TRACE_H
+#define _WORKER_TRACE_H
+
+#include <stdint.h>
+#include <rte_version.h>
+
+/*
+ * Tracepoints of the relay workers, for the DPDK trace framework. They are
+ * compiled in when building with -DWORKER_TRACE against DPDK 21.05 or later,
+ * and recorded once enabled with the --trace option, e.g. --trace=vio4wd.
+ * The burst tracepoints are fast path tracepoints, which DPDK only compiles
+ * in when built with enable_trace_fp. Otherwise, they all compile to nothing.
+ */
+#if defined(WORKER_TRACE) && RTE_VERSION_NUM(21, 5, 0, 0) <= RTE_VERSION
+#define WORKER_TRACE_ENABLED
+#include <rte_trace_point.h>
+
+RTE_TRACE_POINT(
+	worker_trace_virtio_state,
+	RTE_TRACE_POINT_ARGS(uint16_t relay, uint8_t old, uint8_t state),
+	rte_trace_point_emit_u16(relay);
+	rte_trace_point_emit_u8(old);
+	rte_trace_point_emit_u8(state);
+)
+
+RTE_TRACE_POINT(
+	worker_trace_dpdk_state,
+	RTE_TRACE_POINT_ARGS(uint16_t relay, uint8_t old, uint8_t state),
+	rte_trace_point_emit_u16(relay);
+	rte_trace_point_emit_u8(old);
+	rte_trace_point_emit_u8(state);
+)
+
+RTE_TRACE_POINT(
+	worker_trace_update,
+	RTE_TRACE_POINT_ARGS(uint16_t cpu, uint64_t active_relays),
+	rte_trace_point_emit_u16(cpu);
+	rte_trace_point_emit_u64(active_relays);
+)
+
+RTE_TRACE_POINT(
+	worker_trace_migrate,
+	RTE_TRACE_POINT_ARGS(uint16_t relay, uint8_t dir, int16_t from,
+			int16_t to, uint8_t stolen),
+	rte_trace_point_emit_u16(relay);
+	rte_trace_point_emit_u8(dir);
+	rte_trace_point_emit_i16(from);
+	rte_trace_point_emit_i16(to);
+	rte_trace_point_emit_u8(stolen);
+)
+
+RTE_TRACE_POINT(
+	worker_trace_backpressure,
+	RTE_TRACE_POINT_ARGS(uint16_t relay, uint8_t dir, uint16_t held),
+	rte_trace_point_emit_u16(relay);
+	rte_trace_point_emit_u8(dir);
+	rte_trace_point_emit_u16(held);
+)
+
+RTE_TRACE_POINT_FP(
+	worker_trace_rx_burst,
+	RTE_TRACE_POINT_ARGS(uint16_t relay, uint8_t dir, uint16_t n),
+	rte_trace_point_emit_u16(relay);
+	rte_trace_point_emit_u8(dir);
+	rte_trace_point_emit_u16(n);
+)
+
+RTE_TRACE_POINT_FP(
+	worker_trace_tx_burst,
+	RTE_TRACE_POINT_ARGS(uint16_t relay, uint8_t dir, uint16_t offered,
+			uint16_t sent),
+	rte_trace_point_emit_u16(relay);
+	rte_trace_point_emit_u8(dir);
+	rte_trace_point_emit_u16(offered);
+	rte_trace_point_emit_u16(sent);
+)
+
+#else
+
+#define __trace_unused __attribute__((unused))
+
+static inline void
+worker_trace_virtio_state(uint16_t relay __trace_unused,
+			uint8_t old __trace_unused,
+			uint8_t state __trace_unused) {}
+
+static inline void
+worker_trace_dpdk_state(uint16_t relay __trace_unused,
+			uint8_t old __trace_unused,
+			uint8_t state __trace_unused) {}
+
+static inline void
+worker_trace_update(uint16_t cpu __trace_unused,
+			uint64_t active_relays __trace_unused) {}
+
+static inline void
+worker_trace_migrate(uint16_t relay __trace_unused,
+			uint8_t dir __trace_unused,
+			int16_t from __trace_unused,
+			int16_t to __trace_unused,
+			uint8_t stolen __trace_unused) {}
+
+static inline void
+worker_trace_backpressure(uint16_t relay __trace_unused,
+			uint8_t dir __trace_unused,
+			uint16_t held __trace_unused) {}
+
+static inline void
+worker_trace_rx_burst(uint16_t relay __trace_unused,
+			uint8_t dir __trace_unused,
+			uint16_t n __trace_unused) {}
+
+static inline void
+worker_trace_tx_burst(uint16_t relay __trace_unused,
+			uint8_t dir __trace_unused,
+			uint16_t offered __trace_unused,
+			uint16_t sent __trace_unused) {}
+
+#undef __trace_unused
+
+#endif
+
+#endif /* _WORKER_TRACE_H */
@@ -41,6 +41,7 @@
 
 #define __MODULE__ "zmq_core_sched"
 #include "log.h"
+#include "core_sched.h"
 #include "virtio_worker.h"
 #include "zmq_service.h"
 
@@ -57,6 +58,8 @@ Virtioforwarder__CoreSchedRequest__Op__to_str(
 		return "UPDATE";
 	case VIRTIOFORWARDER__CORE_SCHED_REQUEST__OP__GET_EAL_CORES:
 		return "GET_EAL_CORES";
+	case VIRTIOFORWARDER__CORE_SCHED_REQUEST__OP__CONFIGURE:
+		return "CONFIGURE";
 	default:
 		snprintf(ans, len, "Virtioforwarder__CoreSchedRequest__Op(%i)", op);
 		return ans;
@@ -191,6 +194,40 @@ handle_CoreSchedRequest(
 			}
 			break;
 
+		case VIRTIOFORWARDER__CORE_SCHED_REQUEST__OP__CONFIGURE: {
+			struct core_sched_conf conf;
+			struct core_sched_stats stats;
+
+			core_sched_get(&conf, NULL);
+			if (pc->has_native_enable || pc->has_native_interval_ms ||
+					pc->has_native_sensitivity) {
+				if (pc->has_native_enable)
+					conf.enabled = pc->native_enable;
+				if (pc->has_native_interval_ms)
+					conf.interval_ms = pc->native_interval_ms;
+				if (pc->has_native_sensitivity)
+					conf.sensitivity = pc->native_sensitivity;
+				if (core_sched_set_conf(&conf)) {
+					handle_CoreSchedRequest_set_error_code(
+						&response, "core_sched_set_conf()", -1);
+					break;
+				}
+			}
+			core_sched_get(&conf, &stats);
+			response.has_native_enabled = true;
+			response.native_enabled = conf.enabled;
+			response.has_native_interval_ms = true;
+			response.native_interval_ms = conf.interval_ms;
+			response.has_native_sensitivity = true;
+			response.native_sensitivity = conf.sensitivity;
+			response.has_native_rounds = true;
+			response.native_rounds = stats.rounds;
+			response.has_native_migrations = true;
+			response.native_migrations = stats.migrations;
+			response.status = VIRTIOFORWARDER__CORE_SCHED_RESPONSE__STATUS__OK;
+			break;
+		}
+
 		default:
 			log_critical("unhandled CoreSchedRequest.Op %i", pc->op);
 			break;
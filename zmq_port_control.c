@@ -34,6 +34,7 @@
 #include "zmq_port_control.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 
@@ -41,6 +42,7 @@
 
 #define __MODULE__ "zmq_port_control"
 #include "log.h"
+#include "pkt_capture.h"
 #include "sriov.h"
 #include "virtio_worker.h"
 #include "virtio_vhostuser.h"
@@ -161,6 +163,38 @@ validate_PortControlRequest(Virtioforwarder__PortControlRequest const *pc)
 		return false;
 	}
 
+	if (pc->op == VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__SET_RSS) {
+		if (!pc->has_virtio_id) {
+			log_error("RSS configuration requires a virtio id.");
+			return false;
+		}
+		if (pc->n_rss_indirection_table &&
+				(!pc->has_rss_key ||
+				pc->rss_key.len != VIRTIO_RSS_KEY_LEN)) {
+			log_error("RSS configuration requires a %u-byte key.",
+				VIRTIO_RSS_KEY_LEN);
+			return false;
+		}
+	}
+
+	if ((pc->op == VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__CAPTURE_START ||
+			pc->op == VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__CAPTURE_STOP) &&
+			!pc->has_virtio_id) {
+		log_error("Capture operations require a virtio id.");
+		return false;
+	}
+	if (pc->op == VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__CAPTURE_START) {
+		if (pc->capture_path == NULL || *pc->capture_path == '\0') {
+			log_error("Capture requires a file path.");
+			return false;
+		}
+		if (pc->has_capture_queue &&
+				pc->capture_queue >= MAX_MULTIQUEUE_PAIRS) {
+			log_error("Invalid capture queue %u.", pc->capture_queue);
+			return false;
+		}
+	}
+
 	return true;
 }
 
@@ -276,6 +310,70 @@ port_control_handle_remove(Virtioforwarder__PortControlResponse *response,
 	}
 }
 
+static void
+port_control_handle_set_rss(Virtioforwarder__PortControlResponse *response,
+			struct port_control_req_buffer *cfg,
+			Virtioforwarder__PortControlRequest const *pc)
+{
+	handle_PortControlRequest_set_error_code(
+		response, "virtio_forwarder_set_rss()",
+		virtio_forwarder_set_rss(
+			cfg->virtio_id, pc->rss_key.data,
+			pc->rss_indirection_table, pc->n_rss_indirection_table,
+			pc->rss_hash_types, pc->has_rss_unclassified_queue,
+			pc->rss_unclassified_queue
+		)
+	);
+}
+
+static void
+port_control_handle_capture_start(Virtioforwarder__PortControlResponse *response,
+			struct port_control_req_buffer *cfg,
+			Virtioforwarder__PortControlRequest const *pc)
+{
+	struct pkt_capture_conf conf = {
+		.relay_id = cfg->virtio_id,
+		.queue = pc->has_capture_queue ? (int)pc->capture_queue : -1,
+		.snaplen = pc->has_capture_snaplen ? pc->capture_snaplen : 0,
+		.filter = pc->capture_filter,
+		.path = pc->capture_path,
+	};
+
+	switch (pc->capture_direction) {
+	case VIRTIOFORWARDER__PORT_CONTROL_REQUEST__CAPTURE_DIRECTION__VM_TO_VF:
+		conf.dirs = 1 << RELAY_VM2VF;
+		break;
+	case VIRTIOFORWARDER__PORT_CONTROL_REQUEST__CAPTURE_DIRECTION__VF_TO_VM:
+		conf.dirs = 1 << RELAY_VF2VM;
+		break;
+	default:
+		conf.dirs = (1 << RELAY_VM2VF) | (1 << RELAY_VF2VM);
+		break;
+	}
+
+	handle_PortControlRequest_set_error_code(
+		response, "pkt_capture_start()", pkt_capture_start(&conf)
+	);
+}
+
+static void
+port_control_handle_capture_stop(Virtioforwarder__PortControlResponse *response,
+			struct port_control_req_buffer *cfg)
+{
+	struct pkt_capture_stats stats;
+	int ret = pkt_capture_stop(cfg->virtio_id, &stats);
+
+	handle_PortControlRequest_set_error_code(
+		response, "pkt_capture_stop()", ret
+	);
+	if (!ret) {
+		response->capture_packets = stats.captured;
+		response->has_capture_packets = true;
+		response->capture_dropped = stats.dropped;
+		response->has_capture_dropped = true;
+	}
+}
+
 /** Handles a PortControlRequest. */
 static size_t
 handle_PortControlRequest(
@@ -363,6 +461,18 @@ handle_PortControlRequest(
 			port_control_handle_query_pci(&response, &b);
 			break;
 
+		case VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__SET_RSS:
+			port_control_handle_set_rss(&response, &b, pc);
+			break;
+
+		case VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__CAPTURE_START:
+			port_control_handle_capture_start(&response, &b, pc);
+			break;
+
+		case VIRTIOFORWARDER__PORT_CONTROL_REQUEST__OP__CAPTURE_STOP:
+			port_control_handle_capture_stop(&response, &b);
+			break;
+
 		default:
 			log_critical("unhandled PortControlRequest.Op %i", pc->op);
 			break;
@@ -400,7 +510,9 @@ port_control_setup(
 {
 	service->handle_request = &handle_PortControlRequest;
 	service->destructor = &port_control_free;
-	service->max_request_cb = 256 + MAX_NUM_BOND_SLAVES * 16; /* Each PCI request message is 16 bytes. */
+	service->max_request_cb = 256 + MAX_NUM_BOND_SLAVES * 16 + /* Each PCI request message is 16 bytes. */
+		VIRTIO_RSS_KEY_LEN + VIRTIO_RSS_RETA_SIZE * 5 + /* Varint queue numbers. */
+		PATH_MAX + 1024; /* Capture file and filter expression. */
 	service->max_response_cb = 256;
 
 	return 0;
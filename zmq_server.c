@@ -351,8 +351,7 @@ zmq_thread_loop(
 
 		/* Handle the request. */
 		size_t const cb_response_buffer = service->max_response_cb;
-		uint8_t response_buffer[cb_response_buffer];
-		memset(response_buffer, 0, cb_response_buffer);
+		uint8_t *response_buffer = service->response_buffer;
 		size_t cb_response = service->handle_request(
 			service,
 			request_buffer, (size_t) cb_request, response_buffer,
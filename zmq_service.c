@@ -68,6 +68,13 @@ zmq_service_alloc(
 	assert(ans->max_request_cb);
 	log_debug("%s: Response buffer size: %uB", ans->name, ans->max_response_cb);
 	assert(ans->max_response_cb);
+	ans->response_buffer = malloc(ans->max_response_cb);
+	if (!ans->response_buffer) {
+		log_critical("%s: Could not allocate the response buffer",
+			ans->name);
+		zmq_service_release(ans);
+		return NULL;
+	}
 
 	return ans;
 }
@@ -83,5 +90,6 @@ zmq_service_release(struct zmq_service *service)
 void
 zmq_service_free(struct zmq_service *service)
 {
+	free(service->response_buffer);
 	free(service);
 }
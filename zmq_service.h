@@ -76,11 +76,14 @@ struct zmq_service
 
 	/**
 	 * Maximum size of a response, in bytes.
-	 * @remarks
-	 *	   This is limited to uint16_t because currently, the response buffer
-	 *	   is allocated on the stack.
 	 */
-	uint16_t max_response_cb;
+	uint32_t max_response_cb;
+
+	/**
+	 * Response buffer of @a max_response_cb bytes, allocated on the heap
+	 * by zmq_service_alloc() and reused by every request.
+	 */
+	uint8_t *response_buffer;
 
 	/** Service-specific data. */
 	void *priv;
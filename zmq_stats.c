@@ -36,18 +36,120 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
 
 #include "virtioforwarder.pb-c.h"
 
 #define __MODULE__ "zmq_stats"
 #include "log.h"
+#include "flow_sketch.h"
+#include "flight_rec.h"
+#include "perf_counters.h"
+#include "cpu_isolation.h"
 #include "sriov.h"
+#include "rate_sampler.h"
+#include "stats_history.h"
+#include "vf_xstats.h"
 #include "virtio_worker.h"
 #include "zmq_service.h"
 #include <rte_cycles.h>
 
-static float stats_timer_period;
+/* Upper bound of the packed size of a LatencyHistogram.Bucket, with framing. */
+#define LATENCY_BUCKET_CB_MAX 24
+
+/** Storage for latency histogram buckets, only allocated when requested. */
+struct latency_bucket_buffer
+{
+	Virtioforwarder__LatencyHistogram__Bucket
+		bucket[MAX_RELAYS][RELAY_NB_DIRS][LAT_HIST_BUCKETS];
+	Virtioforwarder__LatencyHistogram__Bucket
+		*bucket_ptrs[MAX_RELAYS][RELAY_NB_DIRS][LAT_HIST_BUCKETS];
+};
+
+/* Upper bound of the packed size of a RelayState.Queue, with framing. */
+#define QUEUE_CB_MAX 80
+
+/** Storage for per virtqueue pair counters, only allocated when requested. */
+struct queue_buffer
+{
+	struct virtio_queue_stats stats[MAX_RELAYS][MAX_MULTIQUEUE_PAIRS];
+	Virtioforwarder__RelayState__Queue
+		queue[MAX_RELAYS][MAX_MULTIQUEUE_PAIRS];
+	Virtioforwarder__RelayState__Queue
+		*queue_ptrs[MAX_RELAYS][MAX_MULTIQUEUE_PAIRS];
+};
+
+/* Extended statistics in a response, over all relays. */
+#define XSTATS_MAX 2048
+/* Upper bound of the packed size of a RelayState.VF.Xstat, with framing. */
+#define XSTAT_CB_MAX (RTE_ETH_NAME_MAX_LEN + RTE_ETH_XSTATS_NAME_SIZE + 20)
+
+/** Storage for VF extended statistics, only allocated when requested. */
+struct xstats_buffer
+{
+	struct vf_xstat xstat[XSTATS_MAX];
+	Virtioforwarder__RelayState__VF__Xstat msg[XSTATS_MAX];
+	Virtioforwarder__RelayState__VF__Xstat *ptrs[XSTATS_MAX];
+	unsigned used;
+	char *const *filters;
+	size_t n_filters;
+	bool truncated;
+};
+
+/* Upper bound of the packed size of a Flow, with framing. */
+#define FLOW_CB_MAX (2 * INET6_ADDRSTRLEN + 48)
+
+/** Storage for heavy hitter flows, only allocated when requested. */
+struct flow_buffer
+{
+	struct virtio_flow_stats
+		stats[MAX_RELAYS][RELAY_NB_DIRS][FLOW_SKETCH_TOP_K];
+	char src[MAX_RELAYS][RELAY_NB_DIRS][FLOW_SKETCH_TOP_K][INET6_ADDRSTRLEN];
+	char dst[MAX_RELAYS][RELAY_NB_DIRS][FLOW_SKETCH_TOP_K][INET6_ADDRSTRLEN];
+	Virtioforwarder__Flow flow[MAX_RELAYS][RELAY_NB_DIRS][FLOW_SKETCH_TOP_K];
+	Virtioforwarder__Flow
+		*flow_ptrs[MAX_RELAYS][RELAY_NB_DIRS][FLOW_SKETCH_TOP_K];
+};
+
+/* Events in a response, over all flight recorders. */
+#define FLIGHT_EVENTS_MAX ((MAX_CPUS + 1) * FLIGHT_REC_SIZE)
+/* Upper bound of the packed size of a FlightEvent, with framing. */
+#define FLIGHT_EVENT_CB_MAX 96
+
+/** Storage for flight recorder events, only allocated when requested. */
+struct flight_buffer
+{
+	struct virtio_flight_event events[FLIGHT_EVENTS_MAX];
+	Virtioforwarder__FlightEvent event[FLIGHT_EVENTS_MAX];
+	Virtioforwarder__FlightEvent *event_ptrs[FLIGHT_EVENTS_MAX];
+	size_t used;
+};
+
+/* History samples in a response, over all relays. */
+#define HISTORY_SAMPLES_MAX 4096
+/* Upper bounds of the packed size of a history sample, and of the framing of
+ * a StatsHistory.Relay. */
+#define HISTORY_SAMPLE_CB_MAX 80
+#define HISTORY_RELAY_CB_MAX 64
+
+/** Storage for a history response, only allocated when requested. */
+struct history_buffer
+{
+	/* One more than fits, to tell whether samples were left out. */
+	struct stats_history_point points[HISTORY_SAMPLES_MAX + 1];
+	uint64_t time_s[HISTORY_SAMPLES_MAX];
+	uint32_t pkts[STATS_HISTORY_NB_COUNTERS][HISTORY_SAMPLES_MAX];
+	uint64_t bytes[STATS_HISTORY_NB_COUNTERS][HISTORY_SAMPLES_MAX];
+	uint32_t drops_vm_to_vf[HISTORY_SAMPLES_MAX];
+	uint32_t drops_vf_to_vm[HISTORY_SAMPLES_MAX];
+	Virtioforwarder__StatsHistory history;
+	Virtioforwarder__StatsHistory__Relay relay[MAX_RELAYS];
+	Virtioforwarder__StatsHistory__Relay *relay_ptrs[MAX_RELAYS];
+	unsigned used;
+};
 
 /**
  * In the future, the memory used to construct stats responses could be
@@ -66,14 +168,427 @@ struct stats_response_buffer
 	Virtioforwarder__RelayState__VHOST vhost[MAX_RELAYS];
 	Virtioforwarder__RelayState__VFtoVM vf_to_vm[MAX_RELAYS];
 	Virtioforwarder__RelayState__VMtoVF vm_to_vf[MAX_RELAYS];
+	Virtioforwarder__LatencyHistogram latency[MAX_RELAYS][RELAY_NB_DIRS];
+	Virtioforwarder__RateWindow
+		rate_window[MAX_RELAYS][RELAY_NB_DIRS][RATE_NB_WINDOWS];
+	Virtioforwarder__RateWindow
+		*rate_window_ptrs[MAX_RELAYS][RELAY_NB_DIRS][RATE_NB_WINDOWS];
+	Virtioforwarder__RingGauge guest_rx_free[MAX_RELAYS];
+	Virtioforwarder__RingGauge vf_rx_queue_depth[MAX_RELAYS];
+	struct latency_bucket_buffer *latency_buckets; /* NULL unless requested. */
+	struct queue_buffer *queues; /* NULL unless requested. */
+	struct xstats_buffer *xstats; /* NULL unless requested. */
+	struct flow_buffer *flows; /* NULL unless requested. */
+	Virtioforwarder__PerfCounters perf[MAX_RELAYS][RELAY_NB_DIRS];
+	struct lat_hist lat_hist; /* Scratch copy of a relay's histogram. */
 
 	/*
 	 * Protocol Buffers wants an array of pointers to Virtioforwarder__RelayState,
 	 * not an actual array of Virtioforwarder__RelayState.
 	 */
 	Virtioforwarder__RelayState *relay_state_ptrs[MAX_RELAYS];
+
+	/* Storage for graph mode node counters. */
+	struct virtio_graph_node_stats graph_stats[GRAPH_MAX_NODES];
+	Virtioforwarder__GraphNodeStats graph_node[GRAPH_MAX_NODES];
+	Virtioforwarder__GraphNodeStats *graph_node_ptrs[GRAPH_MAX_NODES];
+
+	/* Storage for worker cycle accounting. */
+	struct virtio_worker_state worker_states[MAX_CPUS];
+	Virtioforwarder__WorkerState worker[MAX_CPUS];
+	Virtioforwarder__WorkerState *worker_ptrs[MAX_CPUS];
+	Virtioforwarder__PerfCounters worker_perf[MAX_CPUS];
+	Virtioforwarder__LatencyHistogram worker_gap[MAX_CPUS];
+	char *isolation_issue[MAX_CPUS][CPU_ISOL_NB];
+	Virtioforwarder__WorkerState__Stall stall[MAX_CPUS][WORKER_STALL_LOG];
+	Virtioforwarder__WorkerState__Stall
+		*stall_ptrs[MAX_CPUS][WORKER_STALL_LOG];
 };
 
+/**
+ * Present the summary of histogram @a h, in TSC cycles, in @a l.
+ */
+static void
+latency_present(const struct lat_hist *h, Virtioforwarder__LatencyHistogram *l)
+{
+	double ns_per_tsc = 1e9 / rte_get_tsc_hz();
+
+	virtioforwarder__latency_histogram__init(l);
+	l->has_count = true;
+	l->count = h->count;
+	l->has_sum_ns = true;
+	l->sum_ns = h->sum * ns_per_tsc;
+	l->has_max_ns = true;
+	l->max_ns = h->max * ns_per_tsc;
+	l->has_p50_ns = true;
+	l->p50_ns = lat_hist_percentile(h, 50) * ns_per_tsc;
+	l->has_p90_ns = true;
+	l->p90_ns = lat_hist_percentile(h, 90) * ns_per_tsc;
+	l->has_p99_ns = true;
+	l->p99_ns = lat_hist_percentile(h, 99) * ns_per_tsc;
+	l->has_p999_ns = true;
+	l->p999_ns = lat_hist_percentile(h, 99.9) * ns_per_tsc;
+}
+
+/**
+ * Query the latency histogram of direction @a dir of @a relay into output
+ * position @a j of @a b. Returns NULL if latency sampling is disabled.
+ */
+static Virtioforwarder__LatencyHistogram *
+latency_query(
+	uint32_t relay, enum relay_dir dir, size_t j,
+	struct stats_response_buffer *b)
+{
+	struct lat_hist *h = &b->lat_hist;
+	double ns_per_tsc = 1e9 / rte_get_tsc_hz();
+
+	if (virtio_forwarder_get_latency(relay, dir, h))
+		return NULL;
+
+	Virtioforwarder__LatencyHistogram *l = &b->latency[j][dir];
+	latency_present(h, l);
+
+	if (b->latency_buckets) {
+		Virtioforwarder__LatencyHistogram__Bucket *bucket =
+			b->latency_buckets->bucket[j][dir];
+		Virtioforwarder__LatencyHistogram__Bucket **ptrs =
+			b->latency_buckets->bucket_ptrs[j][dir];
+		size_t n = 0;
+
+		for (unsigned i = 0; i < LAT_HIST_BUCKETS; ++i) {
+			if (!h->buckets[i])
+				continue;
+			virtioforwarder__latency_histogram__bucket__init(bucket + n);
+			bucket[n].low_ns = lat_hist_bucket_low(i) * ns_per_tsc;
+			bucket[n].count = h->buckets[i];
+			ptrs[n] = bucket + n;
+			++n;
+		}
+		l->n_bucket = n;
+		l->bucket = ptrs;
+	}
+
+	return l;
+}
+
+/* Format address @a a of an IP version @a version flow tuple. */
+static void
+flow_addr_str(uint8_t version, const uint32_t a[4], char *ans, size_t len)
+{
+	uint32_t be[4];
+
+	for (unsigned i = 0; i < 4; ++i)
+		be[i] = htonl(a[i]);
+	inet_ntop(version == 4 ? AF_INET : AF_INET6, be, ans, len);
+}
+
+/**
+ * Query the heaviest flows of direction @a dir of @a relay into output
+ * position @a j of @a b. Returns the number of flows, stored in @a flows.
+ */
+static size_t
+flows_query(
+	uint32_t relay, enum relay_dir dir, size_t j,
+	struct stats_response_buffer *b, Virtioforwarder__Flow ***flows)
+{
+	struct virtio_flow_stats *s = b->flows->stats[j][dir];
+	Virtioforwarder__Flow *flow = b->flows->flow[j][dir];
+	int n = virtio_forwarder_get_flows(relay, dir, s, FLOW_SKETCH_TOP_K);
+
+	for (int i = 0; i < n; ++i) {
+		const struct flow_tuple *t = &s[i].tuple;
+
+		virtioforwarder__flow__init(flow + i);
+		flow[i].hash = s[i].hash;
+		if (t->ip_version) {
+			flow_addr_str(t->ip_version, t->src,
+				b->flows->src[j][dir][i], INET6_ADDRSTRLEN);
+			flow_addr_str(t->ip_version, t->dst,
+				b->flows->dst[j][dir][i], INET6_ADDRSTRLEN);
+			flow[i].src = b->flows->src[j][dir][i];
+			flow[i].dst = b->flows->dst[j][dir][i];
+			flow[i].has_proto = true;
+			flow[i].proto = t->proto;
+			if (t->has_ports) {
+				flow[i].has_sport = true;
+				flow[i].sport = t->sport;
+				flow[i].has_dport = true;
+				flow[i].dport = t->dport;
+			}
+		}
+		flow[i].has_pkt_rate = true;
+		flow[i].pkt_rate = s[i].pkt_rate;
+		flow[i].has_byte_rate = true;
+		flow[i].byte_rate = s[i].byte_rate;
+		b->flows->flow_ptrs[j][dir][i] = flow + i;
+	}
+	*flows = b->flows->flow_ptrs[j][dir];
+
+	return n > 0 ? n : 0;
+}
+
+/**
+ * Query the virtqueue pair counters of @a relay into output position @a j of
+ * @a b.
+ */
+static void
+queue_query(
+	uint32_t relay, size_t j, Virtioforwarder__RelayState *relay_state,
+	struct stats_response_buffer *b)
+{
+	struct virtio_queue_stats *s = b->queues->stats[j];
+	Virtioforwarder__RelayState__Queue *queue = b->queues->queue[j];
+	Virtioforwarder__RelayState__Queue **ptrs = b->queues->queue_ptrs[j];
+	unsigned n;
+
+	n = virtio_forwarder_get_queue_stats(relay, s, MAX_MULTIQUEUE_PAIRS);
+	for (unsigned i = 0; i < n; ++i) {
+		virtioforwarder__relay_state__queue__init(queue + i);
+		queue[i].id = s[i].id;
+		queue[i].has_pkts_rx_from_vm = true;
+		queue[i].pkts_rx_from_vm = s[i].virtio_rx;
+		queue[i].has_bytes_rx_from_vm = true;
+		queue[i].bytes_rx_from_vm = s[i].virtio_rx_bytes;
+		queue[i].has_pkts_tx_to_vm = true;
+		queue[i].pkts_tx_to_vm = s[i].virtio_tx;
+		queue[i].has_bytes_tx_to_vm = true;
+		queue[i].bytes_tx_to_vm = s[i].virtio_tx_bytes;
+		queue[i].has_pkts_dropped_tx_to_vm = true;
+		queue[i].pkts_dropped_tx_to_vm = s[i].virtio_drop;
+		queue[i].has_pkts_steered = true;
+		queue[i].pkts_steered = s[i].steered;
+		ptrs[i] = queue + i;
+	}
+	relay_state->n_queue = n;
+	relay_state->queue = ptrs;
+}
+
+/**
+ * Append the cached extended statistics of the VF of @a relay to @a vf, as far
+ * as they fit into @a x.
+ */
+static void
+xstats_query(
+	uint32_t relay, Virtioforwarder__RelayState__VF *vf,
+	struct xstats_buffer *x)
+{
+	bool truncated;
+	unsigned n = vf_xstats_get(relay, x->filters, x->n_filters,
+		x->xstat + x->used, XSTATS_MAX - x->used, &truncated);
+
+	for (unsigned i = x->used; i < x->used + n; ++i) {
+		virtioforwarder__relay_state__vf__xstat__init(x->msg + i);
+		x->msg[i].port = x->xstat[i].port;
+		x->msg[i].name = x->xstat[i].name;
+		x->msg[i].value = x->xstat[i].value;
+		x->ptrs[i] = x->msg + i;
+	}
+	if (n) {
+		vf->n_xstat = n;
+		vf->xstat = x->ptrs + x->used;
+	}
+	x->used += n;
+	x->truncated |= truncated;
+}
+
+/**
+ * Present the averaged rates of direction @a dir of @a relay, whose counters
+ * are @a rx and @a tx, from output position @a j of @a b. Returns the number
+ * of windows.
+ */
+static size_t
+rates_query(
+	uint32_t relay, enum relay_dir dir, enum relay_counter rx,
+	enum relay_counter tx, size_t j, struct stats_response_buffer *b,
+	Virtioforwarder__RateWindow ***windows)
+{
+	float rates[RATE_NB_WINDOWS][RELAY_NB_COUNTERS];
+
+	rate_sampler_get(relay, rates);
+	for (unsigned w = 0; w < RATE_NB_WINDOWS; ++w) {
+		Virtioforwarder__RateWindow *r = &b->rate_window[j][dir][w];
+
+		virtioforwarder__rate_window__init(r);
+		r->window_s = rate_sampler_window_s(w);
+		r->has_pkt_rate_rx = true;
+		r->pkt_rate_rx = rates[w][rx];
+		r->has_byte_rate_rx = true;
+		r->byte_rate_rx = rates[w][rx + 1];
+		r->has_pkt_rate_tx = true;
+		r->pkt_rate_tx = rates[w][tx];
+		r->has_byte_rate_tx = true;
+		r->byte_rate_tx = rates[w][tx + 1];
+		b->rate_window_ptrs[j][dir][w] = r;
+	}
+	*windows = b->rate_window_ptrs[j][dir];
+
+	return RATE_NB_WINDOWS;
+}
+
+/**
+ * Present hardware performance counters @a v in @a out, leaving out those
+ * not in @a mask.
+ */
+static Virtioforwarder__PerfCounters *
+perf_present(
+	const uint64_t v[PERF_NB_COUNTERS], unsigned mask,
+	Virtioforwarder__PerfCounters *out)
+{
+	virtioforwarder__perf_counters__init(out);
+	out->has_instructions = !!(mask & (1U << PERF_CNT_INSTRUCTIONS));
+	out->instructions = v[PERF_CNT_INSTRUCTIONS];
+	out->has_cycles = !!(mask & (1U << PERF_CNT_CYCLES));
+	out->cycles = v[PERF_CNT_CYCLES];
+	out->has_llc_misses = !!(mask & (1U << PERF_CNT_LLC_MISSES));
+	out->llc_misses = v[PERF_CNT_LLC_MISSES];
+	out->has_branch_misses = !!(mask & (1U << PERF_CNT_BRANCH_MISSES));
+	out->branch_misses = v[PERF_CNT_BRANCH_MISSES];
+	return out;
+}
+
+/**
+ * Query the hardware performance counters of direction @a dir of @a relay
+ * into output position @a j of @a b. Returns NULL if they are disabled.
+ */
+static Virtioforwarder__PerfCounters *
+perf_query(
+	uint32_t relay, enum relay_dir dir, size_t j,
+	struct stats_response_buffer *b)
+{
+	struct relay_perf p;
+	unsigned mask;
+
+	if (virtio_forwarder_get_perf(relay, dir, &p, &mask))
+		return NULL;
+
+	Virtioforwarder__PerfCounters *out =
+		perf_present(p.counters, mask, &b->perf[j][dir]);
+	out->has_polls = true;
+	out->polls = p.polls;
+	out->has_pkts = true;
+	out->pkts = p.pkts;
+	return out;
+}
+
+/**
+ * Present the isolation and the stalls of worker @a s in output position
+ * @a i of @a b.
+ */
+static void
+worker_jitter_present(
+	const struct virtio_worker_state *s, size_t i,
+	struct stats_response_buffer *b)
+{
+	Virtioforwarder__WorkerState *worker = b->worker + i;
+	double ns_per_tsc = 1e9 / s->tsc_hz;
+	size_t n = 0;
+
+	for (unsigned c = 0; c < CPU_ISOL_NB; ++c) {
+		if (s->isolation & (1U << c))
+			b->isolation_issue[i][n++] =
+				(char *)cpu_isolation_name(c);
+	}
+	if (n > 0) {
+		worker->n_isolation_issue = n;
+		worker->isolation_issue = b->isolation_issue[i];
+	}
+	worker->has_irqs = true;
+	worker->irqs = s->irqs;
+
+	if (virtio_forwarder_get_worker_gaps(s->cpu, &b->lat_hist))
+		return;
+	worker->pass_gap = b->worker_gap + i;
+	latency_present(&b->lat_hist, worker->pass_gap);
+	worker->has_stalls = true;
+	worker->stalls = s->stalls;
+	for (n = 0; n < s->nb_stalls; ++n) {
+		Virtioforwarder__WorkerState__Stall *stall = &b->stall[i][n];
+
+		virtioforwarder__worker_state__stall__init(stall);
+		stall->time_ns = s->stall[n].time_ns;
+		stall->duration_ns = s->stall[n].cycles * ns_per_tsc;
+		b->stall_ptrs[i][n] = stall;
+	}
+	worker->n_stall = n;
+	worker->stall = b->stall_ptrs[i];
+}
+
+/**
+ * Append the events of the flight recorder of @a cpu to @a f. The threads
+ * outside of the EAL share the recorder of @a cpu MAX_CPUS.
+ */
+static void
+flight_query(unsigned cpu, struct flight_buffer *f)
+{
+	struct virtio_flight_event *s = f->events + f->used;
+	unsigned n = virtio_forwarder_get_flight(cpu, s, FLIGHT_REC_SIZE);
+
+	for (unsigned i = 0; i < n; ++i, ++s) {
+		Virtioforwarder__FlightEvent *ev = f->event + f->used;
+		char *dir = (s->dir == RELAY_VM2VF) ? "virtio2vf" : "vf2virtio";
+
+		virtioforwarder__flight_event__init(ev);
+		if (cpu < MAX_CPUS) {
+			ev->has_cpu = true;
+			ev->cpu = cpu;
+		}
+		ev->age_ns = s->age_ns;
+		ev->event = (char *)flight_event_name(s->event);
+		switch (s->event) {
+		case FLIGHT_VIRTIO_STATE:
+		case FLIGHT_DPDK_STATE:
+			ev->has_relay = true;
+			ev->relay = s->relay;
+			ev->state = s->state;
+			break;
+		case FLIGHT_WORKER_UPDATE:
+			ev->has_active_relays = true;
+			ev->active_relays = s->active_relays;
+			break;
+		case FLIGHT_MIGRATE:
+			ev->has_relay = true;
+			ev->relay = s->relay;
+			ev->direction = dir;
+			ev->has_from_cpu = true;
+			ev->from_cpu = s->from_cpu;
+			ev->has_to_cpu = true;
+			ev->to_cpu = s->to_cpu;
+			ev->has_stolen = true;
+			ev->stolen = s->stolen;
+			break;
+		case FLIGHT_BACKPRESSURE:
+			ev->has_relay = true;
+			ev->relay = s->relay;
+			ev->direction = dir;
+			ev->has_pkts_held = true;
+			ev->pkts_held = s->pkts_held;
+			break;
+		default:
+			break;
+		}
+		f->event_ptrs[f->used++] = ev;
+	}
+}
+
+/**
+ * Present gauge @a g in @a out. Returns NULL if it was never sampled.
+ */
+static Virtioforwarder__RingGauge *
+gauge_query(const struct relay_gauge *g, Virtioforwarder__RingGauge *out)
+{
+	if (!g->samples)
+		return NULL;
+
+	virtioforwarder__ring_gauge__init(out);
+	out->has_last = true;
+	out->last = g->last;
+	out->has_sum = true;
+	out->sum = g->sum;
+	out->has_samples = true;
+	out->samples = g->samples;
+	return out;
+}
+
 /**
  * Perform query for a specific @a relay, store the result in @a b, and return
  * an updated value for the next free output position @a j.
@@ -90,7 +605,7 @@ relay_query(
 
 	/* Query virtio_worker.c for the relay information. */
 	struct virtio_worker_stats *s = b->worker_stats + j;
-	virtio_forwarder_get_stats(relay, s, &stats_timer_period);
+	virtio_forwarder_get_stats(relay, s);
 
 	if (!include_inactive && !s->active) {
 		/* Exclude inactive relay. */
@@ -131,11 +646,39 @@ relay_query(
 		vm_to_vf->pkts_dropped_vf_queue_full = s->dpdk_drop_full;
 		vm_to_vf->has_pkts_dropped_vf_not_connected = true;
 		vm_to_vf->pkts_dropped_vf_not_connected = s->dpdk_drop_unavail;
+		vm_to_vf->has_pkts_dropped_flushed = true;
+		vm_to_vf->pkts_dropped_flushed = s->dpdk_drop_flush;
+		vm_to_vf->has_guest_tx_nombuf = true;
+		vm_to_vf->guest_tx_nombuf = s->virtio_rx_nombuf;
+		vm_to_vf->has_pkts_vf_tx_errors = true;
+		vm_to_vf->pkts_vf_tx_errors = s->vf_oerrors;
+		vm_to_vf->has_pkts_csum_sw = true;
+		vm_to_vf->pkts_csum_sw = s->csum_sw;
+		vm_to_vf->has_pkts_csum_offload = true;
+		vm_to_vf->pkts_csum_offload = s->csum_offload;
+		vm_to_vf->has_pkts_csum_trunc = true;
+		vm_to_vf->pkts_csum_trunc = s->csum_trunc;
+		vm_to_vf->has_cpu_migrations = true;
+		vm_to_vf->cpu_migrations = s->virtio2vf_migrations;
+		vm_to_vf->has_cpu_steals = true;
+		vm_to_vf->cpu_steals = s->virtio2vf_steals;
+		vm_to_vf->has_cycles = true;
+		vm_to_vf->cycles = s->virtio2vf_cycles;
+		vm_to_vf->latency = latency_query(relay, RELAY_VM2VF, j, b);
+		vm_to_vf->perf = perf_query(relay, RELAY_VM2VF, j, b);
+		vm_to_vf->n_rx_burst_sizes = BURST_LEN + 1;
+		vm_to_vf->rx_burst_sizes = s->virtio_rx_bursts;
 		/* Rates. */
 		vm_to_vf->pkt_rate_rx_from_vm = s->virtio_rx_rate;
 		vm_to_vf->byte_rate_rx_from_vm = s->virtio_rx_byte_rate;
 		vm_to_vf->pkt_rate_tx_to_vf = s->dpdk_tx_rate;
 		vm_to_vf->byte_rate_tx_to_vf = s->dpdk_tx_byte_rate;
+		vm_to_vf->n_rates = rates_query(relay, RELAY_VM2VF,
+			RELAY_CNT_VIRTIO_RX, RELAY_CNT_DPDK_TX, j, b,
+			&vm_to_vf->rates);
+		if (b->flows)
+			vm_to_vf->n_flow = flows_query(relay, RELAY_VM2VF, j,
+				b, &vm_to_vf->flow);
 	}
 
 	Virtioforwarder__RelayState__VFtoVM *vf_to_vm = b->vf_to_vm + j;
@@ -159,11 +702,47 @@ relay_query(
 		vf_to_vm->pkts_dropped_vm_queue_full = s->virtio_drop_full;
 		vf_to_vm->has_pkts_dropped_vm_not_connected = true;
 		vf_to_vm->pkts_dropped_vm_not_connected = s->virtio_drop_unavail;
+		vf_to_vm->has_pkts_dropped_flushed = true;
+		vf_to_vm->pkts_dropped_flushed = s->virtio_drop_flush;
+		vf_to_vm->has_pkts_queue_fallback = true;
+		vf_to_vm->pkts_queue_fallback = s->virtio_queue_fallback;
+		vf_to_vm->has_guest_rx_ring_empty = true;
+		vf_to_vm->guest_rx_ring_empty = s->virtio_ring_empty;
+		vf_to_vm->has_pkts_vf_missed = true;
+		vf_to_vm->pkts_vf_missed = s->vf_imissed;
+		vf_to_vm->has_pkts_vf_rx_nombuf = true;
+		vf_to_vm->pkts_vf_rx_nombuf = s->vf_rx_nombuf;
+		vf_to_vm->has_pkts_vf_rx_errors = true;
+		vf_to_vm->pkts_vf_rx_errors = s->vf_ierrors;
+		vf_to_vm->has_pkts_csum_good = true;
+		vf_to_vm->pkts_csum_good = s->rx_csum_good;
+		vf_to_vm->has_pkts_csum_bad = true;
+		vf_to_vm->pkts_csum_bad = s->rx_csum_bad;
+		vf_to_vm->has_cpu_migrations = true;
+		vf_to_vm->cpu_migrations = s->vf2virtio_migrations;
+		vf_to_vm->has_cpu_steals = true;
+		vf_to_vm->cpu_steals = s->vf2virtio_steals;
+		vf_to_vm->has_cycles = true;
+		vf_to_vm->cycles = s->vf2virtio_cycles;
+		vf_to_vm->latency = latency_query(relay, RELAY_VF2VM, j, b);
+		vf_to_vm->perf = perf_query(relay, RELAY_VF2VM, j, b);
+		vf_to_vm->n_rx_burst_sizes = BURST_LEN + 1;
+		vf_to_vm->rx_burst_sizes = s->dpdk_rx_bursts;
+		vf_to_vm->guest_rx_free = gauge_query(&s->guest_rx_free,
+			b->guest_rx_free + j);
+		vf_to_vm->vf_rx_queue_depth = gauge_query(&s->vf_rx_depth,
+			b->vf_rx_queue_depth + j);
 		/* Rates. */
 		vf_to_vm->pkt_rate_rx_from_vf = s->dpdk_rx_rate;
 		vf_to_vm->byte_rate_rx_from_vf = s->dpdk_rx_byte_rate;
 		vf_to_vm->pkt_rate_tx_to_vm = s->virtio_tx_rate;
 		vf_to_vm->byte_rate_tx_to_vm = s->virtio_tx_byte_rate;
+		vf_to_vm->n_rates = rates_query(relay, RELAY_VF2VM,
+			RELAY_CNT_DPDK_RX, RELAY_CNT_VIRTIO_TX, j, b,
+			&vf_to_vm->rates);
+		if (b->flows)
+			vf_to_vm->n_flow = flows_query(relay, RELAY_VF2VM, j,
+				b, &vf_to_vm->flow);
 	}
 
 	/* Populate relay_state vf and cpu if they have any interesting contents. */
@@ -173,18 +752,97 @@ relay_query(
 	if (vf_to_vm->active) {
 		vf->pci_addr_str = s->pci_dbdf;
 		relay_state->vf = vf;
+		if (b->xstats)
+			xstats_query(relay, vf, b->xstats);
 	}
 
 	/* The following fields are always valid. */
 	relay_state->id = relay;
 	relay_state->active = s->active;
 	relay_state->socket_id = s->socket_id;
+	if (b->queues)
+		queue_query(relay, j, relay_state, b);
 	/* TBA: relay_state->ident = ... */
 
 	b->relay_state_ptrs[j] = relay_state;
 	return j + 1;
 }
 
+/**
+ * Add the history of @a relay to @a h, in the time range of @a req. Returns
+ * false if it did not all fit.
+ */
+static bool
+history_query(uint32_t relay, const Virtioforwarder__StatsHistoryRequest *req,
+	struct history_buffer *h)
+{
+	uint64_t now = time(NULL);
+	uint64_t start_s = req->has_start_s ? req->start_s : 0;
+	uint64_t end_s = req->has_end_s ? req->end_s : now;
+	unsigned first = h->used;
+	unsigned n;
+	bool fits = true;
+
+	if (relay >= MAX_RELAYS)
+		return true;
+	if (req->has_last_s) {
+		end_s = now;
+		start_s = req->last_s < now ? now - req->last_s + 1 : 0;
+	}
+
+	n = stats_history_get(relay, start_s, end_s, h->points + first,
+		HISTORY_SAMPLES_MAX - first + 1);
+	if (n > HISTORY_SAMPLES_MAX - first) {
+		n = HISTORY_SAMPLES_MAX - first;
+		fits = false;
+	}
+	if (n == 0)
+		return fits;
+
+	for (unsigned i = 0; i < n; ++i) {
+		const struct stats_history_point *p = h->points + first + i;
+
+		h->time_s[first + i] = p->time_s;
+		for (unsigned c = 0; c < STATS_HISTORY_NB_COUNTERS; ++c) {
+			h->pkts[c][first + i] = p->pkts[c];
+			h->bytes[c][first + i] = p->bytes[c];
+		}
+		h->drops_vm_to_vf[first + i] = p->drops_vm_to_vf;
+		h->drops_vf_to_vm[first + i] = p->drops_vf_to_vm;
+	}
+	h->used += n;
+
+	Virtioforwarder__StatsHistory__Relay *r =
+		h->relay + h->history.n_relay;
+	virtioforwarder__stats_history__relay__init(r);
+	r->id = relay;
+	r->n_time_s = n;
+	r->time_s = h->time_s + first;
+	r->n_pkts_rx_from_vm = n;
+	r->pkts_rx_from_vm = h->pkts[STATS_HISTORY_VIRTIO_RX] + first;
+	r->n_pkts_tx_to_vf = n;
+	r->pkts_tx_to_vf = h->pkts[STATS_HISTORY_DPDK_TX] + first;
+	r->n_pkts_rx_from_vf = n;
+	r->pkts_rx_from_vf = h->pkts[STATS_HISTORY_DPDK_RX] + first;
+	r->n_pkts_tx_to_vm = n;
+	r->pkts_tx_to_vm = h->pkts[STATS_HISTORY_VIRTIO_TX] + first;
+	r->n_bytes_rx_from_vm = n;
+	r->bytes_rx_from_vm = h->bytes[STATS_HISTORY_VIRTIO_RX] + first;
+	r->n_bytes_tx_to_vf = n;
+	r->bytes_tx_to_vf = h->bytes[STATS_HISTORY_DPDK_TX] + first;
+	r->n_bytes_rx_from_vf = n;
+	r->bytes_rx_from_vf = h->bytes[STATS_HISTORY_DPDK_RX] + first;
+	r->n_bytes_tx_to_vm = n;
+	r->bytes_tx_to_vm = h->bytes[STATS_HISTORY_VIRTIO_TX] + first;
+	r->n_pkts_dropped_vm_to_vf = n;
+	r->pkts_dropped_vm_to_vf = h->drops_vm_to_vf + first;
+	r->n_pkts_dropped_vf_to_vm = n;
+	r->pkts_dropped_vf_to_vm = h->drops_vf_to_vm + first;
+	h->relay_ptrs[h->history.n_relay++] = r;
+
+	return fits;
+}
+
 /** Handles a StatsRequest. */
 static size_t
 handle_StatsRequest(
@@ -194,6 +852,12 @@ handle_StatsRequest(
 {
 	Virtioforwarder__StatsResponse response;
 	virtioforwarder__stats_response__init(&response);
+	struct latency_bucket_buffer *latency_buckets = NULL;
+	struct queue_buffer *queues = NULL;
+	struct xstats_buffer *xstats = NULL;
+	struct flow_buffer *flows = NULL;
+	struct flight_buffer *flight = NULL;
+	struct history_buffer *history = NULL;
 
 	Virtioforwarder__StatsRequest *pc =
 	virtioforwarder__stats_request__unpack(
@@ -211,13 +875,98 @@ handle_StatsRequest(
 		goto pack_response;
 	}
 
+	if (pc->history) {
+		const Virtioforwarder__StatsHistoryRequest *req = pc->history;
+
+		if (req->n_relay > MAX_RELAYS) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__E2BIG;
+			goto pack_response;
+		}
+		if (!stats_history_enabled()) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOSYS;
+			goto pack_response;
+		}
+		history = malloc(sizeof(*history));
+		if (!history) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOMEM;
+			goto pack_response;
+		}
+		history->used = 0;
+		virtioforwarder__stats_history__init(&history->history);
+
+		bool fits = true;
+		size_t n = req->n_relay ? req->n_relay : MAX_RELAYS;
+		for (size_t i = 0; i < n && fits; ++i)
+			fits = history_query(req->n_relay ? req->relay[i] : i,
+				req, history);
+		if (!fits) {
+			history->history.has_truncated = true;
+			history->history.truncated = true;
+		}
+		if (history->history.n_relay)
+			history->history.relay = history->relay_ptrs;
+		response.history = &history->history;
+		goto pack_response;
+	}
+
 	bool include_inactive = !pc->has_include_inactive || pc->include_inactive;
-	unsigned delay = pc->delay; /* Defaults to 0. */
-	reset_all_rate_stats(delay);
+
+	if (pc->latency_buckets) {
+		latency_buckets = malloc(sizeof(*latency_buckets));
+		if (!latency_buckets) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOMEM;
+			goto pack_response;
+		}
+	}
+	if (pc->queues) {
+		queues = malloc(sizeof(*queues));
+		if (!queues) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOMEM;
+			goto pack_response;
+		}
+	}
+	if (pc->xstats) {
+		xstats = malloc(sizeof(*xstats));
+		if (!xstats) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOMEM;
+			goto pack_response;
+		}
+		xstats->used = 0;
+		xstats->filters = pc->xstats_filter;
+		xstats->n_filters = pc->n_xstats_filter;
+		xstats->truncated = false;
+	}
+	if (pc->flows) {
+		flows = malloc(sizeof(*flows));
+		if (!flows) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOMEM;
+			goto pack_response;
+		}
+	}
+	if (pc->flight_recorder) {
+		flight = malloc(sizeof(*flight));
+		if (!flight) {
+			response.status =
+				VIRTIOFORWARDER__STATS_RESPONSE__STATUS__ENOMEM;
+			goto pack_response;
+		}
+		flight->used = 0;
+	}
 
 	/* Construct a response consumable by protoc-c generated code. */
 	struct stats_response_buffer b;
 	memset(&b, 0, sizeof(b));
+	b.latency_buckets = latency_buckets;
+	b.queues = queues;
+	b.xstats = xstats;
+	b.flows = flows;
 
 	if (pc->n_relay) {
 		/* Specific relays query. */
@@ -243,6 +992,72 @@ handle_StatsRequest(
 	if (response.n_relay) {
 		response.relay = b.relay_state_ptrs;
 	}
+	if (xstats && xstats->truncated) {
+		response.has_xstats_truncated = true;
+		response.xstats_truncated = true;
+	}
+
+	int n_graph_node = virtio_forwarder_get_graph_stats(
+		b.graph_stats, GRAPH_MAX_NODES
+	);
+	for (int i = 0; i < n_graph_node; ++i) {
+		Virtioforwarder__GraphNodeStats *node = b.graph_node + i;
+		virtioforwarder__graph_node_stats__init(node);
+		node->name = b.graph_stats[i].name;
+		node->has_calls = true;
+		node->calls = b.graph_stats[i].calls;
+		node->has_objs = true;
+		node->objs = b.graph_stats[i].objs;
+		node->has_cycles = true;
+		node->cycles = b.graph_stats[i].cycles;
+		b.graph_node_ptrs[i] = node;
+	}
+	if (n_graph_node > 0) {
+		response.n_graph_node = n_graph_node;
+		response.graph_node = b.graph_node_ptrs;
+	}
+
+	unsigned n_worker = virtio_forwarder_get_worker_states(
+		b.worker_states, MAX_CPUS
+	);
+	for (unsigned i = 0; i < n_worker; ++i) {
+		Virtioforwarder__WorkerState *worker = b.worker + i;
+		struct virtio_worker_state *s = b.worker_states + i;
+		virtioforwarder__worker_state__init(worker);
+		worker->cpu = s->cpu;
+		worker->has_relays = true;
+		worker->relays = s->nb_relays;
+		worker->has_tsc_hz = true;
+		worker->tsc_hz = s->tsc_hz;
+		worker->has_iterations = true;
+		worker->iterations = s->iterations;
+		worker->has_busy_cycles = true;
+		worker->busy_cycles = s->busy_cycles;
+		worker->has_idle_cycles = true;
+		worker->idle_cycles = s->idle_cycles;
+		worker->has_sleep_cycles = true;
+		worker->sleep_cycles = s->sleep_cycles;
+		worker->has_overhead_cycles = true;
+		worker->overhead_cycles = s->overhead_cycles;
+		if (s->perf_mask)
+			worker->perf = perf_present(s->perf, s->perf_mask,
+				b.worker_perf + i);
+		worker_jitter_present(s, i, &b);
+		b.worker_ptrs[i] = worker;
+	}
+	if (n_worker > 0) {
+		response.n_worker = n_worker;
+		response.worker = b.worker_ptrs;
+	}
+
+	if (flight) {
+		for (unsigned cpu = 0; cpu <= MAX_CPUS; ++cpu)
+			flight_query(cpu, flight);
+		if (flight->used) {
+			response.n_flight = flight->used;
+			response.flight = flight->event_ptrs;
+		}
+	}
 
 pack_response:;
 	if (pc) {
@@ -254,9 +1069,16 @@ pack_response:;
 	size_t cb_response =
 		virtioforwarder__stats_response__get_packed_size(&response);
 	assert(cb_response <= cb_response_buffer);
-	return virtioforwarder__stats_response__pack(
+	cb_response = virtioforwarder__stats_response__pack(
 		&response, response_buffer
 	);
+	free(latency_buckets);
+	free(queues);
+	free(xstats);
+	free(flows);
+	free(flight);
+	free(history);
+	return cb_response;
 }
 
 /** Destructor for stats service. */
@@ -275,7 +1097,15 @@ stats_setup(
 	service->handle_request = &handle_StatsRequest;
 	service->destructor = &stats_free;
 	service->max_request_cb = 512;
-	service->max_response_cb = sizeof(struct stats_response_buffer);
+	service->max_response_cb = sizeof(struct stats_response_buffer) +
+		MAX_RELAYS * RELAY_NB_DIRS * LAT_HIST_BUCKETS *
+		LATENCY_BUCKET_CB_MAX +
+		MAX_RELAYS * MAX_MULTIQUEUE_PAIRS * QUEUE_CB_MAX +
+		XSTATS_MAX * XSTAT_CB_MAX +
+		MAX_RELAYS * RELAY_NB_DIRS * FLOW_SKETCH_TOP_K * FLOW_CB_MAX +
+		FLIGHT_EVENTS_MAX * FLIGHT_EVENT_CB_MAX +
+		HISTORY_SAMPLES_MAX * HISTORY_SAMPLE_CB_MAX +
+		MAX_RELAYS * HISTORY_RELAY_CB_MAX;
 	return 0;
 }
 
@@ -290,7 +1120,6 @@ zmq_stats_service_alloc(void)
 		log_debug(
 			"Overhead per request: %zuB", sizeof(struct stats_response_buffer)
 		);
-		stats_timer_period = 1.0f/rte_get_timer_hz();
 	}
 	else {
 		log_critical("Failed to allocate ZeroMQ stats service");
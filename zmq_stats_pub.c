@@ -0,0 +1,272 @@
+/*
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2016-2017 Netronome.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Netronome nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "zmq_stats_pub.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zmq.h>
+
+#include "virtioforwarder.pb-c.h"
+
+#define __MODULE__ "zmq_stats_pub"
+#include "log.h"
+#include "stats_shm.h"
+#include "virtio_worker.h"
+
+/* Updates queued per subscriber before further ones are dropped for it. */
+static int const sndhwm = 16;
+static int const linger_ms = 0;
+
+static struct {
+	pthread_t thread;
+	volatile bool running;
+	void *zmq_ctx;
+	void *zmq_s;
+	unsigned interval_ms;
+	unsigned keyframe_intervals;
+	uint64_t sequence;
+	/* Relays as of the previous update. */
+	struct stats_shm_relay prev[MAX_RELAYS];
+	/* Storage for the bits and pieces of an update. */
+	struct stats_shm_relay cur[MAX_RELAYS];
+	int64_t counters[MAX_RELAYS][STATS_SHM_NB_COUNTERS];
+	Virtioforwarder__StatsUpdate__Relay relay[MAX_RELAYS];
+	Virtioforwarder__StatsUpdate__Relay *relay_ptrs[MAX_RELAYS];
+	char *counter_names[STATS_SHM_NB_COUNTERS];
+} pub;
+
+static bool relay_state_changed(const struct stats_shm_relay *a,
+				const struct stats_shm_relay *b)
+{
+	return a->flags != b->flags ||
+		a->virtio2vf_cpu != b->virtio2vf_cpu ||
+		a->vf2virtio_cpu != b->vf2virtio_cpu ||
+		strcmp(a->vhost_socket_name, b->vhost_socket_name) ||
+		strcmp(a->pci_dbdf, b->pci_dbdf);
+}
+
+/*
+ * Add relay @a id to @a update at position @a j if it belongs in it. Returns
+ * the next free position.
+ */
+static size_t
+relay_update(unsigned id, bool keyframe, size_t j,
+	Virtioforwarder__StatsUpdate *update)
+{
+	const struct stats_shm_relay *cur = &pub.cur[id];
+	const struct stats_shm_relay *prev = &pub.prev[id];
+	Virtioforwarder__StatsUpdate__Relay *r = &pub.relay[j];
+	int64_t *counters = pub.counters[j];
+	bool state = keyframe || relay_state_changed(cur, prev);
+	bool changed = false;
+
+	if (keyframe && !cur->flags)
+		return j;
+
+	for (unsigned c=0; c<STATS_SHM_NB_COUNTERS; ++c) {
+		counters[c] = keyframe ? (int64_t)cur->counters[c] :
+			(int64_t)(cur->counters[c] - prev->counters[c]);
+		changed |= (counters[c] != 0);
+	}
+	if (!changed && !state)
+		return j;
+
+	virtioforwarder__stats_update__relay__init(r);
+	r->id = id;
+	if (changed) {
+		r->n_counters = STATS_SHM_NB_COUNTERS;
+		r->counters = counters;
+	}
+	if (state) {
+		r->has_vm_to_vf_active = true;
+		r->vm_to_vf_active = !!(cur->flags & STATS_SHM_VIRTIO2VF_ACTIVE);
+		r->has_vf_to_vm_active = true;
+		r->vf_to_vm_active = !!(cur->flags & STATS_SHM_VF2VIRTIO_ACTIVE);
+		r->has_vm_to_vf_cpu = true;
+		r->vm_to_vf_cpu = cur->virtio2vf_cpu;
+		r->has_vf_to_vm_cpu = true;
+		r->vf_to_vm_cpu = cur->vf2virtio_cpu;
+		r->vhost_socket_name = (char *)cur->vhost_socket_name;
+		r->pci_addr_str = (char *)cur->pci_dbdf;
+	}
+	pub.relay_ptrs[j] = r;
+
+	return j + 1;
+}
+
+/** Build and send one update. */
+static void
+stats_pub_send(void)
+{
+	Virtioforwarder__StatsUpdate update;
+	bool keyframe = (pub.sequence % pub.keyframe_intervals == 0);
+	struct timespec now;
+	zmq_msg_t msg;
+
+	virtioforwarder__stats_update__init(&update);
+	update.sequence = pub.sequence;
+	update.keyframe = keyframe;
+	clock_gettime(CLOCK_REALTIME, &now);
+	update.has_timestamp_ns = true;
+	update.timestamp_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+	update.has_interval_ms = true;
+	update.interval_ms = pub.interval_ms;
+	if (keyframe) {
+		update.n_counter_name = STATS_SHM_NB_COUNTERS;
+		update.counter_name = pub.counter_names;
+	}
+
+	for (unsigned id=0; id<MAX_RELAYS; ++id) {
+		stats_shm_snapshot_relay(id, &pub.cur[id]);
+		update.n_relay = relay_update(id, keyframe, update.n_relay,
+			&update);
+	}
+	if (update.n_relay)
+		update.relay = pub.relay_ptrs;
+
+	size_t cb = virtioforwarder__stats_update__get_packed_size(&update);
+	if (zmq_msg_init_size(&msg, cb) == -1) {
+		log_error("zmq_msg_init_size(): %s", zmq_strerror(zmq_errno()));
+		return;
+	}
+	virtioforwarder__stats_update__pack(&update, zmq_msg_data(&msg));
+	/* Subscribers too slow to keep up miss updates, never the publisher. */
+	if (zmq_msg_send(&msg, pub.zmq_s, ZMQ_DONTWAIT) == -1) {
+		if (zmq_errno() != EAGAIN)
+			log_warning("zmq_msg_send(): %s",
+				zmq_strerror(zmq_errno()));
+		zmq_msg_close(&msg);
+	}
+
+	memcpy(pub.prev, pub.cur, sizeof(pub.prev));
+	++pub.sequence;
+}
+
+static void *
+stats_pub_thread(void *arg __attribute__((unused)))
+{
+	log_debug("Stats publisher thread started");
+	while (pub.running) {
+		stats_pub_send();
+		usleep(pub.interval_ms * 1000);
+	}
+	log_debug("Stats publisher thread ended");
+
+	return NULL;
+}
+
+int
+zmq_stats_pub_start(char const *zmq_ep, unsigned interval_ms)
+{
+	const struct {
+		int name;
+		char const *name_str;
+		int const *value;
+	} opts[] = {
+		{ ZMQ_SNDHWM, "ZMQ_SNDHWM", &sndhwm },
+		{ ZMQ_LINGER, "ZMQ_LINGER", &linger_ms },
+	};
+
+	pub.interval_ms = interval_ms ? interval_ms : 1;
+	pub.keyframe_intervals = STATS_PUB_KEYFRAME_MS / pub.interval_ms;
+	if (pub.keyframe_intervals == 0)
+		pub.keyframe_intervals = 1;
+	pub.sequence = 0;
+	for (unsigned c=0; c<STATS_SHM_NB_COUNTERS; ++c)
+		pub.counter_names[c] = (char *)stats_shm_counter_name(c);
+
+	pub.zmq_ctx = zmq_ctx_new();
+	if (!pub.zmq_ctx) {
+		log_error("zmq_ctx_new(): unspecified error");
+		return -1;
+	}
+	pub.zmq_s = zmq_socket(pub.zmq_ctx, ZMQ_PUB);
+	if (!pub.zmq_s) {
+		log_error("zmq_socket(): %s", zmq_strerror(zmq_errno()));
+		goto err;
+	}
+	for (size_t i = 0; i < sizeof opts / sizeof *opts; ++i) {
+		if (zmq_setsockopt(pub.zmq_s, opts[i].name, opts[i].value,
+				sizeof(*opts[i].value)) == -1) {
+			log_error("zmq_setsockopt(%s): %s", opts[i].name_str,
+				zmq_strerror(zmq_errno()));
+			goto err;
+		}
+	}
+	if (zmq_bind(pub.zmq_s, zmq_ep) == -1) {
+		log_error("zmq_bind(): %s: %s", zmq_ep,
+			zmq_strerror(zmq_errno()));
+		goto err;
+	}
+
+	pub.running = true;
+	if (pthread_create(&pub.thread, NULL, stats_pub_thread, NULL)) {
+		log_error("Could not create stats publisher thread!");
+		pub.running = false;
+		goto err;
+	}
+	log_info("Publishing stats updates on %s every %u ms", zmq_ep,
+		pub.interval_ms);
+
+	return 0;
+
+err:
+	if (pub.zmq_s)
+		zmq_close(pub.zmq_s);
+	pub.zmq_s = NULL;
+	zmq_ctx_destroy(pub.zmq_ctx);
+	pub.zmq_ctx = NULL;
+	return -1;
+}
+
+void
+zmq_stats_pub_stop(void)
+{
+	if (!pub.running)
+		return;
+
+	pub.running = false;
+	pthread_join(pub.thread, NULL);
+	zmq_close(pub.zmq_s);
+	pub.zmq_s = NULL;
+	zmq_ctx_destroy(pub.zmq_ctx);
+	pub.zmq_ctx = NULL;
+}